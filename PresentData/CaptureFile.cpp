@@ -0,0 +1,513 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+#include "CaptureFile.hpp"
+
+namespace {
+
+// The compressed data is a sequence of LZ77 sequences, each a run of
+// literal bytes followed by a copy of earlier output.  A sequence starts with
+// a token byte whose high nibble is the literal count and low nibble is the
+// match length minus MIN_MATCH; a nibble of 15 means the count continues in
+// following bytes, each added until one isn't 255.  Then come the literals,
+// and a 16-bit little-endian offset back to the match.  The last sequence
+// has no match.
+uint32_t const MIN_MATCH = 4;
+uint32_t const MAX_OFFSET = 0xffff;
+uint32_t const HASH_BITS = 14;
+
+uint32_t Read32(uint8_t const* p)
+{
+    uint32_t u;
+    memcpy(&u, p, sizeof(u));
+    return u;
+}
+
+size_t AlignUp8(size_t size)
+{
+    return (size + 7) & ~(size_t) 7;
+}
+
+uint32_t HashSequence(uint32_t u)
+{
+    return (u * 2654435761u) >> (32 - HASH_BITS);
+}
+
+uint8_t* WriteLength(uint8_t* dst, size_t length)
+{
+    for (; length >= 255; length -= 255) {
+        *dst++ = 255;
+    }
+    *dst++ = (uint8_t) length;
+    return dst;
+}
+
+bool ReadLength(uint8_t const** src, uint8_t const* srcEnd, size_t* length)
+{
+    for (;;) {
+        if (*src == srcEnd) {
+            return false;
+        }
+        auto b = *(*src)++;
+        *length += b;
+        if (b != 255) {
+            return true;
+        }
+    }
+}
+
+uint8_t* WriteSequence(uint8_t* dst, uint8_t const* literals, size_t literalCount, size_t offset, size_t matchLength)
+{
+    auto token = dst++;
+    *token = (uint8_t) ((literalCount < 15 ? literalCount : 15) << 4);
+    if (literalCount >= 15) {
+        dst = WriteLength(dst, literalCount - 15);
+    }
+    memcpy(dst, literals, literalCount);
+    dst += literalCount;
+
+    if (matchLength > 0) {
+        auto m = matchLength - MIN_MATCH;
+        *token |= (uint8_t) (m < 15 ? m : 15);
+        *dst++ = (uint8_t) offset;
+        *dst++ = (uint8_t) (offset >> 8);
+        if (m >= 15) {
+            dst = WriteLength(dst, m - 15);
+        }
+    }
+    return dst;
+}
+
+}
+
+size_t GetMaxCompressedSize(size_t srcSize)
+{
+    return srcSize + srcSize / 255 + 16;
+}
+
+size_t CompressBlock(uint8_t const* src, size_t srcSize, uint8_t* dst)
+{
+    std::vector<uint32_t> table(1u << HASH_BITS, UINT32_MAX);
+
+    auto dstStart = dst;
+    size_t literalStart = 0;
+    size_t i = 0;
+    while (i + MIN_MATCH <= srcSize) {
+        auto u = Read32(src + i);
+        auto h = HashSequence(u);
+        auto candidate = table[h];
+        table[h] = (uint32_t) i;
+
+        if (candidate == UINT32_MAX || i - candidate > MAX_OFFSET || Read32(src + candidate) != u) {
+            i += 1;
+            continue;
+        }
+
+        auto matchLength = (size_t) MIN_MATCH;
+        while (i + matchLength < srcSize && src[candidate + matchLength] == src[i + matchLength]) {
+            matchLength += 1;
+        }
+
+        dst = WriteSequence(dst, src + literalStart, i - literalStart, i - candidate, matchLength);
+        i += matchLength;
+        literalStart = i;
+    }
+
+    dst = WriteSequence(dst, src + literalStart, srcSize - literalStart, 0, 0);
+    return (size_t) (dst - dstStart);
+}
+
+bool DecompressBlock(uint8_t const* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+    auto srcEnd = src + srcSize;
+    size_t dstOffset = 0;
+    while (src < srcEnd) {
+        auto token = *src++;
+
+        size_t literalCount = token >> 4;
+        if (literalCount == 15 && !ReadLength(&src, srcEnd, &literalCount)) {
+            return false;
+        }
+        if (literalCount > (size_t) (srcEnd - src) || literalCount > dstSize - dstOffset) {
+            return false;
+        }
+        memcpy(dst + dstOffset, src, literalCount);
+        src += literalCount;
+        dstOffset += literalCount;
+
+        // The last sequence has no match.
+        if (src == srcEnd) {
+            break;
+        }
+
+        if (srcEnd - src < 2) {
+            return false;
+        }
+        size_t offset = src[0] | ((size_t) src[1] << 8);
+        src += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !ReadLength(&src, srcEnd, &matchLength)) {
+            return false;
+        }
+        matchLength += MIN_MATCH;
+        if (offset == 0 || offset > dstOffset || matchLength > dstSize - dstOffset) {
+            return false;
+        }
+
+        // The match may overlap the output being written, so copy bytewise.
+        auto from = dst + dstOffset - offset;
+        for (size_t j = 0; j < matchLength; ++j) {
+            dst[dstOffset + j] = from[j];
+        }
+        dstOffset += matchLength;
+    }
+
+    return dstOffset == dstSize;
+}
+
+CaptureFileWriter::~CaptureFileWriter()
+{
+    if (mFile != nullptr) {
+        Close(mHeader.mQpcFrequency, mHeader.mStartQpc, mHeader.mEventsLost, mHeader.mBuffersLost);
+    }
+}
+
+bool CaptureFileWriter::Open(char const* path)
+{
+    assert(mFile == nullptr);
+
+#pragma warning(suppress: 4996)
+    mFile = fopen(path, "wb");
+    if (mFile == nullptr) {
+        return false;
+    }
+
+    // The header is written again by Close(), once its contents are known.
+    memcpy(mHeader.mMagic, CAPTURE_FILE_MAGIC, sizeof(mHeader.mMagic));
+    mHeader.mVersion = CAPTURE_FILE_VERSION;
+    mHeader.mHeaderSize = (uint32_t) sizeof(CaptureFileHeader);
+    if (fwrite(&mHeader, sizeof(mHeader), 1, mFile) != 1) {
+        fclose(mFile);
+        mFile = nullptr;
+        return false;
+    }
+
+    mBlock.reserve(BLOCK_SIZE + sizeof(CaptureEventHeader) + UINT16_MAX + 8);
+    mStopWriterThread = false;
+    mWriteFailed = false;
+    mWriterThread = std::thread(&CaptureFileWriter::WriterThread, this);
+    return true;
+}
+
+bool CaptureFileWriter::WriteEvent(EVENT_RECORD const* eventRecord)
+{
+    auto const& hdr = eventRecord->EventHeader;
+
+    CaptureEventHeader event = {};
+    event.mTimeStamp         = hdr.TimeStamp.QuadPart;
+    event.mProviderId        = hdr.ProviderId;
+    event.mEventDescriptor   = hdr.EventDescriptor;
+    event.mProcessId         = hdr.ProcessId;
+    event.mThreadId          = hdr.ThreadId;
+    event.mFlags             = (uint16_t) (hdr.Flags & ~EVENT_HEADER_FLAG_EXTENDED_INFO);
+    event.mProcessorIndex    = eventRecord->BufferContext.ProcessorIndex;
+    event.mUserDataLength    = eventRecord->UserDataLength;
+    event.mExtendedDataCount = 0;
+
+    auto size = sizeof(event);
+    if ((hdr.Flags & EVENT_HEADER_FLAG_EXTENDED_INFO) && eventRecord->ExtendedDataCount > 0) {
+        event.mFlags |= EVENT_HEADER_FLAG_EXTENDED_INFO;
+        event.mExtendedDataCount = eventRecord->ExtendedDataCount;
+        for (uint16_t i = 0; i < event.mExtendedDataCount; ++i) {
+            size = AlignUp8(size + sizeof(CaptureExtendedDataHeader) + eventRecord->ExtendedData[i].DataSize);
+        }
+    }
+    size = AlignUp8(size + event.mUserDataLength);
+
+    auto offset = mBlock.size();
+    mBlock.resize(offset + size);
+    auto dst = mBlock.data() + offset;
+    memcpy(dst, &event, sizeof(event));
+    dst += sizeof(event);
+
+    for (uint16_t i = 0; i < event.mExtendedDataCount; ++i) {
+        auto const& item = eventRecord->ExtendedData[i];
+        CaptureExtendedDataHeader itemHeader = {};
+        itemHeader.mExtType = item.ExtType;
+        itemHeader.mDataSize = item.DataSize;
+        memcpy(dst, &itemHeader, sizeof(itemHeader));
+        memcpy(dst + sizeof(itemHeader), (void const*) (uintptr_t) item.DataPtr, item.DataSize);
+        dst += AlignUp8(sizeof(itemHeader) + item.DataSize);
+    }
+
+    if (event.mUserDataLength > 0) {
+        memcpy(dst, eventRecord->UserData, event.mUserDataLength);
+    }
+
+    mHeader.mEventCount += 1;
+
+    if (mBlock.size() >= BLOCK_SIZE) {
+        return QueueBlock();
+    }
+    return true;
+}
+
+// Hands the current block to the writer thread, and starts a new one.
+bool CaptureFileWriter::QueueBlock()
+{
+    std::unique_lock<std::mutex> lock(mBlockMutex);
+    mBlockWritten.wait(lock, [this] { return mQueuedBlocks.size() < QUEUED_BLOCK_MAX_COUNT || mWriteFailed; });
+    if (mWriteFailed) {
+        mBlock.clear();
+        return false;
+    }
+
+    mQueuedBlocks.emplace_back(std::move(mBlock));
+    if (mFreeBlocks.empty()) {
+        mBlock = std::vector<uint8_t>();
+        mBlock.reserve(BLOCK_SIZE + sizeof(CaptureEventHeader) + UINT16_MAX + 8);
+    } else {
+        mBlock = std::move(mFreeBlocks.back());
+        mFreeBlocks.pop_back();
+    }
+    lock.unlock();
+
+    mBlockQueued.notify_one();
+    return true;
+}
+
+bool CaptureFileWriter::WriteBlock(std::vector<uint8_t> const& data)
+{
+    mCompressedBlock.resize(GetMaxCompressedSize(data.size()));
+
+    CaptureBlockHeader block = {};
+    block.mDataSize = (uint32_t) data.size();
+    block.mStoredSize = (uint32_t) CompressBlock(data.data(), data.size(), mCompressedBlock.data());
+
+    uint8_t const* stored = mCompressedBlock.data();
+    if (block.mStoredSize >= block.mDataSize) {
+        block.mStoredSize = block.mDataSize;
+        stored = data.data();
+    }
+
+    return fwrite(&block, sizeof(block), 1, mFile) == 1 &&
+           fwrite(stored, block.mStoredSize, 1, mFile) == 1;
+}
+
+// Compresses and writes the queued blocks, in order, until Close().
+void CaptureFileWriter::WriterThread()
+{
+    std::unique_lock<std::mutex> lock(mBlockMutex);
+    for (;;) {
+        mBlockQueued.wait(lock, [this] { return !mQueuedBlocks.empty() || mStopWriterThread; });
+        if (mQueuedBlocks.empty()) {
+            break;
+        }
+
+        auto data = std::move(mQueuedBlocks.front());
+        mQueuedBlocks.pop_front();
+        auto writeFailed = mWriteFailed;
+        lock.unlock();
+
+        if (!writeFailed && !WriteBlock(data)) {
+            writeFailed = true;
+        }
+        data.clear();
+
+        lock.lock();
+        mWriteFailed = writeFailed;
+        mFreeBlocks.emplace_back(std::move(data));
+        mBlockWritten.notify_one();
+    }
+}
+
+bool CaptureFileWriter::Close(uint64_t qpcFrequency, uint64_t startQpc, uint32_t eventsLost, uint32_t buffersLost)
+{
+    if (mFile == nullptr) {
+        return false;
+    }
+
+    if (!mBlock.empty()) {
+        QueueBlock();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mBlockMutex);
+        mStopWriterThread = true;
+    }
+    mBlockQueued.notify_one();
+    mWriterThread.join();
+
+    // The header is still written if a block failed, so the events before it
+    // can be read.
+    mHeader.mQpcFrequency = qpcFrequency;
+    mHeader.mStartQpc     = startQpc;
+    mHeader.mEventsLost   = eventsLost;
+    mHeader.mBuffersLost  = buffersLost;
+    auto ok = !mWriteFailed;
+    ok = fseek(mFile, 0, SEEK_SET) == 0 &&
+         fwrite(&mHeader, sizeof(mHeader), 1, mFile) == 1 &&
+         ok;
+    ok = fclose(mFile) == 0 && ok;
+    mFile = nullptr;
+
+    mBlock.clear();
+    mQueuedBlocks.clear();
+    mFreeBlocks.clear();
+    mCompressedBlock.clear();
+    return ok;
+}
+
+CaptureFileReader::~CaptureFileReader()
+{
+    Close();
+}
+
+bool CaptureFileReader::Open(char const* path, void* userContext)
+{
+    assert(mFile == nullptr);
+
+#pragma warning(suppress: 4996)
+    mFile = fopen(path, "rb");
+    if (mFile == nullptr) {
+        return false;
+    }
+
+    if (fread(&mHeader, sizeof(mHeader), 1, mFile) != 1 ||
+        memcmp(mHeader.mMagic, CAPTURE_FILE_MAGIC, sizeof(mHeader.mMagic)) != 0 ||
+        mHeader.mVersion != CAPTURE_FILE_VERSION ||
+        mHeader.mHeaderSize != sizeof(CaptureFileHeader) ||
+        mHeader.mQpcFrequency == 0) {
+        Close();
+        return false;
+    }
+
+    mUserContext = userContext;
+    mBlock.clear();
+    mBlockOffset = 0;
+    mEventCount = 0;
+    return true;
+}
+
+void CaptureFileReader::Close()
+{
+    if (mFile != nullptr) {
+        fclose(mFile);
+        mFile = nullptr;
+    }
+    mBlock.clear();
+    mCompressedBlock.clear();
+    mBlockOffset = 0;
+}
+
+bool CaptureFileReader::ReadBlock()
+{
+    CaptureBlockHeader block = {};
+    if (fread(&block, sizeof(block), 1, mFile) != 1 || block.mStoredSize > block.mDataSize) {
+        return false;
+    }
+
+    mBlock.resize(block.mDataSize);
+    mBlockOffset = 0;
+    if (block.mStoredSize == block.mDataSize) {
+        return fread(mBlock.data(), block.mDataSize, 1, mFile) == 1;
+    }
+
+    mCompressedBlock.resize(block.mStoredSize);
+    return fread(mCompressedBlock.data(), block.mStoredSize, 1, mFile) == 1 &&
+           DecompressBlock(mCompressedBlock.data(), block.mStoredSize, mBlock.data(), block.mDataSize);
+}
+
+EVENT_RECORD* CaptureFileReader::NextEvent()
+{
+    if (mFile == nullptr) {
+        return nullptr;
+    }
+
+    // Move to the next block once this one is done.  A truncated or corrupt
+    // block ends the capture.
+    while (mBlockOffset + sizeof(CaptureEventHeader) > mBlock.size()) {
+        if (!ReadBlock()) {
+            mBlock.clear();
+            mBlockOffset = 0;
+            return nullptr;
+        }
+    }
+
+    CaptureEventHeader event;
+    memcpy(&event, mBlock.data() + mBlockOffset, sizeof(event));
+
+    // Extended data items are listed with Linkage set on all but the last, as
+    // ETW does.
+    mExtendedData.clear();
+    auto dataOffset = mBlockOffset + sizeof(event);
+    for (uint16_t i = 0; i < event.mExtendedDataCount; ++i) {
+        CaptureExtendedDataHeader itemHeader;
+        if (dataOffset + sizeof(itemHeader) > mBlock.size()) {
+            break;
+        }
+        memcpy(&itemHeader, mBlock.data() + dataOffset, sizeof(itemHeader));
+        if (dataOffset + sizeof(itemHeader) + itemHeader.mDataSize > mBlock.size()) {
+            break;
+        }
+
+        EVENT_HEADER_EXTENDED_DATA_ITEM item = {};
+        item.ExtType  = itemHeader.mExtType;
+        item.Linkage  = i + 1 < event.mExtendedDataCount ? 1 : 0;
+        item.DataSize = itemHeader.mDataSize;
+        item.DataPtr  = (uint64_t) (uintptr_t) (mBlock.data() + dataOffset + sizeof(itemHeader));
+        mExtendedData.push_back(item);
+
+        dataOffset = AlignUp8(dataOffset + sizeof(itemHeader) + itemHeader.mDataSize);
+    }
+
+    if (mExtendedData.size() < event.mExtendedDataCount ||
+        dataOffset + event.mUserDataLength > mBlock.size()) {
+        mBlock.clear();
+        mBlockOffset = 0;
+        return nullptr;
+    }
+
+    auto hdr = &mEventRecord.EventHeader;
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->Size               = (uint16_t) sizeof(EVENT_HEADER);
+    hdr->Flags              = event.mFlags;
+    hdr->ThreadId           = event.mThreadId;
+    hdr->ProcessId          = event.mProcessId;
+    hdr->TimeStamp.QuadPart = event.mTimeStamp;
+    hdr->ProviderId         = event.mProviderId;
+    hdr->EventDescriptor    = event.mEventDescriptor;
+    mEventRecord.BufferContext.ProcessorIndex = event.mProcessorIndex;
+    mEventRecord.ExtendedDataCount = (uint16_t) mExtendedData.size();
+    mEventRecord.ExtendedData      = mExtendedData.empty() ? nullptr : mExtendedData.data();
+    mEventRecord.UserDataLength    = event.mUserDataLength;
+    mEventRecord.UserData          = mBlock.data() + dataOffset;
+    mEventRecord.UserContext       = mUserContext;
+
+    mBlockOffset = std::min(AlignUp8(dataOffset + event.mUserDataLength), mBlock.size());
+    mEventCount += 1;
+    return &mEventRecord;
+}
@@ -0,0 +1,165 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+#include "EtlFileReader.hpp" // EVENT_RECORD, on platforms without evntcons.h
+
+// A capture file holds only the events that PresentMon analyzes, so that a
+// capture can be re-analyzed (e.g., with a different verbosity or process
+// filter) without decoding the whole ETL file again.
+//
+// The file starts with a CaptureFileHeader, followed by blocks of events.
+// Each block is a CaptureBlockHeader followed by the block's data, which is
+// LZ compressed unless that didn't make it smaller.  The uncompressed data is
+// a sequence of events, each a CaptureEventHeader followed by the event's
+// extended data items and then its UserData, padded to 8 bytes.  Each
+// extended data item is a CaptureExtendedDataHeader followed by the item's
+// data, padded to 8 bytes.
+struct CaptureFileHeader {
+    char mMagic[8];                             // CAPTURE_FILE_MAGIC
+    uint32_t mVersion;                          // CAPTURE_FILE_VERSION
+    uint32_t mHeaderSize;                       // sizeof(CaptureFileHeader)
+    uint64_t mQpcFrequency;
+    uint64_t mStartQpc;
+    uint64_t mEventCount;
+    uint32_t mEventsLost;
+    uint32_t mBuffersLost;
+};
+
+struct CaptureBlockHeader {
+    uint32_t mDataSize;                         // Size of the uncompressed data
+    uint32_t mStoredSize;                       // Size of the data in the file; if equal to mDataSize, it isn't compressed
+};
+
+struct CaptureEventHeader {
+    int64_t mTimeStamp;
+    GUID mProviderId;
+    EVENT_DESCRIPTOR mEventDescriptor;
+    uint32_t mProcessId;
+    uint32_t mThreadId;
+    uint16_t mFlags;                            // EVENT_HEADER Flags, e.g. EVENT_HEADER_FLAG_32_BIT_HEADER
+    uint16_t mProcessorIndex;
+    uint16_t mUserDataLength;
+    uint16_t mExtendedDataCount;
+};
+
+struct CaptureExtendedDataHeader {
+    uint16_t mExtType;                          // EVENT_HEADER_EXTENDED_DATA_ITEM ExtType
+    uint16_t mDataSize;
+    uint32_t mReserved;
+};
+
+char const CAPTURE_FILE_MAGIC[8] = { 'P', 'M', 'C', 'A', 'P', 'T', 'U', 'R' };
+uint32_t const CAPTURE_FILE_VERSION = 1;
+
+// WriteEvent() is called from the ETW callback, so it only copies the event
+// into the current block.  Full blocks are compressed and written to the file
+// by a writer thread.
+struct CaptureFileWriter {
+    enum { BLOCK_SIZE = 256 * 1024 };           // Blocks are queued for the writer thread once this much data is buffered
+    enum { QUEUED_BLOCK_MAX_COUNT = 8 };        // WriteEvent() waits for the writer thread if this many blocks are queued
+
+    FILE* mFile = nullptr;
+    CaptureFileHeader mHeader = {};
+    std::vector<uint8_t> mBlock;                // The block being filled by WriteEvent()
+
+    // mQueuedBlocks, mFreeBlocks, mStopWriterThread, and mWriteFailed are
+    // protected by mBlockMutex.  mCompressedBlock is only used by the writer
+    // thread.
+    std::thread mWriterThread;
+    std::deque<std::vector<uint8_t>> mQueuedBlocks;
+    std::vector<std::vector<uint8_t>> mFreeBlocks;
+    std::vector<uint8_t> mCompressedBlock;
+    std::mutex mBlockMutex;
+    std::condition_variable mBlockQueued;
+    std::condition_variable mBlockWritten;
+    bool mStopWriterThread = false;
+    bool mWriteFailed = false;                  // Set once a block fails to be written; no more are written after it
+
+    CaptureFileWriter() = default;
+    ~CaptureFileWriter();
+    CaptureFileWriter(CaptureFileWriter const&) = delete;
+    CaptureFileWriter& operator=(CaptureFileWriter const&) = delete;
+
+    // Creates the file and starts the writer thread.  Returns false if the
+    // file can't be created.
+    bool Open(char const* path);
+
+    // Returns false once the file can't be written to, after which no more
+    // events are recorded.
+    bool WriteEvent(EVENT_RECORD const* eventRecord);
+
+    // Writes any buffered events, and the header with the session's clock
+    // and lost-event information.  Returns false if the file wasn't open, or
+    // if any of it couldn't be written.
+    bool Close(uint64_t qpcFrequency, uint64_t startQpc, uint32_t eventsLost, uint32_t buffersLost);
+
+    bool QueueBlock();
+    bool WriteBlock(std::vector<uint8_t> const& data);
+    void WriterThread();
+};
+
+struct CaptureFileReader {
+    FILE* mFile = nullptr;
+    CaptureFileHeader mHeader = {};
+    void* mUserContext = nullptr;               // Set as each EVENT_RECORD's UserContext
+    std::vector<uint8_t> mBlock;
+    std::vector<uint8_t> mCompressedBlock;
+    size_t mBlockOffset = 0;                    // Offset of the next event into mBlock
+    uint64_t mEventCount = 0;                   // Events returned so far
+    EVENT_RECORD mEventRecord = {};
+    std::vector<EVENT_HEADER_EXTENDED_DATA_ITEM> mExtendedData;
+
+    CaptureFileReader() = default;
+    ~CaptureFileReader();
+    CaptureFileReader(CaptureFileReader const&) = delete;
+    CaptureFileReader& operator=(CaptureFileReader const&) = delete;
+
+    // Opens the file and reads its header.  Returns false if the file can't
+    // be opened or isn't a capture file.
+    bool Open(char const* path, void* userContext);
+    void Close();
+    bool IsOpen() const { return mFile != nullptr; }
+
+    // Returns the next event, or nullptr once all events have been returned.
+    // The returned EVENT_RECORD is valid until the next call.
+    EVENT_RECORD* NextEvent();
+
+    bool ReadBlock();
+};
+
+// The block compression used by capture files.  CompressBlock() returns the
+// compressed size, which may be larger than srcSize for incompressible data;
+// dst must have room for GetMaxCompressedSize(srcSize) bytes.
+// DecompressBlock() returns false if src is corrupt or doesn't decompress to
+// exactly dstSize bytes.
+size_t GetMaxCompressedSize(size_t srcSize);
+size_t CompressBlock(uint8_t const* src, size_t srcSize, uint8_t* dst);
+bool DecompressBlock(uint8_t const* src, size_t srcSize, uint8_t* dst, size_t dstSize);
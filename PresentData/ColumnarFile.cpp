@@ -0,0 +1,378 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <assert.h>
+#include <string.h>
+
+#include "CaptureFile.hpp"
+#include "ColumnarFile.hpp"
+
+// The columns are named after the CSV columns they correspond to (with Qpc
+// instead of Ms for the durations), and ordered widest first.
+ColumnarColumn const COLUMNAR_COLUMNS[COLUMNAR_COLUMN_COUNT] = {
+    { "QPCTime",                 ColumnarType::UInt64, offsetof(ColumnarPresent, mQpcTime) },
+    { "SwapChainAddress",        ColumnarType::UInt64, offsetof(ColumnarPresent, mSwapChainAddress) },
+    { "QpcBetweenPresents",      ColumnarType::UInt64, offsetof(ColumnarPresent, mBetweenPresents) },
+    { "QpcBetweenDisplayChange", ColumnarType::UInt64, offsetof(ColumnarPresent, mBetweenDisplayChange) },
+    { "QpcInPresentAPI",         ColumnarType::UInt64, offsetof(ColumnarPresent, mInPresentAPI) },
+    { "QpcUntilRenderComplete",  ColumnarType::UInt64, offsetof(ColumnarPresent, mUntilRenderComplete) },
+    { "QpcUntilDisplayed",       ColumnarType::UInt64, offsetof(ColumnarPresent, mUntilDisplayed) },
+    { "ProcessID",               ColumnarType::UInt32, offsetof(ColumnarPresent, mProcessId) },
+    { "SyncInterval",            ColumnarType::Int32,  offsetof(ColumnarPresent, mSyncInterval) },
+    { "PresentFlags",            ColumnarType::UInt32, offsetof(ColumnarPresent, mPresentFlags) },
+    { "Runtime",                 ColumnarType::UInt8,  offsetof(ColumnarPresent, mRuntime) },
+    { "PresentMode",             ColumnarType::UInt8,  offsetof(ColumnarPresent, mPresentMode) },
+    { "FinalState",              ColumnarType::UInt8,  offsetof(ColumnarPresent, mFinalState) },
+    { "AllowsTearing",           ColumnarType::UInt8,  offsetof(ColumnarPresent, mSupportsTearing) },
+    { "WasBatched",              ColumnarType::UInt8,  offsetof(ColumnarPresent, mWasBatched) },
+    { "DwmNotified",             ColumnarType::UInt8,  offsetof(ColumnarPresent, mDwmNotified) },
+};
+
+namespace {
+
+size_t Pad8(size_t size)
+{
+    return (size + 7) & ~(size_t) 7;
+}
+
+uint8_t* WriteBlockHeader(ColumnarBlockType type, size_t size, uint8_t* dst)
+{
+    ColumnarBlockHeader block = {};
+    block.mType = type;
+    block.mSize = (uint32_t) size;
+    memcpy(dst, &block, sizeof(block));
+    return dst + sizeof(block);
+}
+
+// Zeroes the padding after size bytes written at dst, and returns its end.
+uint8_t* WritePadding(uint8_t* dst, size_t size)
+{
+    memset(dst + size, 0, Pad8(size) - size);
+    return dst + Pad8(size);
+}
+
+}
+
+uint32_t GetColumnarTypeSize(ColumnarType type)
+{
+    switch (type) {
+    case ColumnarType::UInt8:   return 1;
+    case ColumnarType::Int32:   return 4;
+    case ColumnarType::UInt32:  return 4;
+    case ColumnarType::UInt64:  return 8;
+    case ColumnarType::Float32: return 4;
+    default:                    return 0;
+    }
+}
+
+size_t GetColumnarFileHeaderSize()
+{
+    return sizeof(ColumnarFileHeader) + COLUMNAR_COLUMN_COUNT * sizeof(ColumnarColumnInfo);
+}
+
+uint8_t* EncodeColumnarFileHeader(uint64_t qpcFrequency, uint64_t startQpc, uint8_t* dst)
+{
+    ColumnarFileHeader header = {};
+    memcpy(header.mMagic, COLUMNAR_FILE_MAGIC, sizeof(header.mMagic));
+    header.mVersion      = COLUMNAR_FILE_VERSION;
+    header.mHeaderSize   = (uint32_t) GetColumnarFileHeaderSize();
+    header.mQpcFrequency = qpcFrequency;
+    header.mStartQpc     = startQpc;
+    header.mColumnCount  = COLUMNAR_COLUMN_COUNT;
+    memcpy(dst, &header, sizeof(header));
+    dst += sizeof(header);
+
+    for (auto const& column : COLUMNAR_COLUMNS) {
+        ColumnarColumnInfo info = {};
+#pragma warning(suppress: 4996)
+        strncpy(info.mName, column.mName, sizeof(info.mName) - 1);
+        info.mType = column.mType;
+        info.mSize = GetColumnarTypeSize(column.mType);
+        memcpy(dst, &info, sizeof(info));
+        dst += sizeof(info);
+    }
+
+    return dst;
+}
+
+size_t GetColumnarProcessNameSize(size_t nameLength)
+{
+    return sizeof(ColumnarBlockHeader) + Pad8(sizeof(ColumnarProcessName) + nameLength);
+}
+
+uint8_t* EncodeColumnarProcessName(uint32_t processId, char const* name, size_t nameLength, uint8_t* dst)
+{
+    auto size = sizeof(ColumnarProcessName) + nameLength;
+    dst = WriteBlockHeader(ColumnarBlockType::ProcessName, Pad8(size), dst);
+
+    ColumnarProcessName processName = {};
+    processName.mProcessId = processId;
+    processName.mNameLength = (uint32_t) nameLength;
+    memcpy(dst, &processName, sizeof(processName));
+    memcpy(dst + sizeof(processName), name, nameLength);
+    return WritePadding(dst, size);
+}
+
+bool ColumnarRowGroupWriter::AddPresent(ColumnarPresent const& present)
+{
+    for (uint32_t i = 0; i < COLUMNAR_COLUMN_COUNT; ++i) {
+        auto const& column = COLUMNAR_COLUMNS[i];
+        auto src = (uint8_t const*) &present + column.mOffset;
+        mColumns[i].insert(mColumns[i].end(), src, src + GetColumnarTypeSize(column.mType));
+    }
+
+    mRowCount += 1;
+    return mRowCount >= MAX_ROW_COUNT;
+}
+
+size_t ColumnarRowGroupWriter::GetMaxEncodedSize() const
+{
+    auto size = sizeof(ColumnarBlockHeader) + sizeof(ColumnarRowGroupHeader);
+    for (auto const& values : mColumns) {
+        size += sizeof(ColumnarChunkHeader) + Pad8(values.size());
+    }
+    return size;
+}
+
+uint8_t* ColumnarRowGroupWriter::Encode(uint8_t* dst)
+{
+    // The block size isn't known until the columns are compressed, so its
+    // header is written last.
+    auto block = dst;
+    dst += sizeof(ColumnarBlockHeader);
+
+    ColumnarRowGroupHeader rowGroup = {};
+    rowGroup.mRowCount = mRowCount;
+    rowGroup.mColumnCount = COLUMNAR_COLUMN_COUNT;
+    memcpy(dst, &rowGroup, sizeof(rowGroup));
+    dst += sizeof(rowGroup);
+
+    for (auto& values : mColumns) {
+        // Columns such as ProcessID and PresentMode are mostly the same value
+        // over and over, and compress to almost nothing.
+        mCompressedColumn.resize(GetMaxCompressedSize(values.size()));
+
+        ColumnarChunkHeader chunk = {};
+        chunk.mDataSize = (uint32_t) values.size();
+        chunk.mStoredSize = (uint32_t) CompressBlock(values.data(), values.size(), mCompressedColumn.data());
+
+        auto data = mCompressedColumn.data();
+        if (chunk.mStoredSize >= chunk.mDataSize) {
+            chunk.mStoredSize = chunk.mDataSize;
+            data = values.data();
+        }
+
+        memcpy(dst, &chunk, sizeof(chunk));
+        dst += sizeof(chunk);
+        memcpy(dst, data, chunk.mStoredSize);
+        dst = WritePadding(dst, chunk.mStoredSize);
+
+        values.clear();
+    }
+
+    WriteBlockHeader(ColumnarBlockType::RowGroup, dst - block - sizeof(ColumnarBlockHeader), block);
+    mRowCount = 0;
+    return dst;
+}
+
+ColumnarFileReader::~ColumnarFileReader()
+{
+    Close();
+}
+
+bool ColumnarFileReader::Open(char const* path)
+{
+    assert(mFile == nullptr);
+
+#pragma warning(suppress: 4996)
+    mFile = fopen(path, "rb");
+    if (mFile == nullptr) {
+        return false;
+    }
+
+    if (fread(&mHeader, sizeof(mHeader), 1, mFile) != 1 ||
+        memcmp(mHeader.mMagic, COLUMNAR_FILE_MAGIC, sizeof(mHeader.mMagic)) != 0 ||
+        mHeader.mVersion != COLUMNAR_FILE_VERSION ||
+        mHeader.mHeaderSize != sizeof(ColumnarFileHeader) + mHeader.mColumnCount * sizeof(ColumnarColumnInfo) ||
+        mHeader.mQpcFrequency == 0) {
+        Close();
+        return false;
+    }
+
+    mColumns.resize(mHeader.mColumnCount);
+    if (mHeader.mColumnCount > 0 && fread(mColumns.data(), sizeof(ColumnarColumnInfo), mColumns.size(), mFile) != mColumns.size()) {
+        Close();
+        return false;
+    }
+
+    for (uint32_t i = 0; i < COLUMNAR_COLUMN_COUNT; ++i) {
+        mPresentColumns[i] = -1;
+        for (size_t j = 0; j < mColumns.size(); ++j) {
+            auto const& info = mColumns[j];
+            if (strncmp(info.mName, COLUMNAR_COLUMNS[i].mName, sizeof(info.mName)) == 0 &&
+                info.mType == COLUMNAR_COLUMNS[i].mType &&
+                info.mSize == GetColumnarTypeSize(info.mType)) {
+                mPresentColumns[i] = (int) j;
+                break;
+            }
+        }
+    }
+
+    mColumnData.resize(mColumns.size());
+    mRowCount = 0;
+    return true;
+}
+
+void ColumnarFileReader::Close()
+{
+    if (mFile != nullptr) {
+        fclose(mFile);
+        mFile = nullptr;
+    }
+    mColumns.clear();
+    mProcessNames.clear();
+    mColumnData.clear();
+    mBlock.clear();
+    mCompressedColumn.clear();
+    mRowCount = 0;
+}
+
+bool ColumnarFileReader::ReadRowGroup()
+{
+    if (mFile == nullptr) {
+        return false;
+    }
+
+    mRowCount = 0;
+    for (;;) {
+        ColumnarBlockHeader block = {};
+        if (fread(&block, sizeof(block), 1, mFile) != 1) {
+            return false;
+        }
+
+        switch (block.mType) {
+        case ColumnarBlockType::ProcessName: {
+            ColumnarProcessName processName = {};
+            mBlock.resize(block.mSize);
+            if (block.mSize < sizeof(processName) ||
+                fread(mBlock.data(), block.mSize, 1, mFile) != 1) {
+                return false;
+            }
+            memcpy(&processName, mBlock.data(), sizeof(processName));
+            if (processName.mNameLength > block.mSize - sizeof(processName)) {
+                return false;
+            }
+            mProcessNames[processName.mProcessId].assign((char const*) mBlock.data() + sizeof(processName), processName.mNameLength);
+            break;
+        }
+
+        case ColumnarBlockType::RowGroup:
+            if (!ReadRowGroupBlock(block.mSize)) {
+                mRowCount = 0;
+                return false;
+            }
+            return true;
+
+        default:
+            if (_fseeki64(mFile, block.mSize, SEEK_CUR) != 0) {
+                return false;
+            }
+            break;
+        }
+    }
+}
+
+bool ColumnarFileReader::ReadRowGroupBlock(uint32_t size)
+{
+    mBlock.resize(size);
+    if (size < sizeof(ColumnarRowGroupHeader) || fread(mBlock.data(), size, 1, mFile) != 1) {
+        return false;
+    }
+
+    ColumnarRowGroupHeader rowGroup = {};
+    memcpy(&rowGroup, mBlock.data(), sizeof(rowGroup));
+    if (rowGroup.mColumnCount != mColumns.size()) {
+        return false;
+    }
+
+    size_t offset = sizeof(rowGroup);
+    for (size_t i = 0; i < mColumns.size(); ++i) {
+        ColumnarChunkHeader chunk = {};
+        if (size - offset < sizeof(chunk)) {
+            return false;
+        }
+        memcpy(&chunk, mBlock.data() + offset, sizeof(chunk));
+        offset += sizeof(chunk);
+
+        if (chunk.mDataSize != (uint64_t) rowGroup.mRowCount * mColumns[i].mSize ||
+            chunk.mStoredSize > chunk.mDataSize ||
+            chunk.mStoredSize > size - offset) {
+            return false;
+        }
+
+        auto src = mBlock.data() + offset;
+        auto values = &mColumnData[i];
+        values->resize(chunk.mDataSize);
+        if (chunk.mStoredSize == chunk.mDataSize) {
+            memcpy(values->data(), src, chunk.mDataSize);
+        } else if (!DecompressBlock(src, chunk.mStoredSize, values->data(), chunk.mDataSize)) {
+            return false;
+        }
+
+        offset += chunk.mStoredSize;
+        offset = offset + 7 > size ? size : (offset + 7) & ~(size_t) 7;
+    }
+
+    mRowCount = rowGroup.mRowCount;
+    return true;
+}
+
+void const* ColumnarFileReader::GetColumn(char const* name, ColumnarType type) const
+{
+    for (size_t i = 0; i < mColumns.size(); ++i) {
+        auto const& info = mColumns[i];
+        if (strncmp(info.mName, name, sizeof(info.mName)) == 0 && info.mType == type) {
+            return mColumnData[i].data();
+        }
+    }
+    return nullptr;
+}
+
+void ColumnarFileReader::GetPresent(uint32_t row, ColumnarPresent* present) const
+{
+    assert(row < mRowCount);
+
+    memset(present, 0, sizeof(*present));
+    for (uint32_t i = 0; i < COLUMNAR_COLUMN_COUNT; ++i) {
+        auto index = mPresentColumns[i];
+        if (index >= 0) {
+            auto size = mColumns[index].mSize;
+            memcpy((uint8_t*) present + COLUMNAR_COLUMNS[i].mOffset, mColumnData[index].data() + (size_t) row * size, size);
+        }
+    }
+}
+
+char const* ColumnarFileReader::GetProcessName(uint32_t processId) const
+{
+    auto ii = mProcessNames.find(processId);
+    return ii == mProcessNames.end() ? nullptr : ii->second.c_str();
+}
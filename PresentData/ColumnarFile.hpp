@@ -0,0 +1,203 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A columnar file holds the same presents as a PresentMon CSV, as fixed-width
+// binary values stored a column at a time, so that analysis tools can load
+// them without parsing any text.
+//
+// The file starts with a ColumnarFileHeader and a ColumnarColumnInfo for each
+// column (the schema), followed by blocks.  Each block is a
+// ColumnarBlockHeader followed by mSize bytes of data:
+//
+//   ColumnarBlockType::ProcessName: a ColumnarProcessName followed by the
+//   process's name (not NUL-terminated).  It comes before the first row group
+//   with a present from the process.
+//
+//   ColumnarBlockType::RowGroup: a ColumnarRowGroupHeader, followed by each
+//   column's values in schema order.  Each column is a ColumnarChunkHeader
+//   followed by mRowCount little-endian values, which are LZ compressed (see
+//   CompressBlock() in CaptureFile.hpp) unless that didn't make them smaller.
+//
+// All headers are multiples of 8 bytes, and each block and column is padded
+// to 8 bytes.  Readers should skip block types and columns they don't know.
+struct ColumnarFileHeader {
+    char mMagic[8];                             // COLUMNAR_FILE_MAGIC
+    uint32_t mVersion;                          // COLUMNAR_FILE_VERSION
+    uint32_t mHeaderSize;                       // sizeof(ColumnarFileHeader) + mColumnCount * sizeof(ColumnarColumnInfo)
+    uint64_t mQpcFrequency;
+    uint64_t mStartQpc;                         // QPC time that the CSV's TimeInSeconds are relative to
+    uint32_t mColumnCount;
+    uint32_t mReserved;
+};
+
+enum class ColumnarType : uint32_t {
+    UInt8 = 1,
+    Int32 = 2,
+    UInt32 = 3,
+    UInt64 = 4,
+    Float32 = 5,
+};
+
+struct ColumnarColumnInfo {
+    char mName[24];                             // NUL-terminated, e.g. "QpcBetweenPresents"
+    ColumnarType mType;
+    uint32_t mSize;                             // Bytes per value
+};
+
+enum class ColumnarBlockType : uint32_t {
+    ProcessName = 1,
+    RowGroup = 2,
+};
+
+struct ColumnarBlockHeader {
+    ColumnarBlockType mType;
+    uint32_t mSize;                             // Size of the data that follows, including padding
+};
+
+struct ColumnarProcessName {
+    uint32_t mProcessId;
+    uint32_t mNameLength;
+};
+
+struct ColumnarRowGroupHeader {
+    uint32_t mRowCount;
+    uint32_t mColumnCount;
+};
+
+struct ColumnarChunkHeader {
+    uint32_t mDataSize;                         // Size of the uncompressed values
+    uint32_t mStoredSize;                       // Size of the values in the file; if equal to mDataSize, they aren't compressed
+};
+
+char const COLUMNAR_FILE_MAGIC[8] = { 'P', 'M', 'C', 'O', 'L', 'U', 'M', 'N' };
+uint32_t const COLUMNAR_FILE_VERSION = 1;
+
+// A present, as written to a columnar file.  The durations are the QPC deltas
+// that the CSV's Ms* columns of the same names are computed from (0 if not
+// computed), so they're exact; divide by the header's mQpcFrequency for
+// seconds.  The enums are stored as their PresentMonTraceConsumer.hpp values.
+struct ColumnarPresent {
+    uint64_t mQpcTime;
+    uint64_t mSwapChainAddress;
+    uint64_t mBetweenPresents;
+    uint64_t mBetweenDisplayChange;
+    uint64_t mInPresentAPI;
+    uint64_t mUntilRenderComplete;
+    uint64_t mUntilDisplayed;
+    uint32_t mProcessId;
+    int32_t mSyncInterval;
+    uint32_t mPresentFlags;
+    uint8_t mRuntime;                           // Runtime
+    uint8_t mPresentMode;                       // PresentMode
+    uint8_t mFinalState;                        // PresentResult
+    uint8_t mSupportsTearing;
+    uint8_t mWasBatched;
+    uint8_t mDwmNotified;
+};
+
+// The columns that ColumnarRowGroupWriter writes, in schema order, and where
+// each one's values are in a ColumnarPresent.
+struct ColumnarColumn {
+    char const* mName;
+    ColumnarType mType;
+    size_t mOffset;
+};
+
+enum { COLUMNAR_COLUMN_COUNT = 16 };
+extern ColumnarColumn const COLUMNAR_COLUMNS[COLUMNAR_COLUMN_COUNT];
+
+uint32_t GetColumnarTypeSize(ColumnarType type);
+
+// The Encode*() functions write part of a columnar file to dst, which must
+// have room for the corresponding Get*Size() bytes, and return the end of
+// what they wrote.  This lets the caller put them straight into its own
+// output buffer.
+size_t GetColumnarFileHeaderSize();
+uint8_t* EncodeColumnarFileHeader(uint64_t qpcFrequency, uint64_t startQpc, uint8_t* dst);
+
+size_t GetColumnarProcessNameSize(size_t nameLength);
+uint8_t* EncodeColumnarProcessName(uint32_t processId, char const* name, size_t nameLength, uint8_t* dst);
+
+struct ColumnarRowGroupWriter {
+    enum { MAX_ROW_COUNT = 4096 };              // Rows are encoded once this many are buffered
+
+    std::vector<uint8_t> mColumns[COLUMNAR_COLUMN_COUNT];
+    std::vector<uint8_t> mCompressedColumn;
+    uint32_t mRowCount = 0;
+
+    // Adds a row.  Returns true if the row group is full, and should be
+    // encoded before another row is added.
+    bool AddPresent(ColumnarPresent const& present);
+
+    // Writes the rows as a row group block, and removes them.
+    size_t GetMaxEncodedSize() const;
+    uint8_t* Encode(uint8_t* dst);
+};
+
+struct ColumnarFileReader {
+    FILE* mFile = nullptr;
+    ColumnarFileHeader mHeader = {};
+    std::vector<ColumnarColumnInfo> mColumns;               // The file's schema
+    std::unordered_map<uint32_t, std::string> mProcessNames;
+    uint32_t mRowCount = 0;                                 // Rows in the current row group
+    std::vector<std::vector<uint8_t>> mColumnData;          // The current row group's values, indexed like mColumns
+    int mPresentColumns[COLUMNAR_COLUMN_COUNT] = {};        // Index into mColumns of each COLUMNAR_COLUMNS, or -1
+    std::vector<uint8_t> mBlock;
+    std::vector<uint8_t> mCompressedColumn;
+
+    ColumnarFileReader() = default;
+    ~ColumnarFileReader();
+    ColumnarFileReader(ColumnarFileReader const&) = delete;
+    ColumnarFileReader& operator=(ColumnarFileReader const&) = delete;
+
+    // Opens the file and reads its header and schema.  Returns false if the
+    // file can't be opened or isn't a columnar file.
+    bool Open(char const* path);
+    void Close();
+    bool IsOpen() const { return mFile != nullptr; }
+
+    // Reads the next row group, and the process names before it.  Returns
+    // false once all the row groups have been read; a truncated or corrupt
+    // row group ends the file.
+    bool ReadRowGroup();
+
+    // Returns the current row group's values of the named column, or nullptr
+    // if the file doesn't have a column with that name and type.
+    void const* GetColumn(char const* name, ColumnarType type) const;
+
+    // Copies a row of the current row group into present.  Columns that the
+    // file doesn't have are zero.
+    void GetPresent(uint32_t row, ColumnarPresent* present) const;
+
+    // Returns the name of a process, or nullptr if the file doesn't have it.
+    char const* GetProcessName(uint32_t processId) const;
+
+    bool ReadRowGroupBlock(uint32_t size);
+};
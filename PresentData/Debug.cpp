@@ -58,6 +58,14 @@ struct {
     bool Completed;
 } gOriginalPresentValues;
 
+// A present's tracking state is released when it completes, so use default
+// values after that.
+PresentTrackingState const& GetTracking(PresentEvent const& p)
+{
+    static PresentTrackingState const completedTracking;
+    return p.Tracking == nullptr ? completedTracking : *p.Tracking;
+}
+
 bool gDebugDone = false;
 bool gDebugTrace = false;
 LARGE_INTEGER* gFirstTimestamp = nullptr;
@@ -156,24 +164,33 @@ void FlushModifiedPresent()
         printf("->"); \
         _Fn(gModifiedPresent->_Name); \
     }
-    FLUSH_MEMBER(PrintTimeDelta,     TimeTaken)
-    FLUSH_MEMBER(PrintTimeDelta,     ReadyTime)
-    FLUSH_MEMBER(PrintTimeDelta,     ScreenTime)
-    FLUSH_MEMBER(PrintU64Ptr,        SwapChainAddress)
-    FLUSH_MEMBER(PrintU32,           SyncInterval)
-    FLUSH_MEMBER(PrintU32,           PresentFlags)
-    FLUSH_MEMBER(PrintU64Ptr,        Hwnd)
-    FLUSH_MEMBER(PrintU64Ptr,        TokenPtr)
-    FLUSH_MEMBER(PrintU32,           QueueSubmitSequence)
-    FLUSH_MEMBER(PrintPresentMode,   PresentMode)
-    FLUSH_MEMBER(PrintPresentResult, FinalState)
-    FLUSH_MEMBER(PrintBool,          SupportsTearing)
-    FLUSH_MEMBER(PrintBool,          MMIO)
-    FLUSH_MEMBER(PrintBool,          SeenDxgkPresent)
-    FLUSH_MEMBER(PrintBool,          SeenWin32KEvents)
-    FLUSH_MEMBER(PrintBool,          WasBatched)
-    FLUSH_MEMBER(PrintBool,          DwmNotified)
-    FLUSH_MEMBER(PrintBool,          Completed)
+#define FLUSH_TRACKING_MEMBER(_Fn, _Name) \
+    if (GetTracking(*gModifiedPresent)._Name != gOriginalPresentValues._Name) { \
+        if (changedCount++ == 0) PrintUpdateHeader(gModifiedPresent->Id); \
+        printf(" " #_Name "="); \
+        _Fn(gOriginalPresentValues._Name); \
+        printf("->"); \
+        _Fn(GetTracking(*gModifiedPresent)._Name); \
+    }
+    FLUSH_MEMBER(PrintTimeDelta,               TimeTaken)
+    FLUSH_MEMBER(PrintTimeDelta,               ReadyTime)
+    FLUSH_MEMBER(PrintTimeDelta,               ScreenTime)
+    FLUSH_MEMBER(PrintU64Ptr,                  SwapChainAddress)
+    FLUSH_MEMBER(PrintU32,                     SyncInterval)
+    FLUSH_MEMBER(PrintU32,                     PresentFlags)
+    FLUSH_TRACKING_MEMBER(PrintU64Ptr,         Hwnd)
+    FLUSH_TRACKING_MEMBER(PrintU64Ptr,         TokenPtr)
+    FLUSH_TRACKING_MEMBER(PrintU32,            QueueSubmitSequence)
+    FLUSH_MEMBER(PrintPresentMode,             PresentMode)
+    FLUSH_MEMBER(PrintPresentResult,           FinalState)
+    FLUSH_MEMBER(PrintBool,                    SupportsTearing)
+    FLUSH_TRACKING_MEMBER(PrintBool,           MMIO)
+    FLUSH_TRACKING_MEMBER(PrintBool,           SeenDxgkPresent)
+    FLUSH_TRACKING_MEMBER(PrintBool,           SeenWin32KEvents)
+    FLUSH_MEMBER(PrintBool,                    WasBatched)
+    FLUSH_MEMBER(PrintBool,                    DwmNotified)
+    FLUSH_MEMBER(PrintBool,                    Completed)
+#undef FLUSH_TRACKING_MEMBER
 #undef FLUSH_MEMBER
     if (changedCount > 0) {
         printf("\n");
@@ -342,15 +359,15 @@ void DebugModifyPresent(PresentEvent const& p)
         gOriginalPresentValues.SwapChainAddress    = p.SwapChainAddress;
         gOriginalPresentValues.SyncInterval        = p.SyncInterval;
         gOriginalPresentValues.PresentFlags        = p.PresentFlags;
-        gOriginalPresentValues.Hwnd                = p.Hwnd;
-        gOriginalPresentValues.TokenPtr            = p.TokenPtr;
-        gOriginalPresentValues.QueueSubmitSequence = p.QueueSubmitSequence;
+        gOriginalPresentValues.Hwnd                = GetTracking(p).Hwnd;
+        gOriginalPresentValues.TokenPtr            = GetTracking(p).TokenPtr;
+        gOriginalPresentValues.QueueSubmitSequence = GetTracking(p).QueueSubmitSequence;
         gOriginalPresentValues.PresentMode         = p.PresentMode;
         gOriginalPresentValues.FinalState          = p.FinalState;
         gOriginalPresentValues.SupportsTearing     = p.SupportsTearing;
-        gOriginalPresentValues.MMIO                = p.MMIO;
-        gOriginalPresentValues.SeenDxgkPresent     = p.SeenDxgkPresent;
-        gOriginalPresentValues.SeenWin32KEvents    = p.SeenWin32KEvents;
+        gOriginalPresentValues.MMIO                = GetTracking(p).MMIO;
+        gOriginalPresentValues.SeenDxgkPresent     = GetTracking(p).SeenDxgkPresent;
+        gOriginalPresentValues.SeenWin32KEvents    = GetTracking(p).SeenWin32KEvents;
         gOriginalPresentValues.WasBatched          = p.WasBatched;
         gOriginalPresentValues.DwmNotified         = p.DwmNotified;
         gOriginalPresentValues.Completed           = p.Completed;
@@ -0,0 +1,965 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <algorithm>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+#include "EtlFileReader.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// WMI_BUFFER_HEADER, at the start of each buffer.
+uint32_t const BUFFER_HEADER_SIZE               = 72;
+uint32_t const BUFFER_HEADER_BUFFER_SIZE        = 0x00;
+uint32_t const BUFFER_HEADER_SAVED_OFFSET       = 0x04;
+uint32_t const BUFFER_HEADER_CURRENT_OFFSET     = 0x08;
+uint32_t const BUFFER_HEADER_CLIENT_CONTEXT     = 0x28;     // ETW_BUFFER_CONTEXT
+
+// Each event starts with a trace header, whose type is in its third byte.
+// The fourth byte holds the header flags, which always have the high bit set.
+enum class TraceHeaderType : uint8_t {
+    System32        = 0x01,
+    System64        = 0x02,
+    Compact32       = 0x03,
+    Compact64       = 0x04,
+    FullHeader32    = 0x0A,
+    PerfInfo32      = 0x10,
+    PerfInfo64      = 0x11,
+    EventHeader32   = 0x12,
+    EventHeader64   = 0x13,
+    FullHeader64    = 0x14,
+};
+
+uint8_t const TRACE_HEADER_FLAG_MARKER = 0x80;
+
+// Classic kernel events (SYSTEM_TRACE_HEADER, PERFINFO_TRACE_HEADER) don't
+// include a provider GUID; it is implied by the group in the high byte of the
+// event's hook id.  Only the groups below are returned by NextEvent().
+struct {
+    uint16_t mGroup;
+    GUID mGuid;
+} const KERNEL_GROUP_GUIDS[] = {
+    { 0x0000, { 0x68fdd900, 0x4a3e, 0x11d1, { 0x84, 0xf4, 0x00, 0x00, 0xf8, 0x04, 0x64, 0xe3 } } }, // EventTraceGuid
+    { 0x0300, { 0x3d6fa8d0, 0xfe05, 0x11d0, { 0x9d, 0xda, 0x00, 0xc0, 0x4f, 0xd7, 0xba, 0x7c } } }, // ProcessGuid
+    { 0x0500, { 0x3d6fa8d1, 0xfe05, 0x11d0, { 0x9d, 0xda, 0x00, 0xc0, 0x4f, 0xd7, 0xba, 0x7c } } }, // ThreadGuid
+    { 0x1000, { 0x2cb15d1d, 0x5fc1, 0x11d2, { 0xab, 0xe1, 0x00, 0xa0, 0xc9, 0x11, 0xf5, 0x18 } } }, // ImageLoadGuid
+};
+
+uint16_t const KERNEL_PROCESS_GROUP = 0x0300;
+
+// Microsoft-Windows-EventMetadata, which logs the TDH schemas of the events in
+// the file.
+GUID const EVENT_METADATA_GUID = { 0xbbccf6c1, 0x6cd1, 0x48c4, { 0x80, 0xff, 0x83, 0x94, 0x82, 0xe3, 0x76, 0x71 } };
+
+// The index file saved by WriteIndexFile() is an IndexFileHeader followed by
+// an EtlFileReader::Buffer for each of the ETL file's buffers, in file order.
+// It is only used if the ETL file's size and last write time still match.
+struct IndexFileHeader {
+    char mMagic[8];                             // INDEX_FILE_MAGIC
+    uint32_t mVersion;                          // INDEX_FILE_VERSION
+    uint32_t mBufferEntrySize;                  // sizeof(EtlFileReader::Buffer)
+    uint64_t mEtlFileSize;
+    uint64_t mEtlFileTime;
+    uint64_t mBufferCount;
+};
+
+char const INDEX_FILE_MAGIC[8] = { 'P', 'M', 'E', 'T', 'L', 'I', 'D', 'X' };
+uint32_t const INDEX_FILE_VERSION = 1;
+
+// Buffer::mTimeStamp of buffers that don't have any events.
+int64_t const EMPTY_BUFFER_TIMESTAMP = INT64_MAX;
+
+// TRACE_LOGFILE_HEADER, the payload of the first event in the file.  The
+// offsets of the fields after LoggerName depend on the pointer size.
+uint32_t const LOGFILE_HEADER_POINTER_SIZE      = 44;
+uint32_t const LOGFILE_HEADER_EVENTS_LOST       = 48;
+uint32_t const LOGFILE_HEADER_CPU_SPEED         = 52;
+uint32_t const LOGFILE_HEADER_LOGGER_NAME       = 56;
+uint32_t const TIME_ZONE_INFORMATION_SIZE       = 172;
+
+template<typename T>
+T Read(uint8_t const* p)
+{
+    T t;
+    memcpy(&t, p, sizeof(T));
+    return t;
+}
+
+uint32_t AlignUp8(uint32_t offset)
+{
+    return (offset + 7u) & ~7u;
+}
+
+GUID const* FindKernelGroupGuid(uint16_t hookId)
+{
+    for (auto const& g : KERNEL_GROUP_GUIDS) {
+        if (g.mGroup == (hookId & 0xff00)) {
+            return &g.mGuid;
+        }
+    }
+    return nullptr;
+}
+
+// Returns the size of the trace header at p, or 0 if there isn't a valid
+// header.  Most header types have their size in the first USHORT, but the
+// kernel ones have a version there and their size in the third.
+uint32_t GetEventSize(uint8_t const* p, uint32_t available)
+{
+    if (available < 8 || (p[3] & TRACE_HEADER_FLAG_MARKER) == 0) {
+        return 0;
+    }
+
+    uint32_t size = 0;
+    switch ((TraceHeaderType) p[2]) {
+    case TraceHeaderType::System32:
+    case TraceHeaderType::System64:
+    case TraceHeaderType::Compact32:
+    case TraceHeaderType::Compact64:
+    case TraceHeaderType::PerfInfo32:
+    case TraceHeaderType::PerfInfo64:
+        size = Read<uint16_t>(p + 4);
+        break;
+    default:
+        size = Read<uint16_t>(p);
+        break;
+    }
+
+    return size < 8 || size > available ? 0 : size;
+}
+
+int64_t GetEventTimeStamp(uint8_t const* p)
+{
+    switch ((TraceHeaderType) p[2]) {
+    case TraceHeaderType::PerfInfo32:
+    case TraceHeaderType::PerfInfo64:
+        return Read<int64_t>(p + 8);
+    default:
+        return Read<int64_t>(p + 16);
+    }
+}
+
+// Returns true for the events that are returned from the buffers skipped by
+// Seek(): kernel process events, which PresentMon uses to name processes,
+// and event metadata, which is needed to decode them.
+bool IsStateEvent(uint8_t const* p, uint32_t size)
+{
+    switch ((TraceHeaderType) p[2]) {
+    case TraceHeaderType::System32:
+    case TraceHeaderType::System64:
+    case TraceHeaderType::Compact32:
+    case TraceHeaderType::Compact64:
+    case TraceHeaderType::PerfInfo32:
+    case TraceHeaderType::PerfInfo64:
+        return (Read<uint16_t>(p + 6) & 0xff00) == KERNEL_PROCESS_GROUP;
+    case TraceHeaderType::EventHeader32:
+    case TraceHeaderType::EventHeader64:
+        return size >= sizeof(EVENT_HEADER) &&
+               memcmp(p + offsetof(EVENT_HEADER, ProviderId), &EVENT_METADATA_GUID, sizeof(GUID)) == 0;
+    default:
+        return false;
+    }
+}
+
+// Returns the end of the event data in the buffer; the saved offset, unless
+// that wasn't filled in when the buffer was written.  available is the size
+// of the file from the start of the buffer.
+uint32_t GetBufferEventEnd(uint8_t const* buffer, uint64_t available)
+{
+    auto bufferSize = (uint32_t) std::min<uint64_t>(Read<uint32_t>(buffer + BUFFER_HEADER_BUFFER_SIZE), available);
+    auto end = Read<uint32_t>(buffer + BUFFER_HEADER_SAVED_OFFSET);
+    if (end <= BUFFER_HEADER_SIZE || end > bufferSize) {
+        end = Read<uint32_t>(buffer + BUFFER_HEADER_CURRENT_OFFSET);
+        if (end <= BUFFER_HEADER_SIZE || end > bufferSize) {
+            end = bufferSize;
+        }
+    }
+    return end;
+}
+
+// Fill in eventRecord from the event at p, appending any extended data items
+// to extendedData.  Returns false for events that aren't returned by
+// NextEvent() (e.g., header types that don't map onto an EVENT_RECORD, or
+// kernel groups without a known GUID).
+bool DecodeEvent(uint8_t const* p, uint32_t size, EVENT_RECORD* eventRecord, std::vector<EVENT_HEADER_EXTENDED_DATA_ITEM>* extendedData)
+{
+    auto hdr = &eventRecord->EventHeader;
+    auto type = (TraceHeaderType) p[2];
+    uint32_t headerSize = 0;
+    uint32_t flags = 0;
+
+    switch (type) {
+    case TraceHeaderType::EventHeader32:
+    case TraceHeaderType::EventHeader64:
+        headerSize = (uint32_t) sizeof(EVENT_HEADER);
+        if (size < headerSize) {
+            return false;
+        }
+        memcpy(hdr, p, sizeof(EVENT_HEADER));
+        flags = hdr->Flags & ~(EVENT_HEADER_FLAG_32_BIT_HEADER | EVENT_HEADER_FLAG_64_BIT_HEADER);
+        break;
+
+    case TraceHeaderType::FullHeader32:
+    case TraceHeaderType::FullHeader64:
+        // EVENT_TRACE_HEADER
+        headerSize = 48;
+        if (size < headerSize) {
+            return false;
+        }
+        memset(hdr, 0, sizeof(EVENT_HEADER));
+        hdr->EventDescriptor.Opcode  = p[4];
+        hdr->EventDescriptor.Level   = p[5];
+        hdr->EventDescriptor.Version = (uint8_t) Read<uint16_t>(p + 6);
+        hdr->ThreadId                = Read<uint32_t>(p + 8);
+        hdr->ProcessId               = Read<uint32_t>(p + 12);
+        hdr->TimeStamp.QuadPart      = Read<int64_t>(p + 16);
+        hdr->ProviderId              = Read<GUID>(p + 24);
+        hdr->ProcessorTime           = Read<uint64_t>(p + 40);
+        flags = EVENT_HEADER_FLAG_CLASSIC_HEADER;
+        break;
+
+    case TraceHeaderType::System32:
+    case TraceHeaderType::System64:
+    case TraceHeaderType::Compact32:
+    case TraceHeaderType::Compact64:
+    case TraceHeaderType::PerfInfo32:
+    case TraceHeaderType::PerfInfo64: {
+        // SYSTEM_TRACE_HEADER, or its compact and PERFINFO_TRACE_HEADER
+        // variants which leave out the CPU times and thread/process ids.
+        auto perfInfo = type == TraceHeaderType::PerfInfo32 || type == TraceHeaderType::PerfInfo64;
+        auto compact  = type == TraceHeaderType::Compact32 || type == TraceHeaderType::Compact64;
+        headerSize = perfInfo ? 16 : compact ? 24 : 32;
+        auto hookId = Read<uint16_t>(p + 6);
+        auto guid = FindKernelGroupGuid(hookId);
+        if (size < headerSize || guid == nullptr) {
+            return false;
+        }
+        memset(hdr, 0, sizeof(EVENT_HEADER));
+        hdr->EventDescriptor.Opcode  = (uint8_t) hookId;
+        hdr->EventDescriptor.Version = (uint8_t) Read<uint16_t>(p);
+        hdr->ProviderId              = *guid;
+        if (perfInfo) {
+            hdr->ThreadId            = UINT32_MAX;
+            hdr->ProcessId           = UINT32_MAX;
+            hdr->TimeStamp.QuadPart  = Read<int64_t>(p + 8);
+        } else {
+            hdr->ThreadId            = Read<uint32_t>(p + 8);
+            hdr->ProcessId           = Read<uint32_t>(p + 12);
+            hdr->TimeStamp.QuadPart  = Read<int64_t>(p + 16);
+            if (!compact) {
+                hdr->ProcessorTime   = Read<uint64_t>(p + 24);
+            }
+        }
+        flags = EVENT_HEADER_FLAG_CLASSIC_HEADER;
+        break;
+    }
+
+    default:
+        return false;
+    }
+
+    switch (type) {
+    case TraceHeaderType::System32:
+    case TraceHeaderType::Compact32:
+    case TraceHeaderType::FullHeader32:
+    case TraceHeaderType::PerfInfo32:
+    case TraceHeaderType::EventHeader32:
+        flags |= EVENT_HEADER_FLAG_32_BIT_HEADER;
+        break;
+    default:
+        flags |= EVENT_HEADER_FLAG_64_BIT_HEADER;
+        break;
+    }
+
+    hdr->Size = (uint16_t) sizeof(EVENT_HEADER);
+    hdr->HeaderType = 0;
+    hdr->Flags = (uint16_t) flags;
+
+    // Extended data items follow the EVENT_HEADER, each one an 8 byte item
+    // header followed by its data and padded to 8 bytes.  Linkage is set on
+    // all but the last item.
+    auto offset = headerSize;
+    auto firstExtendedData = extendedData->size();
+    if (flags & EVENT_HEADER_FLAG_EXTENDED_INFO) {
+        for (;;) {
+            if (offset + 8 > size) {
+                return false;
+            }
+            auto dataSize = Read<uint16_t>(p + offset + 6);
+            if (offset + 8 + dataSize > size) {
+                return false;
+            }
+
+            EVENT_HEADER_EXTENDED_DATA_ITEM item = {};
+            item.ExtType  = Read<uint16_t>(p + offset + 2);
+            item.Linkage  = (uint16_t) (Read<uint16_t>(p + offset + 4) & 1);
+            item.DataSize = dataSize;
+            item.DataPtr  = (uint64_t) (uintptr_t) (p + offset + 8);
+            extendedData->push_back(item);
+
+            offset = AlignUp8(offset + 8 + dataSize);
+            if (item.Linkage == 0) {
+                break;
+            }
+        }
+        offset = std::min(offset, size);
+    }
+
+    eventRecord->ExtendedDataCount = (uint16_t) (extendedData->size() - firstExtendedData);
+    eventRecord->ExtendedData      = eventRecord->ExtendedDataCount == 0 ? nullptr : extendedData->data() + firstExtendedData;
+    eventRecord->UserDataLength    = (uint16_t) (size - offset);
+    eventRecord->UserData          = (void*) (p + offset);
+    return true;
+}
+
+}
+
+EtlFileReader::~EtlFileReader()
+{
+    Close();
+}
+
+bool EtlFileReader::Open(char const* path, void* userContext, uint32_t decodeThreadCount)
+{
+    assert(!IsOpen());
+
+    if (!Map(path)) {
+        return false;
+    }
+
+    mUserContext = userContext;
+    mIndexPath = std::string(path) + ".pmidx";
+
+    // Find the buffers, from the index file if there is an up to date one.
+    // Otherwise, each buffer starts with its size and the buffers are stored
+    // back to back; their timestamps aren't known until they are indexed by
+    // Seek().
+    std::vector<Buffer> buffers;
+    mIndexed = ReadIndexFile(&buffers);
+    if (!mIndexed) {
+        for (uint64_t offset = 0; offset + BUFFER_HEADER_SIZE <= mSize; ) {
+            auto buffer = mData + offset;
+            auto bufferSize = Read<uint32_t>(buffer + BUFFER_HEADER_BUFFER_SIZE);
+            if (bufferSize <= BUFFER_HEADER_SIZE || bufferSize > mSize - offset) {
+                break;
+            }
+
+            Buffer b = {};
+            b.mOffset = offset;
+            b.mProcessor = Read<uint16_t>(buffer + BUFFER_HEADER_CLIENT_CONTEXT);
+            buffers.push_back(b);
+
+            offset += bufferSize;
+        }
+    }
+
+    // Group the buffers by the processor that filled them.
+    std::unordered_map<uint16_t, uint32_t> streamByProcessor;
+    for (auto const& buffer : buffers) {
+        auto ii = streamByProcessor.emplace(buffer.mProcessor, (uint32_t) mStreams.size());
+        if (ii.second) {
+            mStreams.emplace_back();
+        }
+        mStreams[ii.first->second].mBuffers.push_back(buffer);
+    }
+
+    if (mStreams.empty() || !ReadLogfileHeader()) {
+        Close();
+        return false;
+    }
+
+    mDecodedEventCount = 0;
+    for (auto& stream : mStreams) {
+        stream.mBufferIndex = 0;
+        stream.mSeekBufferIndex = 0;
+        stream.mEventOffset = 0;
+        stream.mEventEnd = 0;
+        stream.mBatchEventIndex = 0;
+    }
+
+    // Buffers aren't queued for the decode threads until Seek().
+    if (decodeThreadCount > 0) {
+        mStopDecodeThreads = false;
+        for (uint32_t i = 0; i < decodeThreadCount; ++i) {
+            mDecodeThreads.emplace_back(&EtlFileReader::DecodeThread, this);
+        }
+    }
+
+    mCurrentStream = UINT32_MAX;
+    mSeeked = false;
+
+    return true;
+}
+
+void EtlFileReader::Seek(uint64_t timestamp)
+{
+    assert(IsOpen());
+    assert(!mSeeked);
+    mSeeked = true;
+
+    // The first seek into the file has to look at every event, to find the
+    // buffers' first timestamps and which have state events.  Save that so
+    // that later runs don't have to.
+    auto seek = timestamp > mStartTime;
+    if (seek && !mIndexed) {
+        for (auto& stream : mStreams) {
+            for (auto& buffer : stream.mBuffers) {
+                IndexBuffer(&buffer);
+            }
+        }
+        mIndexed = true;
+        WriteIndexFile();
+    }
+
+    // Start each stream at the last buffer that starts at or before
+    // timestamp.
+    if (seek) {
+        for (auto& stream : mStreams) {
+            for (size_t i = 0, n = stream.mBuffers.size(); i < n; ++i) {
+                auto bufferTimeStamp = stream.mBuffers[i].mTimeStamp;
+                if (bufferTimeStamp == EMPTY_BUFFER_TIMESTAMP) {
+                    continue;
+                }
+                if ((uint64_t) bufferTimeStamp > timestamp) {
+                    break;
+                }
+                stream.mSeekBufferIndex = i;
+            }
+        }
+    }
+
+    // With decode threads, queue the first few buffers of each stream for
+    // decode before waiting on any of them.
+    if (!mDecodeThreads.empty()) {
+        std::lock_guard<std::mutex> lock(mBatchMutex);
+        for (auto& stream : mStreams) {
+            QueueBatches(&stream);
+        }
+    }
+
+    // Load the first event of each stream and build the heap.
+    mStreamHeap.reserve(mStreams.size());
+    for (uint32_t i = 0, n = (uint32_t) mStreams.size(); i < n; ++i) {
+        auto stream = &mStreams[i];
+        auto loaded = mDecodeThreads.empty() ? DecodeNextEvent(stream) : NextBatchEvent(stream);
+        if (loaded) {
+            mStreamHeap.push_back(i);
+        }
+    }
+
+    auto greater = [this](uint32_t lhs, uint32_t rhs) { return StreamLess(rhs, lhs); };
+    std::make_heap(mStreamHeap.begin(), mStreamHeap.end(), greater);
+}
+
+void EtlFileReader::Close()
+{
+    if (!mDecodeThreads.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(mBatchMutex);
+            mStopDecodeThreads = true;
+        }
+        mBatchQueued.notify_all();
+        for (auto& thread : mDecodeThreads) {
+            thread.join();
+        }
+        mDecodeThreads.clear();
+    }
+    mBatchQueue.clear();
+    mFreeBatches.clear();
+    mBatchStorage.clear();
+
+    Unmap();
+    mStreams.clear();
+    mStreamHeap.clear();
+    mCurrentStream = UINT32_MAX;
+    mSeeked = false;
+    mIndexed = false;
+}
+
+EVENT_RECORD* EtlFileReader::NextEvent()
+{
+    if (!mSeeked) {
+        Seek(0);
+    }
+
+    auto greater = [this](uint32_t lhs, uint32_t rhs) { return StreamLess(rhs, lhs); };
+
+    // Advance the stream that the previous event came from, and put it back
+    // into the heap unless it has run out of events.
+    if (mCurrentStream != UINT32_MAX) {
+        auto stream = &mStreams[mCurrentStream];
+        auto loaded = mDecodeThreads.empty() ? DecodeNextEvent(stream) : NextBatchEvent(stream);
+        if (loaded) {
+            mStreamHeap.push_back(mCurrentStream);
+            std::push_heap(mStreamHeap.begin(), mStreamHeap.end(), greater);
+        }
+        mCurrentStream = UINT32_MAX;
+    }
+
+    if (mStreamHeap.empty()) {
+        return nullptr;
+    }
+
+    std::pop_heap(mStreamHeap.begin(), mStreamHeap.end(), greater);
+    mCurrentStream = mStreamHeap.back();
+    mStreamHeap.pop_back();
+
+    return &mStreams[mCurrentStream].mEventRecord;
+}
+
+bool EtlFileReader::ReadLogfileHeader()
+{
+    // The first event in the file is the TRACE_LOGFILE_HEADER, logged by the
+    // EventTrace provider in the first buffer.
+    auto buffer = mData;
+    auto bufferSize = Read<uint32_t>(buffer + BUFFER_HEADER_BUFFER_SIZE);
+    if (bufferSize <= BUFFER_HEADER_SIZE || bufferSize > mSize) {
+        return false;
+    }
+    auto p = buffer + BUFFER_HEADER_SIZE;
+    auto size = GetEventSize(p, bufferSize - BUFFER_HEADER_SIZE);
+
+    EVENT_RECORD eventRecord = {};
+    std::vector<EVENT_HEADER_EXTENDED_DATA_ITEM> extendedData;
+    if (size == 0 ||
+        !DecodeEvent(p, size, &eventRecord, &extendedData) ||
+        memcmp(&eventRecord.EventHeader.ProviderId, &KERNEL_GROUP_GUIDS[0].mGuid, sizeof(GUID)) != 0 ||
+        eventRecord.EventHeader.EventDescriptor.Opcode != 0) {
+        return false;
+    }
+
+    mStartTime = (uint64_t) eventRecord.EventHeader.TimeStamp.QuadPart;
+
+    auto header = (uint8_t const*) eventRecord.UserData;
+    uint32_t headerSize = eventRecord.UserDataLength;
+    if (headerSize < LOGFILE_HEADER_LOGGER_NAME) {
+        return false;
+    }
+
+    mPointerSize = Read<uint32_t>(header + LOGFILE_HEADER_POINTER_SIZE);
+    if (mPointerSize != 4 && mPointerSize != 8) {
+        return false;
+    }
+
+    // LoggerName, LogFileName, TimeZone, then BootTime aligned to 8 bytes.
+    auto bootTimeOffset = AlignUp8(LOGFILE_HEADER_LOGGER_NAME + 2 * mPointerSize + TIME_ZONE_INFORMATION_SIZE);
+    auto perfFreqOffset     = bootTimeOffset + 8;
+    auto reservedFlagsOffset = bootTimeOffset + 24;
+    auto buffersLostOffset  = bootTimeOffset + 28;
+    if (headerSize < buffersLostOffset + 4) {
+        return false;
+    }
+
+    // ReservedFlags holds the session's clock type: 1 for QPC, 2 for system
+    // time, and 3 for the CPU cycle counter.
+    switch (Read<uint32_t>(header + reservedFlagsOffset)) {
+    case 2:  mFrequency = 10000000; break;
+    case 3:  mFrequency = (uint64_t) Read<uint32_t>(header + LOGFILE_HEADER_CPU_SPEED) * 1000000; break;
+    default: mFrequency = Read<uint64_t>(header + perfFreqOffset); break;
+    }
+    mEventsLost = Read<uint32_t>(header + LOGFILE_HEADER_EVENTS_LOST);
+    mBuffersLost = Read<uint32_t>(header + buffersLostOffset);
+
+    return mFrequency != 0;
+}
+
+bool EtlFileReader::ReadIndexFile(std::vector<Buffer>* buffers)
+{
+    auto fp = fopen(mIndexPath.c_str(), "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+
+    IndexFileHeader header = {};
+    auto ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+              memcmp(header.mMagic, INDEX_FILE_MAGIC, sizeof(header.mMagic)) == 0 &&
+              header.mVersion == INDEX_FILE_VERSION &&
+              header.mBufferEntrySize == sizeof(Buffer) &&
+              header.mEtlFileSize == mSize &&
+              header.mEtlFileTime == mFileTime &&
+              header.mBufferCount > 0 &&
+              header.mBufferCount <= mSize / BUFFER_HEADER_SIZE;
+    if (ok) {
+        buffers->resize((size_t) header.mBufferCount);
+        ok = fread(buffers->data(), sizeof(Buffer), buffers->size(), fp) == buffers->size();
+    }
+    fclose(fp);
+
+    // The buffers must be in file order, and within the file.
+    for (size_t i = 0, n = buffers->size(); ok && i < n; ++i) {
+        auto offset = (*buffers)[i].mOffset;
+        ok = offset <= mSize - BUFFER_HEADER_SIZE &&
+             (i == 0 ? offset == 0 : offset > (*buffers)[i - 1].mOffset);
+    }
+
+    if (!ok) {
+        buffers->clear();
+    }
+    return ok;
+}
+
+// Failing to save the index isn't an error, it just means the next Seek()
+// will have to index the file again.
+void EtlFileReader::WriteIndexFile() const
+{
+    std::vector<Buffer> buffers;
+    for (auto const& stream : mStreams) {
+        buffers.insert(buffers.end(), stream.mBuffers.begin(), stream.mBuffers.end());
+    }
+    std::sort(buffers.begin(), buffers.end(), [](Buffer const& lhs, Buffer const& rhs) { return lhs.mOffset < rhs.mOffset; });
+
+    IndexFileHeader header = {};
+    memcpy(header.mMagic, INDEX_FILE_MAGIC, sizeof(header.mMagic));
+    header.mVersion = INDEX_FILE_VERSION;
+    header.mBufferEntrySize = (uint32_t) sizeof(Buffer);
+    header.mEtlFileSize = mSize;
+    header.mEtlFileTime = mFileTime;
+    header.mBufferCount = buffers.size();
+
+    auto fp = fopen(mIndexPath.c_str(), "wb");
+    if (fp == nullptr) {
+        return;
+    }
+    auto ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(buffers.data(), sizeof(Buffer), buffers.size(), fp) == buffers.size();
+    ok = fclose(fp) == 0 && ok;
+    if (!ok) {
+        remove(mIndexPath.c_str());
+    }
+}
+
+// Find the buffer's first timestamp and whether it has any state events.
+void EtlFileReader::IndexBuffer(Buffer* buffer) const
+{
+    auto p0 = mData + buffer->mOffset;
+    auto end = GetBufferEventEnd(p0, mSize - buffer->mOffset);
+
+    buffer->mTimeStamp = EMPTY_BUFFER_TIMESTAMP;
+    buffer->mFlags = 0;
+    for (auto offset = BUFFER_HEADER_SIZE; offset < end; ) {
+        auto p = p0 + offset;
+        auto size = GetEventSize(p, end - offset);
+        if (size == 0) {
+            break;
+        }
+        if (buffer->mTimeStamp == EMPTY_BUFFER_TIMESTAMP) {
+            buffer->mTimeStamp = GetEventTimeStamp(p);
+        }
+        if (IsStateEvent(p, size)) {
+            buffer->mFlags |= BUFFER_HAS_STATE_EVENTS;
+        }
+        offset = std::min(AlignUp8(offset + size), end);
+    }
+}
+
+bool EtlFileReader::DecodeNextEvent(Stream* stream)
+{
+    while (stream->mBufferIndex < stream->mBuffers.size()) {
+        auto const& bufferInfo = stream->mBuffers[stream->mBufferIndex];
+        auto stateEventsOnly = stream->mBufferIndex < stream->mSeekBufferIndex;
+        if (stateEventsOnly && (bufferInfo.mFlags & BUFFER_HAS_STATE_EVENTS) == 0) {
+            stream->mBufferIndex += 1;
+            continue;
+        }
+
+        auto buffer = mData + bufferInfo.mOffset;
+        if (stream->mEventOffset == 0) {
+            stream->mEventOffset = BUFFER_HEADER_SIZE;
+            stream->mEventEnd = GetBufferEventEnd(buffer, mSize - bufferInfo.mOffset);
+        }
+
+        while (stream->mEventOffset < stream->mEventEnd) {
+            auto p = buffer + stream->mEventOffset;
+            auto size = GetEventSize(p, stream->mEventEnd - stream->mEventOffset);
+            if (size == 0) {
+                // Padding, or a corrupt event; skip the rest of the buffer.
+                break;
+            }
+
+            stream->mEventOffset = std::min(AlignUp8(stream->mEventOffset + size), stream->mEventEnd);
+            mDecodedEventCount += 1;
+            if (stateEventsOnly && !IsStateEvent(p, size)) {
+                continue;
+            }
+
+            stream->mExtendedData.clear();
+            if (DecodeEvent(p, size, &stream->mEventRecord, &stream->mExtendedData)) {
+                stream->mEventRecord.BufferContext = Read<ETW_BUFFER_CONTEXT>(buffer + BUFFER_HEADER_CLIENT_CONTEXT);
+                stream->mEventRecord.UserContext = mUserContext;
+                if (mEventFilter == nullptr || mEventFilter(&stream->mEventRecord)) {
+                    return true;
+                }
+            }
+        }
+
+        stream->mBufferIndex += 1;
+        stream->mEventOffset = 0;
+    }
+
+    return false;
+}
+
+bool EtlFileReader::NextBatchEvent(Stream* stream)
+{
+    while (!stream->mBatches.empty()) {
+        auto batch = stream->mBatches.front();
+        if (stream->mBatchEventIndex == 0) {
+            WaitForBatch(batch);
+        }
+
+        if (stream->mBatchEventIndex < batch->mEventRecords.size()) {
+            stream->mEventRecord = batch->mEventRecords[stream->mBatchEventIndex];
+            stream->mBatchEventIndex += 1;
+            return true;
+        }
+
+        // The batch has been merged; recycle it and queue the stream's next
+        // buffer for decode in its place.
+        mDecodedEventCount += batch->mDecodedEventCount;
+        stream->mBatches.pop_front();
+        stream->mBatchEventIndex = 0;
+        {
+            std::lock_guard<std::mutex> lock(mBatchMutex);
+            mFreeBatches.push_back(batch);
+            QueueBatches(stream);
+        }
+    }
+
+    return false;
+}
+
+// Must be called with mBatchMutex held.
+void EtlFileReader::QueueBatches(Stream* stream)
+{
+    auto queued = false;
+    while (stream->mBatches.size() < BATCHES_PER_STREAM && stream->mBufferIndex < stream->mBuffers.size()) {
+        auto const& bufferInfo = stream->mBuffers[stream->mBufferIndex];
+        auto stateEventsOnly = stream->mBufferIndex < stream->mSeekBufferIndex;
+        stream->mBufferIndex += 1;
+        if (stateEventsOnly && (bufferInfo.mFlags & BUFFER_HAS_STATE_EVENTS) == 0) {
+            continue;
+        }
+
+        Batch* batch = nullptr;
+        if (mFreeBatches.empty()) {
+            mBatchStorage.emplace_back(new Batch);
+            batch = mBatchStorage.back().get();
+        } else {
+            batch = mFreeBatches.back();
+            mFreeBatches.pop_back();
+        }
+
+        batch->mBufferOffset = bufferInfo.mOffset;
+        batch->mStateEventsOnly = stateEventsOnly;
+        batch->mDecodedEventCount = 0;
+        batch->mDecoded = false;
+
+        stream->mBatches.push_back(batch);
+        mBatchQueue.push_back(batch);
+        queued = true;
+    }
+
+    if (queued) {
+        mBatchQueued.notify_all();
+    }
+}
+
+void EtlFileReader::WaitForBatch(Batch* batch)
+{
+    std::unique_lock<std::mutex> lock(mBatchMutex);
+    mBatchDecoded.wait(lock, [batch]() { return batch->mDecoded; });
+}
+
+void EtlFileReader::DecodeBatch(Batch* batch)
+{
+    auto buffer = mData + batch->mBufferOffset;
+    auto bufferContext = Read<ETW_BUFFER_CONTEXT>(buffer + BUFFER_HEADER_CLIENT_CONTEXT);
+    auto end = GetBufferEventEnd(buffer, mSize - batch->mBufferOffset);
+
+    batch->mEventRecords.clear();
+    batch->mExtendedData.clear();
+
+    EVENT_RECORD eventRecord = {};
+    for (auto offset = BUFFER_HEADER_SIZE; offset < end; ) {
+        auto p = buffer + offset;
+        auto size = GetEventSize(p, end - offset);
+        if (size == 0) {
+            break;
+        }
+
+        offset = std::min(AlignUp8(offset + size), end);
+        batch->mDecodedEventCount += 1;
+        if (batch->mStateEventsOnly && !IsStateEvent(p, size)) {
+            continue;
+        }
+
+        auto extendedDataSize = batch->mExtendedData.size();
+        if (DecodeEvent(p, size, &eventRecord, &batch->mExtendedData)) {
+            eventRecord.BufferContext = bufferContext;
+            eventRecord.UserContext = mUserContext;
+            if (mEventFilter == nullptr || mEventFilter(&eventRecord)) {
+                batch->mEventRecords.push_back(eventRecord);
+                continue;
+            }
+        }
+        batch->mExtendedData.resize(extendedDataSize);
+    }
+
+    // mExtendedData may have been reallocated while it was filled in, so
+    // point the events at their items now that it is complete.
+    size_t extendedDataIndex = 0;
+    for (auto& record : batch->mEventRecords) {
+        if (record.ExtendedDataCount > 0) {
+            record.ExtendedData = batch->mExtendedData.data() + extendedDataIndex;
+            extendedDataIndex += record.ExtendedDataCount;
+        }
+    }
+}
+
+void EtlFileReader::DecodeThread()
+{
+    std::unique_lock<std::mutex> lock(mBatchMutex);
+    for (;;) {
+        mBatchQueued.wait(lock, [this]() { return mStopDecodeThreads || !mBatchQueue.empty(); });
+        if (mStopDecodeThreads) {
+            break;
+        }
+
+        auto batch = mBatchQueue.front();
+        mBatchQueue.pop_front();
+
+        lock.unlock();
+        DecodeBatch(batch);
+        lock.lock();
+
+        batch->mDecoded = true;
+        mBatchDecoded.notify_all();
+    }
+}
+
+bool EtlFileReader::StreamLess(uint32_t lhs, uint32_t rhs) const
+{
+    auto lhsTime = mStreams[lhs].mEventRecord.EventHeader.TimeStamp.QuadPart;
+    auto rhsTime = mStreams[rhs].mEventRecord.EventHeader.TimeStamp.QuadPart;
+    return lhsTime < rhsTime || (lhsTime == rhsTime && lhs < rhs);
+}
+
+#ifdef _WIN32
+
+bool EtlFileReader::Map(char const* path)
+{
+    mFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (mFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER size = {};
+    if (!GetFileSizeEx(mFile, &size) || size.QuadPart < BUFFER_HEADER_SIZE || (uint64_t) size.QuadPart > SIZE_MAX) {
+        Unmap();
+        return false;
+    }
+
+    mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mMapping == NULL) {
+        Unmap();
+        return false;
+    }
+
+    mData = (uint8_t const*) MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+    if (mData == nullptr) {
+        Unmap();
+        return false;
+    }
+
+    FILETIME lastWriteTime = {};
+    GetFileTime(mFile, nullptr, nullptr, &lastWriteTime);
+
+    mSize = (uint64_t) size.QuadPart;
+    mFileTime = ((uint64_t) lastWriteTime.dwHighDateTime << 32) | lastWriteTime.dwLowDateTime;
+    return true;
+}
+
+void EtlFileReader::Unmap()
+{
+    if (mData != nullptr) {
+        UnmapViewOfFile(mData);
+        mData = nullptr;
+    }
+    if (mMapping != NULL) {
+        CloseHandle(mMapping);
+        mMapping = NULL;
+    }
+    if (mFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(mFile);
+        mFile = INVALID_HANDLE_VALUE;
+    }
+    mSize = 0;
+    mFileTime = 0;
+}
+
+#else
+
+bool EtlFileReader::Map(char const* path)
+{
+    auto fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat st = {};
+    if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < BUFFER_HEADER_SIZE || (uint64_t) st.st_size > SIZE_MAX) {
+        close(fd);
+        return false;
+    }
+
+    auto data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    mData = (uint8_t const*) data;
+    mSize = (uint64_t) st.st_size;
+    mFileTime = (uint64_t) st.st_mtim.tv_sec * 1000000000ull + (uint64_t) st.st_mtim.tv_nsec;
+    return true;
+}
+
+void EtlFileReader::Unmap()
+{
+    if (mData != nullptr) {
+        munmap((void*) mData, (size_t) mSize);
+        mData = nullptr;
+    }
+    mSize = 0;
+    mFileTime = 0;
+}
+
+#endif
@@ -0,0 +1,265 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <evntcons.h> // must include after windows.h
+#else
+// The ETW types and flags needed to describe an event, for platforms that
+// don't have the Windows SDK.  These match the layouts in evntcons.h.
+struct GUID {
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t Data4[8];
+};
+
+union LARGE_INTEGER {
+    struct {
+        uint32_t LowPart;
+        int32_t HighPart;
+    };
+    int64_t QuadPart;
+};
+
+struct EVENT_DESCRIPTOR {
+    uint16_t Id;
+    uint8_t Version;
+    uint8_t Channel;
+    uint8_t Level;
+    uint8_t Opcode;
+    uint16_t Task;
+    uint64_t Keyword;
+};
+
+struct EVENT_HEADER {
+    uint16_t Size;
+    uint16_t HeaderType;
+    uint16_t Flags;
+    uint16_t EventProperty;
+    uint32_t ThreadId;
+    uint32_t ProcessId;
+    LARGE_INTEGER TimeStamp;
+    GUID ProviderId;
+    EVENT_DESCRIPTOR EventDescriptor;
+    union {
+        struct {
+            uint32_t KernelTime;
+            uint32_t UserTime;
+        };
+        uint64_t ProcessorTime;
+    };
+    GUID ActivityId;
+};
+
+struct ETW_BUFFER_CONTEXT {
+    union {
+        struct {
+            uint8_t ProcessorNumber;
+            uint8_t Alignment;
+        };
+        uint16_t ProcessorIndex;
+    };
+    uint16_t LoggerId;
+};
+
+struct EVENT_HEADER_EXTENDED_DATA_ITEM {
+    uint16_t Reserved1;
+    uint16_t ExtType;
+    struct {
+        uint16_t Linkage : 1;
+        uint16_t Reserved2 : 15;
+    };
+    uint16_t DataSize;
+    uint64_t DataPtr;
+};
+
+struct EVENT_RECORD {
+    EVENT_HEADER EventHeader;
+    ETW_BUFFER_CONTEXT BufferContext;
+    uint16_t ExtendedDataCount;
+    uint16_t UserDataLength;
+    EVENT_HEADER_EXTENDED_DATA_ITEM* ExtendedData;
+    void* UserData;
+    void* UserContext;
+};
+
+#define EVENT_HEADER_FLAG_EXTENDED_INFO 0x0001
+#define EVENT_HEADER_FLAG_32_BIT_HEADER 0x0020
+#define EVENT_HEADER_FLAG_64_BIT_HEADER 0x0040
+#define EVENT_HEADER_FLAG_CLASSIC_HEADER 0x0100
+#endif
+
+// EtlFileReader reads the events in an ETL file without going through
+// OpenTrace()/ProcessTrace().  The file is memory mapped, and each event is
+// returned as an EVENT_RECORD whose UserData (and ExtendedData items) point
+// into the mapping.
+//
+// An ETL file is a sequence of buffers, each filled by one processor, and
+// each buffer's events are in timestamp order.  Buffers are grouped into one
+// stream per processor, and NextEvent() merges the streams so events are
+// returned in timestamp order across the whole file (as ProcessTrace() does).
+// Timestamps are returned raw, as with PROCESS_TRACE_MODE_RAW_TIMESTAMP.
+//
+// If Open() is given decode threads, whole buffers are decoded (and
+// filtered) ahead of time on those threads, and NextEvent() only merges the
+// decoded events.  Otherwise, events are decoded one at a time by
+// NextEvent().
+//
+// Seek() starts reading part way into the file, using each buffer's first
+// timestamp to find where to start each stream.  Events that describe state
+// rather than activity (process starts/ends and event metadata) are still
+// returned from the skipped buffers, as later events depend on them.  The
+// buffer timestamps and which buffers hold state events are found by
+// scanning the whole file on the first Seek(), and saved next to the ETL
+// file (as <path>.pmidx) so later runs can seek without the scan.
+//
+// Only the buffer and event header formats are interpreted here, so this
+// builds without the ETW APIs.  Compressed or otherwise unrecognized files
+// fail Open(), and can still be read with ProcessTrace() on Windows.
+struct EtlFileReader {
+    // One buffer in the file.  This is also the index file's entry format.
+    struct Buffer {
+        uint64_t mOffset;                       // File offset of the buffer
+        int64_t mTimeStamp;                     // Timestamp of the buffer's first event, or INT64_MAX if it has none
+        uint16_t mProcessor;                    // ETW_BUFFER_CONTEXT ProcessorIndex
+        uint16_t mFlags;                        // BUFFER_HAS_STATE_EVENTS
+        uint32_t mReserved;
+    };
+
+    enum { BUFFER_HAS_STATE_EVENTS = 0x0001 };
+
+    // The events decoded from one buffer by a decode thread.
+    struct Batch {
+        uint64_t mBufferOffset;                 // File offset of the buffer
+        bool mStateEventsOnly;                  // Only decode state events; the buffer is before the seek point
+        std::vector<EVENT_RECORD> mEventRecords;
+        std::vector<EVENT_HEADER_EXTENDED_DATA_ITEM> mExtendedData;
+        uint64_t mDecodedEventCount;            // Events in the buffer, including filtered ones
+        bool mDecoded;                          // Set once the decode thread is done
+    };
+
+    // The buffers filled by one processor, and that processor's next event.
+    struct Stream {
+        std::vector<Buffer> mBuffers;           // The stream's buffers, in file order
+        size_t mBufferIndex;                    // Index of the buffer being read (or next to be queued for decode)
+        size_t mSeekBufferIndex;                // Buffers before this one are only read for state events
+        uint32_t mEventOffset;                  // Offset of the next event into the buffer
+        uint32_t mEventEnd;                     // End of the buffer's event data
+        EVENT_RECORD mEventRecord;
+        std::vector<EVENT_HEADER_EXTENDED_DATA_ITEM> mExtendedData;
+        std::deque<Batch*> mBatches;            // Buffers queued for decode, in stream order
+        size_t mBatchEventIndex;                // Index of the next event in mBatches.front()
+    };
+
+    // Decoded buffers queued ahead of the merge, per stream.
+    enum { BATCHES_PER_STREAM = 4 };
+
+    uint8_t const* mData = nullptr;             // The mapped file
+    uint64_t mSize = 0;
+    uint64_t mFileTime = 0;                     // Last write time, to check that the index file is up to date
+    std::string mIndexPath;
+    bool mIndexed = false;                      // Set once the buffers' timestamps and flags are known
+    void* mUserContext = nullptr;               // Set as each EVENT_RECORD's UserContext
+
+    // If set, only events that pass the filter are returned by NextEvent().
+    // The filter is called on the decode threads, if there are any.
+    bool (*mEventFilter)(EVENT_RECORD const* eventRecord) = nullptr;
+
+    // From the file's TRACE_LOGFILE_HEADER.
+    uint64_t mFrequency = 0;                    // Timestamp ticks per second
+    uint64_t mStartTime = 0;                    // Timestamp of the header event
+    uint32_t mPointerSize = 0;                  // Pointer size of the system the trace was captured on
+    uint32_t mEventsLost = 0;
+    uint32_t mBuffersLost = 0;
+
+    uint64_t mDecodedEventCount = 0;            // Events decoded so far, including filtered ones
+
+    std::vector<Stream> mStreams;
+    std::vector<uint32_t> mStreamHeap;          // Min-heap of streams with a pending event, by timestamp
+    uint32_t mCurrentStream = UINT32_MAX;       // Stream of the last event returned by NextEvent()
+    bool mSeeked = false;                       // Set once Seek() has positioned the streams
+
+    // Decode threads, and the batches they decode.  mBatchQueue and each
+    // batch's mDecoded are protected by mBatchMutex.
+    std::vector<std::thread> mDecodeThreads;
+    std::vector<std::unique_ptr<Batch>> mBatchStorage;
+    std::vector<Batch*> mFreeBatches;
+    std::deque<Batch*> mBatchQueue;
+    std::mutex mBatchMutex;
+    std::condition_variable mBatchQueued;
+    std::condition_variable mBatchDecoded;
+    bool mStopDecodeThreads = false;
+
+#ifdef _WIN32
+    HANDLE mFile = INVALID_HANDLE_VALUE;
+    HANDLE mMapping = NULL;
+#endif
+
+    EtlFileReader() = default;
+    ~EtlFileReader();
+    EtlFileReader(EtlFileReader const&) = delete;
+    EtlFileReader& operator=(EtlFileReader const&) = delete;
+
+    // Maps the file and indexes its buffers, and starts decodeThreadCount
+    // decode threads.  Returns false if the file can't be opened or isn't a
+    // recognized ETL file.
+    bool Open(char const* path, void* userContext, uint32_t decodeThreadCount);
+    void Close();
+    bool IsOpen() const { return mData != nullptr; }
+
+    // Skips the events before timestamp, other than state events.  Reading
+    // starts at the buffer that timestamp falls in, so some earlier events
+    // may be returned too.  Must be called before the first NextEvent(),
+    // otherwise reading starts at the beginning of the file.
+    void Seek(uint64_t timestamp);
+
+    // Returns the next event in timestamp order, or nullptr once all events
+    // have been returned.  The returned EVENT_RECORD is valid until the next
+    // call.
+    EVENT_RECORD* NextEvent();
+
+    bool Map(char const* path);
+    void Unmap();
+    bool ReadLogfileHeader();
+    bool ReadIndexFile(std::vector<Buffer>* buffers);
+    void WriteIndexFile() const;
+    void IndexBuffer(Buffer* buffer) const;
+    bool DecodeNextEvent(Stream* stream);
+    bool NextBatchEvent(Stream* stream);
+    void QueueBatches(Stream* stream);
+    void WaitForBatch(Batch* batch);
+    void DecodeBatch(Batch* batch);
+    void DecodeThread();
+    bool StreamLess(uint32_t lhs, uint32_t rhs) const;
+};
@@ -0,0 +1,241 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <new>
+#include <stdint.h>
+#include <string.h>
+#include <utility>
+
+// FlatHashMap is an open-addressing hash map with linear probing, used for
+// the indexes that PMTraceConsumer looks up on every kernel event.  Keys and
+// values are stored inline in a single power-of-two sized array, with a
+// separate array of slot states.
+//
+// Erasing an element leaves a tombstone rather than moving other elements, so
+// erasing never invalidates iterators to other elements.  Inserting a new key
+// may rehash the table, which invalidates all iterators.
+//
+// Hash must return a uint64_t; the map applies its own (Fibonacci) mixing, so
+// integer keys can use the identity hash.
+
+template<typename Key>
+struct FlatHashMapHash {
+    uint64_t operator()(Key const& key) const { return (uint64_t) key; }
+};
+
+template<typename Key, typename Value, typename Hash = FlatHashMapHash<Key>>
+class FlatHashMap {
+public:
+    typedef std::pair<Key, Value> value_type;
+
+    class iterator {
+    public:
+        iterator() : mMap(nullptr), mIndex(0) {}
+
+        value_type& operator*() const { return mMap->mSlots[mIndex]; }
+        value_type* operator->() const { return &mMap->mSlots[mIndex]; }
+        iterator& operator++() { mIndex = mMap->NextFullSlot(mIndex + 1); return *this; }
+        bool operator==(iterator const& rhs) const { return mIndex == rhs.mIndex; }
+        bool operator!=(iterator const& rhs) const { return mIndex != rhs.mIndex; }
+
+    private:
+        friend class FlatHashMap;
+        iterator(FlatHashMap* map, size_t index) : mMap(map), mIndex(index) {}
+
+        FlatHashMap* mMap;
+        size_t mIndex;
+    };
+
+    FlatHashMap()
+        : mSlots(nullptr)
+        , mStates(nullptr)
+        , mCapacity(0)
+        , mShift(64)
+        , mSize(0)
+        , mDeletedCount(0)
+    {
+    }
+
+    ~FlatHashMap()
+    {
+        clear();
+        ::operator delete(mSlots);
+        delete[] mStates;
+    }
+
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+
+    iterator begin() { return iterator(this, NextFullSlot(0)); }
+    iterator end() { return iterator(this, mCapacity); }
+
+    iterator find(Key const& key)
+    {
+        if (mSize > 0) {
+            auto mask = mCapacity - 1;
+            for (auto i = HashIndex(key); mStates[i] != SLOT_EMPTY; i = (i + 1) & mask) {
+                if (mStates[i] == SLOT_FULL && mSlots[i].first == key) {
+                    return iterator(this, i);
+                }
+            }
+        }
+        return end();
+    }
+
+    template<typename V>
+    std::pair<iterator, bool> emplace(Key const& key, V&& value)
+    {
+        auto iter = find(key);
+        if (iter != end()) {
+            return std::make_pair(iter, false);
+        }
+
+        // Grow (or just clear out tombstones) if the table would exceed a 7/8
+        // load factor.
+        if ((mSize + mDeletedCount + 1) * 8 > mCapacity * 7) {
+            Rehash(mSize * 2 + 2 > mCapacity / 2 ? mCapacity * 2 : mCapacity);
+        }
+
+        auto mask = mCapacity - 1;
+        auto i = HashIndex(key);
+        while (mStates[i] == SLOT_FULL) {
+            i = (i + 1) & mask;
+        }
+        if (mStates[i] == SLOT_DELETED) {
+            mDeletedCount -= 1;
+        }
+        new (&mSlots[i]) value_type(key, std::forward<V>(value));
+        mStates[i] = SLOT_FULL;
+        mSize += 1;
+        return std::make_pair(iterator(this, i), true);
+    }
+
+    Value& operator[](Key const& key)
+    {
+        auto iter = find(key);
+        if (iter == end()) {
+            iter = emplace(key, Value()).first;
+        }
+        return iter->second;
+    }
+
+    void erase(iterator iter)
+    {
+        mSlots[iter.mIndex].~value_type();
+        mStates[iter.mIndex] = SLOT_DELETED;
+        mSize -= 1;
+        mDeletedCount += 1;
+    }
+
+    size_t erase(Key const& key)
+    {
+        auto iter = find(key);
+        if (iter == end()) {
+            return 0;
+        }
+        erase(iter);
+        return 1;
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i < mCapacity; ++i) {
+            if (mStates[i] == SLOT_FULL) {
+                mSlots[i].~value_type();
+            }
+        }
+        if (mCapacity > 0) {
+            memset(mStates, SLOT_EMPTY, mCapacity);
+        }
+        mSize = 0;
+        mDeletedCount = 0;
+    }
+
+private:
+    enum : uint8_t {
+        SLOT_EMPTY,
+        SLOT_FULL,
+        SLOT_DELETED,
+    };
+
+    enum { MIN_CAPACITY = 16 };
+
+    size_t HashIndex(Key const& key) const
+    {
+        return (size_t) ((Hash()(key) * 0x9E3779B97F4A7C15ull) >> mShift);
+    }
+
+    size_t NextFullSlot(size_t i) const
+    {
+        for (; i < mCapacity && mStates[i] != SLOT_FULL; ++i) {
+        }
+        return i;
+    }
+
+    void Rehash(size_t newCapacity)
+    {
+        if (newCapacity < MIN_CAPACITY) {
+            newCapacity = MIN_CAPACITY;
+        }
+
+        auto oldSlots = mSlots;
+        auto oldStates = mStates;
+        auto oldCapacity = mCapacity;
+
+        mSlots = (value_type*) ::operator new(newCapacity * sizeof(value_type));
+        mStates = new uint8_t [newCapacity];
+        memset(mStates, SLOT_EMPTY, newCapacity);
+        mCapacity = newCapacity;
+        mShift = 64;
+        for (auto c = newCapacity; c > 1; c >>= 1) {
+            mShift -= 1;
+        }
+        mDeletedCount = 0;
+
+        auto mask = mCapacity - 1;
+        for (size_t i = 0; i < oldCapacity; ++i) {
+            if (oldStates[i] == SLOT_FULL) {
+                auto j = HashIndex(oldSlots[i].first);
+                while (mStates[j] != SLOT_EMPTY) {
+                    j = (j + 1) & mask;
+                }
+                new (&mSlots[j]) value_type(std::move(oldSlots[i]));
+                mStates[j] = SLOT_FULL;
+                oldSlots[i].~value_type();
+            }
+        }
+
+        ::operator delete(oldSlots);
+        delete[] oldStates;
+    }
+
+    value_type* mSlots;
+    uint8_t* mStates;
+    size_t mCapacity;
+    uint32_t mShift;
+    size_t mSize;
+    size_t mDeletedCount;
+
+    FlatHashMap(FlatHashMap const& copy); // dne
+    FlatHashMap& operator=(FlatHashMap const& copy); // dne
+};
@@ -59,6 +59,25 @@ std::wstring GetEventTaskNameFromTdh(EVENT_RECORD* pEventRecord)
     return taskName;
 }
 
+struct {
+    wchar_t const* mName;
+    MRTask mTask;
+} const MR_TASK_NAMES[] = {
+    { L"AcquireForRendering", MRTask::AcquireForRendering },
+    { L"ReleaseFromRendering", MRTask::ReleaseFromRendering },
+    { L"AcquireForPresentation", MRTask::AcquireForPresentation },
+    { L"ReleaseFromPresentation", MRTask::ReleaseFromPresentation },
+    { L"OasisPresentationSource", MRTask::OasisPresentationSource },
+    { L"LsrThread_BeginLsrProcessing", MRTask::LsrThread_BeginLsrProcessing },
+    { L"LsrThread_LatchedInput", MRTask::LsrThread_LatchedInput },
+    { L"LsrThread_UnaccountedForVsyncsBetweenStatGathering", MRTask::LsrThread_UnaccountedForVsyncsBetweenStatGathering },
+    { L"MissedPresentation", MRTask::MissedPresentation },
+    { L"OnTimePresentationTiming", MRTask::OnTimePresentationTiming },
+    { L"LatePresentationTiming", MRTask::LatePresentationTiming },
+    { L"HolographicFrame", MRTask::HolographicFrame },
+    { L"HolographicFrameMetadata_GetNewPoseForReprojection", MRTask::HolographicFrameMetadata_GetNewPoseForReprojection },
+};
+
 }
 
 HolographicFrame::HolographicFrame(EVENT_HEADER const& hdr)
@@ -146,10 +165,7 @@ void MRTraceConsumer::CompleteLSR(std::shared_ptr<LateStageReprojectionEvent> p)
     }
 
     p->Completed = true;
-    {
-        auto lock = scoped_lock(mMutex);
-        mCompletedLSRs.push_back(p);
-    }
+    mCompletedLSRs.Push(p, mWaitForOutput);
 }
 
 void MRTraceConsumer::CompleteHolographicFrame(std::shared_ptr<HolographicFrame> p)
@@ -216,12 +232,48 @@ void MRTraceConsumer::HolographicFrameStop(std::shared_ptr<HolographicFrame> p)
     mHolographicFramesByPresentId.emplace(p->PresentId, p);
 }
 
+MRTask MRTraceConsumer::GetEventTask(EVENT_RECORD* pEventRecord)
+{
+    EventMetadataKey key;
+    key.guid_ = pEventRecord->EventHeader.ProviderId;
+    key.desc_ = pEventRecord->EventHeader.EventDescriptor;
+
+    auto ii = mTaskByEvent.find(key);
+    if (ii != mTaskByEvent.end()) {
+        return ii->second;
+    }
+
+    // Use the event's metadata if it has already been seen (e.g., from an
+    // ETL file's EventInfo events), otherwise ask TDH.
+    std::wstring taskName;
+    auto metadata = mMetadata.metadata_.find(key);
+    if (metadata == mMetadata.metadata_.end()) {
+        taskName = GetEventTaskNameFromTdh(pEventRecord);
+    } else {
+        auto tei = (TRACE_EVENT_INFO const*) metadata->second.teiData_.data();
+        if (tei->TaskNameOffset != 0) {
+            taskName = TEI_TASK_NAME(tei);
+        }
+    }
+
+    auto task = MRTask::Unknown;
+    for (auto const& t : MR_TASK_NAMES) {
+        if (taskName.compare(t.mName) == 0) {
+            task = t.mTask;
+            break;
+        }
+    }
+
+    mTaskByEvent.emplace(key, task);
+    return task;
+}
+
 void MRTraceConsumer::HandleDHDEvent(EVENT_RECORD* pEventRecord)
 {
     auto const& hdr = pEventRecord->EventHeader;
-    const std::wstring taskName = GetEventTaskNameFromTdh(pEventRecord);
 
-    if (taskName.compare(L"AcquireForRendering") == 0)
+    switch (GetEventTask(pEventRecord)) {
+    case MRTask::AcquireForRendering:
     {
         const uint64_t ptr = mMetadata.GetEventData<uint64_t>(pEventRecord, L"thisPtr");
         auto sourceIter = FindOrCreatePresentationSource(ptr);
@@ -231,20 +283,23 @@ void MRTraceConsumer::HandleDHDEvent(EVENT_RECORD* pEventRecord)
         sourceIter->second->ReleaseFromRenderingTime = 0;
         sourceIter->second->AcquireForPresentationTime = 0;
         sourceIter->second->ReleaseFromPresentationTime = 0;
+        break;
     }
-    else if (taskName.compare(L"ReleaseFromRendering") == 0)
+    case MRTask::ReleaseFromRendering:
     {
         const uint64_t ptr = mMetadata.GetEventData<uint64_t>(pEventRecord, L"thisPtr");
         auto sourceIter = FindOrCreatePresentationSource(ptr);
         sourceIter->second->ReleaseFromRenderingTime = *(uint64_t*)&hdr.TimeStamp;
+        break;
     }
-    else if (taskName.compare(L"AcquireForPresentation") == 0)
+    case MRTask::AcquireForPresentation:
     {
         const uint64_t ptr = mMetadata.GetEventData<uint64_t>(pEventRecord, L"thisPtr");
         auto sourceIter = FindOrCreatePresentationSource(ptr);
         sourceIter->second->AcquireForPresentationTime = *(uint64_t*)&hdr.TimeStamp;
+        break;
     }
-    else if (taskName.compare(L"ReleaseFromPresentation") == 0)
+    case MRTask::ReleaseFromPresentation:
     {
         const uint64_t ptr = mMetadata.GetEventData<uint64_t>(pEventRecord, L"thisPtr");
         auto sourceIter = FindOrCreatePresentationSource(ptr);
@@ -256,8 +311,9 @@ void MRTraceConsumer::HandleDHDEvent(EVENT_RECORD* pEventRecord)
         if (pEvent) {
             pEvent->Source = *sourceIter->second;
         }
+        break;
     }
-    else if (taskName.compare(L"OasisPresentationSource") == 0)
+    case MRTask::OasisPresentationSource:
     {
         std::string eventType = mMetadata.GetEventData<std::string>(pEventRecord, L"EventType");
         eventType.pop_back(); // Pop the null-terminator so the compare works.
@@ -265,8 +321,9 @@ void MRTraceConsumer::HandleDHDEvent(EVENT_RECORD* pEventRecord)
             const uint64_t ptr = mMetadata.GetEventData<uint64_t>(pEventRecord, L"thisPtr");
             CompletePresentationSource(ptr);
         }
+        break;
     }
-    else if (taskName.compare(L"LsrThread_BeginLsrProcessing") == 0)
+    case MRTask::LsrThread_BeginLsrProcessing:
     {
         // Complete the last LSR.
         auto& pEvent = mActiveLSR;
@@ -294,8 +351,9 @@ void MRTraceConsumer::HandleDHDEvent(EVENT_RECORD* pEventRecord)
         pEvent->AppMispredictionMs =       desc[5].GetData<float   >();
 
         assert(pEvent->Source.Ptr != 0);
+        break;
     }
-    else if (taskName.compare(L"LsrThread_LatchedInput") == 0)
+    case MRTask::LsrThread_LatchedInput:
     {
         // Update the active LSR.
         auto& pEvent = mActiveLSR;
@@ -329,8 +387,9 @@ void MRTraceConsumer::HandleDHDEvent(EVENT_RECORD* pEventRecord)
                 }
             }
          }
+        break;
     }
-    else if (taskName.compare(L"LsrThread_UnaccountedForVsyncsBetweenStatGathering") == 0)
+    case MRTask::LsrThread_UnaccountedForVsyncsBetweenStatGathering:
     {
         // Update the active LSR.
         auto& pEvent = mActiveLSR;
@@ -340,8 +399,9 @@ void MRTraceConsumer::HandleDHDEvent(EVENT_RECORD* pEventRecord)
             assert(unaccountedForMissedVSyncCount >= 1);
             pEvent->MissedVsyncCount += unaccountedForMissedVSyncCount;
         }
+        break;
     }
-    else if (taskName.compare(L"MissedPresentation") == 0)
+    case MRTask::MissedPresentation:
     {
         // Update the active LSR.
         auto& pEvent = mActiveLSR;
@@ -352,8 +412,10 @@ void MRTraceConsumer::HandleDHDEvent(EVENT_RECORD* pEventRecord)
                 pEvent->MissedVsyncCount++;
             }
         }
+        break;
     }
-    else if (taskName.compare(L"OnTimePresentationTiming") == 0 || taskName.compare(L"LatePresentationTiming") == 0)
+    case MRTask::OnTimePresentationTiming:
+    case MRTask::LatePresentationTiming:
     {
         // Update the active LSR.
         auto& pEvent = mActiveLSR;
@@ -374,7 +436,7 @@ void MRTraceConsumer::HandleDHDEvent(EVENT_RECORD* pEventRecord)
                 { L"startLatchToCpuRenderFrameStartInMs" }, { L"threadWakeupToCpuRenderFrameStartInMs" },
                 { L"totalWakeupErrorMs" },                  { L"wakeupErrorInMs" },
             };
-            mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
+            mMetadata.GetEventData(pEventRecord, desc, _countof(desc), 2);
             pEvent->CpuRenderFrameStartToHeadPoseCallbackStartInMs =  desc[0].GetData<float>();
             pEvent->HeadPoseCallbackStartToHeadPoseCallbackStopInMs = desc[1].GetData<float>();
             pEvent->HeadPoseCallbackStopToInputLatchInMs =            desc[2].GetData<float>();
@@ -401,15 +463,24 @@ void MRTraceConsumer::HandleDHDEvent(EVENT_RECORD* pEventRecord)
                 pEvent->FinalState = (pEvent->MissedVsyncCount > 1) ? LateStageReprojectionResult::MissedMultiple : LateStageReprojectionResult::Missed;
             }
         }
+        break;
+    }
+    default:
+        break;
     }
 }
 
+void MRTraceConsumer::HandleMetadataEvent(EVENT_RECORD* pEventRecord)
+{
+    mMetadata.AddMetadata(pEventRecord);
+}
+
 void MRTraceConsumer::HandleSpectrumContinuousEvent(EVENT_RECORD* pEventRecord)
 {
     auto const& hdr = pEventRecord->EventHeader;
-    const std::wstring taskName = GetEventTaskNameFromTdh(pEventRecord);
 
-    if (taskName.compare(L"HolographicFrame") == 0)
+    switch (GetEventTask(pEventRecord)) {
+    case MRTask::HolographicFrame:
     {
         // Ignore rehydrated frames.
         const bool bIsRehydration = mMetadata.GetEventData<bool>(pEventRecord, L"isRehydration");
@@ -446,8 +517,9 @@ void MRTraceConsumer::HandleSpectrumContinuousEvent(EVENT_RECORD* pEventRecord)
             }
             }
         }
+        break;
     }
-    else if (taskName.compare(L"HolographicFrameMetadata_GetNewPoseForReprojection") == 0)
+    case MRTask::HolographicFrameMetadata_GetNewPoseForReprojection:
     {
         // Link holographicFrameId -> presentId.
         const uint32_t holographicFrameId = mMetadata.GetEventData<uint32_t>(pEventRecord, L"holographicFrameId");
@@ -462,5 +534,9 @@ void MRTraceConsumer::HandleSpectrumContinuousEvent(EVENT_RECORD* pEventRecord)
         if (frameIter->second->PresentId != 0 && frameIter->second->StopTime != 0) {
             HolographicFrameStop(frameIter->second);
         }
+        break;
+    }
+    default:
+        break;
     }
 }
@@ -28,6 +28,7 @@ SOFTWARE.
 #include <mutex>
 #include <numeric>
 #include <set>
+#include <unordered_map>
 #include <vector>
 #include <windows.h>
 #include <evntcons.h> // must include after windows.h
@@ -224,10 +225,31 @@ struct LateStageReprojectionEvent {
     }
 };
 
+// The DHD and SpectrumContinuous events handled by MRTraceConsumer, identified
+// by their TDH task name.
+enum class MRTask
+{
+    Unknown,
+    AcquireForRendering,
+    ReleaseFromRendering,
+    AcquireForPresentation,
+    ReleaseFromPresentation,
+    OasisPresentationSource,
+    LsrThread_BeginLsrProcessing,
+    LsrThread_LatchedInput,
+    LsrThread_UnaccountedForVsyncsBetweenStatGathering,
+    MissedPresentation,
+    OnTimePresentationTiming,
+    LatePresentationTiming,
+    HolographicFrame,
+    HolographicFrameMetadata_GetNewPoseForReprojection,
+};
+
 struct MRTraceConsumer
 {
     MRTraceConsumer(bool simple)
         : mSimpleMode(simple)
+        , mCompletedLSRs(16 * 1024)
     {}
     ~MRTraceConsumer();
 
@@ -235,11 +257,13 @@ struct MRTraceConsumer
 
     const bool mSimpleMode;
 
-    std::mutex mMutex;
+    // See PMTraceConsumer::mWaitForOutput.
+    bool mWaitForOutput = false;
+
     // A set of LSRs that are "completed":
     // They progressed as far as they can through the pipeline before being either discarded or hitting the screen.
-    // These will be handed off to the consumer thread.
-    std::vector<std::shared_ptr<LateStageReprojectionEvent>> mCompletedLSRs;
+    // These will be handed off to the output thread.
+    SpscRing<std::shared_ptr<LateStageReprojectionEvent>> mCompletedLSRs;
 
     // A high-level description of the sequence of events:
     // HolographicFrameStart (by HolographicFrameId, for App's CPU frame render start time) -> HolographicFrameStop (by HolographicFrameId, for App's CPU frame render end/Present time) -> 
@@ -259,12 +283,7 @@ struct MRTraceConsumer
     std::shared_ptr<LateStageReprojectionEvent> mActiveLSR;
     bool DequeueLSRs(std::vector<std::shared_ptr<LateStageReprojectionEvent>>& outLSRs)
     {
-        if (mCompletedLSRs.size()) {
-            auto lock = scoped_lock(mMutex);
-            outLSRs.swap(mCompletedLSRs);
-            return !outLSRs.empty();
-        }
-        return false;
+        return mCompletedLSRs.PopAll(&outLSRs);
     }
 
     void CompleteLSR(std::shared_ptr<LateStageReprojectionEvent> p);
@@ -276,7 +295,15 @@ struct MRTraceConsumer
     void HolographicFrameStart(std::shared_ptr<HolographicFrame> p);
     void HolographicFrameStop(std::shared_ptr<HolographicFrame> p);
 
+    // Task of each event type seen so far, keyed the same way as
+    // EventMetadata so that the task name is only looked up the first time
+    // an event descriptor is seen.
+    std::unordered_map<EventMetadataKey, MRTask, EventMetadataKeyHash, EventMetadataKeyEqual> mTaskByEvent;
+
+    MRTask GetEventTask(EVENT_RECORD* pEventRecord);
+
     void HandleDHDEvent(EVENT_RECORD* pEventRecord);
     void HandleSpectrumContinuousEvent(EVENT_RECORD* pEventRecord);
+    void HandleMetadataEvent(EVENT_RECORD* pEventRecord);
 };
 
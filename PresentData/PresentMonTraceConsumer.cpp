@@ -33,6 +33,25 @@ SOFTWARE.
 #include <assert.h>
 #include <d3d9.h>
 #include <dxgi.h>
+#include <new>
+
+PresentTrackingState::PresentTrackingState()
+    : Hwnd(0)
+    , TokenPtr(0)
+    , CompositionSurfaceLuid(0)
+    , QueueSubmitSequence(0)
+    , DestWidth(0)
+    , DestHeight(0)
+    , MMIO(false)
+    , SeenDxgkPresent(false)
+    , SeenWin32KEvents(false)
+    , DxgContext(0)
+    , LegacyBlitTokenData(0)
+    , DwmHwnd(0)
+    , Win32KPresentCount(0)
+    , Win32KBindId(0)
+{
+}
 
 PresentEvent::PresentEvent(EVENT_HEADER const& hdr, ::Runtime runtime)
     : QpcTime(*(uint64_t*) &hdr.TimeStamp)
@@ -44,22 +63,16 @@ PresentEvent::PresentEvent(EVENT_HEADER const& hdr, ::Runtime runtime)
     , SwapChainAddress(0)
     , SyncInterval(-1)
     , PresentFlags(0)
-    , Hwnd(0)
-    , TokenPtr(0)
-    , QueueSubmitSequence(0)
     , Runtime(runtime)
     , PresentMode(PresentMode::Unknown)
     , FinalState(PresentResult::Unknown)
-    , DestWidth(0)
-    , DestHeight(0)
-    , CompositionSurfaceLuid(0)
     , SupportsTearing(false)
-    , MMIO(false)
-    , SeenDxgkPresent(false)
-    , SeenWin32KEvents(false)
     , WasBatched(false)
     , DwmNotified(false)
     , Completed(false)
+    , Tracking(nullptr)
+    , mRefCount(0)
+    , mPool(nullptr)
 {
 #if DEBUG_VERBOSE
     static uint64_t presentCount = 0;
@@ -77,11 +90,101 @@ PresentEvent::~PresentEvent()
     assert(Completed || gPresentMonTraceConsumer_Exiting);
 }
 
+PresentEventPool::PresentEventPool()
+    : mFreeList(nullptr)
+{
+    InitializeSListHead(&mReleasedList);
+}
+
+PresentEventPool::~PresentEventPool()
+{
+    for (auto slab : mSlabs) {
+        _aligned_free(slab);
+    }
+    for (auto tracking : mFreeTracking) {
+        delete tracking;
+    }
+}
+
+PresentEventPtr PresentEventPool::Create(EVENT_HEADER const& hdr, ::Runtime runtime)
+{
+    // Each slot must be able to hold an SLIST_ENTRY while the present is free.
+    static_assert(sizeof(PresentEvent) >= sizeof(SLIST_ENTRY), "PresentEvent too small to hold free list entry");
+    size_t const slotSize = (sizeof(PresentEvent) + MEMORY_ALLOCATION_ALIGNMENT - 1) & ~((size_t) MEMORY_ALLOCATION_ALIGNMENT - 1);
+
+    // If the private free list is empty, reclaim all the presents that have
+    // been released since the last time.  If there aren't any, allocate a new
+    // slab.
+    if (mFreeList == nullptr) {
+        mFreeList = InterlockedFlushSList(&mReleasedList);
+        if (mFreeList == nullptr) {
+            auto slab = (uint8_t*) _aligned_malloc(slotSize * SLAB_PRESENT_COUNT, MEMORY_ALLOCATION_ALIGNMENT);
+            if (slab == nullptr) {
+                throw std::bad_alloc();
+            }
+            mSlabs.emplace_back(slab);
+
+            for (size_t i = SLAB_PRESENT_COUNT; i-- > 0; ) {
+                auto entry = (PSLIST_ENTRY) (slab + i * slotSize);
+                entry->Next = mFreeList;
+                mFreeList = entry;
+            }
+        }
+    }
+
+    auto slot = mFreeList;
+    mFreeList = slot->Next;
+
+    auto present = new (slot) PresentEvent(hdr, runtime);
+    present->mRefCount.store(1, std::memory_order_relaxed);
+    present->mPool = this;
+
+    if (mFreeTracking.empty()) {
+        present->Tracking = new PresentTrackingState;
+    } else {
+        present->Tracking = mFreeTracking.back();
+        mFreeTracking.pop_back();
+    }
+
+    return PresentEventPtr(present);
+}
+
+void PresentEventPool::ReleaseTracking(PresentEvent* present)
+{
+    auto tracking = present->Tracking;
+    if (tracking == nullptr) {
+        return;
+    }
+    present->Tracking = nullptr;
+
+    *tracking = PresentTrackingState();
+
+    mFreeTracking.push_back(tracking);
+}
+
+void PresentEventPool::Destroy(PresentEvent* present)
+{
+    // Presents are normally completed (and their tracking state released) on
+    // the consumer thread before they can be released elsewhere.  Presents
+    // still in flight when the consumer is destroyed are the exception.
+    delete present->Tracking;
+
+    present->~PresentEvent();
+    InterlockedPushEntrySList(&mReleasedList, (PSLIST_ENTRY) present);
+}
+
 PMTraceConsumer::~PMTraceConsumer()
 {
 #ifndef NDEBUG
     gPresentMonTraceConsumer_Exiting = true;
 #endif
+
+    if (mCompletedPresentsEvent != NULL) {
+        CloseHandle(mCompletedPresentsEvent);
+    }
+    if (mWakeupTimer != NULL) {
+        CloseHandle(mWakeupTimer);
+    }
 }
 
 void PMTraceConsumer::HandleDXGIEvent(EVENT_RECORD* pEventRecord)
@@ -93,22 +196,19 @@ void PMTraceConsumer::HandleDXGIEvent(EVENT_RECORD* pEventRecord)
     case Microsoft_Windows_DXGI::Present_Start::Id:
     case Microsoft_Windows_DXGI::PresentMultiplaneOverlay_Start::Id:
     {
-        EventDataDesc desc[] = {
-            { L"pIDXGISwapChain" },
-            { L"Flags" },
-            { L"SyncInterval" },
-        };
-        mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-        auto pIDXGISwapChain = desc[0].GetData<uint64_t>();
-        auto Flags           = desc[1].GetData<uint32_t>();
-        auto SyncInterval    = desc[2].GetData<int32_t>();
+        // Present_Start and PresentMultiplaneOverlay_Start share the same
+        // layout for these fields.
+        EventStructReader reader(&mMetadata, pEventRecord);
+        auto pIDXGISwapChain = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DXGI::Present_Start_Struct, pIDXGISwapChain);
+        auto Flags           = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DXGI::Present_Start_Struct, Flags);
+        auto SyncInterval    = (int32_t) EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DXGI::Present_Start_Struct, SyncInterval);
 
         // Ignore PRESENT_TEST: it's just to check if you're still fullscreen
         if ((Flags & DXGI_PRESENT_TEST) != 0) {
             break;
         }
 
-        auto present = std::make_shared<PresentEvent>(hdr, Runtime::DXGI);
+        auto present = mPresentEventPool.Create(hdr, Runtime::DXGI);
         present->SwapChainAddress = pIDXGISwapChain;
         present->PresentFlags     = Flags;
         present->SyncInterval     = SyncInterval;
@@ -119,7 +219,8 @@ void PMTraceConsumer::HandleDXGIEvent(EVENT_RECORD* pEventRecord)
     case Microsoft_Windows_DXGI::Present_Stop::Id:
     case Microsoft_Windows_DXGI::PresentMultiplaneOverlay_Stop::Id:
     {
-        auto result = mMetadata.GetEventData<uint32_t>(pEventRecord, L"Result");
+        EventStructReader reader(&mMetadata, pEventRecord);
+        auto result = EVENT_STRUCT_FIELD(reader, Microsoft_Windows_DXGI::Present_Stop_Struct, Result);
 
         bool AllowBatching =
             SUCCEEDED(result) &&
@@ -153,7 +254,7 @@ void PMTraceConsumer::HandleDxgkBlt(EVENT_HEADER const& hdr, uint64_t hwnd, bool
 
     // This could be one of several types of presents. Further events will clarify.
     // For now, assume that this is a blt straight into a surface which is already on-screen.
-    eventIter->second->Hwnd = hwnd;
+    eventIter->second->Tracking->Hwnd = hwnd;
     if (redirectedPresent) {
         eventIter->second->PresentMode = PresentMode::Composed_Copy_CPU_GDI;
         eventIter->second->SupportsTearing = false;
@@ -172,7 +273,7 @@ void PMTraceConsumer::HandleDxgkFlip(EVENT_HEADER const& hdr, int32_t flipInterv
 
     // Check if we might have retrieved a 'stuck' present from a previous frame.
     // The only events that we can expect before a Flip/FlipMPO are a runtime present start, or a previous FlipMPO.
-    if (eventIter->second->QueueSubmitSequence != 0 || eventIter->second->SeenDxgkPresent) {
+    if (eventIter->second->Tracking->QueueSubmitSequence != 0 || eventIter->second->Tracking->SeenDxgkPresent) {
         // It's already progressed further but didn't complete, ignore it and create a new one.
         mPresentByThreadId.erase(eventIter);
         eventIter = FindOrCreatePresent(hdr);
@@ -183,7 +284,7 @@ void PMTraceConsumer::HandleDxgkFlip(EVENT_HEADER const& hdr, int32_t flipInterv
         return;
     }
 
-    eventIter->second->MMIO = mmio;
+    eventIter->second->Tracking->MMIO = mmio;
     eventIter->second->PresentMode = PresentMode::Hardware_Legacy_Flip;
 
     if (eventIter->second->SyncInterval == -1) {
@@ -195,7 +296,12 @@ void PMTraceConsumer::HandleDxgkFlip(EVENT_HEADER const& hdr, int32_t flipInterv
 
     // If this is the DWM thread, piggyback these pending presents on our fullscreen present
     if (hdr.ThreadId == DwmPresentThreadId) {
-        std::swap(eventIter->second->DependentPresents, mPresentsWaitingForDWM);
+        auto& dependentPresents = eventIter->second->Tracking->DependentPresents;
+        for (auto& p : mPresentsWaitingForDWM) {
+            dependentPresents.emplace_back(std::move(p));
+        }
+        mPresentsWaitingForDWM.clear();
+        mPresentsWaitingForDWMCompactedSize = 0;
         DwmPresentThreadId = 0;
     }
 }
@@ -215,9 +321,10 @@ void PMTraceConsumer::HandleDxgkQueueSubmit(
     if (!supportsDxgkPresentEvent) {
         auto eventIter = mBltsByDxgContext.find(context);
         if (eventIter != mBltsByDxgContext.end()) {
-            if (eventIter->second->PresentMode == PresentMode::Hardware_Legacy_Copy_To_Front_Buffer) {
+            if (!eventIter->second->Completed &&
+                eventIter->second->PresentMode == PresentMode::Hardware_Legacy_Copy_To_Front_Buffer) {
                 DebugModifyPresent(*eventIter->second);
-                eventIter->second->SeenDxgkPresent = true;
+                eventIter->second->Tracking->SeenDxgkPresent = true;
                 if (eventIter->second->ScreenTime != 0) {
                     CompletePresent(eventIter->second);
                 }
@@ -232,16 +339,19 @@ void PMTraceConsumer::HandleDxgkQueueSubmit(
         packetType == DXGKETW_SOFTWARE_COMMAND_BUFFER ||
         present) {
         auto eventIter = mPresentByThreadId.find(hdr.ThreadId);
-        if (eventIter == mPresentByThreadId.end() || eventIter->second->QueueSubmitSequence != 0) {
+        if (eventIter == mPresentByThreadId.end() ||
+            eventIter->second->Completed ||
+            eventIter->second->Tracking->QueueSubmitSequence != 0) {
             return;
         }
 
         DebugModifyPresent(*eventIter->second);
 
-        eventIter->second->QueueSubmitSequence = submitSequence;
+        eventIter->second->Tracking->QueueSubmitSequence = submitSequence;
         mPresentsBySubmitSequence.emplace(submitSequence, eventIter->second);
 
         if (eventIter->second->PresentMode == PresentMode::Hardware_Legacy_Copy_To_Front_Buffer && !supportsDxgkPresentEvent) {
+            eventIter->second->Tracking->DxgContext = context;
             mBltsByDxgContext[context] = eventIter->second;
         }
     }
@@ -255,7 +365,7 @@ void PMTraceConsumer::HandleDxgkQueueComplete(EVENT_HEADER const& hdr, uint32_t
     }
 
     if (pEvent->PresentMode == PresentMode::Hardware_Legacy_Copy_To_Front_Buffer ||
-        (pEvent->PresentMode == PresentMode::Hardware_Legacy_Flip && !pEvent->MMIO)) {
+        (pEvent->PresentMode == PresentMode::Hardware_Legacy_Flip && !pEvent->Tracking->MMIO)) {
         pEvent->ReadyTime = hdr.TimeStamp.QuadPart;
         pEvent->ScreenTime = hdr.TimeStamp.QuadPart;
         pEvent->FinalState = PresentResult::Presented;
@@ -263,7 +373,7 @@ void PMTraceConsumer::HandleDxgkQueueComplete(EVENT_HEADER const& hdr, uint32_t
         // Sometimes, the queue packets associated with a present will complete before the DxgKrnl present event is fired
         // In this case, for blit presents, we have no way to differentiate between fullscreen and windowed blits
         // So, defer the completion of this present until we know all events have been fired
-        if (pEvent->SeenDxgkPresent || pEvent->PresentMode != PresentMode::Hardware_Legacy_Copy_To_Front_Buffer) {
+        if (pEvent->Tracking->SeenDxgkPresent || pEvent->PresentMode != PresentMode::Hardware_Legacy_Copy_To_Front_Buffer) {
             CompletePresent(pEvent);
         }
     }
@@ -367,7 +477,7 @@ void PMTraceConsumer::HandleDxgkSubmitPresentHistoryEventArgs(
     auto eventIter = FindOrCreatePresent(hdr);
 
     // Check if we might have retrieved a 'stuck' present from a previous frame.
-    if (eventIter->second->TokenPtr != 0) {
+    if (eventIter->second->Tracking->TokenPtr != 0) {
         // It's already progressed further but didn't complete, ignore it and create a new one.
         mPresentByThreadId.erase(eventIter);
         eventIter = FindOrCreatePresent(hdr);
@@ -377,7 +487,7 @@ void PMTraceConsumer::HandleDxgkSubmitPresentHistoryEventArgs(
     eventIter->second->ScreenTime = 0;
     eventIter->second->SupportsTearing = false;
     eventIter->second->FinalState = PresentResult::Unknown;
-    eventIter->second->TokenPtr = token;
+    eventIter->second->Tracking->TokenPtr = token;
 
     if (eventIter->second->PresentMode == PresentMode::Hardware_Legacy_Copy_To_Front_Buffer) {
         eventIter->second->PresentMode = PresentMode::Composed_Copy_GPU_GDI;
@@ -391,14 +501,15 @@ void PMTraceConsumer::HandleDxgkSubmitPresentHistoryEventArgs(
             // When there's no Win32K events, we'll assume PHTs that aren't after a blt, and aren't composition tokens
             // are flip tokens and that they're displayed. There are no Win32K events on Win7, and they might not be
             // present in some traces - don't let presents get stuck/dropped just because we can't track them perfectly.
-            assert(!eventIter->second->SeenWin32KEvents);
+            assert(!eventIter->second->Tracking->SeenWin32KEvents);
             eventIter->second->PresentMode = PresentMode::Composed_Flip;
         }
     } else if (eventIter->second->PresentMode == PresentMode::Composed_Copy_CPU_GDI) {
         if (tokenData == 0) {
             // This is the best we can do, we won't be able to tell how many frames are actually displayed.
-            mPresentsWaitingForDWM.emplace_back(eventIter->second);
+            AddPresentWaitingForDWM(eventIter->second);
         } else {
+            eventIter->second->Tracking->LegacyBlitTokenData = tokenData;
             mPresentsByLegacyBlitToken[tokenData] = eventIter->second;
         }
     }
@@ -420,14 +531,14 @@ void PMTraceConsumer::HandleDxgkPropagatePresentHistoryEventArgs(EVENT_HEADER co
         : std::min(eventIter->second->ReadyTime, (uint64_t) hdr.TimeStamp.QuadPart);
 
     if (eventIter->second->PresentMode == PresentMode::Composed_Composition_Atlas ||
-        (eventIter->second->PresentMode == PresentMode::Composed_Flip && !eventIter->second->SeenWin32KEvents)) {
-        mPresentsWaitingForDWM.emplace_back(eventIter->second);
+        (eventIter->second->PresentMode == PresentMode::Composed_Flip && !eventIter->second->Tracking->SeenWin32KEvents)) {
+        AddPresentWaitingForDWM(eventIter->second);
     }
 
     if (eventIter->second->PresentMode == PresentMode::Composed_Copy_GPU_GDI) {
         // Manipulate the map here
         // When DWM is ready to present, we'll query for the most recent blt targeting this window and take it out of the map
-        mLastWindowPresent[eventIter->second->Hwnd] = eventIter->second;
+        mLastWindowPresent[eventIter->second->Tracking->Hwnd] = eventIter->second;
     }
 
     mDxgKrnlPresentHistoryTokens.erase(eventIter);
@@ -441,13 +552,9 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
     switch (hdr.EventDescriptor.Id) {
     case Microsoft_Windows_DxgKrnl::Flip_Info::Id:
     {
-        EventDataDesc desc[] = {
-            { L"FlipInterval" },
-            { L"MMIOFlip" },
-        };
-        mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-        auto FlipInterval = desc[0].GetData<uint32_t>();
-        auto MMIOFlip     = desc[1].GetData<BOOL>() != 0;
+        EventStructReader reader(&mMetadata, pEventRecord);
+        auto FlipInterval = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Flip_Info_Struct, FlipInterval);
+        auto MMIOFlip     = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Flip_Info_Struct, MMIOFlip) != 0;
 
         HandleDxgkFlip(hdr, FlipInterval, MMIOFlip);
         break;
@@ -457,47 +564,40 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
         break;
     case Microsoft_Windows_DxgKrnl::QueuePacket_Start::Id:
     {
-        EventDataDesc desc[] = {
-            { L"PacketType" },
-            { L"SubmitSequence" },
-            { L"hContext" },
-            { L"bPresent" },
-        };
-        mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-        auto PacketType     = desc[0].GetData<uint32_t>();
-        auto SubmitSequence = desc[1].GetData<uint32_t>();
-        auto hContext       = desc[2].GetData<uint64_t>();
-        auto bPresent       = desc[3].GetData<BOOL>() != 0;
+        EventStructReader reader(&mMetadata, pEventRecord);
+        auto PacketType     = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::QueuePacket_Start_Struct, PacketType);
+        auto SubmitSequence = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::QueuePacket_Start_Struct, SubmitSequence);
+        auto hContext       = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::QueuePacket_Start_Struct, hContext);
+        auto bPresent       = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::QueuePacket_Start_Struct, bPresent) != 0;
 
         HandleDxgkQueueSubmit(hdr, PacketType, SubmitSequence, hContext, bPresent, true);
         break;
     }
     case Microsoft_Windows_DxgKrnl::QueuePacket_Stop::Id:
-        HandleDxgkQueueComplete(hdr, mMetadata.GetEventData<uint32_t>(pEventRecord, L"SubmitSequence"));
+    {
+        EventStructReader reader(&mMetadata, pEventRecord);
+        HandleDxgkQueueComplete(hdr, EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::QueuePacket_Stop_Struct, SubmitSequence));
         break;
+    }
     case Microsoft_Windows_DxgKrnl::MMIOFlip_Info::Id:
     {
-        EventDataDesc desc[] = {
-            { L"FlipSubmitSequence" },
-            { L"Flags" },
-        };
-        mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-        auto FlipSubmitSequence = desc[0].GetData<uint32_t>();
-        auto Flags              = desc[1].GetData<uint32_t>();
+        EventStructReader reader(&mMetadata, pEventRecord);
+        auto FlipSubmitSequence = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::MMIOFlip_Info_Struct, FlipSubmitSequence);
+        auto Flags              = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::MMIOFlip_Info_Struct, Flags);
 
         HandleDxgkMMIOFlip(hdr, FlipSubmitSequence, Flags);
         break;
     }
     case Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info::Id:
     {
+        // The struct was generated from version 3 of the event; older
+        // versions fall back to looking the fields up by name.
         auto flipEntryStatusAfterFlipValid = hdr.EventDescriptor.Version >= 2;
-        EventDataDesc desc[] = {
-            { L"FlipSubmitSequence" },
-            { L"FlipEntryStatusAfterFlip" }, // optional
-        };
-        mMetadata.GetEventData(pEventRecord, desc, _countof(desc) - (flipEntryStatusAfterFlipValid ? 0 : 1));
-        auto FlipFenceId              = desc[0].GetData<uint64_t>();
-        auto FlipEntryStatusAfterFlip = flipEntryStatusAfterFlipValid ? desc[1].GetData<uint32_t>() : 0u;
+        EventStructReader reader(&mMetadata, pEventRecord);
+        auto FlipFenceId              = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info_Struct, FlipSubmitSequence);
+        auto FlipEntryStatusAfterFlip = flipEntryStatusAfterFlipValid
+            ? EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info_Struct, FlipEntryStatusAfterFlip)
+            : 0u;
 
         auto flipSubmitSequence = (uint32_t) (FlipFenceId >> 32u);
 
@@ -521,7 +621,8 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
     }
     case Microsoft_Windows_DxgKrnl::VSyncDPC_Info::Id:
     {
-        auto FlipFenceId = mMetadata.GetEventData<uint64_t>(pEventRecord, L"FlipFenceId");
+        EventStructReader reader(&mMetadata, pEventRecord);
+        auto FlipFenceId = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::VSyncDPC_Info_Struct, FlipFenceId);
         HandleDxgkSyncDPC(hdr, (uint32_t)(FlipFenceId >> 32u));
         break;
     }
@@ -535,11 +636,29 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
             return;
         }
 
+        // The present may have already completed (e.g., an immediate flip),
+        // in which case it has been handed off and there's nothing to update.
+        if (eventIter->second->Completed) {
+            mPresentByThreadId.erase(eventIter);
+            break;
+        }
+
         DebugModifyPresent(*eventIter->second);
 
-        eventIter->second->SeenDxgkPresent = true;
-        if (eventIter->second->Hwnd == 0) {
-            eventIter->second->Hwnd = mMetadata.GetEventData<uint64_t>(pEventRecord, L"hWindow");
+        eventIter->second->Tracking->SeenDxgkPresent = true;
+        if (eventIter->second->Tracking->Hwnd == 0) {
+            EventStructReader reader(&mMetadata, pEventRecord);
+            eventIter->second->Tracking->Hwnd = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Present_Info_Struct, hWindow);
+        }
+
+        // Update batching information before the present might be completed
+        // below.
+        auto batched = eventIter->second->ThreadId != hdr.ThreadId;
+        if (batched) {
+            if (eventIter->second->TimeTaken == 0) {
+                eventIter->second->TimeTaken = hdr.TimeStamp.QuadPart - eventIter->second->QpcTime;
+            }
+            eventIter->second->WasBatched = true;
         }
 
         if (eventIter->second->PresentMode == PresentMode::Hardware_Legacy_Copy_To_Front_Buffer &&
@@ -549,11 +668,7 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
             CompletePresent(eventIter->second);
         }
 
-        if (eventIter->second->ThreadId != hdr.ThreadId) {
-            if (eventIter->second->TimeTaken == 0) {
-                eventIter->second->TimeTaken = hdr.TimeStamp.QuadPart - eventIter->second->QpcTime;
-            }
-            eventIter->second->WasBatched = true;
+        if (batched) {
             mPresentByThreadId.erase(eventIter);
         }
         break;
@@ -561,15 +676,12 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
     case Microsoft_Windows_DxgKrnl::PresentHistoryDetailed_Start::Id:
     case Microsoft_Windows_DxgKrnl::PresentHistory_Start::Id:
     {
-        EventDataDesc desc[] = {
-            { L"Token" },
-            { L"TokenData" },
-            { L"Model" },
-        };
-        mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-        auto Token     = desc[0].GetData<uint64_t>();
-        auto TokenData = desc[1].GetData<uint64_t>();
-        auto Model     = desc[2].GetData<uint32_t>();
+        // PresentHistoryDetailed_Start starts with the same layout as
+        // PresentHistory_Start.
+        EventStructReader reader(&mMetadata, pEventRecord);
+        auto Token     = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::PresentHistory_Start_Struct, Token);
+        auto TokenData = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::PresentHistory_Start_Struct, TokenData);
+        auto Model     = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::PresentHistory_Start_Struct, Model);
 
         if (Model == D3DKMT_PM_REDIRECTED_GDI) {
             break;
@@ -587,17 +699,16 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
         break;
     }
     case Microsoft_Windows_DxgKrnl::PresentHistory_Info::Id:
-        HandleDxgkPropagatePresentHistoryEventArgs(hdr, mMetadata.GetEventData<uint64_t>(pEventRecord, L"Token"));
+    {
+        EventStructReader reader(&mMetadata, pEventRecord);
+        HandleDxgkPropagatePresentHistoryEventArgs(hdr, EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::PresentHistory_Info_Struct, Token));
         break;
+    }
     case Microsoft_Windows_DxgKrnl::Blit_Info::Id:
     {
-        EventDataDesc desc[] = {
-            { L"hwnd" },
-            { L"bRedirectedPresent" },
-        };
-        mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-        auto hwnd               = desc[0].GetData<uint64_t>();
-        auto bRedirectedPresent = desc[1].GetData<uint32_t>() != 0;
+        EventStructReader reader(&mMetadata, pEventRecord);
+        auto hwnd               = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Blit_Info_Struct, hwnd);
+        auto bRedirectedPresent = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Blit_Info_Struct, bRedirectedPresent) != 0;
 
         HandleDxgkBlt(hdr, hwnd, bRedirectedPresent);
         break;
@@ -822,16 +933,18 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
         auto eventIter = FindOrCreatePresent(hdr);
 
         // Check if we might have retrieved a 'stuck' present from a previous frame.
-        if (eventIter->second->SeenWin32KEvents) {
+        if (eventIter->second->Tracking->SeenWin32KEvents) {
             mPresentByThreadId.erase(eventIter);
             eventIter = FindOrCreatePresent(hdr);
         }
 
         eventIter->second->PresentMode = PresentMode::Composed_Flip;
-        eventIter->second->DestWidth = DestWidth;
-        eventIter->second->DestHeight = DestHeight;
-        eventIter->second->CompositionSurfaceLuid = CompositionSurfaceLuid;
-        eventIter->second->SeenWin32KEvents = true;
+        eventIter->second->Tracking->DestWidth = DestWidth;
+        eventIter->second->Tracking->DestHeight = DestHeight;
+        eventIter->second->Tracking->CompositionSurfaceLuid = CompositionSurfaceLuid;
+        eventIter->second->Tracking->Win32KPresentCount = PresentCount;
+        eventIter->second->Tracking->Win32KBindId = BindId;
+        eventIter->second->Tracking->SeenWin32KEvents = true;
 
         PMTraceConsumer::Win32KPresentHistoryTokenKey key(CompositionSurfaceLuid, PresentCount, BindId);
         mWin32KPresentHistoryTokens[key] = eventIter->second;
@@ -839,17 +952,11 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
     }
     case Microsoft_Windows_Win32k::TokenStateChanged_Info::Id:
     {
-        EventDataDesc desc[] = {
-            { L"CompositionSurfaceLuid" },
-            { L"PresentCount" },
-            { L"BindId" },
-            { L"NewState" },
-        };
-        mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-        auto CompositionSurfaceLuid = desc[0].GetData<uint64_t>();
-        auto PresentCount           = desc[1].GetData<uint32_t>();
-        auto BindId                 = desc[2].GetData<uint64_t>();
-        auto NewState               = desc[3].GetData<uint32_t>();
+        EventStructReader reader(&mMetadata, pEventRecord);
+        auto CompositionSurfaceLuid = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_Win32k::TokenStateChanged_Info_Struct, CompositionSurfaceLuid);
+        auto PresentCount           = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_Win32k::TokenStateChanged_Info_Struct, PresentCount);
+        auto BindId                 = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_Win32k::TokenStateChanged_Info_Struct, BindId);
+        auto NewState               = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_Win32k::TokenStateChanged_Info_Struct, NewState);
 
         PMTraceConsumer::Win32KPresentHistoryTokenKey key(CompositionSurfaceLuid, PresentCount, BindId);
         auto eventIter = mWin32KPresentHistoryTokens.find(key);
@@ -864,10 +971,10 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
         switch (NewState) {
         case (uint32_t) Microsoft_Windows_Win32k::TokenState::InFrame: // Composition is starting
         {
-            if (event.Hwnd) {
-                auto hWndIter = mLastWindowPresent.find(event.Hwnd);
+            if (!event.Completed && event.Tracking->Hwnd) {
+                auto hWndIter = mLastWindowPresent.find(event.Tracking->Hwnd);
                 if (hWndIter == mLastWindowPresent.end()) {
-                    mLastWindowPresent.emplace(event.Hwnd, eventIter->second);
+                    mLastWindowPresent.emplace(event.Tracking->Hwnd, eventIter->second);
                 } else if (hWndIter->second != eventIter->second) {
                     DebugModifyPresent(*hWndIter->second);
                     hWndIter->second->FinalState = PresentResult::Discarded;
@@ -876,7 +983,7 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
                 }
             }
 
-            bool iFlip = mMetadata.GetEventData<BOOL>(pEventRecord, L"IndependentFlip") != 0;
+            bool iFlip = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_Win32k::TokenStateChanged_Info_Struct, IndependentFlip) != 0;
             if (iFlip && event.PresentMode == PresentMode::Composed_Flip) {
                 event.PresentMode = PresentMode::Hardware_Independent_Flip;
             }
@@ -895,8 +1002,8 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
                     event.FinalState = PresentResult::Presented;
                 }
             }
-            if (event.Hwnd) {
-                mLastWindowPresent.erase(event.Hwnd);
+            if (!event.Completed && event.Tracking->Hwnd) {
+                mLastWindowPresent.erase(event.Tracking->Hwnd);
             }
             break;
 
@@ -941,7 +1048,7 @@ void PMTraceConsumer::HandleDWMEvent(EVENT_RECORD* pEventRecord)
             }
             DebugModifyPresent(*present);
             present->DwmNotified = true;
-            mPresentsWaitingForDWM.emplace_back(present);
+            AddPresentWaitingForDWM(present);
         }
         mLastWindowPresent.clear();
         break;
@@ -980,8 +1087,9 @@ void PMTraceConsumer::HandleDWMEvent(EVENT_RECORD* pEventRecord)
 
         // Watch for multiple legacy blits completing against the same window		
         mLastWindowPresent[hwnd] = flipIter->second;
+        flipIter->second->Tracking->DwmHwnd = hwnd;
         flipIter->second->DwmNotified = true;
-        mPresentsByLegacyBlitToken.erase(flipIter);
+        mPresentsByLegacyBlitToken.erase(token);
         break;
     }
     case Microsoft_Windows_Dwm_Core::SCHEDULE_SURFACEUPDATE_Info::Id:
@@ -1019,15 +1127,11 @@ void PMTraceConsumer::HandleD3D9Event(EVENT_RECORD* pEventRecord)
     switch (hdr.EventDescriptor.Id) {
     case Microsoft_Windows_D3D9::Present_Start::Id:
     {
-        EventDataDesc desc[] = {
-            { L"pSwapchain" },
-            { L"Flags" },
-        };
-        mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-        auto pSwapchain = desc[0].GetData<uint64_t>();
-        auto Flags      = desc[1].GetData<uint32_t>();
+        EventStructReader reader(&mMetadata, pEventRecord);
+        auto pSwapchain = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_D3D9::Present_Start_Struct, pSwapchain);
+        auto Flags      = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_D3D9::Present_Start_Struct, Flags);
 
-        auto present = std::make_shared<PresentEvent>(hdr, Runtime::D3D9);
+        auto present = mPresentEventPool.Create(hdr, Runtime::D3D9);
         present->SwapChainAddress = pSwapchain;
         present->PresentFlags =
             ((Flags & D3DPRESENT_DONOTFLIP) ? DXGI_PRESENT_DO_NOT_SEQUENCE : 0) |
@@ -1042,7 +1146,8 @@ void PMTraceConsumer::HandleD3D9Event(EVENT_RECORD* pEventRecord)
     }
     case Microsoft_Windows_D3D9::Present_Stop::Id:
     {
-        auto result = mMetadata.GetEventData<uint32_t>(pEventRecord, L"Result");
+        EventStructReader reader(&mMetadata, pEventRecord);
+        auto result = EVENT_STRUCT_FIELD(reader, Microsoft_Windows_D3D9::Present_Stop_Struct, Result);
 
         bool AllowBatching =
             SUCCEEDED(result) &&
@@ -1057,7 +1162,84 @@ void PMTraceConsumer::HandleD3D9Event(EVENT_RECORD* pEventRecord)
     }
 }
 
-void PMTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> p, uint32_t recurseDepth)
+void PMTraceConsumer::SignalCompletedPresents(bool force)
+{
+    if (mUnsignalledPresentCount == 0 && !force) {
+        return;
+    }
+
+    LARGE_INTEGER now = {};
+    QueryPerformanceCounter(&now);
+    if (force ||
+        mUnsignalledPresentCount >= mWakeupPresentCount ||
+        (uint64_t) now.QuadPart - mLastSignalQpc >= mWakeupIntervalQpc) {
+        SetEvent(mCompletedPresentsEvent);
+        mUnsignalledPresentCount = 0;
+        mLastSignalQpc = now.QuadPart;
+        mWakeupTimerSet = false;
+        return;
+    }
+
+    // The timer may still go off after the next signal, which only costs the
+    // output thread an extra wakeup.
+    if (!mWakeupTimerSet && mWakeupTimer != NULL) {
+        LARGE_INTEGER dueTime = {};
+        dueTime.QuadPart = -mWakeupInterval100ns;
+        SetWaitableTimer(mWakeupTimer, &dueTime, 0, nullptr, nullptr, FALSE);
+        mWakeupTimerSet = true;
+    }
+}
+
+static bool IsCompletedPresent(PresentEventPtr const& p)
+{
+    return p->Completed;
+}
+
+static bool IsClassifiedPresent(PresentEventPtr const& p)
+{
+    return p->Completed || p->PresentMode != PresentMode::Unknown;
+}
+
+// Remove the presents that match pred from a list that they're otherwise only
+// removed from lazily.  The whole list is only scanned once it has doubled in
+// size since it was last compacted, so this is amortized O(1) per present
+// added.
+template<typename Container, typename Pred>
+static void CompactPresents(Container* presents, size_t* compactedSize, Pred pred)
+{
+    enum { MIN_COMPACT_SIZE = 16 };
+
+    if (presents->size() >= MIN_COMPACT_SIZE && presents->size() >= 2 * *compactedSize) {
+        presents->erase(std::remove_if(presents->begin(), presents->end(), pred), presents->end());
+        *compactedSize = presents->size();
+    }
+}
+
+// Drop presents from either end of a process's unclassified list once
+// they've been classified or completed, so the front is always the oldest
+// present that is still unclassified.
+static void RemoveClassifiedPresents(PMTraceConsumer::UnclassifiedPresents* unclassified)
+{
+    auto presents = &unclassified->mPresents;
+    while (!presents->empty() && IsClassifiedPresent(presents->front())) {
+        presents->pop_front();
+    }
+    while (!presents->empty() && IsClassifiedPresent(presents->back())) {
+        presents->pop_back();
+    }
+}
+
+// Remove the map's entry for key if it refers to p.
+template<typename Map, typename Key>
+static void ErasePresent(Map* map, Key const& key, PresentEventPtr const& p)
+{
+    auto iter = map->find(key);
+    if (iter != map->end() && iter->second == p) {
+        map->erase(iter);
+    }
+}
+
+void PMTraceConsumer::CompletePresent(PresentEventPtr p, uint32_t recurseDepth)
 {
     DebugCompletePresent(*p, recurseDepth);
 
@@ -1068,26 +1250,34 @@ void PMTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> p, uint32_t
     }
 
     // Complete all other presents that were riding along with this one (i.e. this one came from DWM)
-    for (auto& p2 : p->DependentPresents) {
+    PresentTrackingState::PresentList dependentPresents;
+    dependentPresents.swap(p->Tracking->DependentPresents);
+    for (auto& p2 : dependentPresents) {
+        // A dependent present may have already been evicted (see
+        // EvictPresents()), in which case it has been handed off and must not
+        // be modified.
+        if (p2->Completed) {
+            continue;
+        }
         DebugModifyPresent(*p2);
         p2->ScreenTime = p->ScreenTime;
         p2->FinalState = PresentResult::Presented;
         CompletePresent(p2, recurseDepth + 1);
     }
-    p->DependentPresents.clear();
+    dependentPresents.clear();
 
     // Remove it from any tracking maps that it may have been inserted into
-    if (p->QueueSubmitSequence != 0) {
-        mPresentsBySubmitSequence.erase(p->QueueSubmitSequence);
+    if (p->Tracking->QueueSubmitSequence != 0) {
+        mPresentsBySubmitSequence.erase(p->Tracking->QueueSubmitSequence);
     }
-    if (p->Hwnd != 0) {
-        auto hWndIter = mLastWindowPresent.find(p->Hwnd);
+    if (p->Tracking->Hwnd != 0) {
+        auto hWndIter = mLastWindowPresent.find(p->Tracking->Hwnd);
         if (hWndIter != mLastWindowPresent.end() && hWndIter->second == p) {
             mLastWindowPresent.erase(hWndIter);
         }
     }
-    if (p->TokenPtr != 0) {
-        auto iter = mDxgKrnlPresentHistoryTokens.find(p->TokenPtr);
+    if (p->Tracking->TokenPtr != 0) {
+        auto iter = mDxgKrnlPresentHistoryTokens.find(p->Tracking->TokenPtr);
         if (iter != mDxgKrnlPresentHistoryTokens.end() && iter->second == p) {
             mDxgKrnlPresentHistoryTokens.erase(iter);
         }
@@ -1107,17 +1297,117 @@ void PMTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> p, uint32_t
     }
 
     p->Completed = true;
+    mPresentEventPool.ReleaseTracking(p.get());
+
+    auto unclassifiedIter = mUnclassifiedPresentsByProcess.find(p->ProcessId);
+    if (unclassifiedIter != mUnclassifiedPresentsByProcess.end()) {
+        RemoveClassifiedPresents(&unclassifiedIter->second);
+    }
+
+    while (!mInFlightPresents.empty() && mInFlightPresents.front()->Completed) {
+        mInFlightPresents.pop_front();
+    }
+
     if (*presentIter == p) {
-        auto lock = scoped_lock(mMutex);
         while (presentIter != presentDeque.end() && presentIter->get()->Completed) {
-            mCompletedPresents.push_back(*presentIter);
+            // If the queue is full, make sure the output thread is awake
+            // before waiting for (or giving up on) space.
+            if (!mCompletedPresents.TryPush(*presentIter)) {
+                SignalCompletedPresents(true);
+                mCompletedPresents.Push(*presentIter, mWaitForOutput);
+            }
             presentDeque.pop_front();
+            mInFlightPresentCount -= 1;
+            mUnsignalledPresentCount += 1;
             presentIter = presentDeque.begin();
         }
+        SignalCompletedPresents(false);
+    }
+}
+
+void PMTraceConsumer::AddPresentWaitingForDWM(PresentEventPtr const& p)
+{
+    mPresentsWaitingForDWM.emplace_back(p);
+    CompactPresents(&mPresentsWaitingForDWM, &mPresentsWaitingForDWMCompactedSize, IsCompletedPresent);
+}
+
+void PMTraceConsumer::EvictPresent(PresentEventPtr p)
+{
+    DebugModifyPresent(*p);
+
+    // Presents riding along with this one are left in flight; they will
+    // complete or be evicted on their own.
+    p->Tracking->DependentPresents.clear();
+
+    // CompletePresent() only removes a present from the containers indexed by
+    // its own fields, so remove it from the rest.  The entries of a batched
+    // present's thread, and mPresentsWaitingForDWM, are dropped once they're
+    // found to be completed.
+    auto tracking = p->Tracking;
+    ErasePresent(&mPresentByThreadId, p->ThreadId, p);
+    ErasePresent(&mBltsByDxgContext, tracking->DxgContext, p);
+    ErasePresent(&mPresentsByLegacyBlitToken, tracking->LegacyBlitTokenData, p);
+    ErasePresent(&mLastWindowPresent, tracking->DwmHwnd, p);
+    if (tracking->SeenWin32KEvents) {
+        Win32KPresentHistoryTokenKey key(tracking->CompositionSurfaceLuid, tracking->Win32KPresentCount, tracking->Win32KBindId);
+        ErasePresent(&mWin32KPresentHistoryTokens, key, p);
+    }
+
+    CompletePresent(p);
+
+    // Evicted presents are often the last ones of their swapchain, so don't
+    // leave an empty deque behind for every swapchain that has gone away.
+    auto iter = mPresentsByProcessAndSwapChain.find(std::make_tuple(p->ProcessId, p->SwapChainAddress));
+    if (iter != mPresentsByProcessAndSwapChain.end() && iter->second.empty()) {
+        mPresentsByProcessAndSwapChain.erase(iter);
+    }
+}
+
+// The front of mInFlightPresents is always the oldest in-flight present, and
+// it is at the front of its swapchain's deque, so each eviction is O(1)
+// (amortized over the presents that were completed in the meantime).
+void PMTraceConsumer::EvictPresents(uint64_t now)
+{
+    uint32_t overLimitCount = 0;
+    uint32_t timedOutCount = 0;
+
+    // If there are too many presents in flight, evict the oldest ones (across
+    // all swapchains) until there is room for a new one.
+    if (mMaxInFlightPresents != 0) {
+        while (mInFlightPresentCount >= mMaxInFlightPresents && !mInFlightPresents.empty()) {
+            EvictPresent(mInFlightPresents.front());
+            overLimitCount += 1;
+        }
     }
+
+    // Evict any presents that have been in flight longer than the timeout,
+    // and note when the next one will time out.
+    if (mPresentTimeoutQpc != 0 && now >= mNextEvictionQpc) {
+        while (!mInFlightPresents.empty() && mInFlightPresents.front()->QpcTime + mPresentTimeoutQpc < now) {
+            EvictPresent(mInFlightPresents.front());
+            timedOutCount += 1;
+        }
+
+        mNextEvictionQpc = mInFlightPresents.empty()
+            ? now + mPresentTimeoutQpc
+            : mInFlightPresents.front()->QpcTime + mPresentTimeoutQpc + 1;
+    }
+
+    if (overLimitCount == 0 && timedOutCount == 0) {
+        return;
+    }
+
+    auto lock = scoped_lock(mMutex);
+    mOverLimitPresentCount += overLimitCount;
+    mTimedOutPresentCount += timedOutCount;
+}
+
+bool PMTraceConsumer::HasInFlightPresentsBefore(uint64_t qpcTime) const
+{
+    return !mInFlightPresents.empty() && mInFlightPresents.front()->QpcTime < qpcTime;
 }
 
-std::shared_ptr<PresentEvent> PMTraceConsumer::FindBySubmitSequence(uint32_t submitSequence)
+PresentEventPtr PMTraceConsumer::FindBySubmitSequence(uint32_t submitSequence)
 {
     auto eventIter = mPresentsBySubmitSequence.find(submitSequence);
     if (eventIter == mPresentsBySubmitSequence.end()) {
@@ -1129,23 +1419,34 @@ std::shared_ptr<PresentEvent> PMTraceConsumer::FindBySubmitSequence(uint32_t sub
 
 decltype(PMTraceConsumer::mPresentByThreadId.begin()) PMTraceConsumer::FindOrCreatePresent(EVENT_HEADER const& hdr)
 {
-    // Easy: we're on a thread that had some step in the present process
+    // Easy: we're on a thread that had some step in the present process.
+    // Ignore the thread's present if it has already completed though.
     auto eventIter = mPresentByThreadId.find(hdr.ThreadId);
+    if (eventIter != mPresentByThreadId.end() && eventIter->second->Completed) {
+        mPresentByThreadId.erase(eventIter);
+        eventIter = mPresentByThreadId.end();
+    }
     if (eventIter == mPresentByThreadId.end()) {
 
         // No such luck, check for batched presents
         auto& processMap = mPresentsByProcess[hdr.ProcessId];
-        auto processIter = std::find_if(processMap.begin(), processMap.end(),
-            [](auto processIter) {return processIter.second->PresentMode == PresentMode::Unknown; });
-        if (processIter != processMap.end()) {
+        auto& unclassified = mUnclassifiedPresentsByProcess[hdr.ProcessId];
+        RemoveClassifiedPresents(&unclassified);
+        if (!unclassified.mPresents.empty()) {
             // Assume batched presents are popped off the front of the driver queue by process in order, do the same here
-            eventIter = mPresentByThreadId.emplace(hdr.ThreadId, processIter->second).first;
-            processMap.erase(processIter);
+            auto present = unclassified.mPresents.front();
+            unclassified.mPresents.pop_front();
+            eventIter = mPresentByThreadId.emplace(hdr.ThreadId, present).first;
+
+            auto processIter = processMap.find(present->QpcTime);
+            if (processIter != processMap.end() && processIter->second == present) {
+                processMap.erase(processIter);
+            }
         } else {
 
             // This likely didn't originate from a runtime whose events we're tracking (DXGI/D3D9)
             // Could be composition buffers, or maybe another runtime (e.g. GL)
-            auto newEvent = std::make_shared<PresentEvent>(hdr, Runtime::Other);
+            auto newEvent = mPresentEventPool.Create(hdr, Runtime::Other);
             eventIter = CreatePresent(newEvent, processMap);
         }
     }
@@ -1155,20 +1456,36 @@ decltype(PMTraceConsumer::mPresentByThreadId.begin()) PMTraceConsumer::FindOrCre
 }
 
 decltype(PMTraceConsumer::mPresentByThreadId.begin()) PMTraceConsumer::CreatePresent(
-    std::shared_ptr<PresentEvent> newEvent,
+    PresentEventPtr const& newEvent,
     decltype(PMTraceConsumer::mPresentsByProcess.begin()->second)& processMap)
 {
+    if (mPresentTimeoutQpc != 0 || mMaxInFlightPresents != 0) {
+        EvictPresents(newEvent->QpcTime);
+    }
+
     DebugCreatePresent(*newEvent);
 
-    processMap.emplace(newEvent->QpcTime, newEvent);
+    if (processMap.emplace(newEvent->QpcTime, newEvent).second) {
+        auto& unclassified = mUnclassifiedPresentsByProcess[newEvent->ProcessId];
+        unclassified.mPresents.emplace_back(newEvent);
+
+        // Classified presents build up in the middle of the list if an old
+        // present stays unclassified (e.g., because its kernel events were
+        // lost).
+        CompactPresents(&unclassified.mPresents, &unclassified.mCompactedSize, IsClassifiedPresent);
+    }
     mPresentsByProcessAndSwapChain[std::make_tuple(newEvent->ProcessId, newEvent->SwapChainAddress)].emplace_back(newEvent);
+    mInFlightPresentCount += 1;
+
+    mInFlightPresents.emplace_back(newEvent);
+    CompactPresents(&mInFlightPresents, &mInFlightPresentsCompactedSize, IsCompletedPresent);
 
     auto p = mPresentByThreadId.emplace(newEvent->ThreadId, newEvent);
     assert(p.second);
     return p.first;
 }
 
-void PMTraceConsumer::CreatePresent(std::shared_ptr<PresentEvent> present)
+void PMTraceConsumer::CreatePresent(PresentEventPtr const& present)
 {
     // TODO: This version of CreatePresent() will overwrite any in-progress
     // present from this thread with the new one.  Does this ever happen?  If
@@ -1220,10 +1537,7 @@ void PMTraceConsumer::HandleNTProcessEvent(EVENT_RECORD* pEventRecord)
         break;
     }
 
-    {
-        auto lock = scoped_lock(mNTProcessEventMutex);
-        mNTProcessEvents.emplace_back(event);
-    }
+    mNTProcessEvents.Push(event, mWaitForOutput);
 }
 
 void PMTraceConsumer::HandleMetadataEvent(EVENT_RECORD* pEventRecord)
@@ -24,6 +24,7 @@ SOFTWARE.
 
 #define NOMINMAX
 
+#include <atomic>
 #include <deque>
 #include <map>
 #include <memory>
@@ -36,6 +37,9 @@ SOFTWARE.
 #include <evntcons.h> // must include after windows.h
 
 #include "Debug.hpp"
+#include "FlatHashMap.hpp"
+#include "SmallVector.hpp"
+#include "SpscRing.hpp"
 #include "TraceConsumer.hpp"
 
 template <typename mutex_t> std::unique_lock<mutex_t> scoped_lock(mutex_t &m)
@@ -75,6 +79,72 @@ struct NTProcessEvent {
     uint32_t ProcessId;
 };
 
+struct PresentEvent;
+class PresentEventPool;
+
+// PresentEventPtr is an intrusively reference-counted handle to a
+// PresentEvent allocated from a PresentEventPool.  A PresentEvent is shared by
+// the consumer thread's tracking structures and the output thread, and is
+// returned to its pool when the last handle is released (on either thread).
+class PresentEventPtr {
+public:
+    PresentEventPtr() : mPresent(nullptr) {}
+    PresentEventPtr(std::nullptr_t) : mPresent(nullptr) {}
+    PresentEventPtr(PresentEventPtr const& rhs);
+    PresentEventPtr(PresentEventPtr&& rhs) noexcept : mPresent(rhs.mPresent) { rhs.mPresent = nullptr; }
+    ~PresentEventPtr() { Release(); }
+
+    PresentEventPtr& operator=(PresentEventPtr const& rhs);
+    PresentEventPtr& operator=(PresentEventPtr&& rhs) noexcept;
+    PresentEventPtr& operator=(std::nullptr_t) { Release(); return *this; }
+
+    PresentEvent* get() const { return mPresent; }
+    PresentEvent* operator->() const { return mPresent; }
+    PresentEvent& operator*() const { return *mPresent; }
+    explicit operator bool() const { return mPresent != nullptr; }
+
+    bool operator==(PresentEventPtr const& rhs) const { return mPresent == rhs.mPresent; }
+    bool operator!=(PresentEventPtr const& rhs) const { return mPresent != rhs.mPresent; }
+    bool operator==(std::nullptr_t) const { return mPresent == nullptr; }
+    bool operator!=(std::nullptr_t) const { return mPresent != nullptr; }
+
+private:
+    friend class PresentEventPool;
+    explicit PresentEventPtr(PresentEvent* present) : mPresent(present) {} // Adopts the initial reference
+    void Release();
+
+    PresentEvent* mPresent;
+};
+
+// State only needed to correlate events with a present while it is in
+// flight.  It is allocated along with the present and released when the
+// present is completed, so it must not be accessed once Completed is set.
+struct PresentTrackingState {
+    uint64_t Hwnd;
+    uint64_t TokenPtr;
+    uint64_t CompositionSurfaceLuid;
+    uint32_t QueueSubmitSequence;
+    uint32_t DestWidth;
+    uint32_t DestHeight;
+    bool MMIO;
+    bool SeenDxgkPresent;
+    bool SeenWin32KEvents;
+
+    // Keys of the containers that aren't cleaned up by CompletePresent(), so
+    // that an evicted present can be removed from them.
+    uint64_t DxgContext;            // mBltsByDxgContext
+    uint64_t LegacyBlitTokenData;   // mPresentsByLegacyBlitToken
+    uint64_t DwmHwnd;               // mLastWindowPresent, from DWM FlipChain events
+    uint64_t Win32KPresentCount;    // mWin32KPresentHistoryTokens, with CompositionSurfaceLuid
+    uint64_t Win32KBindId;
+
+    // Presents that complete when this one does (i.e., this one came from DWM)
+    typedef SmallVector<PresentEventPtr, 4> PresentList;
+    PresentList DependentPresents;
+
+    PresentTrackingState();
+};
+
 struct PresentEvent {
     // Initial event information (might be a kernel event if not presented
     // through DXGI or D3D9)
@@ -93,25 +163,16 @@ struct PresentEvent {
     uint32_t PresentFlags;
 
     // Properties deduced by watching events through present pipeline
-    uint64_t Hwnd;
-    uint64_t TokenPtr;
-    uint32_t QueueSubmitSequence;
     Runtime Runtime;
     PresentMode PresentMode;
     PresentResult FinalState;
-    uint32_t DestWidth;
-    uint32_t DestHeight;
-    uint64_t CompositionSurfaceLuid;
     bool SupportsTearing;
-    bool MMIO;
-    bool SeenDxgkPresent;
-    bool SeenWin32KEvents;
     bool WasBatched;
     bool DwmNotified;
     bool Completed;
 
-    // Additional transient state
-    std::deque<std::shared_ptr<PresentEvent>> DependentPresents;
+    // Transient state, nullptr once Completed
+    PresentTrackingState* Tracking;
 
 #if DEBUG_VERBOSE
     uint64_t Id;
@@ -121,9 +182,85 @@ struct PresentEvent {
     ~PresentEvent();
 
 private:
+    friend class PresentEventPtr;
+    friend class PresentEventPool;
+
+    std::atomic<uint32_t> mRefCount;
+    PresentEventPool* mPool;
+
     PresentEvent(PresentEvent const& copy); // dne
 };
 
+// PresentEventPool is a slab allocator for PresentEvents.  Presents are only
+// created on the consumer thread, but they can be released on either the
+// consumer or output thread.  Released presents are pushed onto a lock-free
+// list, which the consumer thread reclaims in one operation once its private
+// free list runs out.
+class PresentEventPool {
+public:
+    PresentEventPool();
+    ~PresentEventPool();
+
+    PresentEventPtr Create(EVENT_HEADER const& hdr, ::Runtime runtime);
+
+    // Release present's PresentTrackingState for reuse.  Consumer thread only.
+    void ReleaseTracking(PresentEvent* present);
+
+private:
+    friend class PresentEventPtr;
+    void Destroy(PresentEvent* present);
+
+    enum { SLAB_PRESENT_COUNT = 256 };
+
+    SLIST_HEADER mReleasedList;     // Presents released by any thread
+    PSLIST_ENTRY mFreeList;         // Presents ready for reuse (consumer thread only)
+    std::vector<void*> mSlabs;
+    std::vector<PresentTrackingState*> mFreeTracking;   // Consumer thread only
+
+    PresentEventPool(PresentEventPool const& copy); // dne
+};
+
+inline PresentEventPtr::PresentEventPtr(PresentEventPtr const& rhs)
+    : mPresent(rhs.mPresent)
+{
+    if (mPresent != nullptr) {
+        mPresent->mRefCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Note: rhs may be owned by the present being released (e.g., an element of
+// its DependentPresents) so it must not be accessed after Release().
+inline PresentEventPtr& PresentEventPtr::operator=(PresentEventPtr const& rhs)
+{
+    auto present = rhs.mPresent;
+    if (present != nullptr) {
+        present->mRefCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    Release();
+    mPresent = present;
+    return *this;
+}
+
+inline PresentEventPtr& PresentEventPtr::operator=(PresentEventPtr&& rhs) noexcept
+{
+    if (this != &rhs) {
+        auto present = rhs.mPresent;
+        rhs.mPresent = nullptr;
+        Release();
+        mPresent = present;
+    }
+    return *this;
+}
+
+inline void PresentEventPtr::Release()
+{
+    auto present = mPresent;
+    mPresent = nullptr;
+    if (present != nullptr && present->mRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        present->mPool->Destroy(present);
+    }
+}
+
 // A high-level description of the sequence of events for each present type,
 // ignoring runtime end:
 //
@@ -171,43 +308,171 @@ private:
 
 struct PMTraceConsumer
 {
-    PMTraceConsumer(bool filteredEvents, bool simple) : mFilteredEvents(filteredEvents), mSimpleMode(simple) { }
+    PMTraceConsumer(bool filteredEvents, bool simple)
+        : mFilteredEvents(filteredEvents)
+        , mSimpleMode(simple)
+        , mCompletedPresents(64 * 1024)
+        , mCompletedPresentsEvent(CreateEventA(nullptr, FALSE, FALSE, nullptr))
+        , mWakeupTimer(CreateWaitableTimerA(nullptr, FALSE, nullptr))
+        , mNTProcessEvents(4 * 1024)
+    {
+    }
     ~PMTraceConsumer();
 
     EventMetadata mMetadata;
 
+    // Storage for all PresentEvents created by this consumer.  This is
+    // declared before any of the containers below so that it is destroyed
+    // after them.
+    PresentEventPool mPresentEventPool;
+
     bool mFilteredEvents;
     bool mSimpleMode;
 
+    // If true, the consumer waits for the output thread to make room when a
+    // queue of completed events is full (e.g., when consuming an ETL file).
+    // Otherwise, the event is dropped and counted as an overflow.
+    bool mWaitForOutput = false;
+
+    // Presents that never receive their completing event would otherwise stay
+    // in the tracking containers forever, and block every later present on
+    // the same swapchain from being dequeued.  Presents still in flight after
+    // mPresentTimeoutQpc, or the oldest presents once mMaxInFlightPresents are
+    // in flight, are evicted (completed with their current FinalState) in
+    // submission order.  A value of zero disables each check.
+    //
+    // mMaxInFlightPresents limits the number of presents, not memory, but
+    // each present is a fixed size (plus the presents riding along with a DWM
+    // present) so it bounds memory use as well.
+    uint64_t mPresentTimeoutQpc = 0;
+    uint64_t mNextEvictionQpc = 0;      // When the oldest in-flight present times out
+    size_t mMaxInFlightPresents = 0;
+    size_t mInFlightPresentCount = 0;   // Presents in mPresentsByProcessAndSwapChain
+    uint32_t mTimedOutPresentCount = 0;   // Protected by mMutex
+    uint32_t mOverLimitPresentCount = 0;  // Protected by mMutex
+
+    void SetPresentEvictionLimits(uint64_t timeoutQpc, size_t maxInFlightPresents)
+    {
+        mPresentTimeoutQpc = timeoutQpc;
+        mMaxInFlightPresents = maxInFlightPresents;
+    }
+
+    // Evicts the presents that have timed out as of trace time now.  This is
+    // called for every event, so that presents are evicted even if nothing
+    // else happens to their process.
+    void EvictTimedOutPresents(uint64_t now)
+    {
+        if (mPresentTimeoutQpc != 0 && now >= mNextEvictionQpc) {
+            EvictPresents(now);
+        }
+    }
+
+    void GetEvictedPresentCounts(uint32_t* timedOutCount, uint32_t* overLimitCount)
+    {
+        auto lock = scoped_lock(mMutex);
+        *timedOutCount = mTimedOutPresentCount;
+        *overLimitCount = mOverLimitPresentCount;
+    }
+
+    // Returns true if any present that started before qpcTime hasn't been
+    // completed yet.  Used to stop reading an ETL file once the presents of
+    // interest are done.
+    bool HasInFlightPresentsBefore(uint64_t qpcTime) const;
+
     std::mutex mMutex;
     // A set of presents that are "completed":
     // They progressed as far as they can through the pipeline before being either discarded or hitting the screen.
-    // These will be handed off to the consumer thread.
-    std::vector<std::shared_ptr<PresentEvent>> mCompletedPresents;
+    // These will be handed off to the output thread.
+    SpscRing<PresentEventPtr> mCompletedPresents;
+
+    // Auto-reset event signalled when completed presents are ready, so the
+    // output thread can wait on it instead of polling.  To limit the number
+    // of wakeups, it is only signalled once mWakeupPresentCount presents have
+    // completed since the last signal, or when a present completes at least
+    // mWakeupIntervalQpc (measured with QueryPerformanceCounter()) after the
+    // last signal.
+    //
+    // So that presents aren't left waiting when no more complete, the first
+    // present that isn't signalled also starts mWakeupTimer, which the output
+    // thread waits on as well.  It expires mWakeupInterval100ns later.
+    HANDLE mCompletedPresentsEvent;
+    HANDLE mWakeupTimer;
+    uint32_t mWakeupPresentCount = 1;
+    uint64_t mWakeupIntervalQpc = 0;
+    int64_t mWakeupInterval100ns = 0;
+    uint32_t mUnsignalledPresentCount = 0;
+    uint64_t mLastSignalQpc = 0;
+    bool mWakeupTimerSet = false;
+
+    // The interval is measured on the wall clock, not the trace's, so it is
+    // converted with QueryPerformanceFrequency() even when the events come
+    // from a file recorded with another clock.
+    void SetOutputWakeup(uint32_t presentCount, uint32_t intervalMicroseconds)
+    {
+        LARGE_INTEGER qpcFrequency = {};
+        QueryPerformanceFrequency(&qpcFrequency);
+        mWakeupPresentCount = presentCount;
+        mWakeupIntervalQpc = intervalMicroseconds * (uint64_t) qpcFrequency.QuadPart / 1000000;
+        mWakeupInterval100ns = intervalMicroseconds * 10ll;
+    }
 
     // For each process, stores each in-progress present in order. Used for present batching
-    std::map<uint32_t, std::map<uint64_t, std::shared_ptr<PresentEvent>>> mPresentsByProcess;
+    std::map<uint32_t, std::map<uint64_t, PresentEventPtr>> mPresentsByProcess;
+
+    // For each process, stores the in-progress presents whose PresentMode is
+    // still unknown, in the order they were created.  Used to find the next
+    // batched present without searching mPresentsByProcess.  Presents that
+    // have since been classified or completed are removed lazily: from the
+    // ends of the list as they're seen there, and from the middle when the
+    // list is compacted, once it has doubled in size since it was last
+    // compacted.
+    struct UnclassifiedPresents {
+        std::deque<PresentEventPtr> mPresents;
+        size_t mCompactedSize;  // mPresents.size() after the last compaction
+
+        UnclassifiedPresents() : mCompactedSize(0) {}
+    };
+    FlatHashMap<uint32_t, UnclassifiedPresents> mUnclassifiedPresentsByProcess;
+
+    // Every present that hasn't been completed, in the order they were
+    // created.  Used to find the oldest in-flight present for eviction.
+    // Completed presents are removed from the front as soon as they get there,
+    // and from the middle when the list is compacted (as above).
+    std::deque<PresentEventPtr> mInFlightPresents;
+    size_t mInFlightPresentsCompactedSize = 0;
 
     // For each (process, swapchain) pair, stores each present started. Used to ensure consumer sees presents targeting the same swapchain in the order they were submitted.
     typedef std::tuple<uint32_t, uint64_t> ProcessAndSwapChainKey;
-    std::map<ProcessAndSwapChainKey, std::deque<std::shared_ptr<PresentEvent>>> mPresentsByProcessAndSwapChain;
+    std::map<ProcessAndSwapChainKey, std::deque<PresentEventPtr>> mPresentsByProcessAndSwapChain;
 
     // Presents in the process of being submitted
     // The first map contains a single present that is currently in-between a set of expected events on the same thread:
     //   (e.g. DXGI_Present_Start/DXGI_Present_Stop, or Flip/QueueSubmit)
     // Used for mapping from runtime events to future events, and thread map used extensively for correlating kernel events
-    std::map<uint32_t, std::shared_ptr<PresentEvent>> mPresentByThreadId;
+    FlatHashMap<uint32_t, PresentEventPtr> mPresentByThreadId;
 
     // Maps from queue packet submit sequence
     // Used for Flip -> MMIOFlip -> VSyncDPC for FS, for PresentHistoryToken -> MMIOFlip -> VSyncDPC for iFlip,
     // and for Blit Submission -> Blit completion for FS Blit
-    std::map<uint32_t, std::shared_ptr<PresentEvent>> mPresentsBySubmitSequence;
+    FlatHashMap<uint32_t, PresentEventPtr> mPresentsBySubmitSequence;
 
     // Win32K present history tokens are uniquely identified by (composition surface pointer, present count, bind id)
     // Using a tuple instead of named struct simply to have auto-generated comparison operators
     // These tokens are used for "flip model" presents (windowed flip, dFlip, iFlip) only
     typedef std::tuple<uint64_t, uint64_t, uint64_t> Win32KPresentHistoryTokenKey;
-    std::map<Win32KPresentHistoryTokenKey, std::shared_ptr<PresentEvent>> mWin32KPresentHistoryTokens;
+    struct Win32KPresentHistoryTokenHash {
+        uint64_t operator()(Win32KPresentHistoryTokenKey const& key) const
+        {
+            // The composition surface LUID identifies the swapchain and the
+            // present count increments each present, so combine them such
+            // that consecutive presents don't collide.
+            auto h = std::get<0>(key);
+            h = (h ^ (h >> 31)) * 0xBF58476D1CE4E5B9ull ^ std::get<1>(key);
+            h = (h ^ (h >> 31)) * 0x94D049BB133111EBull ^ std::get<2>(key);
+            return h ^ (h >> 31);
+        }
+    };
+    FlatHashMap<Win32KPresentHistoryTokenKey, PresentEventPtr, Win32KPresentHistoryTokenHash> mWin32KPresentHistoryTokens;
 
     // DxgKrnl present history tokens are uniquely identified and used for all
     // types of windowed presents to track a "ready" time.
@@ -223,11 +488,11 @@ struct PMTraceConsumer
     // The following events lookup presents based on this token:
     // Dwm_Event_FlipChain_Pending, Dwm_Event_FlipChain_Complete,
     // Dwm_Event_FlipChain_Dirty,
-    std::map<uint64_t, std::shared_ptr<PresentEvent>> mDxgKrnlPresentHistoryTokens;
+    FlatHashMap<uint64_t, PresentEventPtr> mDxgKrnlPresentHistoryTokens;
 
     // For blt presents on Win7, it's not possible to distinguish between DWM-off or fullscreen blts, and the DWM-on blt to redirection bitmaps.
     // The best we can do is make the distinction based on the next packet submitted to the context. If it's not a PHT, it's not going to DWM.
-    std::map<uint64_t, std::shared_ptr<PresentEvent>> mBltsByDxgContext;
+    FlatHashMap<uint64_t, PresentEventPtr> mBltsByDxgContext;
 
     // mLastWindowPresent is used as storage for presents handed off to DWM.
     //
@@ -247,40 +512,30 @@ struct PMTraceConsumer
     // For Win32K-tracked events, Win32K_Event_TokenStateChanged InFrame will
     // set mLastWindowPresent (and set any current present as discarded), and
     // Win32K_Event_TokenStateChanged Confirmed will clear mLastWindowPresent.
-    std::map<uint64_t, std::shared_ptr<PresentEvent>> mLastWindowPresent;
+    FlatHashMap<uint64_t, PresentEventPtr> mLastWindowPresent;
 
-    // Presents that will be completed by DWM's next present
-    std::deque<std::shared_ptr<PresentEvent>> mPresentsWaitingForDWM;
+    // Presents that will be completed by DWM's next present.  If DWM doesn't
+    // present, presents can be evicted while waiting, so completed presents
+    // are removed when the list is compacted (as above).
+    std::vector<PresentEventPtr> mPresentsWaitingForDWM;
+    size_t mPresentsWaitingForDWMCompactedSize = 0;
     // Used to understand that a flip event is coming from the DWM
     uint32_t DwmPresentThreadId = 0;
 
     // Yet another unique way of tracking present history tokens, this time from DxgKrnl -> DWM, only for legacy blit
-    std::map<uint64_t, std::shared_ptr<PresentEvent>> mPresentsByLegacyBlitToken;
+    FlatHashMap<uint64_t, PresentEventPtr> mPresentsByLegacyBlitToken;
 
     // Process events
-    std::mutex mNTProcessEventMutex;
-    std::vector<NTProcessEvent> mNTProcessEvents;
+    SpscRing<NTProcessEvent> mNTProcessEvents;
 
     bool DequeueProcessEvents(std::vector<NTProcessEvent>& outProcessEvents)
     {
-        if (mNTProcessEvents.empty()) {
-            return false;
-        }
-
-        auto lock = scoped_lock(mNTProcessEventMutex);
-        outProcessEvents.swap(mNTProcessEvents);
-        return true;
+        return mNTProcessEvents.PopAll(&outProcessEvents);
     }
 
-    bool DequeuePresents(std::vector<std::shared_ptr<PresentEvent>>& outPresents)
+    bool DequeuePresents(std::vector<PresentEventPtr>& outPresents)
     {
-        if (mCompletedPresents.empty()) {
-            return false;
-        }
-
-        auto lock = scoped_lock(mMutex);
-        outPresents.swap(mCompletedPresents);
-        return true;
+        return mCompletedPresents.PopAll(&outPresents);
     }
 
     void HandleDxgkBlt(EVENT_HEADER const& hdr, uint64_t hwnd, bool redirectedPresent);
@@ -293,11 +548,15 @@ struct PMTraceConsumer
     void HandleDxgkSubmitPresentHistoryEventArgs(EVENT_HEADER const& hdr, uint64_t token, uint64_t tokenData, PresentMode knownPresentMode);
     void HandleDxgkPropagatePresentHistoryEventArgs(EVENT_HEADER const& hdr, uint64_t token);
 
-    void CompletePresent(std::shared_ptr<PresentEvent> p, uint32_t recurseDepth=0);
-    std::shared_ptr<PresentEvent> FindBySubmitSequence(uint32_t submitSequence);
+    void CompletePresent(PresentEventPtr p, uint32_t recurseDepth=0);
+    void SignalCompletedPresents(bool force);
+    void EvictPresents(uint64_t now);
+    void EvictPresent(PresentEventPtr p);
+    void AddPresentWaitingForDWM(PresentEventPtr const& p);
+    PresentEventPtr FindBySubmitSequence(uint32_t submitSequence);
     decltype(mPresentByThreadId.begin()) FindOrCreatePresent(EVENT_HEADER const& hdr);
-    decltype(mPresentByThreadId.begin()) CreatePresent(std::shared_ptr<PresentEvent> present, decltype(mPresentsByProcess.begin()->second)& processMap);
-    void CreatePresent(std::shared_ptr<PresentEvent> present);
+    decltype(mPresentByThreadId.begin()) CreatePresent(PresentEventPtr const& present, decltype(mPresentsByProcess.begin()->second)& processMap);
+    void CreatePresent(PresentEventPtr const& present);
     void RuntimePresentStop(EVENT_HEADER const& hdr, bool AllowPresentBatching);
 
     void HandleNTProcessEvent(EVENT_RECORD* pEventRecord);
@@ -0,0 +1,72 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include "ColumnarFile.hpp" // ColumnarPresent, ColumnarProcessName
+
+// PresentMon's -output_pipe sends each client that connects to the named pipe
+// a stream of messages.  Each message is a PresentStreamMessageHeader followed
+// by mSize bytes:
+//
+//   PresentStreamMessageType::Hello: a PresentStreamHello.  This is always
+//   the first message.
+//
+//   PresentStreamMessageType::ProcessName: a ColumnarProcessName followed by
+//   the process's name (not NUL-terminated), padded to 8 bytes.  Presents are
+//   sent in batches, and each batch starts with the names of its presents'
+//   processes, so a client has them however late it connected.
+//
+//   PresentStreamMessageType::Present: a ColumnarPresent, in the order they
+//   are output to the CSV.
+//
+//   PresentStreamMessageType::Dropped: a PresentStreamDropped, sent when
+//   presents weren't sent to the client because it fell behind.
+//
+// Clients should skip message types they don't know.
+enum class PresentStreamMessageType : uint32_t {
+    Hello = 1,
+    ProcessName = 2,
+    Present = 3,
+    Dropped = 4,
+};
+
+struct PresentStreamMessageHeader {
+    PresentStreamMessageType mType;
+    uint32_t mSize;
+};
+
+struct PresentStreamHello {
+    char mMagic[8];                             // PRESENT_STREAM_MAGIC
+    uint32_t mVersion;                          // PRESENT_STREAM_VERSION
+    uint32_t mPresentSize;                      // sizeof(ColumnarPresent)
+    uint64_t mQpcFrequency;
+    uint64_t mStartQpc;                         // QPC time that the CSV's TimeInSeconds are relative to
+};
+
+struct PresentStreamDropped {
+    uint64_t mPresentCount;                     // Presents dropped since the previous message
+};
+
+char const PRESENT_STREAM_MAGIC[8] = { 'P', 'M', 'S', 'T', 'R', 'E', 'A', 'M' };
+uint32_t const PRESENT_STREAM_VERSION = 1;
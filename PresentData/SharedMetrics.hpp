@@ -0,0 +1,163 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <windows.h>
+
+// With -shared_memory NAME, PresentMon publishes the current metrics of each
+// swap chain it's tracking (the ones shown in the console) into a named file
+// mapping, which any number of other processes can read without making any
+// system calls once it's mapped:
+//
+//     auto mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, NAME);
+//     auto header = GetSharedMetricsHeader(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+//     for (uint32_t i = 0, n = header->mSwapChainCount.load(); i < n; ++i) {
+//         SharedSwapChainMetrics metrics;
+//         if (ReadSharedSwapChainMetrics(header, i, &metrics) == SharedMetricsReadResult::Read &&
+//             metrics.mProcessId == GetCurrentProcessId()) ...
+//     }
+//
+// The mapping is a SharedMetricsHeader followed by mSwapChainCapacity
+// SharedSwapChainSlots.  Each swap chain keeps its slot until its process
+// exits, and then the slot is reused.  PresentMon only writes the mapping;
+// each slot is a sequence lock, so a reader retries if PresentMon updated the
+// slot while it was being copied, and never holds PresentMon up.
+struct SharedSwapChainMetrics {
+    uint32_t mProcessId;                        // 0 if the slot isn't in use
+    uint32_t mReserved0;
+    uint64_t mSwapChainAddress;
+    uint64_t mLastPresentQpc;                   // QPC time of the swap chain's latest present
+    uint64_t mPresentCount;                     // Presents since PresentMon started tracking the swap chain
+    char mProcessName[64];                      // NUL-terminated, truncated if needed
+
+    // The averages over the latest presents (up to 120), as shown in the
+    // console.  The displayed rate and latency are 0 with -simple, or if too
+    // few of the presents were displayed.
+    float mMsPerFrame;
+    float mFps;
+    float mDisplayedFps;
+    float mMsLatency;
+    float mMsBetweenPresents;                   // The latest present's MsBetweenPresents
+
+    // Percentiles of all the presents' frame time (MsBetweenPresents) and
+    // latency (MsUntilDisplayed), whether recorded or not; or 0 if there
+    // aren't any yet.
+    float mFrameTimeP50;
+    float mFrameTimeP95;
+    float mFrameTimeP99;
+    float mLowFps1;                             // 1% low frame rate
+    float mLatencyP50;
+    float mLatencyP95;
+    float mLatencyP99;
+
+    int32_t mSyncInterval;                      // The latest present's
+    uint32_t mPresentFlags;                     // The latest present's
+    uint8_t mRuntime;                           // The latest present's Runtime (see PresentMonTraceConsumer.hpp)
+    uint8_t mPresentMode;                       // The latest displayed present's PresentMode (or the latest present's)
+    uint8_t mReserved1[6];
+};
+
+struct SharedSwapChainSlot {
+    std::atomic<uint32_t> mSequence;            // Odd while PresentMon is updating mMetrics
+    uint32_t mReserved;
+    SharedSwapChainMetrics mMetrics;
+};
+
+struct SharedMetricsHeader {
+    char mMagic[8];                             // SHARED_METRICS_MAGIC
+    uint32_t mVersion;                          // SHARED_METRICS_VERSION
+    uint32_t mHeaderSize;                       // sizeof(SharedMetricsHeader), the offset of the first slot
+    uint32_t mSlotSize;                         // sizeof(SharedSwapChainSlot)
+    uint32_t mSwapChainCapacity;                // Number of slots
+    uint64_t mQpcFrequency;
+    std::atomic<uint32_t> mSwapChainCount;      // Slots that have been used; the rest are empty
+    std::atomic<uint32_t> mUpdateCount;         // Incremented each time PresentMon publishes, so readers can tell if it's running
+};
+
+char const SHARED_METRICS_MAGIC[8] = { 'P', 'M', 'M', 'E', 'T', 'R', 'I', 'C' };
+uint32_t const SHARED_METRICS_VERSION = 1;
+
+// Returns the header of a mapped view, or nullptr if it isn't a mapping that
+// this header can read.
+inline SharedMetricsHeader const* GetSharedMetricsHeader(void const* view)
+{
+    auto header = (SharedMetricsHeader const*) view;
+    if (header == nullptr ||
+        memcmp(header->mMagic, SHARED_METRICS_MAGIC, sizeof(header->mMagic)) != 0 ||
+        header->mVersion != SHARED_METRICS_VERSION ||
+        header->mSlotSize != sizeof(SharedSwapChainSlot)) {
+        return nullptr;
+    }
+    return header;
+}
+
+inline SharedSwapChainSlot const* GetSharedSwapChainSlot(SharedMetricsHeader const* header, uint32_t index)
+{
+    return (SharedSwapChainSlot const*) ((char const*) header + header->mHeaderSize + (size_t) index * header->mSlotSize);
+}
+
+// How many times ReadSharedSwapChainMetrics() tries to copy a slot, and how
+// many of those tries spin before it starts yielding the rest of its time
+// slice to PresentMon's output thread between tries.
+enum {
+    SHARED_METRICS_READ_MAX_ATTEMPTS = 256,
+    SHARED_METRICS_READ_SPIN_ATTEMPTS = 8,
+};
+
+enum class SharedMetricsReadResult {
+    Read,       // metrics holds the slot's swap chain
+    Unused,     // The slot isn't in use
+    Busy,       // The slot was still mid-update after SHARED_METRICS_READ_MAX_ATTEMPTS tries
+};
+
+// Copies a slot's metrics, retrying while PresentMon is updating it.  An
+// update only copies a few hundred bytes, so the first few retries just spin;
+// after that the reader calls Sleep(0) between tries, in case it is sharing a
+// processor with PresentMon and is holding the update up.  A slot that stays
+// Busy means PresentMon exited (or was killed) part way through writing it,
+// and the update will never finish.
+inline SharedMetricsReadResult ReadSharedSwapChainMetrics(SharedMetricsHeader const* header, uint32_t index, SharedSwapChainMetrics* metrics)
+{
+    auto slot = GetSharedSwapChainSlot(header, index);
+    for (uint32_t attempt = 0; attempt < SHARED_METRICS_READ_MAX_ATTEMPTS; ++attempt) {
+        if (attempt < SHARED_METRICS_READ_SPIN_ATTEMPTS) {
+            if (attempt > 0) {
+                YieldProcessor();
+            }
+        } else {
+            Sleep(0);
+        }
+
+        auto sequence = slot->mSequence.load(std::memory_order_acquire);
+        if ((sequence & 1) == 0) {
+            memcpy(metrics, &slot->mMetrics, sizeof(*metrics));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->mSequence.load(std::memory_order_relaxed) == sequence) {
+                return metrics->mProcessId != 0 ? SharedMetricsReadResult::Read : SharedMetricsReadResult::Unused;
+            }
+        }
+    }
+    return SharedMetricsReadResult::Busy;
+}
@@ -0,0 +1,170 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <new>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+
+// SmallVector is a vector that stores up to N elements inline, and only
+// allocates from the heap once it grows past that.  It is used for the short
+// per-present lists that are created and destroyed for most presents (e.g.,
+// the presents riding along with a DWM present), so that they usually don't
+// allocate at all.
+//
+// Only the operations that PresentData needs are provided; it can be moved
+// and swapped but not copied.
+
+template<typename T, size_t N>
+class SmallVector {
+public:
+    typedef T value_type;
+    typedef T* iterator;
+    typedef T const* const_iterator;
+
+    SmallVector()
+        : mData(InlineData())
+        , mSize(0)
+        , mCapacity(N)
+    {
+    }
+
+    SmallVector(SmallVector&& rhs) noexcept
+        : mData(InlineData())
+        , mSize(0)
+        , mCapacity(N)
+    {
+        MoveFrom(&rhs);
+    }
+
+    ~SmallVector()
+    {
+        clear();
+        if (mData != InlineData()) {
+            ::operator delete(mData);
+        }
+    }
+
+    SmallVector& operator=(SmallVector&& rhs) noexcept
+    {
+        if (this != &rhs) {
+            clear();
+            if (mData != InlineData()) {
+                ::operator delete(mData);
+                mData = InlineData();
+                mCapacity = N;
+            }
+            MoveFrom(&rhs);
+        }
+        return *this;
+    }
+
+    void swap(SmallVector& rhs)
+    {
+        SmallVector tmp(std::move(rhs));
+        rhs = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    size_t size() const { return mSize; }
+    size_t capacity() const { return mCapacity; }
+    bool empty() const { return mSize == 0; }
+
+    iterator begin() { return mData; }
+    iterator end() { return mData + mSize; }
+    const_iterator begin() const { return mData; }
+    const_iterator end() const { return mData + mSize; }
+
+    T& operator[](size_t index) { return mData[index]; }
+    T const& operator[](size_t index) const { return mData[index]; }
+
+    template<typename... Args>
+    T& emplace_back(Args&&... args)
+    {
+        if (mSize == mCapacity) {
+            Grow();
+        }
+        new (mData + mSize) T(std::forward<Args>(args)...);
+        mSize += 1;
+        return mData[mSize - 1];
+    }
+
+    // Destroys the elements but keeps any heap storage for reuse.  An
+    // element's destructor may release the object that owns this vector's
+    // elements, so the vector is emptied before any of them are destroyed.
+    void clear()
+    {
+        auto size = mSize;
+        mSize = 0;
+        for (size_t i = 0; i < size; ++i) {
+            mData[i].~T();
+        }
+    }
+
+private:
+    SmallVector(SmallVector const& copy); // dne
+    SmallVector& operator=(SmallVector const& copy); // dne
+
+    T* InlineData() { return reinterpret_cast<T*>(mInline); }
+
+    // Takes rhs's elements, leaving it empty.  This vector must be empty and
+    // using its inline storage.
+    void MoveFrom(SmallVector* rhs)
+    {
+        if (rhs->mData != rhs->InlineData()) {
+            mData = rhs->mData;
+            mSize = rhs->mSize;
+            mCapacity = rhs->mCapacity;
+            rhs->mData = rhs->InlineData();
+            rhs->mSize = 0;
+            rhs->mCapacity = N;
+            return;
+        }
+
+        for (size_t i = 0; i < rhs->mSize; ++i) {
+            new (mData + i) T(std::move(rhs->mData[i]));
+        }
+        mSize = rhs->mSize;
+        rhs->clear();
+    }
+
+    void Grow()
+    {
+        auto capacity = mCapacity * 2;
+        auto data = static_cast<T*>(::operator new(capacity * sizeof(T)));
+        for (size_t i = 0; i < mSize; ++i) {
+            new (data + i) T(std::move(mData[i]));
+            mData[i].~T();
+        }
+        if (mData != InlineData()) {
+            ::operator delete(mData);
+        }
+        mData = data;
+        mCapacity = capacity;
+    }
+
+    T* mData;
+    size_t mSize;
+    size_t mCapacity;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type mInline[N];
+};
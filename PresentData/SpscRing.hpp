@@ -0,0 +1,123 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+#include <windows.h>
+
+// SpscRing is a bounded, lock-free queue used to hand completed events from
+// the ETW consumer thread (the only producer) to the output thread (the only
+// consumer).  The producer never blocks on the consumer: Push() either drops
+// the value and counts it as an overflow, or waits for room if the caller
+// asks it to (e.g., when consuming an ETL file, where nothing is lost by
+// waiting).
+//
+// mHead and mTail only ever increase; the slot index is the value modulo the
+// (power-of-two) capacity.  The producer owns mTail and the consumer owns
+// mHead, and they are kept on separate cache lines so that the two threads
+// don't contend on them.
+
+template<typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity)
+        : mCapacity(1)
+    {
+        while (mCapacity < capacity) {
+            mCapacity *= 2;
+        }
+        mSlots = new T [mCapacity];
+        mHead = 0;
+        mTail = 0;
+        mOverflowCount = 0;
+    }
+
+    ~SpscRing()
+    {
+        delete[] mSlots;
+    }
+
+    // Producer: add value to the ring, returning false if it is full.
+    bool TryPush(T const& value)
+    {
+        auto tail = mTail.load(std::memory_order_relaxed);
+        if (tail - mHead.load(std::memory_order_acquire) == mCapacity) {
+            return false;
+        }
+        mSlots[(size_t) (tail & (mCapacity - 1))] = value;
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Producer: add value to the ring.  If the ring is full, either wait for
+    // the consumer to make room or drop the value and count it as an overflow.
+    bool Push(T const& value, bool waitForSpace)
+    {
+        while (!TryPush(value)) {
+            if (!waitForSpace) {
+                mOverflowCount.store(mOverflowCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return false;
+            }
+            Sleep(1);
+        }
+        return true;
+    }
+
+    // Consumer: move all available values onto the end of out, returning
+    // whether any were added.
+    bool PopAll(std::vector<T>* out)
+    {
+        auto head = mHead.load(std::memory_order_relaxed);
+        auto tail = mTail.load(std::memory_order_acquire);
+        if (head == tail) {
+            return false;
+        }
+        out->reserve(out->size() + (size_t) (tail - head));
+        for (; head != tail; ++head) {
+            auto& slot = mSlots[(size_t) (head & (mCapacity - 1))];
+            out->emplace_back(std::move(slot));
+            slot = T();
+        }
+        mHead.store(head, std::memory_order_release);
+        return true;
+    }
+
+    // The number of values dropped by Push().  Safe to call from any thread.
+    uint64_t OverflowCount() const
+    {
+        return mOverflowCount.load(std::memory_order_relaxed);
+    }
+
+private:
+    SpscRing(SpscRing const& copy); // dne
+    SpscRing& operator=(SpscRing const& copy); // dne
+
+    T* mSlots;
+    size_t mCapacity;
+    uint8_t mPad0[64];
+    std::atomic<uint64_t> mHead;
+    uint8_t mPad1[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> mTail;
+    std::atomic<uint64_t> mOverflowCount;
+};
@@ -159,7 +159,7 @@ uint32_t GetPropertyDataOffset(TRACE_EVENT_INFO const& tei, EVENT_RECORD const&
     return offset;
 }
 
-TRACE_EVENT_INFO* GetTraceEventInfo(EventMetadata* metadata, EVENT_RECORD* eventRecord)
+EventMetadataInfo* GetEventMetadataInfo(EventMetadata* metadata, EVENT_RECORD* eventRecord)
 {
     // Look up stored metadata
     EventMetadataKey key;
@@ -173,13 +173,131 @@ TRACE_EVENT_INFO* GetTraceEventInfo(EventMetadata* metadata, EVENT_RECORD* event
         auto status = TdhGetEventInformation(eventRecord, 0, nullptr, nullptr, &bufferSize);
         assert(status == ERROR_INSUFFICIENT_BUFFER);
 
-        ii = metadata->metadata_.emplace(key, std::vector<uint8_t>(bufferSize, 0)).first;
+        ii = metadata->metadata_.emplace(key, EventMetadataInfo()).first;
+        ii->second.teiData_.resize(bufferSize, 0);
 
-        status = TdhGetEventInformation(eventRecord, 0, nullptr, (TRACE_EVENT_INFO*) ii->second.data(), &bufferSize);
+        status = TdhGetEventInformation(eventRecord, 0, nullptr, (TRACE_EVENT_INFO*) ii->second.teiData_.data(), &bufferSize);
         assert(status == ERROR_SUCCESS);
     }
 
-    return (TRACE_EVENT_INFO*) ii->second.data();
+    return &ii->second;
+}
+
+// Returns true if the property's size can be determined from the metadata
+// alone (i.e., without looking at the event data).
+bool IsFixedSizeProperty(TRACE_EVENT_INFO const& tei, uint32_t index)
+{
+    auto const& epi = tei.EventPropertyInfoArray[index];
+
+    if (epi.Flags & (PropertyParamLength | PropertyParamCount)) {
+        return false;
+    }
+
+    if (epi.Flags & PropertyStruct) {
+        for (USHORT i = 0; i < epi.structType.NumOfStructMembers; ++i) {
+            if (!IsFixedSizeProperty(tei, epi.structType.StructStartIndex + i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    switch (epi.nonStructType.InType) {
+    case TDH_INTYPE_UNICODESTRING:
+    case TDH_INTYPE_ANSISTRING: return epi.length != 0;
+    case TDH_INTYPE_WBEMSID:    return false;
+    }
+
+    return true;
+}
+
+// Resolve the offsets of all properties up to, and including, the first one
+// that isn't fixed size.  Pointer-sized properties depend on the event's
+// header flags, so the caller keeps a separate layout for each pointer size.
+void InitializeEventLayout(EventLayout* layout, TRACE_EVENT_INFO const& tei, EVENT_RECORD const& eventRecord)
+{
+    layout->properties_.reserve(tei.TopLevelPropertyCount);
+
+    for (uint32_t i = 0, offset = 0; i < tei.TopLevelPropertyCount; ++i) {
+        EventLayout::Property prop = {};
+        prop.name_   = TEI_PROPERTY_NAME(&tei, &tei.EventPropertyInfoArray[i]);
+        prop.offset_ = offset;
+
+        if (!IsFixedSizeProperty(tei, i)) {
+            layout->properties_.emplace_back(prop);
+            break;
+        }
+
+        prop.status_ = PROP_STATUS_FOUND;
+        GetPropertySize(tei, eventRecord, i, offset, &prop.size_, &prop.count_, &prop.status_);
+        layout->properties_.emplace_back(prop);
+
+        offset += prop.size_ * prop.count_;
+    }
+
+    layout->initialized_ = true;
+}
+
+// FNV-1a
+uint32_t HashPropertyName(wchar_t const* name)
+{
+    uint32_t hash = 2166136261u;
+    for (; *name != L'\0'; ++name) {
+        hash = (hash ^ (uint32_t) *name) * 16777619u;
+    }
+    return hash;
+}
+
+// Find the index of the named top-level property in the event's metadata, or
+// UINT32_MAX if the event doesn't have it.  Indices below
+// layout->properties_.size() are at a fixed offset.
+//
+// Found properties are cached in the layout (i.e., per event descriptor) by
+// property index, and a cached index is only used if that property's name
+// matches, so the result doesn't depend on where the caller's string is
+// stored.  Names the event doesn't have aren't cached.
+uint32_t FindLayoutProperty(EventLayout* layout, TRACE_EVENT_INFO const& tei, wchar_t const* name)
+{
+    auto nameHash = HashPropertyName(name);
+    for (auto const& lookup : layout->lookups_) {
+        if (lookup.nameHash_ == nameHash &&
+            wcscmp(TEI_PROPERTY_NAME(&tei, &tei.EventPropertyInfoArray[lookup.index_]), name) == 0) {
+            return lookup.index_;
+        }
+    }
+
+    for (uint32_t i = 0; i < tei.TopLevelPropertyCount; ++i) {
+        if (wcscmp(TEI_PROPERTY_NAME(&tei, &tei.EventPropertyInfoArray[i]), name) == 0) {
+            EventLayout::Lookup lookup = { nameHash, i };
+            layout->lookups_.emplace_back(lookup);
+            return i;
+        }
+    }
+
+    return UINT32_MAX;
+}
+
+EventLayout* GetEventLayout(EventMetadata* metadata, EVENT_RECORD* eventRecord, TRACE_EVENT_INFO const** outTei)
+{
+    auto info = GetEventMetadataInfo(metadata, eventRecord);
+    auto tei = (TRACE_EVENT_INFO const*) info->teiData_.data();
+    auto layout = &info->layout_[(eventRecord->EventHeader.Flags & EVENT_HEADER_FLAG_64_BIT_HEADER) ? 1 : 0];
+    if (!layout->initialized_) {
+        InitializeEventLayout(layout, *tei, *eventRecord);
+    }
+
+    *outTei = tei;
+    return layout;
+}
+
+void SetEventDataDesc(EventDataDesc* desc, EVENT_RECORD const& eventRecord, uint32_t offset, uint32_t size, uint32_t count, uint32_t status)
+{
+    assert(desc->arrayIndex_ < count);
+    (void) count;
+
+    desc->data_   = (void*) ((uintptr_t) eventRecord.UserData + offset + desc->arrayIndex_ * size);
+    desc->size_   = size;
+    desc->status_ = status;
 }
 
 }
@@ -210,53 +328,115 @@ void EventMetadata::AddMetadata(EVENT_RECORD* eventRecord)
             return; // Don't store tracelogging metadata
         }
 
-        // Store metadata (overwriting any previous)
+        // Store metadata (overwriting any previous, along with the layouts
+        // that were resolved from it)
         EventMetadataKey key;
         key.guid_ = tei->ProviderGuid;
         key.desc_ = tei->EventDescriptor;
-        metadata_[key].assign(userData, userData + eventRecord->UserDataLength);
+        auto& info = metadata_[key];
+        info.teiData_.assign(userData, userData + eventRecord->UserDataLength);
+        info.layout_[0] = EventLayout();
+        info.layout_[1] = EventLayout();
     }
 }
 
 // Look up metadata for this provider/event and use it to look up the property.
 // If the metadata isn't found look it up using TDH.  Then, look up each
 // property in the metadata to obtain it's data pointer and size.
+//
+// Properties at a fixed offset are found through the cached EventLayout; the
+// remaining properties are found by walking the event data from the end of
+// the fixed properties.
 void EventMetadata::GetEventData(EVENT_RECORD* eventRecord, EventDataDesc* desc, uint32_t descCount, uint32_t optionalCount /*=0*/)
 {
-    // Look up metadata
-    auto tei = GetTraceEventInfo(this, eventRecord);
+    // Look up metadata and layout
+    TRACE_EVENT_INFO const* tei = nullptr;
+    auto layout = GetEventLayout(this, eventRecord, &tei);
 
-    // Lookup properties in metadata
+    // Look up properties in the layout
     uint32_t foundCount = 0;
-    for (uint32_t i = 0, offset = 0; i < tei->TopLevelPropertyCount; ++i) {
-        uint32_t size   = 0;
-        uint32_t count  = 0;
-        uint32_t status = PROP_STATUS_FOUND;
-        GetPropertySize(*tei, *eventRecord, i, offset, &size, &count, &status);
+    for (uint32_t j = 0; j < descCount; ++j) {
+        if (desc[j].status_ != PROP_STATUS_NOT_FOUND) {
+            continue;
+        }
 
-        auto propName = TEI_PROPERTY_NAME(tei, &tei->EventPropertyInfoArray[i]);
-        for (uint32_t j = 0; j < descCount; ++j) {
-            if (desc[j].status_ == PROP_STATUS_NOT_FOUND && wcscmp(propName, desc[j].name_) == 0) {
-                assert(desc[j].arrayIndex_ < count);
+        auto index = FindLayoutProperty(layout, *tei, desc[j].name_);
+        if (index >= layout->properties_.size()) {
+            continue;
+        }
 
-                desc[j].data_   = (void*) ((uintptr_t) eventRecord->UserData + offset + desc[j].arrayIndex_ * size);
-                desc[j].size_   = size;
-                desc[j].status_ = status;
+        auto const& prop = layout->properties_[index];
+        if (prop.size_ == 0) {
+            uint32_t size   = 0;
+            uint32_t count  = 0;
+            uint32_t status = PROP_STATUS_FOUND;
+            GetPropertySize(*tei, *eventRecord, index, prop.offset_, &size, &count, &status);
+            SetEventDataDesc(&desc[j], *eventRecord, prop.offset_, size, count, status);
+        } else {
+            SetEventDataDesc(&desc[j], *eventRecord, prop.offset_, prop.size_, prop.count_, prop.status_);
+        }
 
-                foundCount += 1;
-                if (foundCount == descCount) {
-                    return;
+        foundCount += 1;
+    }
+
+    // Walk the event data for any properties past the fixed ones
+    auto propCount = (uint32_t) layout->properties_.size();
+    if (foundCount < descCount && propCount < tei->TopLevelPropertyCount) {
+        auto const& last = layout->properties_.back();
+        uint32_t size   = 0;
+        uint32_t count  = 0;
+        uint32_t status = 0;
+        GetPropertySize(*tei, *eventRecord, propCount - 1, last.offset_, &size, &count, &status);
+
+        for (uint32_t i = propCount, offset = last.offset_ + size * count; i < tei->TopLevelPropertyCount; ++i) {
+            size   = 0;
+            count  = 0;
+            status = PROP_STATUS_FOUND;
+            GetPropertySize(*tei, *eventRecord, i, offset, &size, &count, &status);
+
+            auto propName = TEI_PROPERTY_NAME(tei, &tei->EventPropertyInfoArray[i]);
+            for (uint32_t j = 0; j < descCount; ++j) {
+                if (desc[j].status_ == PROP_STATUS_NOT_FOUND && wcscmp(propName, desc[j].name_) == 0) {
+                    SetEventDataDesc(&desc[j], *eventRecord, offset, size, count, status);
+
+                    foundCount += 1;
+                    if (foundCount == descCount) {
+                        return;
+                    }
                 }
             }
-        }
 
-        offset += size * count;
+            offset += size * count;
+        }
     }
 
     assert(foundCount >= descCount - optionalCount);
     (void) optionalCount;
 }
 
+EventStructReader::EventStructReader(EventMetadata* metadata, EVENT_RECORD* eventRecord)
+    : metadata_(metadata)
+    , eventRecord_(eventRecord)
+{
+    layout_ = GetEventLayout(metadata, eventRecord, &tei_);
+}
+
+// The struct field is valid if the metadata has a property with the same
+// name, at the same fixed offset, and with the same total size.
+bool EventStructReader::IsFieldValid(wchar_t const* name, size_t offset, size_t size)
+{
+    auto index = FindLayoutProperty(layout_, *tei_, name);
+    if (index >= layout_->properties_.size()) {
+        return false;
+    }
+
+    auto const& prop = layout_->properties_[index];
+    return prop.size_ != 0 &&
+           prop.offset_ == offset &&
+           prop.size_ * prop.count_ == size &&
+           offset + size <= eventRecord_->UserDataLength;
+}
+
 namespace {
 
 template <typename T>
@@ -21,6 +21,7 @@ SOFTWARE.
 */
 #pragma once
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string>
@@ -104,8 +105,40 @@ struct EventDataDesc {
     }
 };
 
+// Property offsets resolved from an event's TRACE_EVENT_INFO.  Properties are
+// stored back to back, so every property up to and including the first one
+// whose size depends on the event data (e.g., a null-terminated string or a
+// counted array) is at a fixed offset.  These are computed on the first event
+// seen with a given key and reused for every subsequent one; only properties
+// past that point need to walk the event data.
+struct EventLayout {
+    struct Property {
+        wchar_t const* name_;   // Property name (points into the TRACE_EVENT_INFO)
+        uint32_t offset_;       // Offset of the property data into UserData
+        uint32_t size_;         // Element size, or 0 if it depends on the event data
+        uint32_t count_;        // Element count
+        uint32_t status_;       // PropertyStatus of the property
+    };
+
+    struct Lookup {
+        uint32_t nameHash_;     // Hash of the property name
+        uint32_t index_;        // Index of the property in the TRACE_EVENT_INFO
+    };
+
+    std::vector<Property> properties_;
+    std::vector<Lookup> lookups_;
+    bool initialized_;
+
+    EventLayout() : initialized_(false) {}
+};
+
+struct EventMetadataInfo {
+    std::vector<uint8_t> teiData_;  // TRACE_EVENT_INFO
+    EventLayout layout_[2];         // Indexed by whether the event uses 64-bit pointers
+};
+
 struct EventMetadata {
-    std::unordered_map<EventMetadataKey, std::vector<uint8_t>, EventMetadataKeyHash, EventMetadataKeyEqual> metadata_;
+    std::unordered_map<EventMetadataKey, EventMetadataInfo, EventMetadataKeyHash, EventMetadataKeyEqual> metadata_;
 
     void AddMetadata(EVENT_RECORD* eventRecord);
     void GetEventData(EVENT_RECORD* eventRecord, EventDataDesc* desc, uint32_t descCount, uint32_t optionalCount=0);
@@ -118,5 +151,55 @@ struct EventMetadata {
     }
 };
 
+// Typed access to event properties through the *_Struct layouts declared in
+// the *EventStructs.hpp files.  Field offsets and types come from the struct
+// at compile time, and are checked against the event's metadata (through its
+// cached EventLayout) before being used.  If they don't match, e.g. because
+// the event is a different version than the struct was generated from, the
+// field is looked up by name instead.
+//
+// Use EVENT_STRUCT_FIELD() for structs with a fixed layout, and
+// EVENT_STRUCT_FIELD_PTR() for structs templated on the event's pointer size:
+//
+//     EventStructReader reader(&mMetadata, pEventRecord);
+//     auto FlipInterval = EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Flip_Info_Struct, FlipInterval);
+class EventStructReader {
+    EventMetadata* metadata_;
+    EVENT_RECORD* eventRecord_;
+    TRACE_EVENT_INFO const* tei_;
+    EventLayout* layout_;
+
+    bool IsFieldValid(wchar_t const* name, size_t offset, size_t size);
+
+public:
+    EventStructReader(EventMetadata* metadata, EVENT_RECORD* eventRecord);
+
+    bool Is64Bit() const
+    {
+        return (eventRecord_->EventHeader.Flags & EVENT_HEADER_FLAG_64_BIT_HEADER) != 0;
+    }
+
+    template<typename T> T GetField(wchar_t const* name, size_t offset)
+    {
+        if (IsFieldValid(name, offset, sizeof(T))) {
+            T t;
+            memcpy(&t, (uint8_t const*) eventRecord_->UserData + offset, sizeof(T));
+            return t;
+        }
+        return metadata_->GetEventData<T>(eventRecord_, name);
+    }
+};
+
+#define EVENT_STRUCT_WIDEN_(s) L ## s
+#define EVENT_STRUCT_WIDEN(s) EVENT_STRUCT_WIDEN_(s)
+
+#define EVENT_STRUCT_FIELD(reader, StructT, field) \
+    (reader).GetField<decltype(StructT::field)>(EVENT_STRUCT_WIDEN(#field), offsetof(StructT, field))
+
+#define EVENT_STRUCT_FIELD_PTR(reader, StructT, field) \
+    ((reader).Is64Bit() \
+        ? EVENT_STRUCT_FIELD(reader, StructT<uint64_t>, field) \
+        : EVENT_STRUCT_FIELD(reader, StructT<uint32_t>, field))
+
 template<> std::string EventMetadata::GetEventData<std::string>(EVENT_RECORD* eventRecord, wchar_t const* name, uint32_t arrayIndex);
 template<> std::wstring EventMetadata::GetEventData<std::wstring>(EVENT_RECORD* eventRecord, wchar_t const* name, uint32_t arrayIndex);
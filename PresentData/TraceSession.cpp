@@ -22,6 +22,7 @@ SOFTWARE.
 
 #define WIN32_LEAN_AND_MEAN
 #define VC_EXTRALEAN
+#include <algorithm>
 #include <assert.h>
 #include <stddef.h>
 #include <windows.h>
@@ -29,7 +30,9 @@ SOFTWARE.
 
 #include "TraceSession.hpp"
 
+#include "CaptureFile.hpp"
 #include "Debug.hpp"
+#include "EtlFileReader.hpp"
 #include "PresentMonTraceConsumer.hpp"
 #include "MixedRealityTraceConsumer.hpp"
 
@@ -47,15 +50,61 @@ struct TraceProperties : public EVENT_TRACE_PROPERTIES {
     wchar_t mSessionName[MAX_PATH];
 };
 
+// The event ids handled for each filtered provider.  These are used both to
+// filter the events that the providers send to a realtime session, and to
+// drop any other events (e.g., when reading an ETL file) before they are
+// dispatched.
+USHORT const DXGI_EVENT_IDS[] = {
+    Microsoft_Windows_DXGI::Present_Start::Id,
+    Microsoft_Windows_DXGI::Present_Stop::Id,
+    Microsoft_Windows_DXGI::PresentMultiplaneOverlay_Start::Id,
+    Microsoft_Windows_DXGI::PresentMultiplaneOverlay_Stop::Id,
+};
+
+USHORT const D3D9_EVENT_IDS[] = {
+    Microsoft_Windows_D3D9::Present_Start::Id,
+    Microsoft_Windows_D3D9::Present_Stop::Id,
+};
+
+USHORT const DXGKRNL_EVENT_IDS[] = {
+    Microsoft_Windows_DxgKrnl::Blit_Info::Id,
+    Microsoft_Windows_DxgKrnl::Flip_Info::Id,
+    Microsoft_Windows_DxgKrnl::FlipMultiPlaneOverlay_Info::Id,
+    Microsoft_Windows_DxgKrnl::HSyncDPCMultiPlane_Info::Id,
+    Microsoft_Windows_DxgKrnl::MMIOFlip_Info::Id,
+    Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info::Id,
+    Microsoft_Windows_DxgKrnl::Present_Info::Id,
+    Microsoft_Windows_DxgKrnl::PresentHistory_Start::Id,
+    Microsoft_Windows_DxgKrnl::PresentHistory_Info::Id,
+    Microsoft_Windows_DxgKrnl::PresentHistoryDetailed_Start::Id,
+    Microsoft_Windows_DxgKrnl::QueuePacket_Start::Id,
+    Microsoft_Windows_DxgKrnl::QueuePacket_Stop::Id,
+    Microsoft_Windows_DxgKrnl::VSyncDPC_Info::Id,
+};
+
+USHORT const WIN32K_EVENT_IDS[] = {
+    Microsoft_Windows_Win32k::TokenCompositionSurfaceObject_Info::Id,
+    Microsoft_Windows_Win32k::TokenStateChanged_Info::Id,
+};
+
+USHORT const DWM_EVENT_IDS[] = {
+    Microsoft_Windows_Dwm_Core::MILEVENT_MEDIA_UCE_PROCESSPRESENTHISTORY_GetPresentHistory_Info::Id,
+    Microsoft_Windows_Dwm_Core::SCHEDULE_PRESENT_Start::Id,
+    Microsoft_Windows_Dwm_Core::SCHEDULE_SURFACEUPDATE_Info::Id,
+    Microsoft_Windows_Dwm_Core::FlipChain_Pending::Id,
+    Microsoft_Windows_Dwm_Core::FlipChain_Complete::Id,
+    Microsoft_Windows_Dwm_Core::FlipChain_Dirty::Id,
+};
+
 ULONG EnableFilteredProvider(
     TRACEHANDLE sessionHandle,
     GUID const& sessionGuid, GUID const& providerGuid, UCHAR level,
     ULONGLONG anyKeywordMask, ULONGLONG allKeywordMask,
-    std::initializer_list<USHORT> const& eventIds)
+    USHORT const* eventIds, size_t eventIdCount)
 {
-    assert(eventIds.size() >= ANYSIZE_ARRAY);
-    assert(eventIds.size() <= MAX_EVENT_FILTER_EVENT_ID_COUNT);
-    auto memorySize = sizeof(EVENT_FILTER_EVENT_ID) + sizeof(USHORT) * (eventIds.size() - ANYSIZE_ARRAY);
+    assert(eventIdCount >= ANYSIZE_ARRAY);
+    assert(eventIdCount <= MAX_EVENT_FILTER_EVENT_ID_COUNT);
+    auto memorySize = sizeof(EVENT_FILTER_EVENT_ID) + sizeof(USHORT) * (eventIdCount - ANYSIZE_ARRAY);
     auto memory = _aligned_malloc(memorySize, alignof(USHORT));
     if (memory == nullptr) {
         return ERROR_NOT_ENOUGH_MEMORY;
@@ -65,8 +114,8 @@ ULONG EnableFilteredProvider(
     filterEventIds->FilterIn = TRUE;
     filterEventIds->Reserved = 0;
     filterEventIds->Count = 0;
-    for (auto id : eventIds) {
-        filterEventIds->Events[filterEventIds->Count++] = id;
+    for (size_t i = 0; i < eventIdCount; ++i) {
+        filterEventIds->Events[filterEventIds->Count++] = eventIds[i];
     }
 
     EVENT_FILTER_DESCRIPTOR filterDesc = {};
@@ -97,22 +146,16 @@ ULONG EnableProviders(
     auto keywordMask =
         (uint64_t) Microsoft_Windows_DXGI::Keyword::Microsoft_Windows_DXGI_Analytic |
         (uint64_t) Microsoft_Windows_DXGI::Keyword::Events;
-    auto status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_DXGI::GUID, TRACE_LEVEL_INFORMATION, keywordMask, keywordMask, {
-        Microsoft_Windows_DXGI::Present_Start::Id,
-        Microsoft_Windows_DXGI::Present_Stop::Id,
-        Microsoft_Windows_DXGI::PresentMultiplaneOverlay_Start::Id,
-        Microsoft_Windows_DXGI::PresentMultiplaneOverlay_Stop::Id,
-    });
+    auto status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_DXGI::GUID, TRACE_LEVEL_INFORMATION, keywordMask, keywordMask,
+                                         DXGI_EVENT_IDS, _countof(DXGI_EVENT_IDS));
     if (status != ERROR_SUCCESS) return status;
 
     // D3D9
     keywordMask =
         (uint64_t) Microsoft_Windows_D3D9::Keyword::Microsoft_Windows_Direct3D9_Analytic |
         (uint64_t) Microsoft_Windows_D3D9::Keyword::Events;
-    status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_D3D9::GUID, TRACE_LEVEL_INFORMATION, keywordMask, keywordMask, {
-        Microsoft_Windows_D3D9::Present_Start::Id,
-        Microsoft_Windows_D3D9::Present_Stop::Id,
-    });
+    status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_D3D9::GUID, TRACE_LEVEL_INFORMATION, keywordMask, keywordMask,
+                                    D3D9_EVENT_IDS, _countof(D3D9_EVENT_IDS));
     if (status != ERROR_SUCCESS) return status;
 
     if (!simple) {
@@ -120,21 +163,8 @@ ULONG EnableProviders(
         keywordMask =
             (uint64_t) Microsoft_Windows_DxgKrnl::Keyword::Microsoft_Windows_DxgKrnl_Performance |
             (uint64_t) Microsoft_Windows_DxgKrnl::Keyword::Base;
-        status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_DxgKrnl::GUID, TRACE_LEVEL_INFORMATION, keywordMask, keywordMask, {
-                Microsoft_Windows_DxgKrnl::Blit_Info::Id,
-                Microsoft_Windows_DxgKrnl::Flip_Info::Id,
-                Microsoft_Windows_DxgKrnl::FlipMultiPlaneOverlay_Info::Id,
-                Microsoft_Windows_DxgKrnl::HSyncDPCMultiPlane_Info::Id,
-                Microsoft_Windows_DxgKrnl::MMIOFlip_Info::Id,
-                Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info::Id,
-                Microsoft_Windows_DxgKrnl::Present_Info::Id,
-                Microsoft_Windows_DxgKrnl::PresentHistory_Start::Id,
-                Microsoft_Windows_DxgKrnl::PresentHistory_Info::Id,
-                Microsoft_Windows_DxgKrnl::PresentHistoryDetailed_Start::Id,
-                Microsoft_Windows_DxgKrnl::QueuePacket_Start::Id,
-                Microsoft_Windows_DxgKrnl::QueuePacket_Stop::Id,
-                Microsoft_Windows_DxgKrnl::VSyncDPC_Info::Id,
-            });
+        status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_DxgKrnl::GUID, TRACE_LEVEL_INFORMATION, keywordMask, keywordMask,
+                                        DXGKRNL_EVENT_IDS, _countof(DXGKRNL_EVENT_IDS));
         if (status != ERROR_SUCCESS) return status;
 
         status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_DxgKrnl::Win7::GUID, EVENT_CONTROL_CODE_ENABLE_PROVIDER,
@@ -148,21 +178,13 @@ ULONG EnableProviders(
             (uint64_t) Microsoft_Windows_Win32k::Keyword::Microsoft_Windows_Win32k_Tracing;
         status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_Win32k::GUID, TRACE_LEVEL_INFORMATION, keywordMask,
             (uint64_t) Microsoft_Windows_Win32k::Keyword::Updates |
-            (uint64_t) Microsoft_Windows_Win32k::Keyword::Microsoft_Windows_Win32k_Tracing, {
-            Microsoft_Windows_Win32k::TokenCompositionSurfaceObject_Info::Id,
-            Microsoft_Windows_Win32k::TokenStateChanged_Info::Id,
-        });
+            (uint64_t) Microsoft_Windows_Win32k::Keyword::Microsoft_Windows_Win32k_Tracing,
+            WIN32K_EVENT_IDS, _countof(WIN32K_EVENT_IDS));
         if (status != ERROR_SUCCESS) return status;
 
         // Dwm_Core
-        status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_Dwm_Core::GUID, TRACE_LEVEL_VERBOSE, 0, 0, {
-            Microsoft_Windows_Dwm_Core::MILEVENT_MEDIA_UCE_PROCESSPRESENTHISTORY_GetPresentHistory_Info::Id,
-            Microsoft_Windows_Dwm_Core::SCHEDULE_PRESENT_Start::Id,
-            Microsoft_Windows_Dwm_Core::SCHEDULE_SURFACEUPDATE_Info::Id,
-            Microsoft_Windows_Dwm_Core::FlipChain_Pending::Id,
-            Microsoft_Windows_Dwm_Core::FlipChain_Complete::Id,
-            Microsoft_Windows_Dwm_Core::FlipChain_Dirty::Id,
-        });
+        status = EnableFilteredProvider(sessionHandle, sessionGuid, Microsoft_Windows_Dwm_Core::GUID, TRACE_LEVEL_VERBOSE, 0, 0,
+                                        DWM_EVENT_IDS, _countof(DWM_EVENT_IDS));
         if (status != ERROR_SUCCESS) return status;
 
         status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_Dwm_Core::Win7::GUID, EVENT_CONTROL_CODE_ENABLE_PROVIDER,
@@ -201,10 +223,174 @@ void DisableProviders(TRACEHANDLE sessionHandle)
     status = EnableTraceEx2(sessionHandle, &SPECTRUMCONTINUOUS_PROVIDER_GUID,       EVENT_CONTROL_CODE_DISABLE_PROVIDER, 0, 0, 0, 0, nullptr);
 }
 
-template<
-    bool SAVE_FIRST_TIMESTAMP,
-    bool SIMPLE,
-    bool WMR>
+template<void (PMTraceConsumer::*Handler)(EVENT_RECORD*)>
+void HandlePMEvent(TraceSession* session, EVENT_RECORD* eventRecord)
+{
+    (session->mPMConsumer->*Handler)(eventRecord);
+}
+
+template<void (MRTraceConsumer::*Handler)(EVENT_RECORD*)>
+void HandleMREvent(TraceSession* session, EVENT_RECORD* eventRecord)
+{
+    (session->mMRConsumer->*Handler)(eventRecord);
+}
+
+// EventInfo events can describe any provider's events, so both consumers
+// store them.
+void HandleMetadataEvent(TraceSession* session, EVENT_RECORD* eventRecord)
+{
+    session->mPMConsumer->HandleMetadataEvent(eventRecord);
+    if (session->mMRConsumer != nullptr) {
+        session->mMRConsumer->HandleMetadataEvent(eventRecord);
+    }
+}
+
+// Handler for the providers that are only enabled to be recorded to a
+// capture file.
+void IgnoreEvent(TraceSession* session, EVENT_RECORD* eventRecord)
+{
+    (void) session;
+    (void) eventRecord;
+}
+
+uint32_t HashProviderGuid(GUID const& guid, uint32_t shift)
+{
+    return ((uint32_t) guid.Data1 * 0x9E3779B1u) >> shift;
+}
+
+struct EventHandlerDesc {
+    GUID const* mProviderGuid;
+    void (*mHandler)(TraceSession* session, EVENT_RECORD* eventRecord);
+    USHORT const* mEventIds;    // nullptr if all event ids are handled
+    size_t mEventIdCount;
+};
+
+void AddEventHandlerDescs(std::vector<EventHandlerDesc>* descs, bool simple, bool includeWinMR)
+{
+    descs->push_back({ &Microsoft_Windows_DXGI::GUID,           &HandlePMEvent<&PMTraceConsumer::HandleDXGIEvent>,      DXGI_EVENT_IDS, _countof(DXGI_EVENT_IDS) });
+    descs->push_back({ &Microsoft_Windows_D3D9::GUID,           &HandlePMEvent<&PMTraceConsumer::HandleD3D9Event>,      D3D9_EVENT_IDS, _countof(D3D9_EVENT_IDS) });
+    descs->push_back({ &NTProcessProvider::GUID,                &HandlePMEvent<&PMTraceConsumer::HandleNTProcessEvent>, nullptr, 0 });
+    descs->push_back({ &Microsoft_Windows_EventMetadata::GUID,  &HandleMetadataEvent,                                    nullptr, 0 });
+    if (!simple) {
+        descs->push_back({ &Microsoft_Windows_DxgKrnl::GUID,                      &HandlePMEvent<&PMTraceConsumer::HandleDXGKEvent>,              DXGKRNL_EVENT_IDS, _countof(DXGKRNL_EVENT_IDS) });
+        descs->push_back({ &Microsoft_Windows_Win32k::GUID,                       &HandlePMEvent<&PMTraceConsumer::HandleWin32kEvent>,            WIN32K_EVENT_IDS, _countof(WIN32K_EVENT_IDS) });
+        descs->push_back({ &Microsoft_Windows_Dwm_Core::GUID,                     &HandlePMEvent<&PMTraceConsumer::HandleDWMEvent>,               DWM_EVENT_IDS, _countof(DWM_EVENT_IDS) });
+        descs->push_back({ &Microsoft_Windows_Dwm_Core::Win7::GUID,               &HandlePMEvent<&PMTraceConsumer::HandleDWMEvent>,               nullptr, 0 });
+        descs->push_back({ &Microsoft_Windows_DxgKrnl::Win7::BLT_GUID,            &HandlePMEvent<&PMTraceConsumer::HandleWin7DxgkBlt>,            nullptr, 0 });
+        descs->push_back({ &Microsoft_Windows_DxgKrnl::Win7::FLIP_GUID,           &HandlePMEvent<&PMTraceConsumer::HandleWin7DxgkFlip>,           nullptr, 0 });
+        descs->push_back({ &Microsoft_Windows_DxgKrnl::Win7::PRESENTHISTORY_GUID, &HandlePMEvent<&PMTraceConsumer::HandleWin7DxgkPresentHistory>, nullptr, 0 });
+        descs->push_back({ &Microsoft_Windows_DxgKrnl::Win7::QUEUEPACKET_GUID,    &HandlePMEvent<&PMTraceConsumer::HandleWin7DxgkQueuePacket>,    nullptr, 0 });
+        descs->push_back({ &Microsoft_Windows_DxgKrnl::Win7::VSYNCDPC_GUID,       &HandlePMEvent<&PMTraceConsumer::HandleWin7DxgkVSyncDPC>,       nullptr, 0 });
+        descs->push_back({ &Microsoft_Windows_DxgKrnl::Win7::MMIOFLIP_GUID,       &HandlePMEvent<&PMTraceConsumer::HandleWin7DxgkMMIOFlip>,       nullptr, 0 });
+    }
+    if (includeWinMR) {
+        descs->push_back({ &DHD_PROVIDER_GUID, &HandleMREvent<&MRTraceConsumer::HandleDHDEvent>, nullptr, 0 });
+        if (!simple) {
+            descs->push_back({ &SPECTRUMCONTINUOUS_PROVIDER_GUID, &HandleMREvent<&MRTraceConsumer::HandleSpectrumContinuousEvent>, nullptr, 0 });
+        }
+    }
+}
+
+// Build the session's dispatch table from the handlers for the enabled
+// providers.  The table is sized so that, if possible, no two providers hash
+// to the same slot and there is always an empty slot to end a lookup for a
+// provider that isn't in the table.
+void InitializeEventHandlers(TraceSession* session, bool simple, bool includeWinMR, bool record)
+{
+    std::vector<EventHandlerDesc> descs;
+    descs.reserve(17);
+    AddEventHandlerDescs(&descs, simple, includeWinMR);
+
+    // When recording a capture file, every provider's events are recorded so
+    // that the capture can be re-analyzed with any options.  Providers that
+    // this analysis doesn't use are only recorded.
+    if (record) {
+        std::vector<EventHandlerDesc> allDescs;
+        AddEventHandlerDescs(&allDescs, false, true);
+        for (auto desc : allDescs) {
+            auto ii = std::find_if(descs.begin(), descs.end(), [&desc](EventHandlerDesc const& d) {
+                return InlineIsEqualGUID(*d.mProviderGuid, *desc.mProviderGuid) != 0;
+            });
+            if (ii == descs.end()) {
+                desc.mHandler = &IgnoreEvent;
+                descs.push_back(desc);
+            }
+        }
+    }
+
+    // Find the smallest table without collisions, up to 256 entries.  If
+    // there isn't one, the largest table is used and collisions are resolved
+    // by probing.
+    uint32_t bits = 1;
+    while ((1u << bits) <= descs.size()) {
+        bits += 1;
+    }
+    for (; bits < 8; ++bits) {
+        uint32_t used[8] = {};
+        bool collision = false;
+        for (auto const& desc : descs) {
+            auto h = HashProviderGuid(*desc.mProviderGuid, 32 - bits);
+            if (used[h / 32] & (1u << (h % 32))) {
+                collision = true;
+                break;
+            }
+            used[h / 32] |= 1u << (h % 32);
+        }
+        if (!collision) {
+            break;
+        }
+    }
+
+    session->mEventHandlerHashShift = 32 - bits;
+    session->mEventHandlers.clear();
+    session->mEventHandlers.resize(1u << bits, TraceSession::EventHandler {});
+
+    for (auto const& desc : descs) {
+        auto mask = (uint32_t) session->mEventHandlers.size() - 1;
+        auto h = HashProviderGuid(*desc.mProviderGuid, session->mEventHandlerHashShift);
+        while (session->mEventHandlers[h].mHandler != nullptr) {
+            h = (h + 1) & mask;
+        }
+
+        auto handler = &session->mEventHandlers[h];
+        handler->mProviderGuid = *desc.mProviderGuid;
+        handler->mHandler = desc.mHandler;
+        handler->mAllEventIds = desc.mEventIds == nullptr;
+        for (size_t i = 0; i < desc.mEventIdCount; ++i) {
+            auto id = desc.mEventIds[i];
+            assert(id < _countof(handler->mEventIdMask) * 64);
+            handler->mEventIdMask[id / 64u] |= 1ull << (id % 64u);
+        }
+    }
+}
+
+// Look up the handler for the event's provider.  Returns nullptr if there
+// isn't one or it doesn't handle the event's id.
+TraceSession::EventHandler const* FindEventHandler(TraceSession const* session, EVENT_HEADER const& hdr)
+{
+    auto mask = (uint32_t) session->mEventHandlers.size() - 1;
+    for (auto h = HashProviderGuid(hdr.ProviderId, session->mEventHandlerHashShift);; h = (h + 1) & mask) {
+        auto const& handler = session->mEventHandlers[h];
+        if (handler.mHandler == nullptr) {
+            return nullptr;
+        }
+        if (InlineIsEqualGUID(handler.mProviderGuid, hdr.ProviderId)) {
+            auto id = hdr.EventDescriptor.Id;
+            auto handled = handler.mAllEventIds || (id < _countof(handler.mEventIdMask) * 64 &&
+                                                    (handler.mEventIdMask[id / 64u] & (1ull << (id % 64u))) != 0);
+            return handled ? &handler : nullptr;
+        }
+    }
+}
+
+// EtlFileReader event filter, so that unhandled events are dropped on the
+// decode threads.
+bool IsEventHandled(EVENT_RECORD const* eventRecord)
+{
+    return FindEventHandler((TraceSession const*) eventRecord->UserContext, eventRecord->EventHeader) != nullptr;
+}
+
+template<bool SAVE_FIRST_TIMESTAMP>
 void CALLBACK EventRecordCallback(EVENT_RECORD* pEventRecord)
 {
     auto session = (TraceSession*) pEventRecord->UserContext;
@@ -217,26 +403,45 @@ void CALLBACK EventRecordCallback(EVENT_RECORD* pEventRecord)
         session->mStartQpc = hdr.TimeStamp;
     }
 
-    // TODO: specialize realtime callback to exclude NTProcessEvent?
-
-         if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::GUID)                      session->mPMConsumer->HandleDXGKEvent              (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_Win32k::GUID)                       session->mPMConsumer->HandleWin32kEvent            (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_Dwm_Core::GUID)                     session->mPMConsumer->HandleDWMEvent               (pEventRecord);
-    else if (           hdr.ProviderId == Microsoft_Windows_DXGI::GUID)                         session->mPMConsumer->HandleDXGIEvent              (pEventRecord);
-    else if (           hdr.ProviderId == Microsoft_Windows_D3D9::GUID)                         session->mPMConsumer->HandleD3D9Event              (pEventRecord);
-    else if (           hdr.ProviderId == NTProcessProvider::GUID)                              session->mPMConsumer->HandleNTProcessEvent         (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_Dwm_Core::Win7::GUID)               session->mPMConsumer->HandleDWMEvent               (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::BLT_GUID)            session->mPMConsumer->HandleWin7DxgkBlt            (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::FLIP_GUID)           session->mPMConsumer->HandleWin7DxgkFlip           (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::PRESENTHISTORY_GUID) session->mPMConsumer->HandleWin7DxgkPresentHistory (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::QUEUEPACKET_GUID)    session->mPMConsumer->HandleWin7DxgkQueuePacket    (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::VSYNCDPC_GUID)       session->mPMConsumer->HandleWin7DxgkVSyncDPC       (pEventRecord);
-    else if (!SIMPLE && hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::MMIOFLIP_GUID)       session->mPMConsumer->HandleWin7DxgkMMIOFlip       (pEventRecord);
-    else if (           hdr.ProviderId == Microsoft_Windows_EventMetadata::GUID)                session->mPMConsumer->HandleMetadataEvent          (pEventRecord);
-    else if (           WMR && hdr.ProviderId == DHD_PROVIDER_GUID)                             session->mMRConsumer->HandleDHDEvent               (pEventRecord);
-    else if (!SIMPLE && WMR && hdr.ProviderId == SPECTRUMCONTINUOUS_PROVIDER_GUID)              session->mMRConsumer->HandleSpectrumContinuousEvent(pEventRecord);
+    // SAVE_FIRST_TIMESTAMP is only used for ETL files read with
+    // ProcessTrace(), whose events are counted like ProcessEtlFile()'s.
+    if (SAVE_FIRST_TIMESTAMP) {
+        session->mEtlDecodedEventCount += 1;
+    }
 
 #pragma warning(pop)
+
+    // Drop events that aren't handled before any further processing.
+    auto handler = FindEventHandler(session, hdr);
+    if (handler != nullptr) {
+        // Stop recording if the capture file can't be written to; the
+        // writer's Close() reports the failure.
+        if (session->mCaptureFileWriter != nullptr && !session->mCaptureFileWriter->WriteEvent(pEventRecord)) {
+            session->mCaptureFileWriter = nullptr;
+        }
+        session->mPMConsumer->EvictTimedOutPresents(hdr.TimeStamp.QuadPart);
+        handler->mHandler(session, pEventRecord);
+    }
+}
+
+// Deliver the reader's events until they run out, or until stopQpc (if
+// non-zero) has been reached and every present started before it has
+// completed.
+template<typename Reader>
+void ReadEvents(TraceSession* session, Reader* reader, uint64_t stopQpc)
+{
+    while (session->mContinueProcessingBuffers) {
+        auto eventRecord = reader->NextEvent();
+        if (eventRecord == nullptr) {
+            break;
+        }
+        if (stopQpc != 0 &&
+            (uint64_t) eventRecord->EventHeader.TimeStamp.QuadPart >= stopQpc &&
+            !session->mPMConsumer->HasInFlightPresentsBefore(stopQpc)) {
+            break;
+        }
+        EventRecordCallback<false>(eventRecord);
+    }
 }
 
 ULONG CALLBACK BufferCallback(EVENT_TRACE_LOGFILEA* pLogFile)
@@ -251,15 +456,56 @@ ULONG TraceSession::Start(
     PMTraceConsumer* pmConsumer,
     MRTraceConsumer* mrConsumer,
     char const* etlPath,
+    uint32_t etlDecodeThreadCount,
     char const* sessionName)
 {
     assert(mHandle == 0);
     assert(mTraceHandle == INVALID_PROCESSTRACE_HANDLE);
     mStartQpc.QuadPart = 0;
+    mEtlDecodedEventCount = 0;
     mPMConsumer = pmConsumer;
     mMRConsumer = mrConsumer;
     mContinueProcessingBuffers = TRUE;
 
+    // When consuming an ETL file, nothing is lost by waiting for the output
+    // thread so don't drop completed events when it falls behind.
+    mPMConsumer->mWaitForOutput = etlPath != nullptr;
+    if (mMRConsumer != nullptr) {
+        mMRConsumer->mWaitForOutput = etlPath != nullptr;
+    }
+
+    // -------------------------------------------------------------------------
+    // Read the ETL file directly if we can.  This doesn't need a trace
+    // session, so no providers are enabled.  The file may be a capture file
+    // written by a previous run, or an ETL file.  ETL files that
+    // EtlFileReader doesn't understand (e.g., compressed ones) fall through
+    // to being read with OpenTrace()/ProcessTrace().
+    auto record = mCaptureFileWriter != nullptr;
+    if (etlPath != nullptr) {
+        assert(mEtlFileReader == nullptr);
+        assert(mCaptureFileReader == nullptr);
+        InitializeEventHandlers(this, pmConsumer->mSimpleMode, mrConsumer != nullptr, record);
+
+        mCaptureFileReader = new CaptureFileReader;
+        if (mCaptureFileReader->Open(etlPath, this)) {
+            mQpcFrequency.QuadPart = (LONGLONG) mCaptureFileReader->mHeader.mQpcFrequency;
+            DebugInitialize(&mStartQpc, mQpcFrequency);
+            return ERROR_SUCCESS;
+        }
+        delete mCaptureFileReader;
+        mCaptureFileReader = nullptr;
+
+        mEtlFileReader = new EtlFileReader;
+        mEtlFileReader->mEventFilter = &IsEventHandled;
+        if (mEtlFileReader->Open(etlPath, this, etlDecodeThreadCount)) {
+            mQpcFrequency.QuadPart = (LONGLONG) mEtlFileReader->mFrequency;
+            DebugInitialize(&mStartQpc, mQpcFrequency);
+            return ERROR_SUCCESS;
+        }
+        delete mEtlFileReader;
+        mEtlFileReader = nullptr;
+    }
+
     // -------------------------------------------------------------------------
     // Configure session properties
     TraceProperties sessionProps = {};
@@ -308,25 +554,17 @@ ULONG TraceSession::Start(
     traceProps.IsKernelTrace
     */
 
-    // Redirect to a specialized event handler: <SAVE_FIRST_TIMESTAMP, FULL, WMR>
+    // Redirect to a specialized event handler: <SAVE_FIRST_TIMESTAMP>, and
+    // build the dispatch table for the providers that will be enabled.
     auto saveFirstTimestamp = etlPath != nullptr;
     auto simple             = pmConsumer->mSimpleMode;
     auto includeWinMR       = mrConsumer != nullptr;
 
-    UINT callbackFlags =
-        saveFirstTimestamp ? 4 : 0 |
-        simple             ? 2 : 0 |
-        includeWinMR       ? 1 : 0;
-    switch (callbackFlags) {
-    case 0: traceProps.EventRecordCallback = &EventRecordCallback<false, false, false>; break;
-    case 1: traceProps.EventRecordCallback = &EventRecordCallback<false, false, true>; break;
-    case 2: traceProps.EventRecordCallback = &EventRecordCallback<false, true, false>; break;
-    case 3: traceProps.EventRecordCallback = &EventRecordCallback<false, true, true>; break;
-    case 4: traceProps.EventRecordCallback = &EventRecordCallback<true, false, false>; break;
-    case 5: traceProps.EventRecordCallback = &EventRecordCallback<true, false, true>; break;
-    case 6: traceProps.EventRecordCallback = &EventRecordCallback<true, true, false>; break;
-    case 7: traceProps.EventRecordCallback = &EventRecordCallback<true, true, true>; break;
-    }
+    traceProps.EventRecordCallback = saveFirstTimestamp
+        ? &EventRecordCallback<true>
+        : &EventRecordCallback<false>;
+
+    InitializeEventHandlers(this, simple, includeWinMR, record);
 
     // When processing log files, we need to use the buffer callback in case
     // the user wants to stop processing before the entire log has been parsed.
@@ -341,18 +579,21 @@ ULONG TraceSession::Start(
     }
 
     // -------------------------------------------------------------------------
-    // Start the session
-    auto status = StartTraceA(&mHandle, sessionName, &sessionProps);
-    if (status != ERROR_SUCCESS) {
-        mHandle = 0;
-        return status;
-    }
+    // Start the session and enable the desired providers.  An ETL file is
+    // read by OpenTrace() alone, so no session is started for it; that way
+    // pipelines reading different files don't need different session names.
+    if (etlPath == nullptr) {
+        auto status = StartTraceA(&mHandle, sessionName, &sessionProps);
+        if (status != ERROR_SUCCESS) {
+            mHandle = 0;
+            return status;
+        }
 
-    // Enable desired providers
-    status = EnableProviders(mHandle, sessionProps.Wnode.Guid, simple, includeWinMR);
-    if (status != ERROR_SUCCESS) {
-        Stop();
-        return status;
+        status = EnableProviders(mHandle, sessionProps.Wnode.Guid, simple && !record, includeWinMR || record);
+        if (status != ERROR_SUCCESS) {
+            Stop();
+            return status;
+        }
     }
 
     // -------------------------------------------------------------------------
@@ -367,6 +608,8 @@ ULONG TraceSession::Start(
     // -------------------------------------------------------------------------
     // Store trace properties
     mQpcFrequency = traceProps.LogfileHeader.PerfFreq;
+    mEtlEventsLost = traceProps.LogfileHeader.EventsLost;
+    mEtlBuffersLost = traceProps.LogfileHeader.BuffersLost;
 
     // Use current time as start for realtime traces (instead of the first event time)
     if (!saveFirstTimestamp) {
@@ -391,9 +634,21 @@ void TraceSession::Stop()
     // BufferCallback in this case.
     mContinueProcessingBuffers = FALSE;
 
+    // If reading the ETL file directly, there is no trace or session to shut
+    // down; ProcessEtlFile() returns at the next event.
+    if (IsReadingFile()) {
+        return;
+    }
+
     // Shutdown the trace and session.
-    status = CloseTrace(mTraceHandle);
-    mTraceHandle = INVALID_PROCESSTRACE_HANDLE;
+    if (mTraceHandle != INVALID_PROCESSTRACE_HANDLE) {
+        status = CloseTrace(mTraceHandle);
+        mTraceHandle = INVALID_PROCESSTRACE_HANDLE;
+    }
+
+    if (mHandle == 0) {
+        return;
+    }
 
     DisableProviders(mHandle);
 
@@ -404,6 +659,47 @@ void TraceSession::Stop()
     mHandle = 0;
 }
 
+void TraceSession::ProcessEtlFile()
+{
+    assert(IsReadingFile());
+
+    LARGE_INTEGER startTime = {};
+    LARGE_INTEGER endTime = {};
+    QueryPerformanceCounter(&startTime);
+
+    // Unhandled events are filtered out by the readers, so the first event
+    // delivered may not be the first in the file.  Start at the logfile
+    // header event instead, which is the first event ProcessTrace() delivers.
+    mStartQpc.QuadPart = mCaptureFileReader != nullptr
+        ? (LONGLONG) mCaptureFileReader->mHeader.mStartQpc
+        : (LONGLONG) mEtlFileReader->mStartTime;
+
+    auto secondsToQpc = [this](double seconds) {
+        return (uint64_t) mStartQpc.QuadPart + (uint64_t) (seconds * mQpcFrequency.QuadPart);
+    };
+    auto stopQpc = mEtlStopSeconds > 0.0 ? secondsToQpc(mEtlStopSeconds) : 0ull;
+
+    // Capture files don't have a buffer index to seek with, but they are
+    // small enough to read from the start.
+    if (mCaptureFileReader != nullptr) {
+        ReadEvents(this, mCaptureFileReader, stopQpc);
+        mEtlDecodedEventCount = mCaptureFileReader->mEventCount;
+        mCaptureFileReader->Close();
+    } else {
+        if (mEtlSeekSeconds > 0.0) {
+            mEtlFileReader->Seek(secondsToQpc(mEtlSeekSeconds));
+        }
+        ReadEvents(this, mEtlFileReader, stopQpc);
+        mEtlDecodedEventCount = mEtlFileReader->mDecodedEventCount;
+        mEtlFileReader->Close();
+    }
+
+    QueryPerformanceCounter(&endTime);
+    LARGE_INTEGER frequency = {};
+    QueryPerformanceFrequency(&frequency);
+    mEtlProcessingSeconds = (double) (endTime.QuadPart - startTime.QuadPart) / frequency.QuadPart;
+}
+
 ULONG TraceSession::StopNamedSession(char const* sessionName)
 {
     TraceProperties sessionProps = {};
@@ -415,6 +711,23 @@ ULONG TraceSession::StopNamedSession(char const* sessionName)
 
 ULONG TraceSession::CheckLostReports(ULONG* eventsLost, ULONG* buffersLost) const
 {
+    // The ETL file's header records what was lost while it was captured.
+    if (mEtlFileReader != nullptr) {
+        *eventsLost = mEtlFileReader->mEventsLost;
+        *buffersLost = mEtlFileReader->mBuffersLost;
+        return ERROR_SUCCESS;
+    }
+    if (mCaptureFileReader != nullptr) {
+        *eventsLost = mCaptureFileReader->mHeader.mEventsLost;
+        *buffersLost = mCaptureFileReader->mHeader.mBuffersLost;
+        return ERROR_SUCCESS;
+    }
+    if (mHandle == 0) {
+        *eventsLost = mEtlEventsLost;
+        *buffersLost = mEtlBuffersLost;
+        return ERROR_SUCCESS;
+    }
+
     TraceProperties sessionProps = {};
     sessionProps.Wnode.BufferSize = (ULONG) sizeof(TraceProperties);
     sessionProps.LoggerNameOffset = offsetof(TraceProperties, mSessionName);
@@ -20,26 +20,60 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <stdint.h>
+#include <vector>
+
 struct PMTraceConsumer;
 struct MRTraceConsumer;
+struct EtlFileReader;
+struct CaptureFileReader;
+struct CaptureFileWriter;
 
 struct TraceSession {
+    // Event dispatch table for the providers enabled in the session, indexed
+    // by a hash of the provider GUID.
+    struct EventHandler {
+        GUID mProviderGuid;
+        void (*mHandler)(TraceSession* session, EVENT_RECORD* eventRecord);
+        uint64_t mEventIdMask[8];           // One bit per handled event id
+        bool mAllEventIds;                  // If true, all event ids are handled
+    };
+
     LARGE_INTEGER mStartQpc = {};
     LARGE_INTEGER mQpcFrequency = {};
     PMTraceConsumer* mPMConsumer = nullptr;
     MRTraceConsumer* mMRConsumer = nullptr;
-    TRACEHANDLE mHandle = 0;                                // invalid session handles are 0
+    TRACEHANDLE mHandle = 0;                                // invalid session handles are 0; there is no session when reading an ETL file
     TRACEHANDLE mTraceHandle = INVALID_PROCESSTRACE_HANDLE; // invalid trace handles are INVALID_PROCESSTRACE_HANDLE
     ULONG mContinueProcessingBuffers = TRUE;
+    EtlFileReader* mEtlFileReader = nullptr;                // non-null if the ETL file is read without ProcessTrace()
+    CaptureFileReader* mCaptureFileReader = nullptr;        // non-null if the ETL file is a PresentMon capture file
+    CaptureFileWriter* mCaptureFileWriter = nullptr;        // If set before Start(), handled events are also written here (until a write fails)
+    double mEtlSeekSeconds = 0.0;                           // If set before ProcessEtlFile(), events this far into the file are skipped (see EtlFileReader::Seek())
+    double mEtlStopSeconds = 0.0;                           // If set before ProcessEtlFile(), it returns once all presents started by this time have completed
+    uint64_t mEtlDecodedEventCount = 0;                     // Events decoded by ProcessEtlFile(), or delivered by ProcessTrace() from an ETL file
+    ULONG mEtlEventsLost = 0;                               // From the header of an ETL file read with ProcessTrace()
+    ULONG mEtlBuffersLost = 0;
+    double mEtlProcessingSeconds = 0.0;                     // Time spent in ProcessEtlFile()
+    std::vector<EventHandler> mEventHandlers;
+    uint32_t mEventHandlerHashShift = 0;
 
     ULONG Start(
-        PMTraceConsumer* pmConsumer, // Required PMTraceConsumer instance
-        MRTraceConsumer* mrConsumer, // If nullptr, no WinMR tracing
-        char const* etlPath,         // If nullptr, live/realtime tracing session
-        char const* sessionName);    // Required session name
+        PMTraceConsumer* pmConsumer,    // Required PMTraceConsumer instance
+        MRTraceConsumer* mrConsumer,    // If nullptr, no WinMR tracing
+        char const* etlPath,            // If nullptr, live/realtime tracing session
+        uint32_t etlDecodeThreadCount,  // Threads to decode etlPath on; if 0, decode on the ProcessEtlFile() thread
+        char const* sessionName);       // Realtime session name; not used for ETL files
 
     void Stop();
 
+    // Deliver the events in the ETL file opened by Start() to the consumers,
+    // returning once they have all been delivered, mEtlStopSeconds is
+    // reached, or Stop() is called.  Only used when IsReadingFile();
+    // otherwise call ProcessTrace() on mTraceHandle.
+    void ProcessEtlFile();
+    bool IsReadingFile() const { return mEtlFileReader != nullptr || mCaptureFileReader != nullptr; }
+
     ULONG CheckLostReports(ULONG* eventsLost, ULONG* buffersLost) const;
     static ULONG StopNamedSession(char const* sessionName);
 };
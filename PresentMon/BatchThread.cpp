@@ -0,0 +1,230 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentMon.hpp"
+
+#include <atomic>
+#include <shlwapi.h>
+#include <string>
+
+// Batch mode analyzes many ETL files, each with its own Pipeline.  A bounded
+// number of worker threads each take the next file, run its pipeline to
+// completion, and report how fast it was analyzed.
+
+namespace {
+
+struct BatchFile {
+    std::string mEtlFileName;
+    std::string mOutputCsvFileName;
+    uint64_t mEventCount;
+    uint64_t mPresentCount;
+    double mSeconds;
+    bool mSucceeded;
+};
+
+struct BatchState {
+    std::vector<BatchFile> mFiles;
+    std::atomic<size_t> mNextFile;
+};
+
+double GetSeconds(LARGE_INTEGER start, LARGE_INTEGER end)
+{
+    LARGE_INTEGER frequency = {};
+    QueryPerformanceFrequency(&frequency);
+    return (double) (end.QuadPart - start.QuadPart) / frequency.QuadPart;
+}
+
+// -batch is either a directory, whose ETL files are all analyzed, or a
+// wildcard pattern.  Each file's CSV is named after it, and written to
+// -output_dir or next to the ETL file.
+bool FindBatchFiles(BatchState* batch)
+{
+    auto const& args = GetCommandLineArgs();
+
+    char pattern[MAX_PATH];
+    if (PathIsDirectoryA(args.mBatchInput)) {
+        _snprintf_s(pattern, _TRUNCATE, "%s\\*.etl", args.mBatchInput);
+    } else {
+        strcpy_s(pattern, args.mBatchInput);
+    }
+
+    char drive[_MAX_DRIVE];
+    char dir[_MAX_DIR];
+    _splitpath_s(pattern, drive, _MAX_DRIVE, dir, _MAX_DIR, nullptr, 0, nullptr, 0);
+
+    WIN32_FIND_DATAA findData = {};
+    auto h = FindFirstFileA(pattern, &findData);
+    if (h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    do {
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            continue;
+        }
+
+        char etlPath[MAX_PATH];
+        _snprintf_s(etlPath, _TRUNCATE, "%s%s%s", drive, dir, findData.cFileName);
+
+        char name[_MAX_FNAME];
+        _splitpath_s(findData.cFileName, nullptr, 0, nullptr, 0, name, _MAX_FNAME, nullptr, 0);
+
+        auto ext = args.mOutputFormat == OutputFormat::Columnar ? ".pmcol" : ".csv";
+        char csvPath[MAX_PATH];
+        if (args.mBatchOutputDir != nullptr) {
+            _snprintf_s(csvPath, _TRUNCATE, "%s\\%s%s", args.mBatchOutputDir, name, ext);
+        } else {
+            _snprintf_s(csvPath, _TRUNCATE, "%s%s%s%s", drive, dir, name, ext);
+        }
+
+        BatchFile file = {};
+        file.mEtlFileName = etlPath;
+        file.mOutputCsvFileName = csvPath;
+        batch->mFiles.emplace_back(file);
+    } while (FindNextFileA(h, &findData));
+
+    FindClose(h);
+
+    return !batch->mFiles.empty();
+}
+
+void AnalyzeFile(BatchFile* file)
+{
+    // ETL files are always recorded from the start, so the recording state
+    // can be set before the output thread is started.
+    Pipeline pipeline;
+    pipeline.mEtlFileName = file->mEtlFileName.c_str();
+    pipeline.mOutputCsvFileName = file->mOutputCsvFileName.c_str();
+    pipeline.mBatch = true;
+    pipeline.mIsRecording = true;
+
+    LARGE_INTEGER startTime = {};
+    QueryPerformanceCounter(&startTime);
+
+    if (!StartTraceSession(&pipeline)) {
+        return;
+    }
+
+    // The consumer thread returns once the whole file is read (or once the
+    // output thread calls ExitPipeline()).
+    WaitForConsumerThreadToExit(&pipeline);
+    StopTraceSession(&pipeline);
+
+    LARGE_INTEGER endTime = {};
+    QueryPerformanceCounter(&endTime);
+
+    file->mEventCount = pipeline.mEventCount;
+    file->mPresentCount = pipeline.mPresentCount;
+    file->mSeconds = GetSeconds(startTime, endTime);
+    file->mSucceeded = true;
+
+    printf("%s: %llu events in %.3f seconds (%.0f events/second), %llu presents.\n",
+        file->mEtlFileName.c_str(),
+        file->mEventCount,
+        file->mSeconds,
+        file->mSeconds > 0.0 ? file->mEventCount / file->mSeconds : 0.0,
+        file->mPresentCount);
+}
+
+void BatchThread(BatchState* batch)
+{
+    for (;;) {
+        auto i = batch->mNextFile.fetch_add(1);
+        if (i >= batch->mFiles.size()) {
+            break;
+        }
+
+        AnalyzeFile(&batch->mFiles[i]);
+    }
+}
+
+}
+
+int RunBatch()
+{
+    auto const& args = GetCommandLineArgs();
+
+    BatchState batch;
+    batch.mNextFile = 0;
+    if (!FindBatchFiles(&batch)) {
+        fprintf(stderr, "error: no ETL files found for -batch: %s\n", args.mBatchInput);
+        return 1;
+    }
+
+    if (args.mBatchOutputDir != nullptr && !CreateDirectoryA(args.mBatchOutputDir, nullptr) && GetLastError() != ERROR_ALREADY_EXISTS) {
+        fprintf(stderr, "error: failed to create -output_dir: %s\n", args.mBatchOutputDir);
+        return 1;
+    }
+
+    // Each file is analyzed by a consumer thread and an output thread, so by
+    // default only use half of the logical processors.
+    size_t threadCount = args.mBatchThreads;
+    if (threadCount == 0) {
+        threadCount = max(1u, std::thread::hardware_concurrency() / 2);
+    }
+    threadCount = min(threadCount, batch.mFiles.size());
+
+    LARGE_INTEGER startTime = {};
+    QueryPerformanceCounter(&startTime);
+
+    std::vector<std::thread> threads;
+    threads.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; ++i) {
+        threads.emplace_back(BatchThread, &batch);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    LARGE_INTEGER endTime = {};
+    QueryPerformanceCounter(&endTime);
+
+    // Report the totals for all the files.  The overall rate is over the
+    // wall-clock time of the batch, so it includes the benefit of analyzing
+    // files concurrently.
+    size_t succeededCount = 0;
+    uint64_t eventCount = 0;
+    uint64_t presentCount = 0;
+    for (auto const& file : batch.mFiles) {
+        if (file.mSucceeded) {
+            succeededCount += 1;
+            eventCount += file.mEventCount;
+            presentCount += file.mPresentCount;
+        }
+    }
+
+    auto seconds = GetSeconds(startTime, endTime);
+    printf("Analyzed %zu files: %llu events in %.3f seconds (%.0f events/second) using %zu threads, %llu presents.\n",
+        succeededCount,
+        eventCount,
+        seconds,
+        seconds > 0.0 ? eventCount / seconds : 0.0,
+        threadCount,
+        presentCount);
+
+    if (succeededCount < batch.mFiles.size()) {
+        fprintf(stderr, "error: %zu of %zu files could not be analyzed.\n", batch.mFiles.size() - succeededCount, batch.mFiles.size());
+        return 6;
+    }
+
+    return 0;
+}
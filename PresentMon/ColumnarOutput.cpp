@@ -0,0 +1,192 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentMon.hpp"
+#include "CsvFormat.hpp"
+
+#include "../PresentData/TraceSession.hpp"
+
+// With -output_format columnar, the output files are written in the format
+// described in ../PresentData/ColumnarFile.hpp instead of as CSV.  Each
+// OutputCsv buffers its presents into a row group, which is encoded straight
+// into the write buffer (see WriterThread.cpp) once it's full or the file is
+// closed, so rotation and -max_open_csv work the same as for CSV files.
+
+void WriteColumnarHeader(Pipeline* pipeline, OutputCsv* outputCsv)
+{
+    auto session = pipeline->mSession;
+    auto header = BeginWrite(pipeline, GetColumnarFileHeaderSize());
+    auto end = (char*) EncodeColumnarFileHeader(session->mQpcFrequency.QuadPart, session->mStartQpc.QuadPart, (uint8_t*) header);
+    EndWrite(pipeline, outputCsv->mFile, end);
+
+    // A new file needs its own process names.
+    outputCsv->mProcessNames.clear();
+}
+
+void FlushColumnarRows(Pipeline* pipeline, OutputCsv* outputCsv)
+{
+    auto rowGroup = &outputCsv->mRowGroup;
+    if (rowGroup->mRowCount == 0) {
+        return;
+    }
+
+    auto block = BeginWrite(pipeline, rowGroup->GetMaxEncodedSize());
+    auto end = (char*) rowGroup->Encode((uint8_t*) block);
+    EndWrite(pipeline, outputCsv->mFile, end);
+    outputCsv->mSize += end - block;
+}
+
+void AddColumnarPresent(Pipeline* pipeline, OutputCsv* outputCsv, ProcessInfo const* processInfo, ColumnarPresent const& present)
+{
+    // Write the process's name before the row group with its first present.
+    // If the process ID has been reused by a process with another name, the
+    // previous process's rows are written first so that they keep its name.
+    auto const& moduleName = processInfo->mModuleName;
+    auto ii = outputCsv->mProcessNames.find(present.mProcessId);
+    if (ii == outputCsv->mProcessNames.end() || ii->second != moduleName) {
+        if (ii != outputCsv->mProcessNames.end()) {
+            FlushColumnarRows(pipeline, outputCsv);
+        }
+
+        auto block = BeginWrite(pipeline, GetColumnarProcessNameSize(moduleName.size()));
+        auto end = (char*) EncodeColumnarProcessName(present.mProcessId, moduleName.c_str(), moduleName.size(), (uint8_t*) block);
+        EndWrite(pipeline, outputCsv->mFile, end);
+        outputCsv->mSize += end - block;
+
+        outputCsv->mProcessNames[present.mProcessId] = moduleName;
+    }
+
+    if (outputCsv->mRowGroup.AddPresent(present)) {
+        FlushColumnarRows(pipeline, outputCsv);
+    }
+}
+
+// Converts the -convert_columnar file to the CSV that PresentMon would have
+// written with the other command line arguments (e.g., -verbose or
+// -qpc_time).  The rows are formatted from the stored QPC values with the
+// same Append*() functions as UpdateCsv(), so they're identical.
+int ConvertColumnarFile()
+{
+    auto const& args = GetCommandLineArgs();
+
+    ColumnarFileReader reader;
+    if (!reader.Open(args.mConvertColumnarFileName)) {
+        fprintf(stderr, "error: failed to open columnar file: %s\n", args.mConvertColumnarFileName);
+        return 1;
+    }
+
+    FILE* fp = stdout;
+    char csvPath[MAX_PATH];
+    if (!args.mOutputCsvToStdout) {
+        if (args.mOutputCsvFileName != nullptr) {
+            strcpy_s(csvPath, args.mOutputCsvFileName);
+        } else {
+            char drive[_MAX_DRIVE];
+            char dir[_MAX_DIR];
+            char name[_MAX_FNAME];
+            _splitpath_s(args.mConvertColumnarFileName, drive, _MAX_DRIVE, dir, _MAX_DIR, name, _MAX_FNAME, nullptr, 0);
+            _snprintf_s(csvPath, _TRUNCATE, "%s%s%s.csv", drive, dir, name);
+        }
+
+        if (fopen_s(&fp, csvPath, "wb") != 0) {
+            fprintf(stderr, "error: failed to create CSV file: %s\n", csvPath);
+            return 1;
+        }
+    }
+
+    fputs(GetCsvHeader().c_str(), fp);
+
+    // Rows are formatted into buffer, which is written each time it fills up.
+    enum { CONVERT_BUFFER_SIZE = 64 * 1024 };
+    std::vector<char> buffer(CONVERT_BUFFER_SIZE);
+    size_t bufferUsed = 0;
+
+    auto qpcFrequency = reader.mHeader.mQpcFrequency;
+    uint64_t rowCount = 0;
+    while (reader.ReadRowGroup()) {
+        for (uint32_t i = 0; i < reader.mRowCount; ++i) {
+            ColumnarPresent p;
+            reader.GetPresent(i, &p);
+
+            auto finalState = (PresentResult) p.mFinalState;
+            if (args.mExcludeDropped && finalState != PresentResult::Presented) {
+                continue;
+            }
+
+            auto name = reader.GetProcessName(p.mProcessId);
+            if (name == nullptr) {
+                name = "<unknown>";
+            }
+            auto nameLength = strlen(name);
+
+            if (buffer.size() - bufferUsed < nameLength + CSV_ROW_FIELDS_MAX_SIZE) {
+                fwrite(buffer.data(), 1, bufferUsed, fp);
+                bufferUsed = 0;
+                if (buffer.size() < nameLength + CSV_ROW_FIELDS_MAX_SIZE) {
+                    buffer.resize(nameLength + CSV_ROW_FIELDS_MAX_SIZE);
+                }
+            }
+
+            auto row = buffer.data() + bufferUsed;
+            auto end = AppendString(row, name, nameLength);
+            *end++ = ','; end = AppendInt(end, (int32_t) p.mProcessId);
+            *end++ = ','; end = AppendHex(end, p.mSwapChainAddress);
+            *end++ = ','; end = AppendString(end, RuntimeToString((Runtime) p.mRuntime));
+            *end++ = ','; end = AppendInt(end, p.mSyncInterval);
+            *end++ = ','; end = AppendInt(end, (int32_t) p.mPresentFlags);
+            if (args.mVerbosity > Verbosity::Simple) {
+                *end++ = ','; end = AppendInt(end, p.mSupportsTearing);
+                *end++ = ','; end = AppendString(end, PresentModeToString((PresentMode) p.mPresentMode));
+            }
+            if (args.mVerbosity >= Verbosity::Verbose) {
+                *end++ = ','; end = AppendInt(end, p.mWasBatched);
+                *end++ = ','; end = AppendInt(end, p.mDwmNotified);
+            }
+            *end++ = ','; end = AppendString(end, FinalStateToDroppedString(finalState));
+            *end++ = ','; end = AppendQpcDelta(end, p.mQpcTime - reader.mHeader.mStartQpc, qpcFrequency, 6);
+            *end++ = ','; end = AppendQpcDelta(end, p.mBetweenPresents, qpcFrequency, 3);
+            if (args.mVerbosity > Verbosity::Simple) {
+                *end++ = ','; end = AppendQpcDelta(end, p.mBetweenDisplayChange, qpcFrequency, 3);
+            }
+            *end++ = ','; end = AppendQpcDelta(end, p.mInPresentAPI, qpcFrequency, 3);
+            if (args.mVerbosity > Verbosity::Simple) {
+                *end++ = ','; end = AppendQpcDelta(end, p.mUntilRenderComplete, qpcFrequency, 3);
+                *end++ = ','; end = AppendQpcDelta(end, p.mUntilDisplayed, qpcFrequency, 3);
+            }
+            if (args.mOutputQpcTime) {
+                *end++ = ','; end = AppendUnsigned(end, p.mQpcTime);
+            }
+            *end++ = '\n';
+            bufferUsed += end - row;
+
+            rowCount += 1;
+        }
+    }
+    fwrite(buffer.data(), 1, bufferUsed, fp);
+
+    if (fp != stdout) {
+        fclose(fp);
+        fprintf(stderr, "Converted %llu presents to %s\n", rowCount, csvPath);
+    }
+
+    return 0;
+}
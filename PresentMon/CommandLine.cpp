@@ -193,6 +193,24 @@ static bool AssignHotkey(int i, int argc, char** argv, CommandLineArgs* args)
     return true;
 }
 
+static bool AssignOutputFormat(int i, int argc, char** argv, CommandLineArgs* args)
+{
+    if (i == argc) {
+        fprintf(stderr, "error: -output_format expecting argument.\n");
+        return false;
+    }
+
+    if (_stricmp(argv[i], "csv") == 0) {
+        args->mOutputFormat = OutputFormat::Csv;
+    } else if (_stricmp(argv[i], "columnar") == 0) {
+        args->mOutputFormat = OutputFormat::Columnar;
+    } else {
+        fprintf(stderr, "error: invalid -output_format '%s'. Valid options (case insensitive): csv columnar\n", argv[i]);
+        return false;
+    }
+    return true;
+}
+
 static UINT atou(char const* a)
 {
     int i = atoi(a);
@@ -211,15 +229,66 @@ static void PrintHelp()
                                     " This argument can be repeated to exclude multiple processes.",
         "-process_id [integer]",    "Record only the process specified by ID.",
         "-etl_file [path]",         "Consume events from an ETL file instead of running processes.",
+        "-etl_threads [count]",     "Decode the -etl_file on this many worker threads, and merge the"
+                                    " decoded events back into timestamp order for analysis. The decode"
+                                    " rate is reported when the file is done. By default, events are"
+                                    " decoded on the analysis thread.",
+        "-start_time [seconds]",    "Only output presents from this many seconds into the -etl_file."
+                                    " Reading starts shortly before this time, using an index of the"
+                                    " file that is saved next to it the first time it is used.",
+        "-end_time [seconds]",      "Only output presents started before this many seconds into the"
+                                    " -etl_file, and stop reading once they have all completed.",
+        "-batch [path]",            "Consume events from every ETL file in a directory, or matching a"
+                                    " wildcard pattern, instead of running processes. Each file is"
+                                    " written to its own CSV named after it, several files are analyzed"
+                                    " at once, and the rate each was analyzed at is reported.",
+        "-batch_threads [count]",   "Analyze this many -batch files at once (default: half the logical"
+                                    " processors).",
 
         "Output options (see README for file naming defaults)", nullptr,
         "-output_file [path]",      "Write CSV output to specified path.",
         "-output_stdout",           "Write CSV output to STDOUT.",
+        "-output_dir [path]",       "Write -batch CSV output to the specified directory (default: the"
+                                    " directory of each ETL file).",
         "-multi_csv",               "Create a separate CSV file for each captured process.",
+        "-rotate_mb [size]",        "Start a new CSV file each time the current one reaches this many"
+                                    " megabytes. Each file has its own header and an increasing index"
+                                    " appended to its name.",
+        "-rotate_seconds [time]",   "Start a new CSV file each time the current one has this many seconds"
+                                    " of presents.",
+        "-max_files [count]",       "When using -rotate_mb or -rotate_seconds, delete the oldest CSV files"
+                                    " so that only this many remain.",
+        "-max_open_csv [count]",    "When using -multi_csv, keep at most this many processes' CSV files"
+                                    " open at once (default 128, or 0 for no limit). The least recently"
+                                    " used files are closed, and appended to if they are needed again.",
+        "-summary_interval [ms]",   "Instead of a row for each present, write a row for each swap chain"
+                                    " every this many milliseconds, with the number of presents and"
+                                    " dropped presents, the mean, minimum, and maximum of their"
+                                    " durations, and the number of presents using each present mode.",
+        "-output_format [format]",  "Write the output files as 'csv' (default), or as 'columnar' binary"
+                                    " files of fixed-width typed columns that are several times smaller"
+                                    " and can be loaded without parsing text (see README).",
+        "-convert_columnar [path]", "Convert a columnar output file to CSV, instead of capturing. The CSV"
+                                    " is written to -output_file (default: the file's path with a .csv"
+                                    " extension) or -output_stdout, with the columns selected by -simple,"
+                                    " -verbose, and -qpc_time.",
+        "-output_pipe [name]",      "Also stream each present, as binary messages, to every local client"
+                                    " that connects to the named pipe \\\\.\\pipe\\name (see README).",
+        "-pipe_queue_kb [size]",    "Queue at most this many kilobytes of -output_pipe messages for each"
+                                    " client (default 1024). Once a client's queue is full, its oldest"
+                                    " messages are dropped.",
+        "-pipe_block",              "Wait for an -output_pipe client whose queue is full instead of"
+                                    " dropping its messages.",
+        "-shared_memory [name]",    "Also publish each swap chain's current frame rate, frame time, and"
+                                    " latency to a named shared memory mapping, which other processes"
+                                    " can read without system calls (see README).",
         "-no_csv",                  "Do not create any output file.",
         "-no_top",                  "Don't display active swap chains in the console window.",
         "-qpc_time",                "Output present time as performance counter value (see"
                                     " QueryPerformanceCounter()).",
+        "-capture_file [path]",     "Also write the events that PresentMon analyzes to a compact capture"
+                                    " file. The capture can be re-analyzed much faster than an ETL file,"
+                                    " with any options, by passing it to -etl_file.",
 
         "Recording options", nullptr,
         "-hotkey [key]",            "Use specified key to start and stop recording, writing to a"
@@ -249,6 +318,17 @@ static void PrintHelp()
                                     " won't work and there may be tracking errors near process termination.",
         "-terminate_on_proc_exit",  "Terminate PresentMon when all the target processes have exited.",
         "-terminate_after_timed",   "When using -timed, terminate PresentMon after the timed capture completes.",
+        "-evict_after [seconds]",   "Stop tracking presents that have not completed after the specified"
+                                    " amount of time, and output them with an unknown result. This bounds"
+                                    " memory use and prevents a lost event from stalling all later presents"
+                                    " on the same swap chain during long captures. Disabled by default.",
+        "-max_in_flight [count]",   "Limit the number of presents being tracked at once. When the limit is"
+                                    " reached, the oldest presents are output with an unknown result. This"
+                                    " limits the number of presents rather than memory, but each one uses"
+                                    " a few hundred bytes.",
+        "-wakeup_presents [count]", "Output completed presents once this many are ready (default 256).",
+        "-wakeup_interval [us]",    "Output completed presents no later than this many microseconds after"
+                                    " they complete (default 5000).",
 
         "Beta options", nullptr,
         "-include_mixed_reality",   "Capture Windows Mixed Reality data to a CSV file with \"_WMR\" suffix.",
@@ -306,10 +386,30 @@ bool ParseCommandLine(int argc, char** argv)
     args->mExcludeProcessNames.clear();
     args->mOutputCsvFileName = nullptr;
     args->mEtlFileName = nullptr;
+    args->mCaptureFileName = nullptr;
+    args->mBatchInput = nullptr;
+    args->mBatchOutputDir = nullptr;
     args->mSessionName = "PresentMon";
+    args->mConvertColumnarFileName = nullptr;
+    args->mStreamPipeName = nullptr;
+    args->mSharedMemoryName = nullptr;
     args->mTargetPid = 0;
     args->mDelay = 0;
     args->mTimer = 0;
+    args->mEvictAfter = 0;
+    args->mMaxInFlight = 0;
+    args->mWakeupPresents = 256;
+    args->mWakeupInterval = 5000;
+    args->mEtlDecodeThreads = 0;
+    args->mBatchThreads = 0;
+    args->mRotateMegabytes = 0;
+    args->mRotateSeconds = 0;
+    args->mMaxFiles = 0;
+    args->mMaxOpenCsvs = 128;
+    args->mSummaryIntervalMs = 0;
+    args->mStreamQueueKilobytes = 1024;
+    args->mStartTime = 0.0;
+    args->mEndTime = 0.0;
     args->mHotkeyModifiers = MOD_NOREPEAT;
     args->mHotkeyVirtualKeyCode = 0;
     args->mOutputCsvToFile = true;
@@ -319,6 +419,7 @@ bool ParseCommandLine(int argc, char** argv)
     args->mExcludeDropped = false;
     args->mVerbosity = Verbosity::Normal;
     args->mConsoleOutputType = ConsoleOutput::Full;
+    args->mOutputFormat = OutputFormat::Csv;
     args->mTerminateOnProcExit = false;
     args->mTerminateAfterTimer = false;
     args->mHotkeySupport = false;
@@ -326,6 +427,7 @@ bool ParseCommandLine(int argc, char** argv)
     args->mIncludeWindowsMixedReality = false;
     args->mMultiCsv = false;
     args->mStopExistingSession = false;
+    args->mStreamBlock = false;
 
     bool simple = false;
     bool verbose = false;
@@ -358,14 +460,32 @@ bool ParseCommandLine(int argc, char** argv)
         else ARG2("-exclude",                args->mExcludeProcessNames.emplace_back(argv[i]))
         else ARG2("-process_id",             args->mTargetPid                  = atou(argv[i]))
         else ARG2("-etl_file",               args->mEtlFileName                = argv[i])
+        else ARG2("-etl_threads",            args->mEtlDecodeThreads           = atou(argv[i]))
+        else ARG2("-start_time",             args->mStartTime                  = atof(argv[i]))
+        else ARG2("-end_time",               args->mEndTime                    = atof(argv[i]))
+        else ARG2("-batch",                  args->mBatchInput                 = argv[i])
+        else ARG2("-batch_threads",          args->mBatchThreads               = atou(argv[i]))
 
         // Output options:
         else ARG2("-output_file",            args->mOutputCsvFileName          = argv[i])
         else ARG1("-output_stdout",          args->mOutputCsvToStdout          = true)
+        else ARG2("-output_dir",             args->mBatchOutputDir             = argv[i])
         else ARG1("-multi_csv",              args->mMultiCsv                   = true)
+        else ARG2("-rotate_mb",              args->mRotateMegabytes            = atou(argv[i]))
+        else ARG2("-rotate_seconds",         args->mRotateSeconds              = atou(argv[i]))
+        else ARG2("-max_files",              args->mMaxFiles                   = atou(argv[i]))
+        else ARG2("-max_open_csv",           args->mMaxOpenCsvs                = atou(argv[i]))
+        else ARG2("-summary_interval",       args->mSummaryIntervalMs          = atou(argv[i]))
+        else if (strcmp(argv[i], "-output_format") == 0) { if (AssignOutputFormat(++i, argc, argv, args)) continue; }
+        else ARG2("-convert_columnar",       args->mConvertColumnarFileName    = argv[i])
+        else ARG2("-output_pipe",            args->mStreamPipeName             = argv[i])
+        else ARG2("-pipe_queue_kb",          args->mStreamQueueKilobytes       = atou(argv[i]))
+        else ARG1("-pipe_block",             args->mStreamBlock                = true)
+        else ARG2("-shared_memory",          args->mSharedMemoryName           = argv[i])
         else ARG1("-no_csv",                 args->mOutputCsvToFile            = false)
         else ARG1("-no_top",                 args->mConsoleOutputType          = ConsoleOutput::Simple)
         else ARG1("-qpc_time",               args->mOutputQpcTime              = true)
+        else ARG2("-capture_file",           args->mCaptureFileName            = argv[i])
 
         // Recording options:
         else if (strcmp(argv[i], "-hotkey") == 0) { if (AssignHotkey(++i, argc, argv, args)) continue; }
@@ -382,6 +502,10 @@ bool ParseCommandLine(int argc, char** argv)
         else ARG1("-dont_restart_as_admin",  args->mTryToElevate               = false)
         else ARG1("-terminate_on_proc_exit", args->mTerminateOnProcExit        = true)
         else ARG1("-terminate_after_timed",  args->mTerminateAfterTimer        = true)
+        else ARG2("-evict_after",            args->mEvictAfter                 = atou(argv[i]))
+        else ARG2("-max_in_flight",          args->mMaxInFlight                = atou(argv[i]))
+        else ARG2("-wakeup_presents",        args->mWakeupPresents             = atou(argv[i]))
+        else ARG2("-wakeup_interval",        args->mWakeupInterval             = atou(argv[i]))
 
         // Beta options:
         else ARG1("-include_mixed_reality",  args->mIncludeWindowsMixedReality = true)
@@ -405,6 +529,73 @@ bool ParseCommandLine(int argc, char** argv)
         args->mVerbosity = Verbosity::Simple;
     }
 
+    // In batch mode, every file is analyzed the same way without user
+    // interaction, and each file gets its own CSV and trace session.  Several
+    // files are analyzed at once, so their output can't share stdout or a
+    // console display.
+    if (args->mBatchInput != nullptr) {
+        if (args->mEtlFileName != nullptr) {
+            fprintf(stderr, "error: only one of -etl_file or -batch arguments can be used.\n");
+            PrintHelp();
+            return false;
+        }
+        if (args->mOutputCsvToStdout) {
+            fprintf(stderr, "error: -output_stdout and -batch arguments are not compatible.\n");
+            PrintHelp();
+            return false;
+        }
+        if (args->mOutputCsvFileName != nullptr) {
+            fprintf(stderr, "warning: -output_file and -batch arguments are not compatible; ignoring -output_file.\n");
+            args->mOutputCsvFileName = nullptr;
+        }
+        if (args->mCaptureFileName != nullptr) {
+            fprintf(stderr, "warning: -capture_file and -batch arguments are not compatible; ignoring -capture_file.\n");
+            args->mCaptureFileName = nullptr;
+        }
+        if (args->mHotkeySupport) {
+            fprintf(stderr, "warning: -hotkey and -batch arguments are not compatible; ignoring -hotkey.\n");
+            args->mHotkeySupport = false;
+        }
+        if (args->mDelay != 0) {
+            fprintf(stderr, "warning: -delay and -batch arguments are not compatible; ignoring -delay.\n");
+            args->mDelay = 0;
+        }
+        if (args->mTimer != 0) {
+            fprintf(stderr, "warning: -timed and -batch arguments are not compatible; ignoring -timed.\n");
+            args->mTimer = 0;
+        }
+        if (args->mStreamPipeName != nullptr) {
+            fprintf(stderr, "warning: -output_pipe and -batch arguments are not compatible; ignoring -output_pipe.\n");
+            args->mStreamPipeName = nullptr;
+        }
+        if (args->mSharedMemoryName != nullptr) {
+            fprintf(stderr, "warning: -shared_memory and -batch arguments are not compatible; ignoring -shared_memory.\n");
+            args->mSharedMemoryName = nullptr;
+        }
+        args->mScrollLockIndicator = false;
+        if (args->mConsoleOutputType == ConsoleOutput::Full) {
+            args->mConsoleOutputType = ConsoleOutput::Simple; // No warning needed, just swap out Full for Simple
+        }
+    } else {
+        if (args->mBatchOutputDir != nullptr) {
+            fprintf(stderr, "warning: -output_dir requires -batch; ignoring -output_dir.\n");
+            args->mBatchOutputDir = nullptr;
+        }
+    }
+
+    // -start_time and -end_time are only meaningful for -etl_file and -batch.
+    if (args->mStartTime != 0.0 || args->mEndTime != 0.0) {
+        if (args->mEtlFileName == nullptr && args->mBatchInput == nullptr) {
+            fprintf(stderr, "warning: -start_time and -end_time require -etl_file or -batch; ignoring them.\n");
+            args->mStartTime = 0.0;
+            args->mEndTime = 0.0;
+        } else if (args->mStartTime < 0.0 || args->mEndTime < 0.0 || (args->mEndTime != 0.0 && args->mEndTime <= args->mStartTime)) {
+            fprintf(stderr, "error: -start_time and -end_time can't be negative, and -end_time must be after -start_time.\n");
+            PrintHelp();
+            return false;
+        }
+    }
+
     // Disallow hotkey of CTRL+C, CTRL+SCROLL, and F12
     if (args->mHotkeySupport) {
         if ((args->mHotkeyModifiers & MOD_CONTROL) != 0 && (
@@ -441,6 +632,15 @@ bool ParseCommandLine(int argc, char** argv)
             fprintf(stderr, "warning: -output_stdout and -no_csv arguments are not compatible; ignoring -output_stdout.\n");
             args->mOutputCsvToStdout = false;
         }
+        if (args->mRotateMegabytes != 0 || args->mRotateSeconds != 0) {
+            fprintf(stderr, "warning: -rotate_mb and -rotate_seconds are not compatible with -no_csv; ignoring them.\n");
+            args->mRotateMegabytes = 0;
+            args->mRotateSeconds = 0;
+        }
+        if (args->mSummaryIntervalMs != 0) {
+            fprintf(stderr, "warning: -summary_interval and -no_csv arguments are not compatible; ignoring -summary_interval.\n");
+            args->mSummaryIntervalMs = 0;
+        }
     }
 
     // If we're outputing CSV to stdout, we can't use it for console output.
@@ -467,6 +667,43 @@ bool ParseCommandLine(int argc, char** argv)
             fprintf(stderr, "warning: -include_mixed_reality and -output_stdout are not compatible; ignoring -include_mixed_reality.\n");
             args->mIncludeWindowsMixedReality = false;
         }
+
+        if (args->mRotateMegabytes != 0 || args->mRotateSeconds != 0) {
+            fprintf(stderr, "warning: -rotate_mb and -rotate_seconds are not compatible with -output_stdout; ignoring them.\n");
+            args->mRotateMegabytes = 0;
+            args->mRotateSeconds = 0;
+        }
+    }
+
+    // Columnar files are binary, and only hold a row per present, so they
+    // can't be written to stdout or summarized.  The WMR data is still
+    // written as CSV, and there's no columnar schema for it yet.
+    if (args->mOutputFormat == OutputFormat::Columnar) {
+        if (args->mOutputCsvToStdout) {
+            fprintf(stderr, "error: -output_format columnar and -output_stdout arguments are not compatible.\n");
+            PrintHelp();
+            return false;
+        }
+        if (args->mSummaryIntervalMs != 0) {
+            fprintf(stderr, "warning: -summary_interval and -output_format columnar are not compatible; ignoring -summary_interval.\n");
+            args->mSummaryIntervalMs = 0;
+        }
+        if (args->mIncludeWindowsMixedReality) {
+            fprintf(stderr, "warning: -include_mixed_reality and -output_format columnar are not compatible; ignoring -include_mixed_reality.\n");
+            args->mIncludeWindowsMixedReality = false;
+        }
+    }
+
+    // -pipe_block only applies to -output_pipe.
+    if (args->mStreamPipeName == nullptr && args->mStreamBlock) {
+        fprintf(stderr, "warning: -pipe_block requires -output_pipe; ignoring -pipe_block.\n");
+        args->mStreamBlock = false;
+    }
+
+    // -max_files only applies to rotated CSV files.
+    if (args->mMaxFiles != 0 && args->mRotateMegabytes == 0 && args->mRotateSeconds == 0) {
+        fprintf(stderr, "warning: -max_files requires -rotate_mb or -rotate_seconds; ignoring -max_files.\n");
+        args->mMaxFiles = 0;
     }
 
     // Try to initialize the console, and warn if we're not going to be able to
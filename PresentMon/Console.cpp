@@ -138,10 +138,54 @@ void CommitConsole()
     gConsolePrevWriteBufferSize = sizeWritten;
 }
 
-void UpdateConsole(uint32_t processId, ProcessInfo const& processInfo)
+bool GetSwapChainMetrics(Pipeline const* pipeline, SwapChainData const& chain, SwapChainMetrics* metrics)
 {
     auto const& args = GetCommandLineArgs();
 
+    // Only compute swapchain metrics if there at least two presents in the
+    // history.
+    if (chain.mPresentHistoryCount < 2) {
+        return false;
+    }
+
+    auto const& present0 = *chain.mPresentHistory[(chain.mNextPresentIndex - chain.mPresentHistoryCount) % SwapChainData::PRESENT_HISTORY_MAX_COUNT];
+    auto const& presentN = *chain.mPresentHistory[(chain.mNextPresentIndex - 1) % SwapChainData::PRESENT_HISTORY_MAX_COUNT];
+    metrics->mLastPresent = &presentN;
+    metrics->mCpuAverage = QpcDeltaToSeconds(pipeline, presentN.QpcTime - present0.QpcTime) / (chain.mPresentHistoryCount - 1);
+
+    metrics->mDisplayedCount = 0;
+    metrics->mLastDisplayed = nullptr;
+    metrics->mDisplayedFps = 0.0;
+    metrics->mLatency = 0.0;
+    if (args.mVerbosity > Verbosity::Simple) {
+        uint64_t latencySum = 0;
+        uint64_t display0ScreenTime = 0;
+        for (uint32_t i = 0; i < chain.mPresentHistoryCount; ++i) {
+            auto const& p = chain.mPresentHistory[(chain.mNextPresentIndex - chain.mPresentHistoryCount + i) % SwapChainData::PRESENT_HISTORY_MAX_COUNT];
+            if (p->FinalState == PresentResult::Presented) {
+                if (metrics->mDisplayedCount == 0) {
+                    display0ScreenTime = p->ScreenTime;
+                }
+                metrics->mLastDisplayed = p.get();
+                latencySum += p->ScreenTime - p->QpcTime;
+                metrics->mDisplayedCount += 1;
+            }
+        }
+
+        if (metrics->mDisplayedCount >= 2) {
+            metrics->mDisplayedFps = (double) (metrics->mDisplayedCount - 1) / QpcDeltaToSeconds(pipeline, metrics->mLastDisplayed->ScreenTime - display0ScreenTime);
+        }
+
+        if (metrics->mDisplayedCount >= 1) {
+            metrics->mLatency = QpcDeltaToSeconds(pipeline, latencySum) / metrics->mDisplayedCount;
+        }
+    }
+
+    return true;
+}
+
+void UpdateConsole(Pipeline const* pipeline, uint32_t processId, ProcessInfo const& processInfo)
+{
     // Don't display non-target or empty processes
     if (!processInfo.mTargetProcess ||
         processInfo.mModuleName.empty() ||
@@ -155,9 +199,8 @@ void UpdateConsole(uint32_t processId, ProcessInfo const& processInfo)
         auto address = pair.first;
         auto const& chain = pair.second;
 
-        // Only show swapchain data if there at least two presents in the
-        // history.
-        if (chain.mPresentHistoryCount < 2) {
+        SwapChainMetrics metrics;
+        if (!GetSwapChainMetrics(pipeline, chain, &metrics)) {
             continue;
         }
 
@@ -166,9 +209,8 @@ void UpdateConsole(uint32_t processId, ProcessInfo const& processInfo)
             ConsolePrintLn("%s[%d]:", processInfo.mModuleName.c_str(), processId);
         }
 
-        auto const& present0 = *chain.mPresentHistory[(chain.mNextPresentIndex - chain.mPresentHistoryCount) % SwapChainData::PRESENT_HISTORY_MAX_COUNT];
-        auto const& presentN = *chain.mPresentHistory[(chain.mNextPresentIndex - 1) % SwapChainData::PRESENT_HISTORY_MAX_COUNT];
-        auto cpuAvg = QpcDeltaToSeconds(presentN.QpcTime - present0.QpcTime) / (chain.mPresentHistoryCount - 1);
+        auto const& presentN = *metrics.mLastPresent;
+        auto cpuAvg = metrics.mCpuAverage;
 
         ConsolePrint("    %016llX (%s): SyncInterval=%d Flags=%d %.2lf ms/frame (%.1lf fps",
             address,
@@ -178,39 +220,41 @@ void UpdateConsole(uint32_t processId, ProcessInfo const& processInfo)
             1000.0 * cpuAvg,
             1.0 / cpuAvg);
 
-        size_t displayCount = 0;
-        uint64_t latencySum = 0;
-        uint64_t display0ScreenTime = 0;
-        PresentEvent* displayN = nullptr;
-        if (args.mVerbosity > Verbosity::Simple) {
-            for (uint32_t i = 0; i < chain.mPresentHistoryCount; ++i) {
-                auto const& p = chain.mPresentHistory[(chain.mNextPresentIndex - chain.mPresentHistoryCount + i) % SwapChainData::PRESENT_HISTORY_MAX_COUNT];
-                if (p->FinalState == PresentResult::Presented) {
-                    if (displayCount == 0) {
-                        display0ScreenTime = p->ScreenTime;
-                    }
-                    displayN = p.get();
-                    latencySum += p->ScreenTime - p->QpcTime;
-                    displayCount += 1;
-                }
-            }
-        }
-
-        if (displayCount >= 2) {
-            ConsolePrint(", %.1lf fps displayed", (double) (displayCount - 1) / QpcDeltaToSeconds(displayN->ScreenTime - display0ScreenTime));
+        if (metrics.mDisplayedCount >= 2) {
+            ConsolePrint(", %.1lf fps displayed", metrics.mDisplayedFps);
         }
 
-        if (displayCount >= 1) {
-            ConsolePrint(", %.2lf ms latency", 1000.0 * QpcDeltaToSeconds(latencySum) / displayCount);
+        if (metrics.mDisplayedCount >= 1) {
+            ConsolePrint(", %.2lf ms latency", 1000.0 * metrics.mLatency);
         }
 
         ConsolePrint(")");
 
-        if (displayCount > 0) {
-            ConsolePrint(" %s", PresentModeToString(displayN->PresentMode));
+        if (metrics.mDisplayedCount > 0) {
+            ConsolePrint(" %s", PresentModeToString(metrics.mLastDisplayed->PresentMode));
         }
 
         ConsolePrintLn("");
+
+        // Percentiles of all the presents, not just the history.
+        if (chain.mHistograms != nullptr) {
+            auto const& frameTimes = chain.mHistograms->mBetweenPresents;
+            ConsolePrint("        P50/P95/P99 %.2lf/%.2lf/%.2lf ms/frame (1%% low %.1lf fps)",
+                frameTimes.GetPercentile(50.0),
+                frameTimes.GetPercentile(95.0),
+                frameTimes.GetPercentile(99.0),
+                frameTimes.GetLowRate(1.0));
+
+            auto const& latencies = chain.mHistograms->mUntilDisplayed;
+            if (latencies.mCount > 0) {
+                ConsolePrint(", %.2lf/%.2lf/%.2lf ms latency",
+                    latencies.GetPercentile(50.0),
+                    latencies.GetPercentile(95.0),
+                    latencies.GetPercentile(99.0));
+            }
+
+            ConsolePrintLn("");
+        }
     }
 
     if (!empty) {
@@ -22,11 +22,39 @@ SOFTWARE.
 
 #include "PresentMon.hpp"
 
-static std::thread gThread;
+#include "../PresentData/TraceSession.hpp"
 
-static void Consume(TRACEHANDLE traceHandle)
+static void Consume(Pipeline* pipeline)
 {
-    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+    // A realtime session's consumer must keep up with the events, or they're
+    // lost.  Batch pipelines only read ETL files, and there are many of them,
+    // so they run at normal priority so as not to starve the rest of the
+    // system.
+    if (!pipeline->mBatch) {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+    }
+
+    // If the session is reading an ETL file itself, ProcessEtlFile() delivers
+    // all the events in the file, or returns early once the session is
+    // stopped.
+    auto session = pipeline->mSession;
+    if (session->IsReadingFile()) {
+        session->ProcessEtlFile();
+        pipeline->mEventCount = session->mEtlDecodedEventCount;
+
+        // Batch mode reports each file's throughput itself.
+        auto const& args = GetCommandLineArgs();
+        if (args.mEtlDecodeThreads > 0 && !pipeline->mBatch) {
+            fprintf(stderr, "Decoded %llu events in %.3f seconds (%.0f events/second) using %u decode threads.\n",
+                session->mEtlDecodedEventCount,
+                session->mEtlProcessingSeconds,
+                session->mEtlProcessingSeconds > 0.0 ? session->mEtlDecodedEventCount / session->mEtlProcessingSeconds : 0.0,
+                args.mEtlDecodeThreads);
+        }
+
+        ExitPipeline(pipeline);
+        return;
+    }
 
     // You must call OpenTrace() prior to calling this function
     //
@@ -45,25 +73,28 @@ static void Consume(TRACEHANDLE traceHandle)
     //
     // However, it seems to always return ERROR_SUCCESS.
 
+    auto traceHandle = session->mTraceHandle;
     auto status = ProcessTrace(&traceHandle, 1, NULL, NULL);
     (void) status;
 
-    // Signal MainThread to exit.  This is only needed if we are processing an
-    // ETL file and ProcessTrace() returned because the ETL is done, but there
-    // is no harm in calling ExitMainThread() if MainThread is already exiting
+    pipeline->mEventCount = session->mEtlDecodedEventCount;
+
+    // Signal the pipeline to exit.  This is only needed if we are processing
+    // an ETL file and ProcessTrace() returned because the ETL is done, but
+    // there is no harm in calling ExitPipeline() if MainThread is already exiting
     // (and caused ProcessTrace() to exit via 2, 3, or 4 above) because the
     // message queue isn't beeing listened too anymore in that case.
-    ExitMainThread();
+    ExitPipeline(pipeline);
 }
 
-void StartConsumerThread(TRACEHANDLE traceHandle)
+void StartConsumerThread(Pipeline* pipeline)
 {
-    gThread = std::thread(Consume, traceHandle);
+    pipeline->mConsumerThread = std::thread(Consume, pipeline);
 }
 
-void WaitForConsumerThreadToExit()
+void WaitForConsumerThreadToExit(Pipeline* pipeline)
 {
-    if (gThread.joinable()) {
-        gThread.join();
+    if (pipeline->mConsumerThread.joinable()) {
+        pipeline->mConsumerThread.join();
     }
 }
@@ -0,0 +1,136 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// CSV rows are formatted straight into a write buffer (see WriterThread.cpp),
+// rather than using a fprintf() per field which parses the format string and
+// takes the FILE lock each time.  The Append*() functions each format like
+// the printf() conversion they're named after, and return the end of what
+// they wrote.
+
+enum {
+    CSV_ROW_FIELDS_MAX_SIZE = 1024,         // Upper bound on the size of a row, excluding Application
+    CSV_FLOAT_MAX_SIZE = 64,                // Upper bound on the size of a %.3lf/%.6lf time
+};
+
+inline char* AppendString(char* dst, char const* src, size_t size)
+{
+    memcpy(dst, src, size);
+    return dst + size;
+}
+
+inline char* AppendString(char* dst, char const* src)
+{
+    return AppendString(dst, src, strlen(src));
+}
+
+// %llu
+inline char* AppendUnsigned(char* dst, uint64_t value)
+{
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[count++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    do {
+        *dst++ = digits[--count];
+    } while (count > 0);
+
+    return dst;
+}
+
+// %d
+inline char* AppendInt(char* dst, int32_t value)
+{
+    if (value < 0) {
+        *dst++ = '-';
+        return AppendUnsigned(dst, (uint64_t) -(int64_t) value);
+    }
+    return AppendUnsigned(dst, (uint64_t) value);
+}
+
+// 0x%016llX
+inline char* AppendHex(char* dst, uint64_t value)
+{
+    static char const HEX_DIGITS[] = "0123456789ABCDEF";
+
+    *dst++ = '0';
+    *dst++ = 'x';
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        *dst++ = HEX_DIGITS[(value >> shift) & 0xf];
+    }
+    return dst;
+}
+
+// %.3lf
+inline char* AppendFloat(char* dst, double value)
+{
+    return dst + sprintf_s(dst, CSV_FLOAT_MAX_SIZE, "%.3lf", value);
+}
+
+// %.6lf of qpcDelta / qpcFrequency seconds if decimals is 6, or %.3lf of the
+// same time in milliseconds if decimals is 3.
+//
+// Either way the output is the time rounded to a whole number of
+// microseconds, which is computed exactly with integer arithmetic instead.
+// The double computation has a relative error of a few ulps, so it can only
+// round the other way if the exact time is within that error of half a
+// microsecond; that, and times too large for the integer arithmetic, are
+// formatted with the double computation so the output is always the same.
+inline char* AppendQpcDelta(char* dst, uint64_t qpcDelta, uint64_t qpcFrequency, uint32_t decimals)
+{
+    if (qpcDelta <= UINT64_MAX / 1000000) {
+        auto scaled = qpcDelta * 1000000;
+        auto microseconds = scaled / qpcFrequency;
+        auto remainder = scaled % qpcFrequency;
+        auto distanceToHalf = 2 * remainder > qpcFrequency
+            ? 2 * remainder - qpcFrequency
+            : qpcFrequency - 2 * remainder;
+        if (distanceToHalf > (scaled >> 49) + 1) {
+            if (2 * remainder > qpcFrequency) {
+                microseconds += 1;
+            }
+
+            uint64_t unitsPerWhole = decimals == 6 ? 1000000 : 1000;
+            auto fraction = microseconds % unitsPerWhole;
+            dst = AppendUnsigned(dst, microseconds / unitsPerWhole);
+            *dst++ = '.';
+            for (auto place = unitsPerWhole / 10; place > 0; place /= 10) {
+                *dst++ = (char) ('0' + fraction / place % 10);
+            }
+            return dst;
+        }
+    }
+
+    auto seconds = (double) qpcDelta / (double) qpcFrequency;
+    auto size = decimals == 6
+        ? sprintf_s(dst, CSV_FLOAT_MAX_SIZE, "%.6lf", seconds)
+        : sprintf_s(dst, CSV_FLOAT_MAX_SIZE, "%.3lf", 1000.0 * seconds);
+    return dst + size;
+}
@@ -21,13 +21,20 @@ SOFTWARE.
 */
 
 #include "PresentMon.hpp"
+#include "CsvFormat.hpp"
 
-static OutputCsv gSingleOutputCsv = {};
-static uint32_t gRecordingCount = 1;
+#include "../PresentData/TraceSession.hpp"
 
-void IncrementRecordingCount()
+enum {
+    CSV_SUMMARY_ROW_FIELDS_MAX_SIZE = 2048, // Upper bound on the size of a -summary_interval row, excluding Application
+};
+
+static bool IsOutputCsvDueToRotate(Pipeline const* pipeline, OutputCsv* outputCsv, uint64_t qpcTime);
+static void RotateOutputCsv(Pipeline* pipeline, ProcessInfo* processInfo, OutputCsv* outputCsv);
+
+void IncrementRecordingCount(Pipeline* pipeline)
 {
-    gRecordingCount += 1;
+    pipeline->mRecordingCount += 1;
 }
 
 const char* PresentModeToString(PresentMode mode)
@@ -63,32 +70,316 @@ const char* FinalStateToDroppedString(PresentResult res)
     }
 }
 
-static void WriteCsvHeader(FILE* fp)
+// The -summary_interval present mode columns, indexed by PresentMode.
+static char const* const SUMMARY_PRESENT_MODE_COLUMNS[SwapChainSummary::PRESENT_MODE_COUNT] = {
+    "OtherPresentModeFrames",
+    "HardwareLegacyFlipFrames",
+    "HardwareLegacyCopyToFrontBufferFrames",
+    "HardwareIndependentFlipFrames",
+    "ComposedFlipFrames",
+    "ComposedCopyGPUGDIFrames",
+    "ComposedCopyCPUGDIFrames",
+    "ComposedCompositionAtlasFrames",
+    "HardwareComposedIndependentFlipFrames",
+};
+
+static void WriteSummaryCsvHeader(Pipeline* pipeline, FILE* fp)
+{
+    auto const& args = GetCommandLineArgs();
+
+    WriteFormatted(pipeline, fp, "Application,ProcessID,SwapChainAddress,Runtime,TimeInSeconds,Frames,Dropped");
+    WriteFormatted(pipeline, fp, ",MsBetweenPresentsMean,MsBetweenPresentsMin,MsBetweenPresentsMax");
+    WriteFormatted(pipeline, fp, ",MsBetweenPresentsP50,MsBetweenPresentsP95,MsBetweenPresentsP99,OnePercentLowFps");
+    if (args.mVerbosity > Verbosity::Simple) {
+        WriteFormatted(pipeline, fp, ",MsBetweenDisplayChangeMean,MsBetweenDisplayChangeMin,MsBetweenDisplayChangeMax");
+        WriteFormatted(pipeline, fp, ",MsBetweenDisplayChangeP50,MsBetweenDisplayChangeP95,MsBetweenDisplayChangeP99");
+    }
+    WriteFormatted(pipeline, fp, ",MsInPresentAPIMean,MsInPresentAPIMin,MsInPresentAPIMax");
+    if (args.mVerbosity > Verbosity::Simple) {
+        WriteFormatted(pipeline, fp, ",MsUntilDisplayedMean,MsUntilDisplayedMin,MsUntilDisplayedMax");
+        WriteFormatted(pipeline, fp, ",MsUntilDisplayedP50,MsUntilDisplayedP95,MsUntilDisplayedP99");
+        for (auto column : SUMMARY_PRESENT_MODE_COLUMNS) {
+            WriteFormatted(pipeline, fp, ",%s", column);
+        }
+    }
+    if (args.mOutputQpcTime) {
+        WriteFormatted(pipeline, fp, ",QPCTime");
+    }
+    WriteFormatted(pipeline, fp, "\n");
+}
+
+// Returns the header line of a CSV with a row for each present, which is also
+// used when converting a columnar file to CSV.
+std::string GetCsvHeader()
 {
     auto const& args = GetCommandLineArgs();
 
-    fprintf(fp, "Application,ProcessID,SwapChainAddress,Runtime,SyncInterval,PresentFlags");
+    std::string header = "Application,ProcessID,SwapChainAddress,Runtime,SyncInterval,PresentFlags";
     if (args.mVerbosity > Verbosity::Simple) {
-        fprintf(fp, ",AllowsTearing,PresentMode");
+        header += ",AllowsTearing,PresentMode";
     }
     if (args.mVerbosity >= Verbosity::Verbose) {
-        fprintf(fp, ",WasBatched,DwmNotified");
+        header += ",WasBatched,DwmNotified";
+    }
+    header += ",Dropped,TimeInSeconds,MsBetweenPresents";
+    if (args.mVerbosity > Verbosity::Simple) {
+        header += ",MsBetweenDisplayChange";
+    }
+    header += ",MsInPresentAPI";
+    if (args.mVerbosity > Verbosity::Simple) {
+        header += ",MsUntilRenderComplete,MsUntilDisplayed";
+    }
+    if (args.mOutputQpcTime) {
+        header += ",QPCTime";
+    }
+    header += "\n";
+    return header;
+}
+
+static void WriteCsvHeader(Pipeline* pipeline, FILE* fp)
+{
+    auto const& args = GetCommandLineArgs();
+
+    if (args.mSummaryIntervalMs != 0) {
+        WriteSummaryCsvHeader(pipeline, fp);
+        return;
+    }
+
+    WriteFormatted(pipeline, fp, "%s", GetCsvHeader().c_str());
+}
+
+// UpdateCsv() formats each row with the Append*() functions in CsvFormat.hpp.
+static char* AppendQpcDelta(Pipeline const* pipeline, char* dst, uint64_t qpcDelta, uint32_t decimals)
+{
+    return AppendQpcDelta(dst, qpcDelta, (uint64_t) pipeline->mSession->mQpcFrequency.QuadPart, decimals);
+}
+
+static void AddSummaryStat(SummaryStats* stats, uint64_t qpcDuration)
+{
+    if (stats->mCount == 0 || qpcDuration < stats->mMin) {
+        stats->mMin = qpcDuration;
+    }
+    if (stats->mCount == 0 || qpcDuration > stats->mMax) {
+        stats->mMax = qpcDuration;
+    }
+    stats->mCount += 1;
+    stats->mTotal += qpcDuration;
+}
+
+// Mean, minimum, and maximum; all 0.000 if there were none.
+static char* AppendSummaryStats(Pipeline const* pipeline, char* dst, SummaryStats const& stats)
+{
+    auto mean = stats.mCount == 0 ? 0 : stats.mTotal / stats.mCount;
+    *dst++ = ','; dst = AppendQpcDelta(pipeline, dst, mean, 3);
+    *dst++ = ','; dst = AppendQpcDelta(pipeline, dst, stats.mMin, 3);
+    *dst++ = ','; dst = AppendQpcDelta(pipeline, dst, stats.mMax, 3);
+    return dst;
+}
+
+// P50, P95, and P99.
+static char* AppendPercentiles(char* dst, DurationHistogram const& histogram)
+{
+    *dst++ = ','; dst = AppendFloat(dst, histogram.GetPercentile(50.0));
+    *dst++ = ','; dst = AppendFloat(dst, histogram.GetPercentile(95.0));
+    *dst++ = ','; dst = AppendFloat(dst, histogram.GetPercentile(99.0));
+    return dst;
+}
+
+static uint64_t GetSummaryIntervalQpc(Pipeline const* pipeline)
+{
+    auto const& args = GetCommandLineArgs();
+    return max(1ull, SecondsDeltaToQpc(pipeline, args.mSummaryIntervalMs / 1000.0));
+}
+
+// Returns the index of the interval that qpcTime is in.
+static uint64_t GetSummaryIntervalIndex(Pipeline const* pipeline, uint64_t qpcTime)
+{
+    auto startQpc = (uint64_t) pipeline->mSession->mStartQpc.QuadPart;
+    return qpcTime > startQpc ? (qpcTime - startQpc) / GetSummaryIntervalQpc(pipeline) : 0;
+}
+
+// Resets summary to accumulate the swapchain's presents in interval
+// intervalIndex.  Its histograms are reused from the previous interval.
+static void StartSummaryInterval(SwapChainSummary* summary, uint64_t intervalIndex, uint64_t swapChainAddress, uint32_t processId, Runtime runtime)
+{
+    auto histograms = std::move(summary->mHistograms);
+    if (histograms == nullptr) {
+        histograms.reset(new SwapChainHistograms());
+    } else {
+        *histograms = SwapChainHistograms();
     }
-    fprintf(fp, ",Dropped,TimeInSeconds,MsBetweenPresents");
+
+    *summary = {};
+    summary->mHistograms       = std::move(histograms);
+    summary->mActive           = true;
+    summary->mIntervalIndex    = intervalIndex;
+    summary->mSwapChainAddress = swapChainAddress;
+    summary->mProcessId        = processId;
+    summary->mRuntime          = runtime;
+}
+
+// Outputs summary as a row, and resets it for the next interval.
+static void WriteSummaryRow(Pipeline* pipeline, OutputCsv* outputCsv, std::string const& moduleName, SwapChainSummary* summary)
+{
+    auto const& args = GetCommandLineArgs();
+
+    auto intervalStart = summary->mIntervalIndex * GetSummaryIntervalQpc(pipeline);
+
+    auto row = BeginWrite(pipeline, moduleName.size() + CSV_SUMMARY_ROW_FIELDS_MAX_SIZE);
+    auto end = AppendString(row, moduleName.c_str(), moduleName.size());
+    *end++ = ','; end = AppendInt(end, (int32_t) summary->mProcessId);
+    *end++ = ','; end = AppendHex(end, summary->mSwapChainAddress);
+    *end++ = ','; end = AppendString(end, RuntimeToString(summary->mRuntime));
+    *end++ = ','; end = AppendQpcDelta(pipeline, end, intervalStart, 6);
+    *end++ = ','; end = AppendUnsigned(end, summary->mFrameCount);
+    *end++ = ','; end = AppendUnsigned(end, summary->mDroppedCount);
+    end = AppendSummaryStats(pipeline, end, summary->mBetweenPresents);
+    end = AppendPercentiles(end, summary->mHistograms->mBetweenPresents);
+    *end++ = ','; end = AppendFloat(end, summary->mHistograms->mBetweenPresents.GetLowRate(1.0));
     if (args.mVerbosity > Verbosity::Simple) {
-        fprintf(fp, ",MsBetweenDisplayChange");
+        end = AppendSummaryStats(pipeline, end, summary->mBetweenDisplayChange);
+        end = AppendPercentiles(end, summary->mHistograms->mBetweenDisplayChange);
     }
-    fprintf(fp, ",MsInPresentAPI");
+    end = AppendSummaryStats(pipeline, end, summary->mInPresentAPI);
     if (args.mVerbosity > Verbosity::Simple) {
-        fprintf(fp, ",MsUntilRenderComplete,MsUntilDisplayed");
+        end = AppendSummaryStats(pipeline, end, summary->mUntilDisplayed);
+        end = AppendPercentiles(end, summary->mHistograms->mUntilDisplayed);
+        for (auto count : summary->mPresentModeCount) {
+            *end++ = ','; end = AppendUnsigned(end, count);
+        }
     }
     if (args.mOutputQpcTime) {
-        fprintf(fp, ",QPCTime");
+        *end++ = ','; end = AppendUnsigned(end, pipeline->mSession->mStartQpc.QuadPart + intervalStart);
+    }
+    *end++ = '\n';
+
+    EndWrite(pipeline, outputCsv->mFile, end);
+    outputCsv->mSize += end - row;
+
+    StartSummaryInterval(summary, summary->mIntervalIndex + 1, summary->mSwapChainAddress, summary->mProcessId, summary->mRuntime);
+}
+
+// Outputs summary's rows for the intervals before intervalIndex, including
+// those that the swapchain didn't present in.
+static void WriteSummaryRowsBefore(Pipeline* pipeline, OutputCsv* outputCsv, std::string const& moduleName, SwapChainSummary* summary, uint64_t intervalIndex)
+{
+    while (summary->mIntervalIndex < intervalIndex) {
+        WriteSummaryRow(pipeline, outputCsv, moduleName, summary);
+    }
+}
+
+// Outputs the rows for the intervals that processInfo's swapchains are still
+// accumulating, e.g., because the CSV is being closed.
+static void WriteSummaryRows(Pipeline* pipeline, OutputCsv* outputCsv, ProcessInfo* processInfo)
+{
+    for (auto& pair : processInfo->mSwapChain) {
+        auto summary = &pair.second.mSummary;
+        if (summary->mFrameCount > 0) {
+            WriteSummaryRow(pipeline, outputCsv, processInfo->mModuleName, summary);
+        }
+    }
+}
+
+// Stops outputting rows for processInfo's swapchains until they present again
+// (into the next CSV).
+static void EndSummaries(ProcessInfo* processInfo)
+{
+    for (auto& pair : processInfo->mSwapChain) {
+        pair.second.mSummary = {};
+    }
+}
+
+static bool HasSummaryRows(ProcessInfo const* processInfo)
+{
+    for (auto const& pair : processInfo->mSwapChain) {
+        if (pair.second.mSummary.mFrameCount > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The durations output for a present, as QPC deltas.  A duration of zero is
+// output as 0.000, the same as a statistic that isn't computed.
+struct PresentDurations {
+    uint64_t mBetweenPresents;
+    uint64_t mBetweenDisplayChange;
+    uint64_t mUntilRenderComplete;
+    uint64_t mUntilDisplayed;
+};
+
+// Computes the durations of p from the presents before it in chain's
+// history.  Returns false if there isn't a previous present to compute them
+// from.
+static bool GetPresentDurations(SwapChainData const* chain, PresentEvent const& p, PresentDurations* durations)
+{
+    auto const& args = GetCommandLineArgs();
+
+    if (chain->mPresentHistoryCount == 0) {
+        return false;
+    }
+
+    auto lastPresented = chain->mPresentHistory[(chain->mNextPresentIndex - 1) % SwapChainData::PRESENT_HISTORY_MAX_COUNT].get();
+
+    durations->mBetweenPresents      = p.QpcTime - lastPresented->QpcTime;
+    durations->mBetweenDisplayChange = 0;
+    durations->mUntilRenderComplete  = 0;
+    durations->mUntilDisplayed       = 0;
+
+    if (args.mVerbosity > Verbosity::Simple) {
+        if (p.ReadyTime > 0) {
+            durations->mUntilRenderComplete = p.ReadyTime - p.QpcTime;
+        }
+        if (p.FinalState == PresentResult::Presented) {
+            durations->mUntilDisplayed = p.ScreenTime - p.QpcTime;
+
+            if (chain->mLastDisplayedPresentIndex > 0) {
+                auto lastDisplayed = chain->mPresentHistory[chain->mLastDisplayedPresentIndex % SwapChainData::PRESENT_HISTORY_MAX_COUNT].get();
+                durations->mBetweenDisplayChange = p.ScreenTime - lastDisplayed->ScreenTime;
+            }
+        }
+    }
+
+    return true;
+}
+
+// The durations are stored as the QPC deltas the CSV columns are computed
+// from, and all the fields are stored whatever the verbosity.
+static void ToColumnarPresent(PresentEvent const& p, PresentDurations const& durations, ColumnarPresent* columnar)
+{
+    columnar->mQpcTime              = p.QpcTime;
+    columnar->mSwapChainAddress     = p.SwapChainAddress;
+    columnar->mBetweenPresents      = durations.mBetweenPresents;
+    columnar->mBetweenDisplayChange = durations.mBetweenDisplayChange;
+    columnar->mInPresentAPI         = p.TimeTaken;
+    columnar->mUntilRenderComplete  = durations.mUntilRenderComplete;
+    columnar->mUntilDisplayed       = durations.mUntilDisplayed;
+    columnar->mProcessId            = p.ProcessId;
+    columnar->mSyncInterval         = p.SyncInterval;
+    columnar->mPresentFlags         = p.PresentFlags;
+    columnar->mRuntime              = (uint8_t) p.Runtime;
+    columnar->mPresentMode          = (uint8_t) p.PresentMode;
+    columnar->mFinalState           = (uint8_t) p.FinalState;
+    columnar->mSupportsTearing      = p.SupportsTearing;
+    columnar->mWasBatched           = p.WasBatched;
+    columnar->mDwmNotified          = p.DwmNotified;
+}
+
+// Returns p as it's written to -output_format columnar files, which is also
+// how it's streamed to -output_pipe clients.  Returns false if it's the first
+// present of chain, which has no durations and isn't output.
+bool GetColumnarPresent(SwapChainData const* chain, PresentEvent const& p, ColumnarPresent* columnar)
+{
+    PresentDurations durations;
+    if (!GetPresentDurations(chain, p, &durations)) {
+        return false;
     }
-    fprintf(fp, "\n");
+
+    ToColumnarPresent(p, durations, columnar);
+    return true;
 }
 
-void UpdateCsv(ProcessInfo* processInfo, SwapChainData const& chain, PresentEvent const& p)
+void UpdateCsv(Pipeline* pipeline, ProcessInfo* processInfo, SwapChainData* chain, PresentEvent const& p)
 {
     auto const& args = GetCommandLineArgs();
 
@@ -99,80 +390,165 @@ void UpdateCsv(ProcessInfo* processInfo, SwapChainData const& chain, PresentEven
     }
 
     // Early return if not outputing to CSV.
-    auto fp = GetOutputCsv(processInfo).mFile;
-    if (fp == nullptr) {
+    auto outputCsv = GetOutputCsv(pipeline, processInfo);
+    if (outputCsv->mFile == nullptr) {
         return;
     }
 
-    // Look up the last present event in the swapchain's history.  We need at
-    // least two presents to compute frame statistics.
-    if (chain.mPresentHistoryCount == 0) {
+    // We need at least two presents to compute frame statistics.
+    PresentDurations durations;
+    if (!GetPresentDurations(chain, p, &durations)) {
+        return;
+    }
+    uint64_t timeSinceStart = p.QpcTime - pipeline->mSession->mStartQpc.QuadPart;
+
+    // Start the next file before writing this row if the current one is due
+    // to be rotated, so that every row ends up in exactly one file.
+    if (IsOutputCsvDueToRotate(pipeline, outputCsv, p.QpcTime)) {
+        RotateOutputCsv(pipeline, processInfo, outputCsv);
+        if (outputCsv->mFile == nullptr) {
+            return;
+        }
+    }
+    auto fp = outputCsv->mFile;
+
+    // With -output_format columnar, add the present to the file's current row
+    // group instead.
+    if (args.mOutputFormat == OutputFormat::Columnar) {
+        ColumnarPresent columnar;
+        ToColumnarPresent(p, durations, &columnar);
+        AddColumnarPresent(pipeline, outputCsv, processInfo, columnar);
         return;
     }
 
-    auto lastPresented = chain.mPresentHistory[(chain.mNextPresentIndex - 1) % SwapChainData::PRESENT_HISTORY_MAX_COUNT].get();
-
-    // Compute frame statistics.
-    double timeInSeconds          = QpcToSeconds(p.QpcTime);
-    double msBetweenPresents      = 1000.0 * QpcDeltaToSeconds(p.QpcTime - lastPresented->QpcTime);
-    double msInPresentApi         = 1000.0 * QpcDeltaToSeconds(p.TimeTaken);
-    double msUntilRenderComplete  = 0.0;
-    double msUntilDisplayed       = 0.0;
-    double msBetweenDisplayChange = 0.0;
-
-    if (args.mVerbosity > Verbosity::Simple) {
-        if (p.ReadyTime > 0) {
-            msUntilRenderComplete = 1000.0 * QpcDeltaToSeconds(p.ReadyTime - p.QpcTime);
+    // With -summary_interval, add the present to its swapchain's summary
+    // instead, once the previous intervals' summaries are output.  Presents
+    // complete out of order, so one can start in an interval that
+    // FlushSummaryIntervals() has already output; it's added to the current
+    // interval instead.
+    if (args.mSummaryIntervalMs != 0) {
+        auto summary = &chain->mSummary;
+        auto intervalIndex = GetSummaryIntervalIndex(pipeline, p.QpcTime);
+        if (!summary->mActive) {
+            StartSummaryInterval(summary, intervalIndex, p.SwapChainAddress, p.ProcessId, p.Runtime);
         }
-        if (presented) {
-            msUntilDisplayed = 1000.0 * QpcDeltaToSeconds(p.ScreenTime - p.QpcTime);
+        WriteSummaryRowsBefore(pipeline, outputCsv, processInfo->mModuleName, summary, intervalIndex);
 
-            if (chain.mLastDisplayedPresentIndex > 0) {
-                auto lastDisplayed = chain.mPresentHistory[chain.mLastDisplayedPresentIndex % SwapChainData::PRESENT_HISTORY_MAX_COUNT].get();
-                msBetweenDisplayChange = 1000.0 * QpcDeltaToSeconds(p.ScreenTime - lastDisplayed->ScreenTime);
+        summary->mFrameCount += 1;
+        if (!presented) {
+            summary->mDroppedCount += 1;
+        }
+        AddSummaryStat(&summary->mBetweenPresents, durations.mBetweenPresents);
+        summary->mHistograms->mBetweenPresents.Add(QpcDeltaToMicroseconds(pipeline, durations.mBetweenPresents));
+        AddSummaryStat(&summary->mInPresentAPI, p.TimeTaken);
+        if (args.mVerbosity > Verbosity::Simple) {
+            if (presented) {
+                AddSummaryStat(&summary->mUntilDisplayed, durations.mUntilDisplayed);
+                summary->mHistograms->mUntilDisplayed.Add(QpcDeltaToMicroseconds(pipeline, durations.mUntilDisplayed));
+                if (chain->mLastDisplayedPresentIndex > 0) {
+                    AddSummaryStat(&summary->mBetweenDisplayChange, durations.mBetweenDisplayChange);
+                    summary->mHistograms->mBetweenDisplayChange.Add(QpcDeltaToMicroseconds(pipeline, durations.mBetweenDisplayChange));
+                }
+            }
+            auto presentMode = (uint32_t) p.PresentMode;
+            if (presentMode < SwapChainSummary::PRESENT_MODE_COUNT) {
+                summary->mPresentModeCount[presentMode] += 1;
             }
         }
+        return;
     }
 
     // Output in CSV format
-    fprintf(fp, "%s,%d,0x%016llX,%s,%d,%d", processInfo->mModuleName.c_str(), p.ProcessId, p.SwapChainAddress,
-        RuntimeToString(p.Runtime), p.SyncInterval, p.PresentFlags);
+    auto const& moduleName = processInfo->mModuleName;
+    auto row = BeginWrite(pipeline, moduleName.size() + CSV_ROW_FIELDS_MAX_SIZE);
+    auto end = AppendString(row, moduleName.c_str(), moduleName.size());
+    *end++ = ','; end = AppendInt(end, (int32_t) p.ProcessId);
+    *end++ = ','; end = AppendHex(end, p.SwapChainAddress);
+    *end++ = ','; end = AppendString(end, RuntimeToString(p.Runtime));
+    *end++ = ','; end = AppendInt(end, p.SyncInterval);
+    *end++ = ','; end = AppendInt(end, (int32_t) p.PresentFlags);
     if (args.mVerbosity > Verbosity::Simple) {
-        fprintf(fp, ",%d,%s", p.SupportsTearing, PresentModeToString(p.PresentMode));
+        *end++ = ','; end = AppendInt(end, p.SupportsTearing);
+        *end++ = ','; end = AppendString(end, PresentModeToString(p.PresentMode));
     }
     if (args.mVerbosity >= Verbosity::Verbose) {
-        fprintf(fp, ",%d,%d", p.WasBatched, p.DwmNotified);
+        *end++ = ','; end = AppendInt(end, p.WasBatched);
+        *end++ = ','; end = AppendInt(end, p.DwmNotified);
     }
-    fprintf(fp, ",%s,%.6lf,%.3lf", FinalStateToDroppedString(p.FinalState), timeInSeconds, msBetweenPresents);
+    *end++ = ','; end = AppendString(end, FinalStateToDroppedString(p.FinalState));
+    *end++ = ','; end = AppendQpcDelta(pipeline, end, timeSinceStart, 6);
+    *end++ = ','; end = AppendQpcDelta(pipeline, end, durations.mBetweenPresents, 3);
     if (args.mVerbosity > Verbosity::Simple) {
-        fprintf(fp, ",%.3lf", msBetweenDisplayChange);
+        *end++ = ','; end = AppendQpcDelta(pipeline, end, durations.mBetweenDisplayChange, 3);
     }
-    fprintf(fp, ",%.3lf", msInPresentApi);
+    *end++ = ','; end = AppendQpcDelta(pipeline, end, p.TimeTaken, 3);
     if (args.mVerbosity > Verbosity::Simple) {
-        fprintf(fp, ",%.3lf,%.3lf", msUntilRenderComplete, msUntilDisplayed);
+        *end++ = ','; end = AppendQpcDelta(pipeline, end, durations.mUntilRenderComplete, 3);
+        *end++ = ','; end = AppendQpcDelta(pipeline, end, durations.mUntilDisplayed, 3);
     }
     if (args.mOutputQpcTime) {
-        fprintf(fp, ",%llu", p.QpcTime);
+        *end++ = ','; end = AppendUnsigned(end, p.QpcTime);
+    }
+    *end++ = '\n';
+
+    EndWrite(pipeline, fp, end);
+    outputCsv->mSize += end - row;
+}
+
+// With -summary_interval, outputs the rows for the intervals that ended
+// before qpcTime, the latest trace time seen, for every swapchain that has
+// presented.  This way a swapchain's rows are written in time even if it
+// stops presenting.
+void FlushSummaryIntervals(Pipeline* pipeline, uint64_t qpcTime)
+{
+    auto intervalIndex = GetSummaryIntervalIndex(pipeline, qpcTime);
+
+    for (auto& pair : pipeline->mProcesses) {
+        auto processInfo = &pair.second;
+        for (auto& pair2 : processInfo->mSwapChain) {
+            auto summary = &pair2.second.mSummary;
+            if (!summary->mActive || summary->mIntervalIndex >= intervalIndex) {
+                continue;
+            }
+
+            auto outputCsv = GetOutputCsv(pipeline, processInfo);
+            if (outputCsv->mFile != nullptr && IsOutputCsvDueToRotate(pipeline, outputCsv, qpcTime)) {
+                RotateOutputCsv(pipeline, processInfo, outputCsv);
+            }
+            if (outputCsv->mFile == nullptr) {
+                continue;
+            }
+
+            WriteSummaryRowsBefore(pipeline, outputCsv, processInfo->mModuleName, summary, intervalIndex);
+        }
     }
-    fprintf(fp, "\n");
 }
 
 /* This text is reproduced in the readme, modify both if there are changes:
 
 By default, PresentMon creates a CSV file named `PresentMon-TIME.csv`, where
 `TIME` is the creation time in ISO 8601 format.  To specify your own output
-location, use the `-output_file PATH` command line argument.
+location, use the `-output_file PATH` command line argument.  With
+`-output_format columnar`, the default extension is `.pmcol` instead.
 
 If `-multi_csv` is used, then one CSV is created for each process captured with
 `-PROCESSNAME` appended to the file name.
+Only the `-max_open_csv` most recently used of these are kept open at once; the
+others are closed, and appended to if the process presents again.
 
 If `-hotkey` is used, then one CSV is created each time recording is started
 with `-INDEX` appended to the file name.
 
+If `-rotate_mb` or `-rotate_seconds` is used, then a new CSV is started each
+time the current one reaches the size or duration limit, with `-FILEINDEX`
+appended to the file name.  `FILEINDEX` starts at 0001 and increases with each
+file; if `-max_files` is also used, the oldest files are deleted so that only
+that many remain.
+
 If `-include_mixed_reality` is used, a second CSV file will be generated with
 `_WMR` appended to the filename containing the WMR data.
 */
-static void GenerateFilename(char const* processName, char* path)
+static void GenerateFilename(Pipeline const* pipeline, char const* processName, uint32_t fileIndex, char* path)
 {
     auto const& args = GetCommandLineArgs();
 
@@ -187,18 +563,18 @@ static void GenerateFilename(char const* processName, char* path)
 } while (0)
 
     // Generate base filename.
-    if (args.mOutputCsvFileName) {
+    if (pipeline->mOutputCsvFileName) {
         char drive[_MAX_DRIVE];
         char dir[_MAX_DIR];
         char name[_MAX_FNAME];
-        _splitpath_s(args.mOutputCsvFileName, drive, dir, name, ext);
+        _splitpath_s(pipeline->mOutputCsvFileName, drive, dir, name, ext);
         ADD_TO_PATH("%s%s%s", drive, dir, name);
     } else {
         struct tm tm;
         time_t time_now = time(NULL);
         localtime_s(&tm, &time_now);
         ADD_TO_PATH("PresentMon-%4d-%02d-%02dT%02d%02d%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
-        strcpy_s(ext, ".csv");
+        strcpy_s(ext, args.mOutputFormat == OutputFormat::Columnar ? ".pmcol" : ".csv");
     }
 
     // Append -PROCESSNAME if applicable.
@@ -208,41 +584,175 @@ static void GenerateFilename(char const* processName, char* path)
 
     // Append -INDEX if applicable.
     if (args.mHotkeySupport) {
-        ADD_TO_PATH("-%d", gRecordingCount);
+        ADD_TO_PATH("-%d", pipeline->mRecordingCount);
+    }
+
+    // Append -FILEINDEX if applicable.
+    if (args.mRotateMegabytes != 0 || args.mRotateSeconds != 0) {
+        ADD_TO_PATH("-%04u", fileIndex);
     }
 
     // Append extension.
     ADD_TO_PATH("%s", ext);
 }
 
-static OutputCsv CreateOutputCsv(char const* processName)
+// Deletes the oldest of outputCsv's files (and its _WMR file) until only
+// -max_files remain.  The files are deleted by WriterThread, after it has
+// closed them.
+static void DeleteOldOutputCsvFiles(Pipeline* pipeline, OutputCsv* outputCsv)
+{
+    auto const& args = GetCommandLineArgs();
+
+    while (outputCsv->mPaths.size() > args.mMaxFiles) {
+        auto const& path = outputCsv->mPaths.front();
+        DeleteFileAfterWrites(pipeline, path.c_str());
+        if (args.mIncludeWindowsMixedReality) {
+            char lsrPath[MAX_PATH];
+            GenerateLsrCsvFilename(path.c_str(), lsrPath);
+            DeleteFileAfterWrites(pipeline, lsrPath);
+        }
+        outputCsv->mPaths.pop_front();
+    }
+}
+
+// Closes outputCsv's files once everything written to them has been written.
+static void CloseOutputCsvFiles(Pipeline* pipeline, OutputCsv* outputCsv)
+{
+    auto const& args = GetCommandLineArgs();
+
+    if (outputCsv->mFile != nullptr) {
+        if (args.mOutputFormat == OutputFormat::Columnar) {
+            FlushColumnarRows(pipeline, outputCsv);
+        }
+        CloseFileAfterWrites(pipeline, outputCsv->mFile);
+        if (args.mMultiCsv) {
+            pipeline->mOpenOutputCsvs.erase(outputCsv->mOpenPosition);
+        }
+    }
+    if (outputCsv->mWmrFile != nullptr) {
+        CloseFileAfterWrites(pipeline, outputCsv->mWmrFile);
+    }
+    outputCsv->mFile = nullptr;
+    outputCsv->mWmrFile = nullptr;
+}
+
+// With -multi_csv, there can be a CSV for each of thousands of processes, so
+// only the -max_open_csv most recently used ones are kept open.  The others
+// are closed, and reopened by ReopenOutputCsv() if they're used again.
+static void AddOpenOutputCsv(Pipeline* pipeline, OutputCsv* outputCsv)
+{
+    auto const& args = GetCommandLineArgs();
+
+    if (!args.mMultiCsv) {
+        return;
+    }
+
+    pipeline->mOpenOutputCsvs.push_front(outputCsv);
+    outputCsv->mOpenPosition = pipeline->mOpenOutputCsvs.begin();
+
+    if (args.mMaxOpenCsvs != 0) {
+        while (pipeline->mOpenOutputCsvs.size() > args.mMaxOpenCsvs) {
+            CloseOutputCsvFiles(pipeline, pipeline->mOpenOutputCsvs.back());
+        }
+    }
+}
+
+// Reopens outputCsv's files, which were closed by AddOpenOutputCsv(), to
+// append to them.  Their headers were already written when they were created.
+static void ReopenOutputCsv(Pipeline* pipeline, OutputCsv* outputCsv)
 {
     auto const& args = GetCommandLineArgs();
 
-    OutputCsv outputCsv = {};
+    fopen_s(&outputCsv->mFile, outputCsv->mPath.c_str(), "ab");
+    if (outputCsv->mFile == nullptr) {
+        return;
+    }
+
+    if (args.mIncludeWindowsMixedReality) {
+        char lsrPath[MAX_PATH];
+        GenerateLsrCsvFilename(outputCsv->mPath.c_str(), lsrPath);
+        fopen_s(&outputCsv->mWmrFile, lsrPath, "a");
+    }
+
+    AddOpenOutputCsv(pipeline, outputCsv);
+}
+
+// Opens the next file of outputCsv, which must not have one open.
+static void CreateOutputCsv(Pipeline* pipeline, char const* processName, OutputCsv* outputCsv)
+{
+    auto const& args = GetCommandLineArgs();
 
     if (args.mOutputCsvToStdout) {
-        outputCsv.mFile = stdout;
-        outputCsv.mWmrFile = nullptr;       // WMR disallowed if -output_stdout
+        outputCsv->mFile = stdout;
+        outputCsv->mWmrFile = nullptr;      // WMR disallowed if -output_stdout
     } else {
         char path[MAX_PATH];
-        GenerateFilename(processName, path);
+        GenerateFilename(pipeline, processName, outputCsv->mFileIndex + 1, path);
 
-        fopen_s(&outputCsv.mFile, path, "wb");
+        fopen_s(&outputCsv->mFile, path, "wb");
+        if (outputCsv->mFile == nullptr) {
+            return;
+        }
 
         if (args.mIncludeWindowsMixedReality) {
-            outputCsv.mWmrFile = CreateLsrCsvFile(path);
+            outputCsv->mWmrFile = CreateLsrCsvFile(pipeline, path);
         }
+
+        outputCsv->mFileIndex += 1;
+        if (args.mMaxFiles != 0) {
+            outputCsv->mPaths.emplace_back(path);
+            DeleteOldOutputCsvFiles(pipeline, outputCsv);
+        }
+
+        outputCsv->mPath = path;
+        AddOpenOutputCsv(pipeline, outputCsv);
     }
 
-    if (outputCsv.mFile != nullptr) {
-        WriteCsvHeader(outputCsv.mFile);
+    outputCsv->mSize = 0;
+    outputCsv->mRotateQpc = 0;
+
+    if (args.mOutputFormat == OutputFormat::Columnar) {
+        WriteColumnarHeader(pipeline, outputCsv);
+    } else {
+        WriteCsvHeader(pipeline, outputCsv->mFile);
     }
+}
 
-    return outputCsv;
+// Returns true if the present at qpcTime should start the next file, because
+// the current one has reached -rotate_mb or has -rotate_seconds of presents.
+static bool IsOutputCsvDueToRotate(Pipeline const* pipeline, OutputCsv* outputCsv, uint64_t qpcTime)
+{
+    auto const& args = GetCommandLineArgs();
+
+    if (args.mRotateMegabytes != 0 && outputCsv->mSize >= (uint64_t) args.mRotateMegabytes * 1024 * 1024) {
+        return true;
+    }
+
+    if (args.mRotateSeconds != 0) {
+        if (outputCsv->mRotateQpc == 0) {
+            outputCsv->mRotateQpc = qpcTime + SecondsDeltaToQpc(pipeline, args.mRotateSeconds);
+        } else if (qpcTime >= outputCsv->mRotateQpc) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
-OutputCsv GetOutputCsv(ProcessInfo* processInfo)
+// Closes outputCsv's files and opens the next ones.  Closing and opening are
+// both ordered with the rows by WriterThread, so no rows are lost or written
+// to the wrong file across the switch.
+static void RotateOutputCsv(Pipeline* pipeline, ProcessInfo* processInfo, OutputCsv* outputCsv)
+{
+    auto const& args = GetCommandLineArgs();
+
+    CloseOutputCsvFiles(pipeline, outputCsv);
+    outputCsv->mPath.clear();
+
+    CreateOutputCsv(pipeline, args.mMultiCsv ? processInfo->mModuleName.c_str() : nullptr, outputCsv);
+}
+
+OutputCsv* GetOutputCsv(Pipeline* pipeline, ProcessInfo* processInfo)
 {
     auto const& args = GetCommandLineArgs();
 
@@ -250,51 +760,74 @@ OutputCsv GetOutputCsv(ProcessInfo* processInfo)
     // every time PresentMon wants to output to the file. We should detect the
     // failure and generate an error instead.
 
-    if (args.mOutputCsvToFile && processInfo->mOutputCsv.mFile == nullptr) {
-        if (args.mMultiCsv) {
-            processInfo->mOutputCsv = CreateOutputCsv(processInfo->mModuleName.c_str());
-        } else {
-            if (gSingleOutputCsv.mFile == nullptr) {
-                gSingleOutputCsv = CreateOutputCsv(nullptr);
+    // Without -multi_csv, every process outputs to the pipeline's single CSV.
+    auto outputCsv = args.mMultiCsv ? &processInfo->mOutputCsv : &pipeline->mSingleOutputCsv;
+    if (args.mOutputCsvToFile) {
+        if (outputCsv->mFile != nullptr) {
+            if (args.mMultiCsv) {
+                // Move to the front of the -max_open_csv LRU order.
+                pipeline->mOpenOutputCsvs.splice(pipeline->mOpenOutputCsvs.begin(), pipeline->mOpenOutputCsvs, outputCsv->mOpenPosition);
             }
-
-            processInfo->mOutputCsv = gSingleOutputCsv;
+        } else if (outputCsv->mPath.empty()) {
+            CreateOutputCsv(pipeline, args.mMultiCsv ? processInfo->mModuleName.c_str() : nullptr, outputCsv);
+        } else {
+            ReopenOutputCsv(pipeline, outputCsv);
         }
     }
 
-    return processInfo->mOutputCsv;
+    return outputCsv;
 }
 
-void CloseOutputCsv(ProcessInfo* processInfo)
+void CloseOutputCsv(Pipeline* pipeline, ProcessInfo* processInfo)
 {
     auto const& args = GetCommandLineArgs();
 
-    // If processInfo is nullptr, it means we should operate on the global
+    // If processInfo is nullptr, it means we should operate on the pipeline's
     // single output CSV.
     //
     // We only actually close the FILE if we own it (we're operating on the
-    // single global output CSV, or we're writing a CSV per process) and it's
+    // single output CSV, or we're writing a CSV per process) and it's
     // not stdout.
     OutputCsv* csv = nullptr;
     bool closeFile = false;
     if (processInfo == nullptr) {
-        csv = &gSingleOutputCsv;
+        csv = &pipeline->mSingleOutputCsv;
         closeFile = !args.mOutputCsvToStdout;
+
+        // Output the intervals all the processes are still accumulating
+        // before the single CSV is closed.
+        if (args.mSummaryIntervalMs != 0) {
+            for (auto& pair : pipeline->mProcesses) {
+                if (csv->mFile != nullptr) {
+                    WriteSummaryRows(pipeline, csv, &pair.second);
+                }
+                EndSummaries(&pair.second);
+            }
+        }
     } else {
         csv = &processInfo->mOutputCsv;
         closeFile = !args.mOutputCsvToStdout && args.mMultiCsv;
+
+        // Output the intervals the process is still accumulating, to whichever
+        // CSV it's been writing to (reopening it if it was closed for
+        // -max_open_csv).
+        if (args.mSummaryIntervalMs != 0) {
+            if (HasSummaryRows(processInfo)) {
+                auto outputCsv = GetOutputCsv(pipeline, processInfo);
+                if (outputCsv->mFile != nullptr) {
+                    WriteSummaryRows(pipeline, outputCsv, processInfo);
+                }
+            }
+            EndSummaries(processInfo);
+        }
     }
 
     if (closeFile) {
-        if (csv->mFile != nullptr) {
-            fclose(csv->mFile);
-        }
-        if (csv->mWmrFile != nullptr) {
-            fclose(csv->mWmrFile);
-        }
+        CloseOutputCsvFiles(pipeline, csv);
     }
 
-    csv->mFile = nullptr;
-    csv->mWmrFile = nullptr;
+    // Reset the rotation and -max_open_csv state too, so that the next file
+    // starts a new sequence (e.g., for the next -hotkey recording).
+    *csv = OutputCsv();
 }
 
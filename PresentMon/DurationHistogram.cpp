@@ -0,0 +1,118 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "DurationHistogram.hpp"
+
+#include <intrin.h>
+#include <math.h>
+
+namespace {
+
+uint32_t GetBucketIndex(uint64_t microseconds)
+{
+    if (microseconds < DurationHistogram::EXACT_COUNT) {
+        return (uint32_t) microseconds;
+    }
+    if (microseconds >= (1ull << DurationHistogram::MAX_BITS)) {
+        return DurationHistogram::BUCKET_COUNT - 1;
+    }
+
+    // The top SUB_BUCKET_BITS + 1 bits select the bucket within the power of
+    // two.
+    unsigned long topBit = 0;
+    _BitScanReverse(&topBit, (unsigned long) microseconds);
+    auto shift = topBit - DurationHistogram::SUB_BUCKET_BITS;
+    auto subBucket = (uint32_t) (microseconds >> shift) - DurationHistogram::SUB_BUCKET_COUNT;
+    return DurationHistogram::EXACT_COUNT + (shift - 1) * DurationHistogram::SUB_BUCKET_COUNT + subBucket;
+}
+
+// The middle of the durations counted in bucket index, in milliseconds.
+double GetBucketMilliseconds(uint32_t index)
+{
+    if (index < DurationHistogram::EXACT_COUNT) {
+        return index / 1000.0;
+    }
+
+    auto shift = (index - DurationHistogram::EXACT_COUNT) / DurationHistogram::SUB_BUCKET_COUNT + 1;
+    auto subBucket = (index - DurationHistogram::EXACT_COUNT) % DurationHistogram::SUB_BUCKET_COUNT + DurationHistogram::SUB_BUCKET_COUNT;
+    auto first = (uint64_t) subBucket << shift;
+    auto last = first + (1ull << shift) - 1;
+    return (first + last) / 2000.0;
+}
+
+}
+
+void DurationHistogram::Add(uint64_t microseconds)
+{
+    mBucketCount[GetBucketIndex(microseconds)] += 1;
+    mCount += 1;
+}
+
+double DurationHistogram::GetPercentile(double percent) const
+{
+    if (mCount == 0) {
+        return 0.0;
+    }
+
+    // The rank of the duration at percent, rounded up (e.g., the median of
+    // 4 durations is the 2nd).
+    auto rank = (uint64_t) ceil(percent / 100.0 * mCount);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < BUCKET_COUNT; ++i) {
+        count += mBucketCount[i];
+        if (count >= rank) {
+            return GetBucketMilliseconds(i);
+        }
+    }
+    return GetBucketMilliseconds(BUCKET_COUNT - 1);
+}
+
+double DurationHistogram::GetLargestMean(double percent) const
+{
+    if (mCount == 0) {
+        return 0.0;
+    }
+
+    auto largestCount = (uint64_t) (percent / 100.0 * mCount);
+    if (largestCount == 0) {
+        largestCount = 1;
+    }
+
+    uint64_t count = 0;
+    double total = 0.0;
+    for (uint32_t i = BUCKET_COUNT; i-- > 0 && count < largestCount; ) {
+        auto bucketCount = mBucketCount[i] < largestCount - count ? mBucketCount[i] : largestCount - count;
+        total += bucketCount * GetBucketMilliseconds(i);
+        count += bucketCount;
+    }
+    return total / count;
+}
+
+double DurationHistogram::GetLowRate(double percent) const
+{
+    auto mean = GetLargestMean(percent);
+    return mean == 0.0 ? 0.0 : 1000.0 / mean;
+}
@@ -0,0 +1,61 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// A histogram of durations that uses the same memory however many durations
+// are added, so that percentiles can be computed over a capture of any length.
+//
+// Like an HdrHistogram, durations are counted in microseconds in log-linear
+// buckets: each microsecond up to EXACT_COUNT has its own bucket, and each
+// power of two above that is split into SUB_BUCKET_COUNT buckets.  So a
+// percentile is within 1/SUB_BUCKET_COUNT of the exact value.  Durations of
+// 2^MAX_BITS microseconds (about 33 seconds) or more are counted as the
+// largest bucket.
+struct DurationHistogram {
+    enum {
+        SUB_BUCKET_BITS = 6,
+        SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS,
+        EXACT_COUNT = 2 * SUB_BUCKET_COUNT,
+        MAX_BITS = 25,
+        BUCKET_COUNT = EXACT_COUNT + (MAX_BITS - SUB_BUCKET_BITS - 1) * SUB_BUCKET_COUNT,
+    };
+
+    uint32_t mBucketCount[BUCKET_COUNT];
+    uint64_t mCount;
+
+    void Add(uint64_t microseconds);
+
+    // Returns the duration, in milliseconds, that percentile percent of the
+    // durations are less than or equal to; or 0 if there are no durations.
+    double GetPercentile(double percent) const;
+
+    // Returns the mean, in milliseconds, of the largest percent of the
+    // durations (at least one); or 0 if there are no durations.
+    double GetLargestMean(double percent) const;
+
+    // Returns the rate per second corresponding to GetLargestMean(percent),
+    // e.g., the "1% low" frame rate is GetLowRate(1.0) of the frame times.
+    double GetLowRate(double percent) const;
+};
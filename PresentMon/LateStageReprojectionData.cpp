@@ -33,7 +33,7 @@ enum {
 void LateStageReprojectionData::PruneDeque(std::deque<LateStageReprojectionEvent> &lsrHistory, uint32_t msTimeDiff, uint32_t maxHistLen) {
     while (!lsrHistory.empty() && (
         lsrHistory.size() > maxHistLen ||
-        1000.0 * QpcDeltaToSeconds(lsrHistory.back().QpcTime - lsrHistory.front().QpcTime) > msTimeDiff)) {
+        1000.0 * QpcDeltaToSeconds(mPipeline, lsrHistory.back().QpcTime - lsrHistory.front().QpcTime) > msTimeDiff)) {
         lsrHistory.pop_front();
     }
 }
@@ -82,7 +82,7 @@ double LateStageReprojectionData::ComputeHistoryTime(const std::deque<LateStageR
 
     auto start = lsrHistory.front().QpcTime;
     auto end = lsrHistory.back().QpcTime;
-    return QpcDeltaToSeconds(end - start);
+    return QpcDeltaToSeconds(mPipeline, end - start);
 }
 
 size_t LateStageReprojectionData::ComputeHistorySize() const
@@ -108,7 +108,7 @@ double LateStageReprojectionData::ComputeFps(const std::deque<LateStageReproject
     auto end = lsrHistory.back().QpcTime;
     auto count = lsrHistory.size() - 1;
 
-    return count / QpcDeltaToSeconds(end - start);
+    return count / QpcDeltaToSeconds(mPipeline, end - start);
 }
 
 double LateStageReprojectionData::ComputeSourceFps() const
@@ -187,8 +187,8 @@ LateStageReprojectionRuntimeStats LateStageReprojectionData::ComputeRuntimeStats
     stats.mAppProcessId = mLSRHistory[count - 1].GetAppProcessId();
     stats.mLsrProcessId = mLSRHistory[count - 1].ProcessId;
 
-    stats.mAppSourceCpuRenderTimeInMs = 1000.0 * QpcDeltaToSeconds(totalAppSourceCpuRenderTime);
-    stats.mAppSourceReleaseToLsrAcquireInMs = 1000.0 * QpcDeltaToSeconds(totalAppSourceReleaseToLsrAcquireTime);
+    stats.mAppSourceCpuRenderTimeInMs = 1000.0 * QpcDeltaToSeconds(mPipeline, totalAppSourceCpuRenderTime);
+    stats.mAppSourceReleaseToLsrAcquireInMs = 1000.0 * QpcDeltaToSeconds(mPipeline, totalAppSourceReleaseToLsrAcquireTime);
 
     stats.mAppSourceReleaseToLsrAcquireInMs /= count;
     stats.mAppSourceCpuRenderTimeInMs /= count;
@@ -201,19 +201,25 @@ LateStageReprojectionRuntimeStats LateStageReprojectionData::ComputeRuntimeStats
     return stats;
 }
 
-FILE* CreateLsrCsvFile(char const* path)
+// Adds _WMR to the CSV file name in path.  lsrPath must have room for
+// MAX_PATH characters.
+void GenerateLsrCsvFilename(char const* path, char* lsrPath)
 {
-    auto const& args = GetCommandLineArgs();
-
-    // Add _WMR to the file name
     char drive[_MAX_DRIVE];
     char dir[_MAX_DIR];
     char name[_MAX_FNAME];
     char ext[_MAX_EXT];
     _splitpath_s(path, drive, dir, name, ext);
 
+    _snprintf_s(lsrPath, MAX_PATH, _TRUNCATE, "%s%s%s_WMR%s", drive, dir, name, ext);
+}
+
+FILE* CreateLsrCsvFile(Pipeline* pipeline, char const* path)
+{
+    auto const& args = GetCommandLineArgs();
+
     char outputPath[MAX_PATH];
-    _snprintf_s(outputPath, _TRUNCATE, "%s%s%s_WMR%s", drive, dir, name, ext);
+    GenerateLsrCsvFilename(path, outputPath);
 
     // Open output file
     FILE* fp = nullptr;
@@ -222,37 +228,37 @@ FILE* CreateLsrCsvFile(char const* path)
     }
 
     // Print CSV header
-    fprintf(fp, "Application,ProcessID,DwmProcessID");
+    WriteFormatted(pipeline, fp, "Application,ProcessID,DwmProcessID");
     if (args.mVerbosity >= Verbosity::Verbose) {
-        fprintf(fp, ",HolographicFrameID");
+        WriteFormatted(pipeline, fp, ",HolographicFrameID");
     }
-    fprintf(fp, ",TimeInSeconds");
+    WriteFormatted(pipeline, fp, ",TimeInSeconds");
     if (args.mVerbosity > Verbosity::Simple) {
-        fprintf(fp, ",MsBetweenAppPresents,MsAppPresentToLsr");
+        WriteFormatted(pipeline, fp, ",MsBetweenAppPresents,MsAppPresentToLsr");
     }
-    fprintf(fp, ",MsBetweenLsrs,AppMissed,LsrMissed");
+    WriteFormatted(pipeline, fp, ",MsBetweenLsrs,AppMissed,LsrMissed");
     if (args.mVerbosity >= Verbosity::Verbose) {
-        fprintf(fp, ",MsSourceReleaseFromRenderingToLsrAcquire,MsAppCpuRenderFrame");
+        WriteFormatted(pipeline, fp, ",MsSourceReleaseFromRenderingToLsrAcquire,MsAppCpuRenderFrame");
     }
-    fprintf(fp, ",MsAppPoseLatency");
+    WriteFormatted(pipeline, fp, ",MsAppPoseLatency");
     if (args.mVerbosity >= Verbosity::Verbose) {
-        fprintf(fp, ",MsAppMisprediction,MsLsrCpuRenderFrame");
+        WriteFormatted(pipeline, fp, ",MsAppMisprediction,MsLsrCpuRenderFrame");
     }
-    fprintf(fp, ",MsLsrPoseLatency,MsActualLsrPoseLatency,MsTimeUntilVsync,MsLsrThreadWakeupToGpuEnd,MsLsrThreadWakeupError");
+    WriteFormatted(pipeline, fp, ",MsLsrPoseLatency,MsActualLsrPoseLatency,MsTimeUntilVsync,MsLsrThreadWakeupToGpuEnd,MsLsrThreadWakeupError");
     if (args.mVerbosity >= Verbosity::Verbose) {
-        fprintf(fp, ",MsLsrThreadWakeupToCpuRenderFrameStart,MsCpuRenderFrameStartToHeadPoseCallbackStart,MsGetHeadPose,MsHeadPoseCallbackStopToInputLatch,MsInputLatchToGpuSubmission");
+        WriteFormatted(pipeline, fp, ",MsLsrThreadWakeupToCpuRenderFrameStart,MsCpuRenderFrameStartToHeadPoseCallbackStart,MsGetHeadPose,MsHeadPoseCallbackStopToInputLatch,MsInputLatchToGpuSubmission");
     }
-    fprintf(fp, ",MsLsrPreemption,MsLsrExecution,MsCopyPreemption,MsCopyExecution,MsGpuEndToVsync");
-    fprintf(fp, "\n");
+    WriteFormatted(pipeline, fp, ",MsLsrPreemption,MsLsrExecution,MsCopyPreemption,MsCopyExecution,MsGpuEndToVsync");
+    WriteFormatted(pipeline, fp, "\n");
 
     return fp;
 }
 
-void UpdateLsrCsv(LateStageReprojectionData& lsr, ProcessInfo* proc, LateStageReprojectionEvent& p)
+void UpdateLsrCsv(Pipeline* pipeline, LateStageReprojectionData& lsr, ProcessInfo* proc, LateStageReprojectionEvent& p)
 {
     auto const& args = GetCommandLineArgs();
 
-    auto fp = GetOutputCsv(proc).mWmrFile;
+    auto fp = GetOutputCsv(pipeline, proc)->mWmrFile;
     if (fp == nullptr) {
         return;
     }
@@ -268,57 +274,57 @@ void UpdateLsrCsv(LateStageReprojectionData& lsr, ProcessInfo* proc, LateStageRe
 
     auto& curr = lsr.mLSRHistory[len - 1];
     auto& prev = lsr.mLSRHistory[len - 2];
-    const double deltaMilliseconds = 1000.0 * QpcDeltaToSeconds(curr.QpcTime - prev.QpcTime);
-    const double timeInSeconds = QpcToSeconds(p.QpcTime);
+    const double deltaMilliseconds = 1000.0 * QpcDeltaToSeconds(pipeline, curr.QpcTime - prev.QpcTime);
+    const double timeInSeconds = QpcToSeconds(pipeline, p.QpcTime);
 
-    fprintf(fp, "%s,%d,%d", proc->mModuleName.c_str(), curr.GetAppProcessId(), curr.ProcessId);
+    WriteFormatted(pipeline, fp, "%s,%d,%d", proc->mModuleName.c_str(), curr.GetAppProcessId(), curr.ProcessId);
     if (args.mVerbosity >= Verbosity::Verbose) {
-        fprintf(fp, ",%d", curr.GetAppFrameId());
+        WriteFormatted(pipeline, fp, ",%d", curr.GetAppFrameId());
     }
-    fprintf(fp, ",%.6lf", timeInSeconds);
+    WriteFormatted(pipeline, fp, ",%.6lf", timeInSeconds);
     if (args.mVerbosity > Verbosity::Simple) {
         double appPresentDeltaMilliseconds = 0.0;
         double appPresentToLsrMilliseconds = 0.0;
         if (curr.IsValidAppFrame()) {
             const uint64_t currAppPresentTime = curr.GetAppPresentTime();
-            appPresentToLsrMilliseconds = 1000.0 * QpcDeltaToSeconds(curr.QpcTime - currAppPresentTime);
+            appPresentToLsrMilliseconds = 1000.0 * QpcDeltaToSeconds(pipeline, curr.QpcTime - currAppPresentTime);
 
             if (prev.IsValidAppFrame() && (curr.GetAppProcessId() == prev.GetAppProcessId())) {
                 const uint64_t prevAppPresentTime = prev.GetAppPresentTime();
-                appPresentDeltaMilliseconds = 1000.0 * QpcDeltaToSeconds(currAppPresentTime - prevAppPresentTime);
+                appPresentDeltaMilliseconds = 1000.0 * QpcDeltaToSeconds(pipeline, currAppPresentTime - prevAppPresentTime);
             }
         }
-        fprintf(fp, ",%.6lf,%.6lf", appPresentDeltaMilliseconds, appPresentToLsrMilliseconds);
+        WriteFormatted(pipeline, fp, ",%.6lf,%.6lf", appPresentDeltaMilliseconds, appPresentToLsrMilliseconds);
     }
-    fprintf(fp, ",%.6lf,%d,%d", deltaMilliseconds, !curr.NewSourceLatched, curr.MissedVsyncCount);
+    WriteFormatted(pipeline, fp, ",%.6lf,%d,%d", deltaMilliseconds, !curr.NewSourceLatched, curr.MissedVsyncCount);
     if (args.mVerbosity >= Verbosity::Verbose) {
-        fprintf(fp, ",%.6lf,%.6lf", 1000 * QpcDeltaToSeconds(curr.Source.GetReleaseFromRenderingToAcquireForPresentationTime()), 1000.0 * QpcDeltaToSeconds(curr.GetAppCpuRenderFrameTime()));
+        WriteFormatted(pipeline, fp, ",%.6lf,%.6lf", 1000 * QpcDeltaToSeconds(pipeline, curr.Source.GetReleaseFromRenderingToAcquireForPresentationTime()), 1000.0 * QpcDeltaToSeconds(pipeline, curr.GetAppCpuRenderFrameTime()));
     }
-    fprintf(fp, ",%.6lf", curr.AppPredictionLatencyMs);
+    WriteFormatted(pipeline, fp, ",%.6lf", curr.AppPredictionLatencyMs);
     if (args.mVerbosity >= Verbosity::Verbose) {
-        fprintf(fp, ",%.6lf,%.6lf", curr.AppMispredictionMs, curr.GetLsrCpuRenderFrameMs());
+        WriteFormatted(pipeline, fp, ",%.6lf,%.6lf", curr.AppMispredictionMs, curr.GetLsrCpuRenderFrameMs());
     }
-    fprintf(fp, ",%.6lf,%.6lf,%.6lf,%.6lf,%.6lf",
+    WriteFormatted(pipeline, fp, ",%.6lf,%.6lf,%.6lf,%.6lf,%.6lf",
         curr.LsrPredictionLatencyMs,
         curr.GetLsrMotionToPhotonLatencyMs(),
         curr.TimeUntilVsyncMs,
         curr.GetLsrThreadWakeupStartLatchToGpuEndMs(),
         curr.TotalWakeupErrorMs);
     if (args.mVerbosity >= Verbosity::Verbose) {
-        fprintf(fp, ",%.6lf,%.6lf,%.6lf,%.6lf,%.6lf",
+        WriteFormatted(pipeline, fp, ",%.6lf,%.6lf,%.6lf,%.6lf,%.6lf",
             curr.ThreadWakeupStartLatchToCpuRenderFrameStartInMs,
             curr.CpuRenderFrameStartToHeadPoseCallbackStartInMs,
             curr.HeadPoseCallbackStartToHeadPoseCallbackStopInMs,
             curr.HeadPoseCallbackStopToInputLatchInMs,
             curr.InputLatchToGpuSubmissionInMs);
     }
-    fprintf(fp, ",%.6lf,%.6lf,%.6lf,%.6lf,%.6lf",
+    WriteFormatted(pipeline, fp, ",%.6lf,%.6lf,%.6lf,%.6lf,%.6lf",
         curr.GpuSubmissionToGpuStartInMs,
         curr.GpuStartToGpuStopInMs,
         curr.GpuStopToCopyStartInMs,
         curr.CopyStartToCopyStopInMs,
         curr.CopyStopToVsyncInMs);
-    fprintf(fp, "\n");
+    WriteFormatted(pipeline, fp, "\n");
 }
 
 void UpdateConsole(std::unordered_map<uint32_t, ProcessInfo> const& activeProcesses, LateStageReprojectionData& lsr)
@@ -81,6 +81,7 @@ struct LateStageReprojectionRuntimeStats {
 };
 
 struct LateStageReprojectionData {
+    Pipeline const* mPipeline = nullptr;        // Provides the session's QPC frequency
     size_t mLifetimeLsrMissedFrames = 0;
     size_t mLifetimeAppMissedFrames = 0;
     std::deque<LateStageReprojectionEvent> mLSRHistory;
@@ -104,6 +105,7 @@ private:
     double ComputeHistoryTime(const std::deque<LateStageReprojectionEvent>& lsrHistory) const;
 };
 
-FILE* CreateLsrCsvFile(char const* path);
-void UpdateLsrCsv(LateStageReprojectionData& lsr, ProcessInfo* proc, LateStageReprojectionEvent& p);
+void GenerateLsrCsvFilename(char const* path, char* lsrPath);
+FILE* CreateLsrCsvFile(Pipeline* pipeline, char const* path);
+void UpdateLsrCsv(Pipeline* pipeline, LateStageReprojectionData& lsr, ProcessInfo* proc, LateStageReprojectionEvent& p);
 void UpdateConsole(std::unordered_map<uint32_t, ProcessInfo> const& activeProcesses, LateStageReprojectionData& lsr);
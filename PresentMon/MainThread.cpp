@@ -30,6 +30,7 @@ enum {
     TIMED_TIMER_ID = 2,
 };
 
+static Pipeline gPipeline;
 static HWND gWnd = NULL;
 static bool gIsRecording = false;
 static uint32_t gHotkeyIgnoreCount = 0;
@@ -94,7 +95,7 @@ static void StartRecording()
     }
 
     // Tell OutputThread to record
-    SetOutputRecordingState(true);
+    SetOutputRecordingState(&gPipeline, true);
 
     // Start -timed timer
     if (args.mTimer > 0) {
@@ -113,7 +114,7 @@ static void StopRecording()
     KillTimer(gWnd, TIMED_TIMER_ID);
 
     // Tell OutputThread to stop recording
-    SetOutputRecordingState(false);
+    SetOutputRecordingState(&gPipeline, false);
 
     // Notify the user we're no longer recording
     if (args.mScrollLockIndicator) {
@@ -201,6 +202,12 @@ int main(int argc, char** argv)
 
     auto const& args = GetCommandLineArgs();
 
+    // Converting a columnar file doesn't need a trace session, or elevated
+    // privilege.
+    if (args.mConvertColumnarFileName != nullptr) {
+        return ConvertColumnarFile();
+    }
+
     // Attempt to elevate process privilege if necessary.
     //
     // If a new process needs to be started, this will wait for the elevated
@@ -209,6 +216,12 @@ int main(int argc, char** argv)
     // won't run in this process).
     ElevatePrivilege(argc, argv);
 
+    // In batch mode, the ETL files are analyzed by BatchThread workers
+    // instead; there's no recording or user interaction to coordinate.
+    if (args.mBatchInput != nullptr) {
+        return RunBatch();
+    }
+
     // Create a message queue to handle the input messages.
     WNDCLASSEXW wndClass = { sizeof(wndClass) };
     wndClass.lpfnWndProc = HandleWindowMessage;
@@ -237,7 +250,9 @@ int main(int argc, char** argv)
     SetConsoleCtrlHandler(HandleCtrlEvent, TRUE);
 
     // Start the ETW trace session (including consumer and output threads).
-    if (!StartTraceSession()) {
+    gPipeline.mEtlFileName = args.mEtlFileName;
+    gPipeline.mOutputCsvFileName = args.mOutputCsvFileName;
+    if (!StartTraceSession(&gPipeline)) {
         SetConsoleCtrlHandler(HandleCtrlEvent, FALSE);
         DestroyWindow(gWnd);
         UnregisterClass(wndClass.lpszClassName, NULL);
@@ -278,7 +293,7 @@ int main(int argc, char** argv)
     if (args.mScrollLockIndicator) {
         EnableScrollLock(originalScrollLockEnabled);
     }
-    StopTraceSession();
+    StopTraceSession(&gPipeline);
     /* We cannot remove the Ctrl handler because it is in an infinite sleep so
      * this call will never return, either hanging the application or having
      * the threshold timer trigger and force terminate (depending on what Ctrl
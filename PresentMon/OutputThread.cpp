@@ -26,9 +26,6 @@ SOFTWARE.
 #include <shlwapi.h>
 #include <thread>
 
-static std::thread gThread;
-static bool gQuit = false;
-
 // When we collect realtime ETW events, we don't receive the events in real
 // time but rather sometime after they occur.  Since the user might be toggling
 // recording based on realtime cues (e.g., watching the target application) we
@@ -36,62 +33,56 @@ static bool gQuit = false;
 // consider recording an event, we can look back and see what the recording
 // state was at the time the event actually occurred.
 //
-// gRecordingToggleHistory is a vector of QueryPerformanceCounter() values at
-// times when the recording state changed, and gIsRecording is the recording
-// state at the current time.
+// Pipeline::mRecordingToggleHistory is a vector of QueryPerformanceCounter()
+// values at times when the recording state changed, and
+// Pipeline::mIsRecording is the recording state at the current time.
 //
 // CRITICAL_SECTION used as this is expected to have low contention (e.g., *no*
 // contention when capturing from ETL).
 
-static CRITICAL_SECTION gRecordingToggleCS;
-static std::vector<uint64_t> gRecordingToggleHistory;
-static bool gIsRecording = false;
-
-void SetOutputRecordingState(bool record)
+void SetOutputRecordingState(Pipeline* pipeline, bool record)
 {
-    auto const& args = GetCommandLineArgs();
-
-    if (gIsRecording == record) {
+    if (pipeline->mIsRecording == record) {
         return;
     }
 
     // When capturing from an ETL file, just use the current recording state.
     // It's not clear how best to map realtime to ETL QPC time, and there
     // aren't any realtime cues in this case.
-    if (args.mEtlFileName != nullptr) {
-        EnterCriticalSection(&gRecordingToggleCS);
-        gIsRecording = record;
-        LeaveCriticalSection(&gRecordingToggleCS);
+    if (pipeline->mEtlFileName != nullptr) {
+        EnterCriticalSection(&pipeline->mRecordingToggleCS);
+        pipeline->mIsRecording = record;
+        LeaveCriticalSection(&pipeline->mRecordingToggleCS);
         return;
     }
 
     uint64_t qpc = 0;
     QueryPerformanceCounter((LARGE_INTEGER*) &qpc);
 
-    EnterCriticalSection(&gRecordingToggleCS);
-    gRecordingToggleHistory.emplace_back(qpc);
-    gIsRecording = record;
-    LeaveCriticalSection(&gRecordingToggleCS);
+    EnterCriticalSection(&pipeline->mRecordingToggleCS);
+    pipeline->mRecordingToggleHistory.emplace_back(qpc);
+    pipeline->mIsRecording = record;
+    LeaveCriticalSection(&pipeline->mRecordingToggleCS);
 }
 
-static bool CopyRecordingToggleHistory(std::vector<uint64_t>* recordingToggleHistory)
+static bool CopyRecordingToggleHistory(Pipeline* pipeline, std::vector<uint64_t>* recordingToggleHistory)
 {
-    EnterCriticalSection(&gRecordingToggleCS);
-    recordingToggleHistory->assign(gRecordingToggleHistory.begin(), gRecordingToggleHistory.end());
-    auto isRecording = gIsRecording;
-    LeaveCriticalSection(&gRecordingToggleCS);
+    EnterCriticalSection(&pipeline->mRecordingToggleCS);
+    recordingToggleHistory->assign(pipeline->mRecordingToggleHistory.begin(), pipeline->mRecordingToggleHistory.end());
+    auto isRecording = pipeline->mIsRecording;
+    LeaveCriticalSection(&pipeline->mRecordingToggleCS);
 
     auto recording = recordingToggleHistory->size() + (isRecording ? 1 : 0);
     return (recording & 1) == 1;
 }
 
 // Remove recording toggle events that we've processed.
-static void UpdateRecordingToggles(size_t nextIndex)
+static void UpdateRecordingToggles(Pipeline* pipeline, size_t nextIndex)
 {
     if (nextIndex > 0) {
-        EnterCriticalSection(&gRecordingToggleCS);
-        gRecordingToggleHistory.erase(gRecordingToggleHistory.begin(), gRecordingToggleHistory.begin() + nextIndex);
-        LeaveCriticalSection(&gRecordingToggleCS);
+        EnterCriticalSection(&pipeline->mRecordingToggleCS);
+        pipeline->mRecordingToggleHistory.erase(pipeline->mRecordingToggleHistory.begin(), pipeline->mRecordingToggleHistory.begin() + nextIndex);
+        LeaveCriticalSection(&pipeline->mRecordingToggleCS);
     }
 }
 
@@ -104,9 +95,6 @@ static void UpdateRecordingToggles(size_t nextIndex)
 // obtain a handle to the process, and periodically check it to see if it has
 // exited.
 
-static std::unordered_map<uint32_t, ProcessInfo> gProcesses;
-static uint32_t gTargetProcessCount = 0;
-
 static bool IsTargetProcess(uint32_t processId, std::string const& processName)
 {
     auto const& args = GetCommandLineArgs();
@@ -138,7 +126,7 @@ static bool IsTargetProcess(uint32_t processId, std::string const& processName)
     return false;
 }
 
-static void InitProcessInfo(ProcessInfo* processInfo, uint32_t processId, HANDLE handle, std::string const& processName)
+static void InitProcessInfo(Pipeline* pipeline, ProcessInfo* processInfo, uint32_t processId, HANDLE handle, std::string const& processName)
 {
     auto target = IsTargetProcess(processId, processName);
 
@@ -149,13 +137,13 @@ static void InitProcessInfo(ProcessInfo* processInfo, uint32_t processId, HANDLE
     processInfo->mTargetProcess      = target;
 
     if (target) {
-        gTargetProcessCount += 1;
+        pipeline->mTargetProcessCount += 1;
     }
 }
 
-static ProcessInfo* GetProcessInfo(uint32_t processId)
+static ProcessInfo* GetProcessInfo(Pipeline* pipeline, uint32_t processId)
 {
-    auto result = gProcesses.emplace(processId, ProcessInfo());
+    auto result = pipeline->mProcesses.emplace(processId, ProcessInfo());
     auto processInfo = &result.first->second;
     auto newProcess = result.second;
 
@@ -168,7 +156,7 @@ static ProcessInfo* GetProcessInfo(uint32_t processId)
         auto h = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);
         auto processName = QueryFullProcessImageNameA(h, 0, path, &numChars) ? PathFindFileNameA(path) : "<error>";
 
-        InitProcessInfo(processInfo, processId, h, processName);
+        InitProcessInfo(pipeline, processInfo, processId, h, processName);
     }
 
     return processInfo;
@@ -180,9 +168,9 @@ static ProcessInfo* GetProcessInfo(uint32_t processId)
 // We assume that the process terminated now, which is wrong but conservative
 // and functionally ok because no other process should start with the same PID
 // as long as we're still holding a handle to it.
-static void CheckForTerminatedRealtimeProcesses(std::vector<std::pair<uint32_t, uint64_t>>* terminatedProcesses)
+static void CheckForTerminatedRealtimeProcesses(Pipeline* pipeline, std::vector<std::pair<uint32_t, uint64_t>>* terminatedProcesses)
 {
-    for (auto& pair : gProcesses) {
+    for (auto& pair : pipeline->mProcesses) {
         auto processId = pair.first;
         auto processInfo = &pair.second;
 
@@ -197,31 +185,74 @@ static void CheckForTerminatedRealtimeProcesses(std::vector<std::pair<uint32_t,
     }
 }
 
-static void HandleTerminatedProcess(uint32_t processId)
+// Adds processInfo's swapchains to the percentile report that is printed once
+// the output thread is done, so that processes that exit before then are
+// still reported.
+static void AddToPercentileReport(Pipeline* pipeline, uint32_t processId, ProcessInfo const& processInfo)
+{
+    char line[512];
+
+    for (auto const& pair : processInfo.mSwapChain) {
+        auto address = pair.first;
+        auto const& chain = pair.second;
+        if (chain.mRecordedHistograms == nullptr) {
+            continue;
+        }
+
+        auto const& frameTimes = chain.mRecordedHistograms->mBetweenPresents;
+
+        _snprintf_s(line, _TRUNCATE, "    %s[%u] %016llX: %llu presents\n"
+            "        frame time P50/P95/P99: %.2lf/%.2lf/%.2lf ms (1%% low %.1lf fps)\n",
+            processInfo.mModuleName.c_str(), processId, address, frameTimes.mCount,
+            frameTimes.GetPercentile(50.0), frameTimes.GetPercentile(95.0), frameTimes.GetPercentile(99.0),
+            frameTimes.GetLowRate(1.0));
+        pipeline->mPercentileReport += line;
+
+        auto const& displayTimes = chain.mRecordedHistograms->mBetweenDisplayChange;
+        if (displayTimes.mCount > 0) {
+            _snprintf_s(line, _TRUNCATE, "        display frame time P50/P95/P99: %.2lf/%.2lf/%.2lf ms\n",
+                displayTimes.GetPercentile(50.0), displayTimes.GetPercentile(95.0), displayTimes.GetPercentile(99.0));
+            pipeline->mPercentileReport += line;
+        }
+
+        auto const& latencies = chain.mRecordedHistograms->mUntilDisplayed;
+        if (latencies.mCount > 0) {
+            _snprintf_s(line, _TRUNCATE, "        latency P50/P95/P99: %.2lf/%.2lf/%.2lf ms\n",
+                latencies.GetPercentile(50.0), latencies.GetPercentile(95.0), latencies.GetPercentile(99.0));
+            pipeline->mPercentileReport += line;
+        }
+    }
+}
+
+static void HandleTerminatedProcess(Pipeline* pipeline, uint32_t processId)
 {
     auto const& args = GetCommandLineArgs();
 
-    auto iter = gProcesses.find(processId);
-    if (iter == gProcesses.end()) {
+    auto iter = pipeline->mProcesses.find(processId);
+    if (iter == pipeline->mProcesses.end()) {
         return; // shouldn't happen.
     }
 
     auto processInfo = &iter->second;
     if (processInfo->mTargetProcess) {
         // Close this process' CSV.
-        CloseOutputCsv(processInfo);
+        CloseOutputCsv(pipeline, processInfo);
+
+        AddToPercentileReport(pipeline, processId, *processInfo);
+
+        ReleaseSharedMetricsSlots(pipeline, processInfo);
 
         // Quit if this is the last process tracked for -terminate_on_proc_exit.
-        gTargetProcessCount -= 1;
-        if (args.mTerminateOnProcExit && gTargetProcessCount == 0) {
-            ExitMainThread();
+        pipeline->mTargetProcessCount -= 1;
+        if (args.mTerminateOnProcExit && pipeline->mTargetProcessCount == 0) {
+            ExitPipeline(pipeline);
         }
     }
 
-    gProcesses.erase(iter);
+    pipeline->mProcesses.erase(iter);
 }
 
-static void UpdateNTProcesses(std::vector<NTProcessEvent> const& ntProcessEvents, std::vector<std::pair<uint32_t, uint64_t>>* terminatedProcesses)
+static void UpdateNTProcesses(Pipeline* pipeline, std::vector<NTProcessEvent> const& ntProcessEvents, std::vector<std::pair<uint32_t, uint64_t>>* terminatedProcesses)
 {
     for (auto const& ntProcessEvent : ntProcessEvents) {
         // An empty ImageFileName indicates that the event is a process
@@ -234,22 +265,67 @@ static void UpdateNTProcesses(std::vector<NTProcessEvent> const& ntProcessEvents
         }
 
         // This event is a new process starting, the pid should not already be
-        // in gProcesses.
-        auto result = gProcesses.emplace(ntProcessEvent.ProcessId, ProcessInfo());
+        // in mProcesses.
+        auto result = pipeline->mProcesses.emplace(ntProcessEvent.ProcessId, ProcessInfo());
         auto processInfo = &result.first->second;
         auto newProcess = result.second;
         if (newProcess) {
-            InitProcessInfo(processInfo, ntProcessEvent.ProcessId, NULL, ntProcessEvent.ImageFileName);
+            InitProcessInfo(pipeline, processInfo, ntProcessEvent.ProcessId, NULL, ntProcessEvent.ImageFileName);
         }
     }
 }
 
-static void AddPresents(std::vector<std::shared_ptr<PresentEvent>> const& presentEvents, size_t* presentEventIndex,
+// -start_time and -end_time limit the CSV output to part of the ETL file.
+// Presents outside of that range are still added to the swapchain history,
+// e.g., so that the first output present has a previous one to compare to.
+static bool IsInOutputTimeRange(Pipeline const* pipeline, uint64_t qpc)
+{
+    auto const& args = GetCommandLineArgs();
+    auto t = QpcToSeconds(pipeline, qpc);
+    return t >= args.mStartTime && (args.mEndTime == 0.0 || t < args.mEndTime);
+}
+
+// Adds the present's frame time, display frame time, and latency to
+// histograms, allocating them if these are the first.  Like the CSV
+// statistics, these are relative to the previous presents, so this must be
+// done before the present is added to the swapchain's history.
+static void UpdateHistograms(Pipeline const* pipeline, SwapChainData const* chain, PresentEvent const& p, std::unique_ptr<SwapChainHistograms>* histograms)
+{
+    auto const& args = GetCommandLineArgs();
+
+    if (chain->mPresentHistoryCount == 0) {
+        return;
+    }
+
+    if (*histograms == nullptr) {
+        histograms->reset(new SwapChainHistograms());
+    }
+
+    auto lastPresented = chain->mPresentHistory[(chain->mNextPresentIndex - 1) % SwapChainData::PRESENT_HISTORY_MAX_COUNT].get();
+    (*histograms)->mBetweenPresents.Add(QpcDeltaToMicroseconds(pipeline, p.QpcTime - lastPresented->QpcTime));
+
+    if (args.mVerbosity > Verbosity::Simple && p.FinalState == PresentResult::Presented) {
+        (*histograms)->mUntilDisplayed.Add(QpcDeltaToMicroseconds(pipeline, p.ScreenTime - p.QpcTime));
+
+        if (chain->mLastDisplayedPresentIndex > 0) {
+            auto lastDisplayed = chain->mPresentHistory[chain->mLastDisplayedPresentIndex % SwapChainData::PRESENT_HISTORY_MAX_COUNT].get();
+            (*histograms)->mBetweenDisplayChange.Add(QpcDeltaToMicroseconds(pipeline, p.ScreenTime - lastDisplayed->ScreenTime));
+        }
+    }
+}
+
+static void AddPresents(Pipeline* pipeline, std::vector<PresentEventPtr> const& presentEvents, size_t* presentEventIndex,
                         bool recording, bool checkStopQpc, uint64_t stopQpc, bool* hitStopQpc)
 {
+    auto const& args = GetCommandLineArgs();
+
+    // The console and -shared_memory readers show the percentiles of all the
+    // presents, whether recording or not.
+    auto showPercentiles = args.mConsoleOutputType == ConsoleOutput::Full || args.mSharedMemoryName != nullptr;
+
     auto i = *presentEventIndex;
     for (auto n = presentEvents.size(); i < n; ++i) {
-        auto presentEvent = presentEvents[i];
+        auto const& presentEvent = presentEvents[i];
 
         // Stop processing events if we hit the next stop time.
         if (checkStopQpc && presentEvent->QpcTime >= stopQpc) {
@@ -258,7 +334,7 @@ static void AddPresents(std::vector<std::shared_ptr<PresentEvent>> const& presen
         }
 
         // Look up the swapchain this present belongs to.
-        auto processInfo = GetProcessInfo(presentEvent->ProcessId);
+        auto processInfo = GetProcessInfo(pipeline, presentEvent->ProcessId);
         if (!processInfo->mTargetProcess) {
             continue;
         }
@@ -269,11 +345,28 @@ static void AddPresents(std::vector<std::shared_ptr<PresentEvent>> const& presen
             chain->mPresentHistoryCount = 0;
             chain->mNextPresentIndex = 1; // Start at 1 so that mLastDisplayedPresentIndex starts out invalid.
             chain->mLastDisplayedPresentIndex = 0;
+            chain->mSummary = {};
+            chain->mSharedMetricsSlot = UINT32_MAX;
+            chain->mSharedMetricsPresentIndex = 0;
+        }
+
+        if (showPercentiles) {
+            UpdateHistograms(pipeline, chain, *presentEvent, &chain->mHistograms);
         }
 
         // Output CSV row if recording (need to do this before updating chain).
-        if (recording) {
-            UpdateCsv(processInfo, *chain, *presentEvent);
+        if (recording && IsInOutputTimeRange(pipeline, presentEvent->QpcTime)) {
+            UpdateHistograms(pipeline, chain, *presentEvent, &chain->mRecordedHistograms);
+            UpdateCsv(pipeline, processInfo, chain, *presentEvent);
+        }
+
+        // Stream the present to the -output_pipe clients, whether recording
+        // or not.
+        if (args.mStreamPipeName != nullptr && IsInOutputTimeRange(pipeline, presentEvent->QpcTime)) {
+            ColumnarPresent present;
+            if (GetColumnarPresent(chain, *presentEvent, &present)) {
+                StreamPresent(pipeline, processInfo, present);
+            }
         }
 
         // Add the present to the swapchain history.
@@ -291,10 +384,11 @@ static void AddPresents(std::vector<std::shared_ptr<PresentEvent>> const& presen
         }
     }
 
+    pipeline->mPresentCount += i - *presentEventIndex;
     *presentEventIndex = i;
 }
 
-static void AddPresents(LateStageReprojectionData* lsrData,
+static void AddPresents(Pipeline* pipeline, LateStageReprojectionData* lsrData,
                         std::vector<std::shared_ptr<LateStageReprojectionEvent>> const& presentEvents, size_t* presentEventIndex,
                         bool recording, bool checkStopQpc, uint64_t stopQpc, bool* hitStopQpc)
 {
@@ -311,7 +405,7 @@ static void AddPresents(LateStageReprojectionData* lsrData,
         }
 
         const uint32_t appProcessId = presentEvent->GetAppProcessId();
-        auto processInfo = GetProcessInfo(appProcessId);
+        auto processInfo = GetProcessInfo(pipeline, appProcessId);
         if (!processInfo->mTargetProcess) {
             continue;
         }
@@ -322,8 +416,8 @@ static void AddPresents(LateStageReprojectionData* lsrData,
 
         lsrData->AddLateStageReprojection(*presentEvent);
 
-        if (recording) {
-            UpdateLsrCsv(*lsrData, processInfo, *presentEvent);
+        if (recording && IsInOutputTimeRange(pipeline, presentEvent->QpcTime)) {
+            UpdateLsrCsv(pipeline, *lsrData, processInfo, *presentEvent);
         }
 
         lsrData->UpdateLateStageReprojectionInfo();
@@ -332,22 +426,26 @@ static void AddPresents(LateStageReprojectionData* lsrData,
     *presentEventIndex = i;
 }
 
-// Limit the present history stored in SwapChainData to 2 seconds.
-static void PruneHistory(
+// Returns the latest trace time of the events being processed.
+static uint64_t GetLatestQpc(
     std::vector<NTProcessEvent> const& ntProcessEvents,
-    std::vector<std::shared_ptr<PresentEvent>> const& presentEvents,
+    std::vector<PresentEventPtr> const& presentEvents,
     std::vector<std::shared_ptr<LateStageReprojectionEvent>> const& lsrEvents)
 {
     assert(ntProcessEvents.size() + presentEvents.size() + lsrEvents.size() > 0);
 
-    auto latestQpc = max(max(
+    return max(max(
         ntProcessEvents.empty() ? 0ull : ntProcessEvents.back().QpcTime,
         presentEvents.empty()   ? 0ull : presentEvents.back()->QpcTime),
         lsrEvents.empty()       ? 0ull : lsrEvents.back()->QpcTime);
+}
 
-    auto minQpc = latestQpc - SecondsDeltaToQpc(2.0);
+// Limit the present history stored in SwapChainData to 2 seconds.
+static void PruneHistory(Pipeline* pipeline, uint64_t latestQpc)
+{
+    auto minQpc = latestQpc - SecondsDeltaToQpc(pipeline, 2.0);
 
-    for (auto& pair : gProcesses) {
+    for (auto& pair : pipeline->mProcesses) {
         auto processInfo = &pair.second;
         for (auto& pair2 : processInfo->mSwapChain) {
             auto swapChain = &pair2.second;
@@ -370,9 +468,10 @@ static void PruneHistory(
 }
 
 static void ProcessEvents(
+    Pipeline* pipeline,
     LateStageReprojectionData* lsrData,
     std::vector<NTProcessEvent>* ntProcessEvents,
-    std::vector<std::shared_ptr<PresentEvent>>* presentEvents,
+    std::vector<PresentEventPtr>* presentEvents,
     std::vector<std::shared_ptr<LateStageReprojectionEvent>>* lsrEvents,
     std::vector<uint64_t>* recordingToggleHistory,
     std::vector<std::pair<uint32_t, uint64_t>>* terminatedProcesses)
@@ -381,15 +480,15 @@ static void ProcessEvents(
 
     // Copy any analyzed information from ConsumerThread and early-out if there
     // isn't any.
-    DequeueAnalyzedInfo(ntProcessEvents, presentEvents, lsrEvents);
+    DequeueAnalyzedInfo(pipeline, ntProcessEvents, presentEvents, lsrEvents);
     if (ntProcessEvents->empty() && presentEvents->empty() && lsrEvents->empty()) {
         return;
     }
 
     // Copy the record range history form the MainThread.
-    auto recording = CopyRecordingToggleHistory(recordingToggleHistory);
+    auto recording = CopyRecordingToggleHistory(pipeline, recordingToggleHistory);
 
-    // Process NTProcess events; created processes are added to gProcesses and
+    // Process NTProcess events; created processes are added to mProcesses and
     // terminated processes are added to terminatedProcesses.
     //
     // Handling of terminated processes need to be deferred until we observe
@@ -400,7 +499,7 @@ static void ProcessEvents(
     // We don't have to worry about the recording toggles here because
     // NTProcess events are only captured when parsing ETL files and we don't
     // use recording toggle history for ETL files.
-    UpdateNTProcesses(*ntProcessEvents, terminatedProcesses);
+    UpdateNTProcesses(pipeline, *ntProcessEvents, terminatedProcesses);
 
     // Next, iterate through the recording toggles (if any)...
     size_t presentEventIndex = 0;
@@ -427,20 +526,20 @@ static void ProcessEvents(
             }
 
             auto hitTerminatedProcess = false;
-            AddPresents(*presentEvents, &presentEventIndex, recording, true, terminatedProcessQpc, &hitTerminatedProcess);
-            AddPresents(lsrData, *lsrEvents, &lsrEventIndex, recording, true, terminatedProcessQpc, &hitTerminatedProcess);
+            AddPresents(pipeline, *presentEvents, &presentEventIndex, recording, true, terminatedProcessQpc, &hitTerminatedProcess);
+            AddPresents(pipeline, lsrData, *lsrEvents, &lsrEventIndex, recording, true, terminatedProcessQpc, &hitTerminatedProcess);
             if (!hitTerminatedProcess) {
                 goto done;
             }
-            HandleTerminatedProcess(terminatedProcessId);
+            HandleTerminatedProcess(pipeline, terminatedProcessId);
         }
 
         // Process present events up until the next recording toggle.  If we
         // reached the toggle, handle it and continue.  Otherwise, we're done
         // handling all the presents and any outstanding toggles will have to
         // wait for next batch of events.
-        AddPresents(*presentEvents, &presentEventIndex, recording, checkRecordingToggle, nextRecordingToggleQpc, &hitNextRecordingToggle);
-        AddPresents(lsrData, *lsrEvents, &lsrEventIndex, recording, checkRecordingToggle, nextRecordingToggleQpc, &hitNextRecordingToggle);
+        AddPresents(pipeline, *presentEvents, &presentEventIndex, recording, checkRecordingToggle, nextRecordingToggleQpc, &hitNextRecordingToggle);
+        AddPresents(pipeline, lsrData, *lsrEvents, &lsrEventIndex, recording, checkRecordingToggle, nextRecordingToggleQpc, &hitNextRecordingToggle);
         if (!hitNextRecordingToggle) {
             break;
         }
@@ -449,23 +548,31 @@ static void ProcessEvents(
         recordingToggleIndex += 1;
         recording = !recording;
         if (!recording) {
-            IncrementRecordingCount();
-            CloseOutputCsv(nullptr);
-            for (auto& pair : gProcesses) {
-                CloseOutputCsv(&pair.second);
+            IncrementRecordingCount(pipeline);
+            CloseOutputCsv(pipeline, nullptr);
+            for (auto& pair : pipeline->mProcesses) {
+                CloseOutputCsv(pipeline, &pair.second);
             }
         }
     }
 
 done:
 
+    auto latestQpc = GetLatestQpc(*ntProcessEvents, *presentEvents, *lsrEvents);
+
+    // With -summary_interval, output the intervals that have ended, including
+    // for swapchains that haven't presented since.
+    if (args.mSummaryIntervalMs != 0 && recording && IsInOutputTimeRange(pipeline, latestQpc)) {
+        FlushSummaryIntervals(pipeline, latestQpc);
+    }
+
     // Limit the present history stored in SwapChainData to 2 seconds, so that
     // processes that stop presenting are removed from the console display.
     // This only applies to ConsoleOutput::Full, otherwise it's ok to just
     // leave the older presents in the history buffer since they aren't used
     // for anything.
     if (args.mConsoleOutputType == ConsoleOutput::Full) {
-        PruneHistory(*ntProcessEvents, *presentEvents, *lsrEvents);
+        PruneHistory(pipeline, latestQpc);
     }
 
     // Clear events processed.
@@ -476,17 +583,32 @@ done:
 
     // Finished processing all events.  Erase the recording toggles and
     // terminated processes that we also handled now.
-    UpdateRecordingToggles(recordingToggleIndex);
+    UpdateRecordingToggles(pipeline, recordingToggleIndex);
     if (terminatedProcessIndex > 0) {
         terminatedProcesses->erase(terminatedProcesses->begin(), terminatedProcesses->begin() + terminatedProcessIndex);
     }
 
     if (DebugDone()) {
-        ExitMainThread();
+        ExitPipeline(pipeline);
     }
 }
 
-void Output()
+// In batch mode several pipelines report to stderr at once, so warnings are
+// prefixed with the ETL file they're about.
+static void PrintWarning(Pipeline const* pipeline, char const* format, ...)
+{
+    fprintf(stderr, "warning: ");
+    if (pipeline->mBatch) {
+        fprintf(stderr, "%s: ", pipeline->mEtlFileName);
+    }
+
+    va_list val;
+    va_start(val, format);
+    vfprintf(stderr, format, val);
+    va_end(val);
+}
+
+static void Output(Pipeline* pipeline)
 {
 #if !DEBUG_VERBOSE
     auto const& args = GetCommandLineArgs();
@@ -494,8 +616,9 @@ void Output()
 
     // Structures to track processes and statistics from recorded events.
     LateStageReprojectionData lsrData;
+    lsrData.mPipeline = pipeline;
     std::vector<NTProcessEvent> ntProcessEvents;
-    std::vector<std::shared_ptr<PresentEvent>> presentEvents;
+    std::vector<PresentEventPtr> presentEvents;
     std::vector<std::shared_ptr<LateStageReprojectionEvent>> lsrEvents;
     std::vector<uint64_t> recordingToggleHistory;
     std::vector<std::pair<uint32_t, uint64_t>> terminatedProcesses;
@@ -505,25 +628,51 @@ void Output()
     recordingToggleHistory.reserve(16);
     terminatedProcesses.reserve(16);
 
+#if !DEBUG_VERBOSE
+    DWORD lastConsoleUpdateTime = 0;
+#endif
+
     for (;;) {
-        // Read gQuit here, but then check it after processing queued events.
+        // Read mQuit here, but then check it after processing queued events.
         // This ensures that we call DequeueAnalyzedInfo() at least once after
         // events have stopped being collected so that all events are included.
-        auto quit = gQuit;
+        auto quit = pipeline->mQuit;
 
         // Copy and process all the collected events, and update the various
         // tracking and statistics data structures.
-        ProcessEvents(&lsrData, &ntProcessEvents, &presentEvents, &lsrEvents, &recordingToggleHistory, &terminatedProcesses);
+        ProcessEvents(pipeline, &lsrData, &ntProcessEvents, &presentEvents, &lsrEvents, &recordingToggleHistory, &terminatedProcesses);
+
+        // Publish the swapchains' latest metrics to the -shared_memory
+        // readers.
+        PublishSharedMetrics(pipeline);
+
+        // Hand the CSV output to WriterThread if it's been buffered for long
+        // enough.
+        FlushWrites(pipeline, false);
+
+        // Queue the presents streamed since the last time we woke up to the
+        // -output_pipe clients.
+        if (args.mStreamPipeName != nullptr) {
+            FlushStream(pipeline);
+        }
 
         // Display information to console if requested.  If debug build and
-        // simple console, print a heartbeat if recording.
+        // simple console, print a heartbeat if recording.  The console is
+        // updated at most every 100ms, regardless of how often we wake up.
         //
-        // gIsRecording is the real timeline recording state.  Because we're
-        // just reading it without correlation to gRecordingToggleHistory, we
+        // mIsRecording is the real timeline recording state.  Because we're
+        // just reading it without correlation to mRecordingToggleHistory, we
         // don't need the critical section.
 #if !DEBUG_VERBOSE
-        auto realtimeRecording = gIsRecording;
-        switch (args.mConsoleOutputType) {
+        auto realtimeRecording = pipeline->mIsRecording;
+        auto consoleTime = GetTickCount();
+        auto consoleOutputType = args.mConsoleOutputType;
+        if (!quit && consoleTime - lastConsoleUpdateTime < 100) {
+            consoleOutputType = ConsoleOutput::None;
+        } else {
+            lastConsoleUpdateTime = consoleTime;
+        }
+        switch (consoleOutputType) {
         case ConsoleOutput::None:
             break;
         case ConsoleOutput::Simple:
@@ -534,10 +683,10 @@ void Output()
 #endif
             break;
         case ConsoleOutput::Full:
-            for (auto const& pair : gProcesses) {
-                UpdateConsole(pair.first, pair.second);
+            for (auto const& pair : pipeline->mProcesses) {
+                UpdateConsole(pipeline, pair.first, pair.second);
             }
-            UpdateConsole(gProcesses, lsrData);
+            UpdateConsole(pipeline->mProcesses, lsrData);
 
             if (realtimeRecording) {
                 ConsolePrintLn("** RECORDING **");
@@ -554,50 +703,101 @@ void Output()
         }
 
         // Update tracking information.
-        CheckForTerminatedRealtimeProcesses(&terminatedProcesses);
+        CheckForTerminatedRealtimeProcesses(pipeline, &terminatedProcesses);
 
-        // Sleep to reduce overhead.
-        Sleep(100);
+        // Wait until the consumer has completed more presents (or the
+        // -wakeup_interval has passed since one completed), or at most 100ms
+        // so that the console and process tracking stay up to date.
+        WaitForAnalyzedInfo(pipeline, 100);
     }
 
     // Output warning if events were lost.
     ULONG eventsLost = 0;
     ULONG buffersLost = 0;
-    CheckLostReports(&eventsLost, &buffersLost);
+    CheckLostReports(pipeline, &eventsLost, &buffersLost);
     if (buffersLost > 0) {
-        fprintf(stderr, "warning: %u ETW buffers were lost.\n", buffersLost);
+        PrintWarning(pipeline, "%u ETW buffers were lost.\n", buffersLost);
     }
     if (eventsLost > 0) {
-        fprintf(stderr, "warning: %u ETW events were lost.\n", eventsLost);
+        PrintWarning(pipeline, "%u ETW events were lost.\n", eventsLost);
+    }
+
+    // Output warning if analyzed events were dropped because this thread
+    // couldn't keep up.
+    uint64_t droppedPresents = 0;
+    uint64_t droppedProcessEvents = 0;
+    uint64_t droppedLSRs = 0;
+    CheckDroppedEvents(pipeline, &droppedPresents, &droppedProcessEvents, &droppedLSRs);
+    if (droppedPresents > 0) {
+        PrintWarning(pipeline, "%llu presents were dropped because output fell behind.\n", droppedPresents);
+    }
+    if (droppedProcessEvents > 0) {
+        PrintWarning(pipeline, "%llu process events were dropped because output fell behind.\n", droppedProcessEvents);
+    }
+    if (droppedLSRs > 0) {
+        PrintWarning(pipeline, "%llu LSRs were dropped because output fell behind.\n", droppedLSRs);
+    }
+
+    // Output warning if presents were evicted before completing.
+    uint32_t timedOutCount = 0;
+    uint32_t overLimitCount = 0;
+    CheckEvictedPresents(pipeline, &timedOutCount, &overLimitCount);
+    if (timedOutCount > 0) {
+        PrintWarning(pipeline, "%u presents did not complete within -evict_after time.\n", timedOutCount);
+    }
+    if (overLimitCount > 0) {
+        PrintWarning(pipeline, "%u presents were evicted to stay within -max_in_flight limit.\n", overLimitCount);
     }
 
     // Close all CSV and process handles
-    for (auto& pair : gProcesses) {
+    for (auto& pair : pipeline->mProcesses) {
         auto processInfo = &pair.second;
         if (processInfo->mHandle != NULL) {
             CloseHandle(processInfo->mHandle);
         }
-        CloseOutputCsv(processInfo);
+        CloseOutputCsv(pipeline, processInfo);
+        AddToPercentileReport(pipeline, pair.first, *processInfo);
+        ReleaseSharedMetricsSlots(pipeline, processInfo);
+    }
+    pipeline->mProcesses.clear();
+    CloseOutputCsv(pipeline, nullptr); // Special case to close single global CSV if not
+                                       // using per-process CSVs.
+
+    // Report the percentiles of all the swapchains' recorded presents.
+    if (!pipeline->mPercentileReport.empty()) {
+        fprintf(stderr, "%s%sPercentiles of the recorded presents:\n%s",
+            pipeline->mBatch ? pipeline->mEtlFileName : "",
+            pipeline->mBatch ? ": " : "",
+            pipeline->mPercentileReport.c_str());
     }
-    gProcesses.clear();
-    CloseOutputCsv(nullptr); // Special case to close single global CSV if not
-                             // using per-process CSVs.
 }
 
-void StartOutputThread()
+void StartOutputThread(Pipeline* pipeline)
 {
-    InitializeCriticalSection(&gRecordingToggleCS);
+    InitializeCriticalSection(&pipeline->mRecordingToggleCS);
 
-    gThread = std::thread(Output);
+    StartWriterThread(pipeline);
+    StartStreamThread(pipeline);
+    CreateSharedMetrics(pipeline);
+    pipeline->mOutputThread = std::thread(Output, pipeline);
 }
 
-void StopOutputThread()
+void StopOutputThread(Pipeline* pipeline)
 {
-    if (gThread.joinable()) {
-        gQuit = true;
-        gThread.join();
+    if (pipeline->mOutputThread.joinable()) {
+        pipeline->mQuit = true;
+        SignalAnalyzedInfo(pipeline);
+        pipeline->mOutputThread.join();
+
+        // Write the output that the output thread left buffered.
+        StopWriterThread(pipeline);
+
+        // Send the streamed presents that are still queued.
+        StopStreamThread(pipeline);
+
+        CloseSharedMetrics(pipeline);
 
-        DeleteCriticalSection(&gRecordingToggleCS);
+        DeleteCriticalSection(&pipeline->mRecordingToggleCS);
     }
 }
 
@@ -40,22 +40,48 @@ PresentMon Architecture:
     OutputThread: is controlled by the trace session, and outputs analyzed
     events to the CSV and/or console.
 
+    WriterThread: is controlled by OutputThread, and writes its CSV output to
+    the files so that a slow disk doesn't hold up the analysis.
+
+    StreamThread: accepts -output_pipe clients, each of which has its own
+    thread that sends it the presents that OutputThread streams.
+
 The trace session and ETW analysis is always running, but whether or not
 collected data is written to the CSV file(s) is controlled by a recording state
 which is controlled from MainThread based on user input or timer.
+
+The trace session, its ConsumerThread and OutputThread, and their state make up
+a Pipeline.  Normally there is one, but in batch mode (-batch) each ETL file is
+analyzed by its own Pipeline, and several of them are run at once by
+BatchThread workers instead of MainThread.
 */
 
+#include "../PresentData/ColumnarFile.hpp"
 #include "../PresentData/MixedRealityTraceConsumer.hpp"
 #include "../PresentData/PresentMonTraceConsumer.hpp"
+#include "../PresentData/SharedMetrics.hpp"
+#include "DurationHistogram.hpp"
 
+#include <deque>
+#include <list>
+#include <memory>
+#include <thread>
 #include <unordered_map>
 
+struct TraceSession;
+struct CaptureFileWriter;
+
 enum class Verbosity {
     Simple,
     Normal,
     Verbose
 };
 
+enum class OutputFormat {
+    Csv,
+    Columnar
+};
+
 enum class ConsoleOutput {
     None,
     Simple,
@@ -67,13 +93,34 @@ struct CommandLineArgs {
     std::vector<const char*> mExcludeProcessNames;
     const char *mOutputCsvFileName;
     const char *mEtlFileName;
+    const char *mCaptureFileName;
+    const char *mBatchInput;
+    const char *mBatchOutputDir;
     const char *mSessionName;
+    const char *mConvertColumnarFileName;
+    const char *mStreamPipeName;
+    const char *mSharedMemoryName;
     UINT mTargetPid;
     UINT mDelay;
     UINT mTimer;
+    UINT mEvictAfter;
+    UINT mMaxInFlight;
+    UINT mWakeupPresents;
+    UINT mWakeupInterval;
+    UINT mEtlDecodeThreads;
+    UINT mBatchThreads;
+    UINT mRotateMegabytes;
+    UINT mRotateSeconds;
+    UINT mMaxFiles;
+    UINT mMaxOpenCsvs;
+    UINT mSummaryIntervalMs;
+    UINT mStreamQueueKilobytes;
+    double mStartTime;
+    double mEndTime;
     UINT mHotkeyModifiers;
     UINT mHotkeyVirtualKeyCode;
     ConsoleOutput mConsoleOutputType;
+    OutputFormat mOutputFormat;
     Verbosity mVerbosity;
     bool mOutputCsvToFile;
     bool mOutputCsvToStdout;
@@ -87,6 +134,48 @@ struct CommandLineArgs {
     bool mIncludeWindowsMixedReality;
     bool mMultiCsv;
     bool mStopExistingSession;
+    bool mStreamBlock;
+};
+
+// The count, total, minimum, and maximum of a QPC duration over a
+// -summary_interval.
+struct SummaryStats {
+    uint64_t mCount;
+    uint64_t mTotal;
+    uint64_t mMin;
+    uint64_t mMax;
+};
+
+// Frame time (MsBetweenPresents), display frame time
+// (MsBetweenDisplayChange), and latency (MsUntilDisplayed) histograms, for
+// percentiles.  These are about 15KB together, so they're only allocated for a
+// swapchain once there's a duration to add to them.
+struct SwapChainHistograms {
+    DurationHistogram mBetweenPresents;
+    DurationHistogram mBetweenDisplayChange;
+    DurationHistogram mUntilDisplayed;
+};
+
+// With -summary_interval, a swapchain's presents are accumulated into a
+// SwapChainSummary instead of being output, and the summary is output as one
+// row once trace time reaches a later interval (or its CSV is closed).  From
+// its first present on, a swapchain has a row for every interval, with no
+// frames if it didn't present.
+struct SwapChainSummary {
+    enum { PRESENT_MODE_COUNT = (uint32_t) PresentMode::Hardware_Composed_Independent_Flip + 1 };
+    bool mActive;                                   // Whether the swapchain has presented since its CSV was opened
+    uint64_t mIntervalIndex;                        // Interval since the session started
+    uint64_t mSwapChainAddress;
+    uint32_t mProcessId;
+    Runtime mRuntime;
+    uint32_t mFrameCount;
+    uint32_t mDroppedCount;
+    SummaryStats mBetweenPresents;
+    SummaryStats mBetweenDisplayChange;
+    SummaryStats mInPresentAPI;
+    SummaryStats mUntilDisplayed;
+    std::unique_ptr<SwapChainHistograms> mHistograms; // Allocated while mActive
+    uint32_t mPresentModeCount[PRESENT_MODE_COUNT];
 };
 
 // CSV output only requires last presented/displayed event to compute frame
@@ -95,15 +184,50 @@ struct CommandLineArgs {
 // reduce memory/compute overhead.
 struct SwapChainData {
     enum { PRESENT_HISTORY_MAX_COUNT = 120 };
-    std::shared_ptr<PresentEvent> mPresentHistory[PRESENT_HISTORY_MAX_COUNT];
+    PresentEventPtr mPresentHistory[PRESENT_HISTORY_MAX_COUNT];
     uint32_t mPresentHistoryCount;
     uint32_t mNextPresentIndex;
     uint32_t mLastDisplayedPresentIndex;
+    SwapChainSummary mSummary;
+
+    // Histograms of all the presents, shown in the console and published to
+    // -shared_memory readers (only allocated if either is used); and of the
+    // recorded presents, reported once done.
+    std::unique_ptr<SwapChainHistograms> mHistograms;
+    std::unique_ptr<SwapChainHistograms> mRecordedHistograms;
+
+    // -shared_memory state:
+    uint32_t mSharedMetricsSlot;                    // Index of the swapchain's slot, or UINT32_MAX if it doesn't have one
+    uint32_t mSharedMetricsPresentIndex;            // mNextPresentIndex when the slot was last updated
+};
+
+// The averages over a swapchain's present history, as shown in the console.
+struct SwapChainMetrics {
+    PresentEvent const* mLastPresent;
+    PresentEvent const* mLastDisplayed;             // The latest displayed present in the history, or nullptr
+    uint32_t mDisplayedCount;                       // Displayed presents in the history (0 with -simple)
+    double mCpuAverage;                             // Seconds between presents
+    double mDisplayedFps;                           // 0 if mDisplayedCount < 2
+    double mLatency;                                // Seconds from present to display; 0 if mDisplayedCount == 0
 };
 
 struct OutputCsv {
-    FILE* mFile;
-    FILE* mWmrFile;
+    FILE* mFile = nullptr;
+    FILE* mWmrFile = nullptr;
+
+    // -rotate_mb/-rotate_seconds state:
+    uint64_t mSize = 0;                             // Bytes of rows written to mFile
+    uint64_t mRotateQpc = 0;                        // Present time at which to start the next file
+    uint32_t mFileIndex = 0;                        // Index of mFile in the sequence of rotated files
+    std::deque<std::string> mPaths;                 // Rotated files still on disk, oldest first (for -max_files)
+
+    // -max_open_csv state:
+    std::string mPath;                              // Path of the current file, to reopen it once it's been closed
+    std::list<OutputCsv*>::iterator mOpenPosition;  // Position in Pipeline::mOpenOutputCsvs, if mFile is open
+
+    // -output_format columnar state:
+    ColumnarRowGroupWriter mRowGroup;               // Rows not yet written to mFile
+    std::unordered_map<uint32_t, std::string> mProcessNames; // Names written to mFile for each process ID
 };
 
 struct ProcessInfo {
@@ -114,28 +238,154 @@ struct ProcessInfo {
     bool mTargetProcess;
 };
 
+// CSV output is appended into a WriteBuffer by OutputThread, which hands the
+// buffer to WriterThread to write.  mRuns describes which file each part of
+// mData goes to, in order.
+struct WriteBuffer {
+    struct Run {
+        FILE* mFile;
+        size_t mSize;
+        bool mClose;                                // If true, mFile is closed after this run is written
+    };
+
+    std::vector<char> mData;
+    size_t mSize = 0;
+    std::vector<Run> mRuns;
+    std::vector<std::string> mDeletePaths;          // Files to delete after the runs are written
+    DWORD mFirstWriteTime = 0;                      // GetTickCount() when the first run was added
+};
+
+// -output_pipe messages are appended into a StreamBatch by OutputThread, which
+// is then shared by the connected clients' queues.
+struct StreamBatch {
+    std::vector<uint8_t> mData;
+    uint32_t mPresentCount = 0;
+};
+
+struct StreamClient {
+    uint32_t mIndex = 0;                            // Order the client connected in
+    HANDLE mPipe = INVALID_HANDLE_VALUE;
+    std::thread mThread;
+
+    // Protected by Pipeline::mStreamCS:
+    CONDITION_VARIABLE mBatchQueued;
+    CONDITION_VARIABLE mBatchSent;
+    std::deque<std::shared_ptr<StreamBatch const>> mQueue;
+    size_t mQueuedSize = 0;
+    uint64_t mUnsentDroppedCount = 0;               // Presents dropped since the last Dropped message
+    bool mConnected = true;
+
+    // Statistics reported once the client disconnects:
+    uint64_t mSentPresentCount = 0;
+    uint64_t mSentByteCount = 0;
+    uint64_t mDroppedPresentCount = 0;
+    uint64_t mBlockedQpc = 0;                       // Time OutputThread waited for the client with -pipe_block
+};
+
+struct Pipeline {
+    enum { WRITE_BUFFER_COUNT = 3 };
+
+    // The ETL file to analyze (nullptr for a realtime session), and the CSV
+    // file name to output to (nullptr for the default name).  These are the
+    // -etl_file and -output_file arguments, unless in batch mode.
+    char const* mEtlFileName = nullptr;
+    char const* mOutputCsvFileName = nullptr;
+    bool mBatch = false;                            // If true, stopped by its BatchThread worker instead of MainThread
+
+    // TraceSession.cpp:
+    TraceSession* mSession = nullptr;
+    PMTraceConsumer* mPMConsumer = nullptr;
+    MRTraceConsumer* mMRConsumer = nullptr;
+    CaptureFileWriter* mCaptureFileWriter = nullptr;
+
+    // ConsumerThread.cpp:
+    std::thread mConsumerThread;
+    uint64_t mEventCount = 0;                       // Events read from the ETL file
+
+    // OutputThread.cpp:
+    std::thread mOutputThread;
+    bool mQuit = false;
+    CRITICAL_SECTION mRecordingToggleCS;            // Protects mRecordingToggleHistory and mIsRecording
+    std::vector<uint64_t> mRecordingToggleHistory;
+    bool mIsRecording = false;
+    std::unordered_map<uint32_t, ProcessInfo> mProcesses;
+    uint32_t mTargetProcessCount = 0;
+    uint64_t mPresentCount = 0;                     // Presents handed to the output thread
+    std::string mPercentileReport;                  // Swapchains to report percentiles for once done
+
+    // CsvOutput.cpp:
+    OutputCsv mSingleOutputCsv;
+    uint32_t mRecordingCount = 1;
+    std::list<OutputCsv*> mOpenOutputCsvs;          // -multi_csv files that are open, most recently used first
+
+    // WriterThread.cpp:
+    std::thread mWriterThread;
+    CRITICAL_SECTION mWriterCS;                     // Protects mQueuedWriteBufferCount and mWriterQuit
+    CONDITION_VARIABLE mWriteBufferQueued;
+    CONDITION_VARIABLE mWriteBufferFree;
+    WriteBuffer mWriteBuffers[WRITE_BUFFER_COUNT];
+    uint32_t mAppendWriteBuffer = 0;                // The buffer OutputThread is appending to
+    uint32_t mNextWriteBuffer = 0;                  // The next buffer WriterThread writes
+    uint32_t mQueuedWriteBufferCount = 0;
+    bool mWriterQuit = false;
+    uint32_t mMaxQueuedWriteBufferCount = 0;        // Statistics reported by StopWriterThread()
+    uint64_t mWriteBufferCount = 0;
+    uint64_t mWriteByteCount = 0;
+    uint64_t mWriteStallQpc = 0;
+
+    // StreamThread.cpp:
+    std::thread mStreamThread;
+    CRITICAL_SECTION mStreamCS;                     // Protects mStreamClients, their queues, and mStreamQuit
+    HANDLE mStreamQuitEvent = NULL;
+    bool mStreamQuit = false;
+    std::vector<StreamClient*> mStreamClients;
+    uint32_t mStreamClientCount = 0;                // Clients that have connected
+    std::shared_ptr<StreamBatch> mStreamBatch;      // Messages not yet queued to the clients
+    std::vector<uint32_t> mStreamBatchProcessIds;   // Processes whose names are in mStreamBatch
+    std::string mStreamReport;                      // Statistics of the disconnected clients
+
+    // SharedMetrics.cpp:
+    HANDLE mSharedMetricsMapping = NULL;
+    SharedMetricsHeader* mSharedMetrics = nullptr;  // The mapped view
+    std::vector<uint32_t> mFreeSharedMetricsSlots;  // Slots released by exited processes
+    bool mSharedMetricsFull = false;                // If true, a swapchain didn't get a slot
+};
+
 #include "LateStageReprojectionData.hpp"
 
 // CommandLine.cpp:
 bool ParseCommandLine(int argc, char** argv);
 CommandLineArgs const& GetCommandLineArgs();
 
+// BatchThread.cpp:
+int RunBatch();
+
 // Console.cpp:
 bool InitializeConsole();
 void ConsolePrint(char const* format, ...);
 void ConsolePrintLn(char const* format, ...);
 void CommitConsole();
-void UpdateConsole(uint32_t processId, ProcessInfo const& processInfo);
+void UpdateConsole(Pipeline const* pipeline, uint32_t processId, ProcessInfo const& processInfo);
+bool GetSwapChainMetrics(Pipeline const* pipeline, SwapChainData const& chain, SwapChainMetrics* metrics);
+
+// ColumnarOutput.cpp:
+void WriteColumnarHeader(Pipeline* pipeline, OutputCsv* outputCsv);
+void AddColumnarPresent(Pipeline* pipeline, OutputCsv* outputCsv, ProcessInfo const* processInfo, ColumnarPresent const& present);
+void FlushColumnarRows(Pipeline* pipeline, OutputCsv* outputCsv);
+int ConvertColumnarFile();
 
 // ConsumerThread.cpp:
-void StartConsumerThread(TRACEHANDLE traceHandle);
-void WaitForConsumerThreadToExit();
+void StartConsumerThread(Pipeline* pipeline);
+void WaitForConsumerThreadToExit(Pipeline* pipeline);
 
 // CsvOutput.cpp:
-void IncrementRecordingCount();
-OutputCsv GetOutputCsv(ProcessInfo* processInfo);
-void CloseOutputCsv(ProcessInfo* processInfo);
-void UpdateCsv(ProcessInfo* processInfo, SwapChainData const& chain, PresentEvent const& p);
+void IncrementRecordingCount(Pipeline* pipeline);
+OutputCsv* GetOutputCsv(Pipeline* pipeline, ProcessInfo* processInfo);
+void CloseOutputCsv(Pipeline* pipeline, ProcessInfo* processInfo);
+void UpdateCsv(Pipeline* pipeline, ProcessInfo* processInfo, SwapChainData* chain, PresentEvent const& p);
+void FlushSummaryIntervals(Pipeline* pipeline, uint64_t qpcTime);
+std::string GetCsvHeader();
+bool GetColumnarPresent(SwapChainData const* chain, PresentEvent const& p, ColumnarPresent* columnar);
 const char* FinalStateToDroppedString(PresentResult res);
 const char* PresentModeToString(PresentMode mode);
 const char* RuntimeToString(Runtime rt);
@@ -144,22 +394,51 @@ const char* RuntimeToString(Runtime rt);
 void ExitMainThread();
 
 // OutputThread.cpp:
-void StartOutputThread();
-void StopOutputThread();
-void SetOutputRecordingState(bool record);
+void StartOutputThread(Pipeline* pipeline);
+void StopOutputThread(Pipeline* pipeline);
+void SetOutputRecordingState(Pipeline* pipeline, bool record);
 
 // Privilege.cpp:
 void ElevatePrivilege(int argc, char** argv);
 
+// WriterThread.cpp:
+void StartWriterThread(Pipeline* pipeline);
+void StopWriterThread(Pipeline* pipeline);
+char* BeginWrite(Pipeline* pipeline, size_t maxSize);
+void EndWrite(Pipeline* pipeline, FILE* fp, char const* end);
+void WriteFormatted(Pipeline* pipeline, FILE* fp, char const* format, ...);
+void CloseFileAfterWrites(Pipeline* pipeline, FILE* fp);
+void DeleteFileAfterWrites(Pipeline* pipeline, char const* path);
+void FlushWrites(Pipeline* pipeline, bool force);
+
+// SharedMetrics.cpp:
+void CreateSharedMetrics(Pipeline* pipeline);
+void CloseSharedMetrics(Pipeline* pipeline);
+void PublishSharedMetrics(Pipeline* pipeline);
+void ReleaseSharedMetricsSlots(Pipeline* pipeline, ProcessInfo* processInfo);
+
+// StreamThread.cpp:
+void StartStreamThread(Pipeline* pipeline);
+void StopStreamThread(Pipeline* pipeline);
+void StreamPresent(Pipeline* pipeline, ProcessInfo const* processInfo, ColumnarPresent const& present);
+void FlushStream(Pipeline* pipeline);
+
 // TraceSession.cpp:
-bool StartTraceSession();
-void StopTraceSession();
-void CheckLostReports(ULONG* eventsLost, ULONG* buffersLost);
+bool StartTraceSession(Pipeline* pipeline);
+void StopTraceSession(Pipeline* pipeline);
+void ExitPipeline(Pipeline* pipeline);
+void CheckLostReports(Pipeline const* pipeline, ULONG* eventsLost, ULONG* buffersLost);
+void CheckEvictedPresents(Pipeline const* pipeline, uint32_t* timedOutCount, uint32_t* overLimitCount);
+void CheckDroppedEvents(Pipeline const* pipeline, uint64_t* presentCount, uint64_t* processEventCount, uint64_t* lsrCount);
+void WaitForAnalyzedInfo(Pipeline const* pipeline, DWORD timeoutMilliseconds);
+void SignalAnalyzedInfo(Pipeline const* pipeline);
 void DequeueAnalyzedInfo(
+    Pipeline const* pipeline,
     std::vector<NTProcessEvent>* ntProcessEvents,
-    std::vector<std::shared_ptr<PresentEvent>>* presents,
+    std::vector<PresentEventPtr>* presents,
     std::vector<std::shared_ptr<LateStageReprojectionEvent>>* lsrs);
-double QpcDeltaToSeconds(uint64_t qpcDelta);
-uint64_t SecondsDeltaToQpc(double secondsDelta);
-double QpcToSeconds(uint64_t qpc);
+double QpcDeltaToSeconds(Pipeline const* pipeline, uint64_t qpcDelta);
+uint64_t QpcDeltaToMicroseconds(Pipeline const* pipeline, uint64_t qpcDelta);
+uint64_t SecondsDeltaToQpc(Pipeline const* pipeline, double secondsDelta);
+double QpcToSeconds(Pipeline const* pipeline, uint64_t qpc);
 
@@ -180,8 +180,8 @@ void ElevatePrivilege(int argc, char** argv)
 {
     auto const& args = GetCommandLineArgs();
 
-    // If we are processing an ETL file, then we don't need elevated privilege
-    if (args.mEtlFileName != nullptr) {
+    // If we are processing ETL file(s), then we don't need elevated privilege
+    if (args.mEtlFileName != nullptr || args.mBatchInput != nullptr) {
         return;
     }
 
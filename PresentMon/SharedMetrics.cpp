@@ -0,0 +1,239 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentMon.hpp"
+
+#include "../PresentData/TraceSession.hpp"
+
+#include <sddl.h>
+
+// With -shared_memory, OutputThread publishes each swapchain's console
+// metrics into the named file mapping described in
+// ../PresentData/SharedMetrics.hpp each time it wakes up, so readers see them
+// as soon as they've been analyzed.  Only swapchains that have presented since
+// they were last published are updated.
+
+enum {
+    SHARED_METRICS_SWAP_CHAIN_CAPACITY = 256,
+};
+
+// Updates a slot's metrics.  The slot's sequence is odd while they are being
+// written, so readers know to retry.
+static void WriteSlot(SharedMetricsHeader* header, uint32_t index, SharedSwapChainMetrics const& metrics)
+{
+    auto slot = (SharedSwapChainSlot*) GetSharedSwapChainSlot(header, index);
+    auto sequence = slot->mSequence.load(std::memory_order_relaxed);
+    slot->mSequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&slot->mMetrics, &metrics, sizeof(metrics));
+    slot->mSequence.store(sequence + 2, std::memory_order_release);
+}
+
+static bool AllocateSlot(Pipeline* pipeline, SwapChainData* chain)
+{
+    auto header = pipeline->mSharedMetrics;
+
+    if (!pipeline->mFreeSharedMetricsSlots.empty()) {
+        chain->mSharedMetricsSlot = pipeline->mFreeSharedMetricsSlots.back();
+        pipeline->mFreeSharedMetricsSlots.pop_back();
+        return true;
+    }
+
+    auto count = header->mSwapChainCount.load(std::memory_order_relaxed);
+    if (count == header->mSwapChainCapacity) {
+        pipeline->mSharedMetricsFull = true;
+        return false;
+    }
+
+    chain->mSharedMetricsSlot = count;
+    header->mSwapChainCount.store(count + 1, std::memory_order_release);
+    return true;
+}
+
+void CreateSharedMetrics(Pipeline* pipeline)
+{
+    auto const& args = GetCommandLineArgs();
+
+    if (args.mSharedMemoryName == nullptr) {
+        return;
+    }
+
+    // PresentMon usually runs elevated, so the mapping must let non-elevated
+    // processes (e.g., the game) read it.
+    SECURITY_ATTRIBUTES securityAttributes = {};
+    securityAttributes.nLength = sizeof(securityAttributes);
+    if (!ConvertStringSecurityDescriptorToSecurityDescriptorA("D:(A;;GA;;;SY)(A;;GA;;;BA)(A;;GR;;;WD)", SDDL_REVISION_1,
+                                                              &securityAttributes.lpSecurityDescriptor, nullptr)) {
+        fprintf(stderr, "error: failed to create -shared_memory %s (error=%u).\n", args.mSharedMemoryName, GetLastError());
+        return;
+    }
+
+    auto size = sizeof(SharedMetricsHeader) + SHARED_METRICS_SWAP_CHAIN_CAPACITY * sizeof(SharedSwapChainSlot);
+    auto mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, &securityAttributes, PAGE_READWRITE, 0, (DWORD) size, args.mSharedMemoryName);
+    auto error = GetLastError();
+    LocalFree(securityAttributes.lpSecurityDescriptor);
+
+    if (mapping == NULL) {
+        fprintf(stderr, "error: failed to create -shared_memory %s (error=%u).\n", args.mSharedMemoryName, error);
+        return;
+    }
+
+    // If the mapping already exists, another PresentMon is publishing to it
+    // (or a reader still has the previous one open), so don't write to it.
+    // Otherwise it's new, and zero-initialized.
+    if (error == ERROR_ALREADY_EXISTS) {
+        fprintf(stderr, "error: -shared_memory %s is already in use.\n", args.mSharedMemoryName);
+        CloseHandle(mapping);
+        return;
+    }
+
+    auto header = (SharedMetricsHeader*) MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+    if (header == nullptr) {
+        fprintf(stderr, "error: failed to map -shared_memory %s (error=%u).\n", args.mSharedMemoryName, GetLastError());
+        CloseHandle(mapping);
+        return;
+    }
+
+    // Write the magic last, so a reader doesn't see a partial header.
+    header->mVersion = SHARED_METRICS_VERSION;
+    header->mHeaderSize = (uint32_t) sizeof(SharedMetricsHeader);
+    header->mSlotSize = (uint32_t) sizeof(SharedSwapChainSlot);
+    header->mSwapChainCapacity = SHARED_METRICS_SWAP_CHAIN_CAPACITY;
+    header->mQpcFrequency = (uint64_t) pipeline->mSession->mQpcFrequency.QuadPart;
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->mMagic, SHARED_METRICS_MAGIC, sizeof(header->mMagic));
+
+    pipeline->mSharedMetricsMapping = mapping;
+    pipeline->mSharedMetrics = header;
+}
+
+// OutputThread has emptied the slots by now (see
+// ReleaseSharedMetricsSlots()), so readers that keep the mapping open don't
+// see stale metrics.
+void CloseSharedMetrics(Pipeline* pipeline)
+{
+    auto const& args = GetCommandLineArgs();
+
+    if (pipeline->mSharedMetrics == nullptr) {
+        return;
+    }
+
+    if (pipeline->mSharedMetricsFull) {
+        fprintf(stderr, "warning: -shared_memory %s only had room for %u swap chains; some weren't published.\n",
+            args.mSharedMemoryName, (uint32_t) SHARED_METRICS_SWAP_CHAIN_CAPACITY);
+    }
+
+    UnmapViewOfFile(pipeline->mSharedMetrics);
+    CloseHandle(pipeline->mSharedMetricsMapping);
+    pipeline->mSharedMetrics = nullptr;
+    pipeline->mSharedMetricsMapping = NULL;
+    pipeline->mFreeSharedMetricsSlots.clear();
+}
+
+void PublishSharedMetrics(Pipeline* pipeline)
+{
+    auto header = pipeline->mSharedMetrics;
+    if (header == nullptr) {
+        return;
+    }
+
+    for (auto& pair : pipeline->mProcesses) {
+        auto processId = pair.first;
+        auto processInfo = &pair.second;
+        if (!processInfo->mTargetProcess) {
+            continue;
+        }
+
+        for (auto& chainPair : processInfo->mSwapChain) {
+            auto chain = &chainPair.second;
+            if (chain->mSharedMetricsPresentIndex == chain->mNextPresentIndex) {
+                continue;
+            }
+
+            SwapChainMetrics swapChainMetrics;
+            if (!GetSwapChainMetrics(pipeline, *chain, &swapChainMetrics)) {
+                continue;
+            }
+
+            if (chain->mSharedMetricsSlot == UINT32_MAX && !AllocateSlot(pipeline, chain)) {
+                continue;
+            }
+
+            chain->mSharedMetricsPresentIndex = chain->mNextPresentIndex;
+
+            auto const& presentN = *swapChainMetrics.mLastPresent;
+            auto const& presentN1 = *chain->mPresentHistory[(chain->mNextPresentIndex - 2) % SwapChainData::PRESENT_HISTORY_MAX_COUNT];
+            auto cpuAvg = swapChainMetrics.mCpuAverage;
+
+            SharedSwapChainMetrics metrics = {};
+            metrics.mProcessId         = processId;
+            metrics.mSwapChainAddress  = chainPair.first;
+            metrics.mLastPresentQpc    = presentN.QpcTime;
+            metrics.mPresentCount      = chain->mNextPresentIndex - 1;
+            strncpy_s(metrics.mProcessName, processInfo->mModuleName.c_str(), _TRUNCATE);
+
+            metrics.mMsPerFrame        = (float) (1000.0 * cpuAvg);
+            metrics.mFps               = (float) (1.0 / cpuAvg);
+            metrics.mDisplayedFps      = (float) swapChainMetrics.mDisplayedFps;
+            metrics.mMsLatency         = (float) (1000.0 * swapChainMetrics.mLatency);
+            metrics.mMsBetweenPresents = (float) (1000.0 * QpcDeltaToSeconds(pipeline, presentN.QpcTime - presentN1.QpcTime));
+
+            if (chain->mHistograms != nullptr) {
+                auto const& histograms = *chain->mHistograms;
+                metrics.mFrameTimeP50  = (float) histograms.mBetweenPresents.GetPercentile(50.0);
+                metrics.mFrameTimeP95  = (float) histograms.mBetweenPresents.GetPercentile(95.0);
+                metrics.mFrameTimeP99  = (float) histograms.mBetweenPresents.GetPercentile(99.0);
+                metrics.mLowFps1       = (float) histograms.mBetweenPresents.GetLowRate(1.0);
+                metrics.mLatencyP50    = (float) histograms.mUntilDisplayed.GetPercentile(50.0);
+                metrics.mLatencyP95    = (float) histograms.mUntilDisplayed.GetPercentile(95.0);
+                metrics.mLatencyP99    = (float) histograms.mUntilDisplayed.GetPercentile(99.0);
+            }
+
+            metrics.mSyncInterval      = presentN.SyncInterval;
+            metrics.mPresentFlags      = presentN.PresentFlags;
+            metrics.mRuntime           = (uint8_t) presentN.Runtime;
+            metrics.mPresentMode       = (uint8_t) (swapChainMetrics.mLastDisplayed == nullptr ? presentN.PresentMode : swapChainMetrics.mLastDisplayed->PresentMode);
+
+            WriteSlot(header, chain->mSharedMetricsSlot, metrics);
+        }
+    }
+
+    header->mUpdateCount.store(header->mUpdateCount.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Empties the slots of an exited process's swapchains, so they can be reused.
+void ReleaseSharedMetricsSlots(Pipeline* pipeline, ProcessInfo* processInfo)
+{
+    if (pipeline->mSharedMetrics == nullptr) {
+        return;
+    }
+
+    SharedSwapChainMetrics empty = {};
+    for (auto& pair : processInfo->mSwapChain) {
+        auto chain = &pair.second;
+        if (chain->mSharedMetricsSlot != UINT32_MAX) {
+            WriteSlot(pipeline->mSharedMetrics, chain->mSharedMetricsSlot, empty);
+            pipeline->mFreeSharedMetricsSlots.push_back(chain->mSharedMetricsSlot);
+            chain->mSharedMetricsSlot = UINT32_MAX;
+        }
+    }
+}
@@ -0,0 +1,384 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentMon.hpp"
+
+#include "../PresentData/PresentStream.hpp"
+#include "../PresentData/TraceSession.hpp"
+
+#include <algorithm>
+
+// With -output_pipe, OutputThread appends each present it outputs to a
+// StreamBatch as binary messages (see ../PresentData/PresentStream.hpp), and
+// queues the batch to every connected client each time it has processed the
+// events it woke up for.  StreamThread accepts the clients on the named pipe,
+// and each client has its own thread that writes its queued batches, so a
+// client that reads slowly only holds up itself.
+//
+// Each client's queue is limited to -pipe_queue_kb.  Once it's full, the
+// oldest batches are dropped and the client is sent a Dropped message instead,
+// or with -pipe_block OutputThread waits for the client to catch up.
+
+enum {
+    STREAM_BATCH_MAX_SIZE = 64 * 1024,          // A batch is queued early once it's this big
+    STREAM_PIPE_BUFFER_SIZE = 64 * 1024,
+    STREAM_STOP_TIMEOUT_MILLISECONDS = 1000,    // How long a write can take once stopping, before the client is dropped
+    STREAM_BLOCK_POLL_MILLISECONDS = 100,       // How often a -pipe_block wait checks if PresentMon is stopping
+};
+
+static uint8_t* AppendMessage(StreamBatch* batch, PresentStreamMessageType type, size_t size)
+{
+    PresentStreamMessageHeader header = {};
+    header.mType = type;
+    header.mSize = (uint32_t) size;
+
+    auto offset = batch->mData.size();
+    batch->mData.resize(offset + sizeof(header) + size);
+    memcpy(batch->mData.data() + offset, &header, sizeof(header));
+    return batch->mData.data() + offset + sizeof(header);
+}
+
+// Writes to the pipe, and waits for the client to read it if the pipe's
+// buffer is full.  Once PresentMon is stopping, the client only has
+// STREAM_STOP_TIMEOUT_MILLISECONDS to do so.
+static bool WriteToPipe(Pipeline const* pipeline, HANDLE pipe, OVERLAPPED* overlapped, void const* data, size_t size)
+{
+    DWORD writtenSize = 0;
+    if (!WriteFile(pipe, data, (DWORD) size, nullptr, overlapped)) {
+        if (GetLastError() != ERROR_IO_PENDING) {
+            return false;
+        }
+
+        HANDLE events[] = { overlapped->hEvent, pipeline->mStreamQuitEvent };
+        if (WaitForMultipleObjects(_countof(events), events, FALSE, INFINITE) != WAIT_OBJECT_0 &&
+            WaitForSingleObject(overlapped->hEvent, STREAM_STOP_TIMEOUT_MILLISECONDS) != WAIT_OBJECT_0) {
+            CancelIo(pipe);
+            GetOverlappedResult(pipe, overlapped, &writtenSize, TRUE);
+            return false;
+        }
+    }
+
+    return GetOverlappedResult(pipe, overlapped, &writtenSize, FALSE) && writtenSize == size;
+}
+
+// A client's thread, which sends it its queued batches until it disconnects
+// or PresentMon stops.
+static void Send(Pipeline* pipeline, StreamClient* client)
+{
+    OVERLAPPED overlapped = {};
+    overlapped.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+
+    auto connected = true;
+    auto sentHello = false;
+    while (connected) {
+        EnterCriticalSection(&pipeline->mStreamCS);
+        while (client->mQueue.empty() && !pipeline->mStreamQuit) {
+            SleepConditionVariableCS(&client->mBatchQueued, &pipeline->mStreamCS, INFINITE);
+        }
+        if (client->mQueue.empty()) {
+            LeaveCriticalSection(&pipeline->mStreamCS);
+            break;
+        }
+        auto batch = client->mQueue.front();
+        client->mQueue.pop_front();
+        client->mQueuedSize -= batch->mData.size();
+        auto droppedCount = client->mUnsentDroppedCount;
+        client->mUnsentDroppedCount = 0;
+        LeaveCriticalSection(&pipeline->mStreamCS);
+        WakeConditionVariable(&client->mBatchSent);
+
+        // The Hello message is sent along with the first batch, because the
+        // session's start time isn't known until it has had an event.
+        if (!sentHello) {
+            StreamBatch hello;
+            PresentStreamHello message = {};
+            memcpy(message.mMagic, PRESENT_STREAM_MAGIC, sizeof(message.mMagic));
+            message.mVersion      = PRESENT_STREAM_VERSION;
+            message.mPresentSize  = (uint32_t) sizeof(ColumnarPresent);
+            message.mQpcFrequency = pipeline->mSession->mQpcFrequency.QuadPart;
+            message.mStartQpc     = pipeline->mSession->mStartQpc.QuadPart;
+            memcpy(AppendMessage(&hello, PresentStreamMessageType::Hello, sizeof(message)), &message, sizeof(message));
+            connected = WriteToPipe(pipeline, client->mPipe, &overlapped, hello.mData.data(), hello.mData.size());
+            sentHello = true;
+        }
+
+        if (connected && droppedCount > 0) {
+            StreamBatch dropped;
+            PresentStreamDropped message = {};
+            message.mPresentCount = droppedCount;
+            memcpy(AppendMessage(&dropped, PresentStreamMessageType::Dropped, sizeof(message)), &message, sizeof(message));
+            connected = WriteToPipe(pipeline, client->mPipe, &overlapped, dropped.mData.data(), dropped.mData.size());
+        }
+
+        if (connected) {
+            connected = WriteToPipe(pipeline, client->mPipe, &overlapped, batch->mData.data(), batch->mData.size());
+        }
+        if (connected) {
+            client->mSentPresentCount += batch->mPresentCount;
+            client->mSentByteCount += batch->mData.size();
+        }
+    }
+
+    // Stop OutputThread from queueing batches to, or waiting for, the client.
+    EnterCriticalSection(&pipeline->mStreamCS);
+    for (auto const& batch : client->mQueue) {
+        client->mDroppedPresentCount += batch->mPresentCount;
+    }
+    client->mQueue.clear();
+    client->mQueuedSize = 0;
+    client->mConnected = false;
+    LeaveCriticalSection(&pipeline->mStreamCS);
+    WakeConditionVariable(&client->mBatchSent);
+
+    CloseHandle(client->mPipe);
+    CloseHandle(overlapped.hEvent);
+}
+
+// StreamThread, which creates an instance of the named pipe for each client
+// to connect to.
+static void Listen(Pipeline* pipeline)
+{
+    auto const& args = GetCommandLineArgs();
+
+    char pipeName[MAX_PATH];
+    _snprintf_s(pipeName, _TRUNCATE, "\\\\.\\pipe\\%s", args.mStreamPipeName);
+
+    OVERLAPPED overlapped = {};
+    overlapped.hEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+
+    for (auto firstInstance = true; ; firstInstance = false) {
+        auto pipe = CreateNamedPipeA(pipeName,
+            PIPE_ACCESS_OUTBOUND | FILE_FLAG_OVERLAPPED | (firstInstance ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+            PIPE_TYPE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+            PIPE_UNLIMITED_INSTANCES, STREAM_PIPE_BUFFER_SIZE, 0, 0, nullptr);
+        if (pipe == INVALID_HANDLE_VALUE) {
+            fprintf(stderr, "error: failed to create -output_pipe %s (error=%u).\n", pipeName, GetLastError());
+            break;
+        }
+
+        // Wait for a client to connect, or for PresentMon to stop.
+        DWORD size = 0;
+        auto connected = ConnectNamedPipe(pipe, &overlapped) != FALSE;
+        if (!connected) {
+            switch (GetLastError()) {
+            case ERROR_PIPE_CONNECTED:
+                connected = true;
+                break;
+            case ERROR_IO_PENDING: {
+                HANDLE events[] = { overlapped.hEvent, pipeline->mStreamQuitEvent };
+                if (WaitForMultipleObjects(_countof(events), events, FALSE, INFINITE) == WAIT_OBJECT_0) {
+                    connected = GetOverlappedResult(pipe, &overlapped, &size, FALSE) != FALSE;
+                } else {
+                    CancelIo(pipe);
+                    GetOverlappedResult(pipe, &overlapped, &size, TRUE);
+                }
+                break;
+            }
+            }
+        }
+
+        if (WaitForSingleObject(pipeline->mStreamQuitEvent, 0) == WAIT_OBJECT_0) {
+            CloseHandle(pipe);
+            break;
+        }
+        if (!connected) {
+            CloseHandle(pipe);
+            continue;
+        }
+
+        auto client = new StreamClient;
+        client->mPipe = pipe;
+        InitializeConditionVariable(&client->mBatchQueued);
+        InitializeConditionVariable(&client->mBatchSent);
+
+        EnterCriticalSection(&pipeline->mStreamCS);
+        pipeline->mStreamClientCount += 1;
+        client->mIndex = pipeline->mStreamClientCount;
+        client->mThread = std::thread(Send, pipeline, client);
+        pipeline->mStreamClients.push_back(client);
+        LeaveCriticalSection(&pipeline->mStreamCS);
+    }
+
+    CloseHandle(overlapped.hEvent);
+}
+
+// Waits for a client's thread to exit, and adds its statistics to
+// mStreamReport.
+static void DeleteStreamClient(Pipeline* pipeline, StreamClient* client)
+{
+    client->mThread.join();
+
+    LARGE_INTEGER qpcFrequency = {};
+    QueryPerformanceFrequency(&qpcFrequency);
+
+    char line[256];
+    _snprintf_s(line, _TRUNCATE, "    client %u: sent %llu presents (%.1f MB), dropped %llu presents, output waited %.3f seconds for it\n",
+        client->mIndex,
+        client->mSentPresentCount,
+        client->mSentByteCount / (1024.0 * 1024.0),
+        client->mDroppedPresentCount,
+        (double) client->mBlockedQpc / qpcFrequency.QuadPart);
+    pipeline->mStreamReport += line;
+
+    delete client;
+}
+
+void StreamPresent(Pipeline* pipeline, ProcessInfo const* processInfo, ColumnarPresent const& present)
+{
+    if (pipeline->mStreamBatch == nullptr) {
+        pipeline->mStreamBatch = std::make_shared<StreamBatch>();
+    }
+    auto batch = pipeline->mStreamBatch.get();
+
+    // Each batch has the names of its presents' processes, so that a client
+    // has them whichever batches it was sent.
+    auto processIds = &pipeline->mStreamBatchProcessIds;
+    if (std::find(processIds->begin(), processIds->end(), present.mProcessId) == processIds->end()) {
+        processIds->push_back(present.mProcessId);
+
+        auto const& moduleName = processInfo->mModuleName;
+        auto size = sizeof(ColumnarProcessName) + moduleName.size();
+        auto dst = AppendMessage(batch, PresentStreamMessageType::ProcessName, (size + 7) & ~(size_t) 7);
+
+        ColumnarProcessName processName = {};
+        processName.mProcessId = present.mProcessId;
+        processName.mNameLength = (uint32_t) moduleName.size();
+        memcpy(dst, &processName, sizeof(processName));
+        memcpy(dst + sizeof(processName), moduleName.c_str(), moduleName.size());
+    }
+
+    memcpy(AppendMessage(batch, PresentStreamMessageType::Present, sizeof(present)), &present, sizeof(present));
+    batch->mPresentCount += 1;
+
+    if (batch->mData.size() >= STREAM_BATCH_MAX_SIZE) {
+        FlushStream(pipeline);
+    }
+}
+
+// Queues the presents streamed so far to every connected client.
+void FlushStream(Pipeline* pipeline)
+{
+    auto const& args = GetCommandLineArgs();
+
+    std::shared_ptr<StreamBatch const> batch = pipeline->mStreamBatch;
+    if (batch == nullptr) {
+        return;
+    }
+    pipeline->mStreamBatch.reset();
+    pipeline->mStreamBatchProcessIds.clear();
+
+    auto maxQueuedSize = (size_t) args.mStreamQueueKilobytes * 1024;
+    auto size = batch->mData.size();
+    std::vector<StreamClient*> disconnectedClients;
+
+    EnterCriticalSection(&pipeline->mStreamCS);
+    for (auto client : pipeline->mStreamClients) {
+        if (args.mStreamBlock) {
+            // Wait for the client to make room, holding up the analysis
+            // instead of dropping presents.
+            if (client->mConnected && client->mQueuedSize > 0 && client->mQueuedSize + size > maxQueuedSize) {
+                LARGE_INTEGER startQpc = {};
+                QueryPerformanceCounter(&startQpc);
+
+                do {
+                    SleepConditionVariableCS(&client->mBatchSent, &pipeline->mStreamCS, STREAM_BLOCK_POLL_MILLISECONDS);
+                } while (client->mConnected && client->mQueuedSize > 0 && client->mQueuedSize + size > maxQueuedSize && !pipeline->mQuit);
+
+                LARGE_INTEGER endQpc = {};
+                QueryPerformanceCounter(&endQpc);
+                client->mBlockedQpc += endQpc.QuadPart - startQpc.QuadPart;
+            }
+        } else {
+            while (!client->mQueue.empty() && client->mQueuedSize + size > maxQueuedSize) {
+                auto const& oldest = client->mQueue.front();
+                client->mQueuedSize -= oldest->mData.size();
+                client->mUnsentDroppedCount += oldest->mPresentCount;
+                client->mDroppedPresentCount += oldest->mPresentCount;
+                client->mQueue.pop_front();
+            }
+        }
+
+        if (client->mConnected) {
+            client->mQueue.push_back(batch);
+            client->mQueuedSize += size;
+            WakeConditionVariable(&client->mBatchQueued);
+        } else {
+            disconnectedClients.push_back(client);
+        }
+    }
+
+    for (auto client : disconnectedClients) {
+        pipeline->mStreamClients.erase(std::find(pipeline->mStreamClients.begin(), pipeline->mStreamClients.end(), client));
+    }
+    LeaveCriticalSection(&pipeline->mStreamCS);
+
+    for (auto client : disconnectedClients) {
+        DeleteStreamClient(pipeline, client);
+    }
+}
+
+void StartStreamThread(Pipeline* pipeline)
+{
+    auto const& args = GetCommandLineArgs();
+
+    if (args.mStreamPipeName == nullptr) {
+        return;
+    }
+
+    InitializeCriticalSection(&pipeline->mStreamCS);
+    pipeline->mStreamQuitEvent = CreateEventA(nullptr, TRUE, FALSE, nullptr);
+
+    pipeline->mStreamThread = std::thread(Listen, pipeline);
+}
+
+// Queues the last presents, gives the clients a chance to read them, and
+// reports what was sent to each client.
+void StopStreamThread(Pipeline* pipeline)
+{
+    if (!pipeline->mStreamThread.joinable()) {
+        return;
+    }
+
+    FlushStream(pipeline);
+
+    EnterCriticalSection(&pipeline->mStreamCS);
+    pipeline->mStreamQuit = true;
+    for (auto client : pipeline->mStreamClients) {
+        WakeConditionVariable(&client->mBatchQueued);
+    }
+    LeaveCriticalSection(&pipeline->mStreamCS);
+    SetEvent(pipeline->mStreamQuitEvent);
+
+    pipeline->mStreamThread.join();
+    for (auto client : pipeline->mStreamClients) {
+        DeleteStreamClient(pipeline, client);
+    }
+    pipeline->mStreamClients.clear();
+
+    CloseHandle(pipeline->mStreamQuitEvent);
+    pipeline->mStreamQuitEvent = NULL;
+    DeleteCriticalSection(&pipeline->mStreamCS);
+
+    if (pipeline->mStreamClientCount > 0) {
+        fprintf(stderr, "Streamed presents to %u -output_pipe clients:\n%s", pipeline->mStreamClientCount, pipeline->mStreamReport.c_str());
+    }
+}
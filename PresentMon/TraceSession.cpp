@@ -22,37 +22,65 @@ SOFTWARE.
 
 #include "PresentMon.hpp"
 
+#include "../PresentData/CaptureFile.hpp"
 #include "../PresentData/TraceSession.hpp"
 #include <VersionHelpers.h>
 
 namespace {
 
-TraceSession gSession;
-static PMTraceConsumer* gPMConsumer = nullptr;
-static MRTraceConsumer* gMRConsumer = nullptr;
+// How long before -start_time to start analyzing, so that the presents in
+// flight at -start_time are tracked (and classified) from their start.
+double const ETL_WARM_UP_SECONDS = 2.0;
+
+void DeleteSessionObjects(Pipeline* pipeline)
+{
+    delete pipeline->mCaptureFileWriter;
+    delete pipeline->mMRConsumer;
+    delete pipeline->mPMConsumer;
+    delete pipeline->mSession;
+    pipeline->mCaptureFileWriter = nullptr;
+    pipeline->mMRConsumer = nullptr;
+    pipeline->mPMConsumer = nullptr;
+    pipeline->mSession = nullptr;
+}
 
 }
 
-bool StartTraceSession()
+bool StartTraceSession(Pipeline* pipeline)
 {
     auto const& args = GetCommandLineArgs();
     auto simple = args.mVerbosity == Verbosity::Simple;
     auto includeWinMR = args.mIncludeWindowsMixedReality;
     auto expectFilteredEvents =
-        args.mEtlFileName == nullptr && // Scope filtering based on event ID only works for realtime collection
-        IsWindows8Point1OrGreater();    // and requires Win8.1+
+        pipeline->mEtlFileName == nullptr && // Scope filtering based on event ID only works for realtime collection
+        IsWindows8Point1OrGreater();         // and requires Win8.1+
 
     // Create consumers
-    gPMConsumer = new PMTraceConsumer(expectFilteredEvents, simple);
+    pipeline->mSession = new TraceSession;
+    pipeline->mPMConsumer = new PMTraceConsumer(expectFilteredEvents, simple);
+    pipeline->mPMConsumer->SetOutputWakeup(args.mWakeupPresents, args.mWakeupInterval);
     if (includeWinMR) {
-        gMRConsumer = new MRTraceConsumer(simple);
+        pipeline->mMRConsumer = new MRTraceConsumer(simple);
+    }
+
+    // Create the capture file before starting the session, so that all
+    // providers are enabled for it.
+    if (args.mCaptureFileName != nullptr) {
+        pipeline->mCaptureFileWriter = new CaptureFileWriter;
+        if (!pipeline->mCaptureFileWriter->Open(args.mCaptureFileName)) {
+            fprintf(stderr, "error: failed to create capture file: %s\n", args.mCaptureFileName);
+            DeleteSessionObjects(pipeline);
+            return false;
+        }
+        pipeline->mSession->mCaptureFileWriter = pipeline->mCaptureFileWriter;
     }
 
     // Start the session;
     // If a session with this same name is already running, we either exit or
     // stop it and start a new session.  This is useful if a previous process
     // failed to properly shut down the session for some reason.
-    auto status = gSession.Start(gPMConsumer, gMRConsumer, args.mEtlFileName, args.mSessionName);
+    auto session = pipeline->mSession;
+    auto status = session->Start(pipeline->mPMConsumer, pipeline->mMRConsumer, pipeline->mEtlFileName, args.mEtlDecodeThreads, args.mSessionName);
 
     if (status == ERROR_ALREADY_EXISTS) {
         if (args.mStopExistingSession) {
@@ -66,16 +94,13 @@ bool StartTraceSession()
                 "       to stop the existing session, or use -session_name with a different name to\n"
                 "       start a new session.\n",
                 args.mSessionName);
-            delete gPMConsumer;
-            delete gMRConsumer;
-            gPMConsumer = nullptr;
-            gMRConsumer = nullptr;
+            DeleteSessionObjects(pipeline);
             return false;
         }
 
         status = TraceSession::StopNamedSession(args.mSessionName);
         if (status == ERROR_SUCCESS) {
-            status = gSession.Start(gPMConsumer, gMRConsumer, args.mEtlFileName, args.mSessionName);
+            status = session->Start(pipeline->mPMConsumer, pipeline->mMRConsumer, pipeline->mEtlFileName, args.mEtlDecodeThreads, args.mSessionName);
         }
     }
 
@@ -90,69 +115,142 @@ bool StartTraceSession()
         case ERROR_ACCESS_DENIED:     fprintf(stderr, " (access denied)"); break;
         default:                      fprintf(stderr, " (error=%u)", status); break;
         }
+        if (pipeline->mBatch) {
+            fprintf(stderr, ": %s", pipeline->mEtlFileName);
+        }
         fprintf(stderr, ".\n");
 
-        delete gPMConsumer;
-        delete gMRConsumer;
-        gPMConsumer = nullptr;
-        gMRConsumer = nullptr;
+        DeleteSessionObjects(pipeline);
         return false;
     }
 
+    // The QPC frequency isn't known until the session has started, so the
+    // eviction timeout can't be converted until now.
+    if (args.mEvictAfter != 0 || args.mMaxInFlight != 0) {
+        pipeline->mPMConsumer->SetPresentEvictionLimits(SecondsDeltaToQpc(pipeline, args.mEvictAfter), args.mMaxInFlight);
+    }
+
+    if (args.mStartTime > 0.0) {
+        session->mEtlSeekSeconds = max(0.0, args.mStartTime - ETL_WARM_UP_SECONDS);
+    }
+    session->mEtlStopSeconds = args.mEndTime;
+
     // -------------------------------------------------------------------------
     // Start the consumer and output threads
-    StartConsumerThread(gSession.mTraceHandle);
-    StartOutputThread();
+    StartConsumerThread(pipeline);
+    StartOutputThread(pipeline);
 
     return true;
 }
 
-void StopTraceSession()
+void StopTraceSession(Pipeline* pipeline)
 {
+    auto const& args = GetCommandLineArgs();
+    auto session = pipeline->mSession;
+
+    // The session's lost event counts are recorded in the capture file, and
+    // can't be queried once it is stopped.
+    ULONG eventsLost = 0;
+    ULONG buffersLost = 0;
+    if (pipeline->mCaptureFileWriter != nullptr) {
+        session->CheckLostReports(&eventsLost, &buffersLost);
+    }
+
     // Stop the trace session.
-    gSession.Stop();
+    session->Stop();
 
     // Wait for the consumer and output threads to end (which are using the
     // consumers).
-    WaitForConsumerThreadToExit();
-    StopOutputThread();
-
-    // Destruct the consumers
-    delete gMRConsumer;
-    delete gPMConsumer;
-    gMRConsumer = nullptr;
-    gPMConsumer = nullptr;
+    WaitForConsumerThreadToExit(pipeline);
+    StopOutputThread(pipeline);
+
+    // Finish the capture file, now that the consumer thread is done writing
+    // to it.
+    if (pipeline->mCaptureFileWriter != nullptr) {
+        if (!pipeline->mCaptureFileWriter->Close(session->mQpcFrequency.QuadPart, session->mStartQpc.QuadPart, eventsLost, buffersLost)) {
+            fprintf(stderr, "warning: failed to write capture file: %s; it is incomplete.\n", args.mCaptureFileName);
+        }
+        session->mCaptureFileWriter = nullptr;
+    }
+
+    // Destruct the session and consumers
+    DeleteSessionObjects(pipeline);
 }
 
-void CheckLostReports(ULONG* eventsLost, ULONG* buffersLost)
+// Called from the pipeline's consumer or output thread once the pipeline
+// should stop (e.g., the ETL file is done).  MainThread stops its pipeline
+// when it exits; a batch pipeline is stopped by its BatchThread worker once
+// the consumer thread returns, which this makes it do early.
+void ExitPipeline(Pipeline* pipeline)
 {
-    auto status = gSession.CheckLostReports(eventsLost, buffersLost);
+    if (pipeline->mBatch) {
+        pipeline->mSession->mContinueProcessingBuffers = FALSE;
+    } else {
+        ExitMainThread();
+    }
+}
+
+void CheckLostReports(Pipeline const* pipeline, ULONG* eventsLost, ULONG* buffersLost)
+{
+    auto status = pipeline->mSession->CheckLostReports(eventsLost, buffersLost);
     (void) status;
 }
 
+void CheckEvictedPresents(Pipeline const* pipeline, uint32_t* timedOutCount, uint32_t* overLimitCount)
+{
+    pipeline->mPMConsumer->GetEvictedPresentCounts(timedOutCount, overLimitCount);
+}
+
+void CheckDroppedEvents(Pipeline const* pipeline, uint64_t* presentCount, uint64_t* processEventCount, uint64_t* lsrCount)
+{
+    *presentCount = pipeline->mPMConsumer->mCompletedPresents.OverflowCount();
+    *processEventCount = pipeline->mPMConsumer->mNTProcessEvents.OverflowCount();
+    *lsrCount = pipeline->mMRConsumer == nullptr ? 0 : pipeline->mMRConsumer->mCompletedLSRs.OverflowCount();
+}
+
+void WaitForAnalyzedInfo(Pipeline const* pipeline, DWORD timeoutMilliseconds)
+{
+    HANDLE handles[] = {
+        pipeline->mPMConsumer->mCompletedPresentsEvent,
+        pipeline->mPMConsumer->mWakeupTimer,
+    };
+    WaitForMultipleObjects(handles[1] == NULL ? 1 : 2, handles, FALSE, timeoutMilliseconds);
+}
+
+void SignalAnalyzedInfo(Pipeline const* pipeline)
+{
+    SetEvent(pipeline->mPMConsumer->mCompletedPresentsEvent);
+}
+
 void DequeueAnalyzedInfo(
+    Pipeline const* pipeline,
     std::vector<NTProcessEvent>* ntProcessEvents,
-    std::vector<std::shared_ptr<PresentEvent>>* presents,
+    std::vector<PresentEventPtr>* presents,
     std::vector<std::shared_ptr<LateStageReprojectionEvent>>* lsrs)
 {
-    gPMConsumer->DequeueProcessEvents(*ntProcessEvents);
-    gPMConsumer->DequeuePresents(*presents);
-    if (gMRConsumer != nullptr) {
-        gMRConsumer->DequeueLSRs(*lsrs);
+    pipeline->mPMConsumer->DequeueProcessEvents(*ntProcessEvents);
+    pipeline->mPMConsumer->DequeuePresents(*presents);
+    if (pipeline->mMRConsumer != nullptr) {
+        pipeline->mMRConsumer->DequeueLSRs(*lsrs);
     }
 }
 
-double QpcDeltaToSeconds(uint64_t qpcDelta)
+double QpcDeltaToSeconds(Pipeline const* pipeline, uint64_t qpcDelta)
+{
+    return (double) qpcDelta / pipeline->mSession->mQpcFrequency.QuadPart;
+}
+
+uint64_t QpcDeltaToMicroseconds(Pipeline const* pipeline, uint64_t qpcDelta)
 {
-    return (double) qpcDelta / gSession.mQpcFrequency.QuadPart;
+    return (uint64_t) (1000000.0 * QpcDeltaToSeconds(pipeline, qpcDelta));
 }
 
-uint64_t SecondsDeltaToQpc(double secondsDelta)
+uint64_t SecondsDeltaToQpc(Pipeline const* pipeline, double secondsDelta)
 {
-    return (uint64_t) (secondsDelta * gSession.mQpcFrequency.QuadPart);
+    return (uint64_t) (secondsDelta * pipeline->mSession->mQpcFrequency.QuadPart);
 }
 
-double QpcToSeconds(uint64_t qpc)
+double QpcToSeconds(Pipeline const* pipeline, uint64_t qpc)
 {
-    return QpcDeltaToSeconds(qpc - gSession.mStartQpc.QuadPart);
+    return QpcDeltaToSeconds(pipeline, qpc - pipeline->mSession->mStartQpc.QuadPart);
 }
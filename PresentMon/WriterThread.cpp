@@ -0,0 +1,261 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentMon.hpp"
+
+#include <algorithm>
+
+// OutputThread appends CSV output into one of Pipeline::mWriteBuffers, and
+// hands it to WriterThread once it's full or its oldest output is
+// WRITE_FLUSH_MILLISECONDS old.  WriterThread writes the buffers in order
+// while OutputThread fills the next one, so OutputThread only waits for the
+// disk if all the buffers are queued (the time it waits is reported as the
+// stall time).
+
+enum {
+    WRITE_BUFFER_SIZE = 1024 * 1024,
+    WRITE_FLUSH_MILLISECONDS = 100,
+};
+
+static void Write(Pipeline* pipeline)
+{
+    std::vector<FILE*> writtenFiles;
+
+    for (;;) {
+        EnterCriticalSection(&pipeline->mWriterCS);
+        while (pipeline->mQueuedWriteBufferCount == 0 && !pipeline->mWriterQuit) {
+            SleepConditionVariableCS(&pipeline->mWriteBufferQueued, &pipeline->mWriterCS, INFINITE);
+        }
+        auto done = pipeline->mQueuedWriteBufferCount == 0;
+        LeaveCriticalSection(&pipeline->mWriterCS);
+
+        if (done) {
+            break;
+        }
+
+        // Write the runs in order, and then flush the files written to so
+        // that the output isn't held in the FILE buffers.
+        auto buffer = &pipeline->mWriteBuffers[pipeline->mNextWriteBuffer];
+        auto data = buffer->mData.data();
+        for (auto const& run : buffer->mRuns) {
+            if (run.mSize > 0) {
+                fwrite(data, 1, run.mSize, run.mFile);
+                data += run.mSize;
+            }
+
+            auto ii = std::find(writtenFiles.begin(), writtenFiles.end(), run.mFile);
+            if (run.mClose) {
+                fclose(run.mFile);
+                if (ii != writtenFiles.end()) {
+                    writtenFiles.erase(ii);
+                }
+            } else if (ii == writtenFiles.end()) {
+                writtenFiles.emplace_back(run.mFile);
+            }
+        }
+
+        for (auto fp : writtenFiles) {
+            fflush(fp);
+        }
+        writtenFiles.clear();
+
+        for (auto const& path : buffer->mDeletePaths) {
+            remove(path.c_str());
+        }
+
+        buffer->mSize = 0;
+        buffer->mRuns.clear();
+        buffer->mDeletePaths.clear();
+        pipeline->mNextWriteBuffer = (pipeline->mNextWriteBuffer + 1) % Pipeline::WRITE_BUFFER_COUNT;
+
+        EnterCriticalSection(&pipeline->mWriterCS);
+        pipeline->mQueuedWriteBufferCount -= 1;
+        LeaveCriticalSection(&pipeline->mWriterCS);
+        WakeConditionVariable(&pipeline->mWriteBufferFree);
+    }
+}
+
+static bool IsEmpty(WriteBuffer const* buffer)
+{
+    return buffer->mRuns.empty() && buffer->mDeletePaths.empty();
+}
+
+// Hands the buffer being appended to to WriterThread, and waits until the
+// next buffer has been written if it's still queued.
+static void QueueWriteBuffer(Pipeline* pipeline)
+{
+    auto buffer = &pipeline->mWriteBuffers[pipeline->mAppendWriteBuffer];
+    if (IsEmpty(buffer)) {
+        return;
+    }
+
+    pipeline->mWriteBufferCount += 1;
+    pipeline->mWriteByteCount += buffer->mSize;
+    pipeline->mAppendWriteBuffer = (pipeline->mAppendWriteBuffer + 1) % Pipeline::WRITE_BUFFER_COUNT;
+
+    EnterCriticalSection(&pipeline->mWriterCS);
+    pipeline->mQueuedWriteBufferCount += 1;
+    pipeline->mMaxQueuedWriteBufferCount = max(pipeline->mMaxQueuedWriteBufferCount, pipeline->mQueuedWriteBufferCount);
+    WakeConditionVariable(&pipeline->mWriteBufferQueued);
+
+    if (pipeline->mQueuedWriteBufferCount == Pipeline::WRITE_BUFFER_COUNT) {
+        LARGE_INTEGER startQpc = {};
+        QueryPerformanceCounter(&startQpc);
+
+        do {
+            SleepConditionVariableCS(&pipeline->mWriteBufferFree, &pipeline->mWriterCS, INFINITE);
+        } while (pipeline->mQueuedWriteBufferCount == Pipeline::WRITE_BUFFER_COUNT);
+
+        LARGE_INTEGER endQpc = {};
+        QueryPerformanceCounter(&endQpc);
+        pipeline->mWriteStallQpc += endQpc.QuadPart - startQpc.QuadPart;
+    }
+    LeaveCriticalSection(&pipeline->mWriterCS);
+}
+
+// Returns where to format up to maxSize bytes of output, which EndWrite()
+// then adds to the buffer.
+char* BeginWrite(Pipeline* pipeline, size_t maxSize)
+{
+    auto buffer = &pipeline->mWriteBuffers[pipeline->mAppendWriteBuffer];
+    if (buffer->mSize + maxSize > buffer->mData.size()) {
+        if (!IsEmpty(buffer)) {
+            QueueWriteBuffer(pipeline);
+            buffer = &pipeline->mWriteBuffers[pipeline->mAppendWriteBuffer];
+        }
+        if (buffer->mSize + maxSize > buffer->mData.size()) {
+            buffer->mData.resize(max(maxSize, (size_t) WRITE_BUFFER_SIZE));
+        }
+    }
+
+    return buffer->mData.data() + buffer->mSize;
+}
+
+void EndWrite(Pipeline* pipeline, FILE* fp, char const* end)
+{
+    auto buffer = &pipeline->mWriteBuffers[pipeline->mAppendWriteBuffer];
+    auto size = end - (buffer->mData.data() + buffer->mSize);
+
+    if (IsEmpty(buffer)) {
+        buffer->mFirstWriteTime = GetTickCount();
+    }
+    if (!buffer->mRuns.empty() && buffer->mRuns.back().mFile == fp && !buffer->mRuns.back().mClose) {
+        buffer->mRuns.back().mSize += size;
+    } else {
+        buffer->mRuns.push_back({ fp, (size_t) size, false });
+    }
+    buffer->mSize += size;
+}
+
+void WriteFormatted(Pipeline* pipeline, FILE* fp, char const* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    auto size = (size_t) _vscprintf(format, args);
+    va_end(args);
+
+    auto dst = BeginWrite(pipeline, size + 1);
+
+    va_start(args, format);
+    vsprintf_s(dst, size + 1, format, args);
+    va_end(args);
+
+    EndWrite(pipeline, fp, dst + size);
+}
+
+// Closes fp once everything written to it so far has been written.
+void CloseFileAfterWrites(Pipeline* pipeline, FILE* fp)
+{
+    auto buffer = &pipeline->mWriteBuffers[pipeline->mAppendWriteBuffer];
+    if (IsEmpty(buffer)) {
+        buffer->mFirstWriteTime = GetTickCount();
+    }
+    if (!buffer->mRuns.empty() && buffer->mRuns.back().mFile == fp) {
+        buffer->mRuns.back().mClose = true;
+    } else {
+        buffer->mRuns.push_back({ fp, 0, true });
+    }
+}
+
+// Deletes path once everything written so far has been written, including
+// the close of any file opened on it.
+void DeleteFileAfterWrites(Pipeline* pipeline, char const* path)
+{
+    auto buffer = &pipeline->mWriteBuffers[pipeline->mAppendWriteBuffer];
+    if (IsEmpty(buffer)) {
+        buffer->mFirstWriteTime = GetTickCount();
+    }
+    buffer->mDeletePaths.emplace_back(path);
+}
+
+// Hands the output appended so far to WriterThread if it's been waiting for
+// WRITE_FLUSH_MILLISECONDS (or if force is true).
+void FlushWrites(Pipeline* pipeline, bool force)
+{
+    auto buffer = &pipeline->mWriteBuffers[pipeline->mAppendWriteBuffer];
+    if (!IsEmpty(buffer) && (force || GetTickCount() - buffer->mFirstWriteTime >= WRITE_FLUSH_MILLISECONDS)) {
+        QueueWriteBuffer(pipeline);
+    }
+}
+
+void StartWriterThread(Pipeline* pipeline)
+{
+    InitializeCriticalSection(&pipeline->mWriterCS);
+    InitializeConditionVariable(&pipeline->mWriteBufferQueued);
+    InitializeConditionVariable(&pipeline->mWriteBufferFree);
+
+    pipeline->mWriterThread = std::thread(Write, pipeline);
+}
+
+// Writes all the remaining output, and reports how much output was written
+// and how much OutputThread had to wait for it.
+void StopWriterThread(Pipeline* pipeline)
+{
+    if (!pipeline->mWriterThread.joinable()) {
+        return;
+    }
+
+    FlushWrites(pipeline, true);
+
+    EnterCriticalSection(&pipeline->mWriterCS);
+    pipeline->mWriterQuit = true;
+    LeaveCriticalSection(&pipeline->mWriterCS);
+    WakeConditionVariable(&pipeline->mWriteBufferQueued);
+
+    pipeline->mWriterThread.join();
+
+    DeleteCriticalSection(&pipeline->mWriterCS);
+
+    if (pipeline->mWriteBufferCount > 0) {
+        LARGE_INTEGER qpcFrequency = {};
+        QueryPerformanceFrequency(&qpcFrequency);
+
+        fprintf(stderr, "%s%sWrote %.1f MB of CSV output in %llu buffers; up to %u of %u buffers were queued, and output waited %.3f seconds for them to be written.\n",
+            pipeline->mBatch ? pipeline->mEtlFileName : "",
+            pipeline->mBatch ? ": " : "",
+            pipeline->mWriteByteCount / (1024.0 * 1024.0),
+            pipeline->mWriteBufferCount,
+            pipeline->mMaxQueuedWriteBufferCount,
+            Pipeline::WRITE_BUFFER_COUNT,
+            (double) pipeline->mWriteStallQpc / qpcFrequency.QuadPart);
+    }
+}
@@ -0,0 +1,204 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include "../../PresentData/CaptureFile.hpp"
+#include "../../PresentData/MixedRealityTraceConsumer.hpp"
+#include "../../PresentData/PresentMonTraceConsumer.hpp"
+#include "../../PresentData/TraceSession.hpp"
+#include "../../PresentData/EventMetadataEventStructs.hpp"
+
+#include <initializer_list>
+#include <string>
+#include <tdh.h>
+
+// Synthetic event streams are written to a capture file, and replayed with
+// TraceSession::Start() and ProcessEtlFile(), so every event goes through the
+// same EventRecordCallback() dispatch as it would in PresentMon.
+//
+// The capture also holds an EventInfo event describing each handled event,
+// as ETL files do, so the replay doesn't depend on which manifests are
+// installed.
+
+template<typename EventT>
+EVENT_DESCRIPTOR GetEventDescriptor()
+{
+    EVENT_DESCRIPTOR desc = {};
+    desc.Id      = EventT::Id;
+    desc.Version = EventT::Version;
+    desc.Channel = EventT::Channel;
+    desc.Level   = EventT::Level;
+    desc.Opcode  = EventT::Opcode;
+    desc.Task    = EventT::Task;
+    desc.Keyword = (ULONGLONG) EventT::Keyword;
+    return desc;
+}
+
+inline EVENT_DESCRIPTOR GetEventDescriptor(uint16_t id)
+{
+    EVENT_DESCRIPTOR desc = {};
+    desc.Id = id;
+    return desc;
+}
+
+struct EventInfoProperty {
+    wchar_t const* mName;
+    USHORT mInType;
+    USHORT mLength;
+};
+
+// Returns the TRACE_EVENT_INFO that an EventInfo event carries, describing an
+// event's task name (optional) and top-level properties.
+inline std::vector<uint8_t> MakeTraceEventInfo(GUID const& providerId, EVENT_DESCRIPTOR const& desc, std::initializer_list<EventInfoProperty> properties,
+                                               wchar_t const* taskName = nullptr)
+{
+    auto propertyCount = (uint32_t) properties.size();
+    std::vector<uint8_t> teiData(offsetof(TRACE_EVENT_INFO, EventPropertyInfoArray) + propertyCount * sizeof(EVENT_PROPERTY_INFO), 0);
+
+    uint32_t i = 0;
+    for (auto const& property : properties) {
+        auto nameOffset = (ULONG) teiData.size();
+        auto name = (uint8_t const*) property.mName;
+        teiData.insert(teiData.end(), name, name + (wcslen(property.mName) + 1) * sizeof(wchar_t));
+
+        auto epi = &((TRACE_EVENT_INFO*) teiData.data())->EventPropertyInfoArray[i++];
+        epi->NameOffset = nameOffset;
+        epi->nonStructType.InType = property.mInType;
+        epi->count = 1;
+        epi->length = property.mLength;
+    }
+
+    ULONG taskNameOffset = 0;
+    if (taskName != nullptr) {
+        taskNameOffset = (ULONG) teiData.size();
+        auto name = (uint8_t const*) taskName;
+        teiData.insert(teiData.end(), name, name + (wcslen(taskName) + 1) * sizeof(wchar_t));
+    }
+
+    auto tei = (TRACE_EVENT_INFO*) teiData.data();
+    tei->ProviderGuid = providerId;
+    tei->EventDescriptor = desc;
+    tei->DecodingSource = DecodingSourceXMLFile;
+    tei->TaskNameOffset = taskNameOffset;
+    tei->PropertyCount = propertyCount;
+    tei->TopLevelPropertyCount = propertyCount;
+    return teiData;
+}
+
+struct SyntheticCapture {
+    std::string mPath;
+    CaptureFileWriter mWriter;
+    uint64_t mStartQpc = 0;
+
+    explicit SyntheticCapture(char const* name)
+    {
+        char tempPath[MAX_PATH] = {};
+        GetTempPathA(MAX_PATH, tempPath);
+        mPath = tempPath;
+        mPath += name;
+        mPath += ".pmcapture";
+    }
+
+    ~SyntheticCapture()
+    {
+        DeleteFileA(mPath.c_str());
+    }
+
+    bool Open()
+    {
+        if (!mWriter.Open(mPath.c_str())) {
+            fprintf(stderr, "error: failed to create %s.\n", mPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void WriteEvent(GUID const& providerId, EVENT_DESCRIPTOR const& desc, uint32_t processId, uint32_t threadId, uint64_t qpcTime,
+                    void const* userData, size_t userDataLength)
+    {
+        if (mStartQpc == 0) {
+            mStartQpc = qpcTime;
+        }
+
+        EVENT_RECORD eventRecord = {};
+        eventRecord.EventHeader.Flags = EVENT_HEADER_FLAG_64_BIT_HEADER;
+        eventRecord.EventHeader.ProcessId = processId;
+        eventRecord.EventHeader.ThreadId = threadId;
+        eventRecord.EventHeader.TimeStamp.QuadPart = (LONGLONG) qpcTime;
+        eventRecord.EventHeader.ProviderId = providerId;
+        eventRecord.EventHeader.EventDescriptor = desc;
+        eventRecord.UserData = (void*) userData;
+        eventRecord.UserDataLength = (USHORT) userDataLength;
+        mWriter.WriteEvent(&eventRecord);
+    }
+
+    template<typename EventT, typename StructT>
+    void WriteEvent(GUID const& providerId, uint32_t processId, uint32_t threadId, uint64_t qpcTime, StructT const& data)
+    {
+        WriteEvent(providerId, GetEventDescriptor<EventT>(), processId, threadId, qpcTime, &data, sizeof(data));
+    }
+
+    // Writes the EventInfo event describing an event's task name (optional)
+    // and top-level properties.
+    void WriteEventInfo(GUID const& providerId, EVENT_DESCRIPTOR const& desc, uint64_t qpcTime, std::initializer_list<EventInfoProperty> properties,
+                        wchar_t const* taskName = nullptr)
+    {
+        auto teiData = MakeTraceEventInfo(providerId, desc, properties, taskName);
+        WriteEvent(Microsoft_Windows_EventMetadata::GUID, GetEventDescriptor<Microsoft_Windows_EventMetadata::EventInfo>(), 0, 0, qpcTime,
+                   teiData.data(), teiData.size());
+    }
+
+    void Close(uint64_t qpcFrequency)
+    {
+        mWriter.Close(qpcFrequency, mStartQpc, 0, 0);
+    }
+
+    // Replays the capture through a session, and returns the number of
+    // events read and the time it took.  Completed presents and LSRs are
+    // dropped instead of being dequeued.
+    bool Replay(PMTraceConsumer* pmConsumer, MRTraceConsumer* mrConsumer, uint64_t* eventCount, double* seconds)
+    {
+        TraceSession session;
+        auto status = session.Start(pmConsumer, mrConsumer, mPath.c_str(), 0, "PresentDataBench");
+        if (status != ERROR_SUCCESS || !session.IsReadingFile()) {
+            fprintf(stderr, "error: failed to open %s (error=%lu).\n", mPath.c_str(), status);
+            session.Stop();
+            return false;
+        }
+
+        pmConsumer->mWaitForOutput = false;
+        if (mrConsumer != nullptr) {
+            mrConsumer->mWaitForOutput = false;
+        }
+
+        session.ProcessEtlFile();
+        session.Stop();
+
+        // TraceSession leaves its reader to be freed at exit.
+        delete session.mCaptureFileReader;
+        delete session.mEtlFileReader;
+
+        *eventCount = session.mEtlDecodedEventCount;
+        *seconds = session.mEtlProcessingSeconds;
+        return true;
+    }
+};
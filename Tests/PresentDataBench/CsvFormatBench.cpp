@@ -0,0 +1,163 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataBench.hpp"
+
+#include "../../PresentMon/CsvFormat.hpp"
+
+#include <string>
+#include <vector>
+#include <windows.h>
+
+// Writes the rows of a default-verbosity CSV, once with a fprintf() per
+// field group (as PresentMon used to) and once with the CsvFormat.hpp
+// Append*() functions into a write buffer (as CsvOutput.cpp and
+// WriterThread.cpp do), to measure CSV rows per second.
+
+namespace {
+
+enum {
+    ROW_COUNT = 2000000,
+    QPC_FREQUENCY = 10000000,
+    QPC_PER_FRAME = QPC_FREQUENCY / 60,
+    WRITE_BUFFER_SIZE = 64 * 1024,
+    ROW_MAX_SIZE = 1024,
+};
+
+struct CsvRow {
+    uint64_t mTimeInSeconds;                    // QPC ticks since the start of the capture
+    uint64_t mBetweenPresents;                  // The rest are QPC durations
+    uint64_t mBetweenDisplayChange;
+    uint64_t mInPresentAPI;
+    uint64_t mUntilRenderComplete;
+    uint64_t mUntilDisplayed;
+};
+
+char const APPLICATION[] = "Game.exe";
+
+std::vector<CsvRow> MakeRows()
+{
+    std::vector<CsvRow> rows(ROW_COUNT);
+    uint64_t qpc = 123456789;
+    uint32_t noise = 1;
+    for (auto& row : rows) {
+        noise = noise * 1664525u + 1013904223u;
+        auto betweenPresents = QPC_PER_FRAME - 1000 + (noise >> 20);
+        qpc += betweenPresents;
+        row.mTimeInSeconds        = qpc;
+        row.mBetweenPresents      = betweenPresents;
+        row.mBetweenDisplayChange = betweenPresents + (noise & 7);
+        row.mInPresentAPI         = 1234 + (noise & 1023);
+        row.mUntilRenderComplete  = 40000 + (noise & 4095);
+        row.mUntilDisplayed       = 160000 + (noise & 8191);
+    }
+    return rows;
+}
+
+std::string GetTempCsvPath(char const* name)
+{
+    char tempPath[MAX_PATH] = {};
+    GetTempPathA(MAX_PATH, tempPath);
+    return std::string(tempPath) + name + ".csv";
+}
+
+double ToSeconds(uint64_t qpcDelta)
+{
+    return (double) qpcDelta / QPC_FREQUENCY;
+}
+
+void WriteRowsFprintf(FILE* fp, std::vector<CsvRow> const& rows)
+{
+    for (auto const& row : rows) {
+        fprintf(fp, "%s,%d,0x%016llX,%s,%d,%d", APPLICATION, 1234, 0x1234567890ull, "DXGI", 1, 0);
+        fprintf(fp, ",%d,%s", 0, "Hardware: Independent Flip");
+        fprintf(fp, ",%s,%.6lf,%.3lf", "0", ToSeconds(row.mTimeInSeconds), 1000.0 * ToSeconds(row.mBetweenPresents));
+        fprintf(fp, ",%.3lf", 1000.0 * ToSeconds(row.mBetweenDisplayChange));
+        fprintf(fp, ",%.3lf", 1000.0 * ToSeconds(row.mInPresentAPI));
+        fprintf(fp, ",%.3lf,%.3lf", 1000.0 * ToSeconds(row.mUntilRenderComplete), 1000.0 * ToSeconds(row.mUntilDisplayed));
+        fprintf(fp, "\n");
+    }
+}
+
+void WriteRowsAppend(FILE* fp, std::vector<CsvRow> const& rows)
+{
+    std::vector<char> buffer(WRITE_BUFFER_SIZE + ROW_MAX_SIZE);
+    auto end = buffer.data();
+    for (auto const& row : rows) {
+        end = AppendString(end, APPLICATION, sizeof(APPLICATION) - 1);
+        *end++ = ','; end = AppendInt(end, 1234);
+        *end++ = ','; end = AppendHex(end, 0x1234567890ull);
+        *end++ = ','; end = AppendString(end, "DXGI");
+        *end++ = ','; end = AppendInt(end, 1);
+        *end++ = ','; end = AppendInt(end, 0);
+        *end++ = ','; end = AppendInt(end, 0);
+        *end++ = ','; end = AppendString(end, "Hardware: Independent Flip");
+        *end++ = ','; end = AppendString(end, "0");
+        *end++ = ','; end = AppendQpcDelta(end, row.mTimeInSeconds, QPC_FREQUENCY, 6);
+        *end++ = ','; end = AppendQpcDelta(end, row.mBetweenPresents, QPC_FREQUENCY, 3);
+        *end++ = ','; end = AppendQpcDelta(end, row.mBetweenDisplayChange, QPC_FREQUENCY, 3);
+        *end++ = ','; end = AppendQpcDelta(end, row.mInPresentAPI, QPC_FREQUENCY, 3);
+        *end++ = ','; end = AppendQpcDelta(end, row.mUntilRenderComplete, QPC_FREQUENCY, 3);
+        *end++ = ','; end = AppendQpcDelta(end, row.mUntilDisplayed, QPC_FREQUENCY, 3);
+        *end++ = '\n';
+
+        if (end - buffer.data() >= WRITE_BUFFER_SIZE) {
+            _fwrite_nolock(buffer.data(), 1, end - buffer.data(), fp);
+            end = buffer.data();
+        }
+    }
+    _fwrite_nolock(buffer.data(), 1, end - buffer.data(), fp);
+}
+
+void RunCsvRowsBenchmark(char const* name, void (*writeRows)(FILE*, std::vector<CsvRow> const&))
+{
+    auto rows = MakeRows();
+    auto path = GetTempCsvPath(name);
+
+    FILE* fp = nullptr;
+    if (fopen_s(&fp, path.c_str(), "wb") != 0) {
+        fprintf(stderr, "error: failed to create %s.\n", path.c_str());
+        return;
+    }
+
+    auto start = GetBenchmarkSeconds();
+    writeRows(fp, rows);
+    fflush(fp);
+    auto seconds = GetBenchmarkSeconds() - start;
+
+    fclose(fp);
+    DeleteFileA(path.c_str());
+
+    ReportBenchmarkRate("rows", rows.size(), seconds);
+}
+
+}
+
+BENCHMARK(CsvRows_Fprintf)
+{
+    RunCsvRowsBenchmark("PresentDataBench_CsvRowsFprintf", &WriteRowsFprintf);
+}
+
+BENCHMARK(CsvRows_Append)
+{
+    RunCsvRowsBenchmark("PresentDataBench_CsvRowsAppend", &WriteRowsAppend);
+}
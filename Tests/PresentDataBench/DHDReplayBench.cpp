@@ -0,0 +1,252 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataBench.hpp"
+#include "CaptureReplay.hpp"
+
+// Replays a synthetic Windows Mixed Reality capture through MRTraceConsumer:
+// per frame, the app's HolographicFrame events (SpectrumContinuous) and the
+// DHD events of one LSR pass, plus a DHD event that isn't handled.  The
+// consumers find each event's task from the capture's EventInfo events.
+
+namespace {
+
+enum {
+    FRAME_COUNT = 100000,
+    PROCESS_ID = 1000,
+    LSR_PROCESS_ID = 2000,
+    THREAD_ID = 1001,
+    LSR_THREAD_ID = 2001,
+    QPC_FREQUENCY = 10000000,
+    QPC_PER_FRAME = QPC_FREQUENCY / 90,
+};
+
+EVENT_DESCRIPTOR GetMREventDescriptor(uint16_t id, uint16_t task, uint8_t opcode = 0)
+{
+    auto desc = GetEventDescriptor(id);
+    desc.Task = task;
+    desc.Opcode = opcode;
+    return desc;
+}
+
+EVENT_DESCRIPTOR const ACQUIRE_FOR_RENDERING        = GetMREventDescriptor(1, 1);
+EVENT_DESCRIPTOR const RELEASE_FROM_RENDERING       = GetMREventDescriptor(2, 2);
+EVENT_DESCRIPTOR const ACQUIRE_FOR_PRESENTATION     = GetMREventDescriptor(3, 3);
+EVENT_DESCRIPTOR const RELEASE_FROM_PRESENTATION    = GetMREventDescriptor(4, 4);
+EVENT_DESCRIPTOR const BEGIN_LSR_PROCESSING         = GetMREventDescriptor(5, 5);
+EVENT_DESCRIPTOR const LATCHED_INPUT                = GetMREventDescriptor(6, 6);
+EVENT_DESCRIPTOR const ON_TIME_PRESENTATION_TIMING  = GetMREventDescriptor(7, 7);
+EVENT_DESCRIPTOR const UNHANDLED_DHD_EVENT          = GetMREventDescriptor(8, 8);
+EVENT_DESCRIPTOR const HOLOGRAPHIC_FRAME_START      = GetMREventDescriptor(1, 1, EVENT_TRACE_TYPE_START);
+EVENT_DESCRIPTOR const HOLOGRAPHIC_FRAME_STOP       = GetMREventDescriptor(2, 1, EVENT_TRACE_TYPE_STOP);
+EVENT_DESCRIPTOR const GET_NEW_POSE_FOR_REPROJECTION = GetMREventDescriptor(3, 2);
+
+#pragma pack(push)
+#pragma pack(1)
+
+struct ThisPtrData {
+    uint64_t thisPtr;
+};
+
+struct BeginLsrProcessingData {
+    uint64_t SourcePtr;
+    uint8_t NewSourceLatched;
+    float TimeUntilVblankMs;
+    float TimeUntilPhotonsMiddleMs;
+    float PredictionSampleTimeToPhotonsVisibleMs;
+    float MispredictionMs;
+};
+
+struct LatchedInputData {
+    float TimeUntilTopPhotonsMs;
+    float TimeUntilBottomPhotonsMs;
+    uint32_t PresentId;
+};
+
+struct PresentationTimingData {
+    float cpuRenderFrameStartToHeadPoseCallbackStartInMs;
+    float headPoseCallbackDurationInMs;
+    float headPoseCallbackEndToInputLatchInMs;
+    float inputLatchToGpuSubmissionInMs;
+    float gpuSubmissionToGpuStartInMs;
+    float gpuStartToGpuStopInMs;
+    float gpuStopToCopyStartInMs;
+    float copyStartToCopyStopInMs;
+    float copyStopToVsyncInMs;
+    uint8_t frameSubmittedOnSchedule;
+    float threadWakeupToCpuRenderFrameStartInMs;
+    float wakeupErrorInMs;
+};
+
+struct HolographicFrameData {
+    uint8_t isRehydration;
+    uint32_t holographicFrameID;
+};
+
+struct GetNewPoseForReprojectionData {
+    uint32_t holographicFrameId;
+    uint32_t presentId;
+};
+
+#pragma pack(pop)
+
+void WriteEventInfos(SyntheticCapture* capture, uint64_t qpc)
+{
+    auto const& dhd = DHD_PROVIDER_GUID;
+    auto const& spectrum = SPECTRUMCONTINUOUS_PROVIDER_GUID;
+
+    capture->WriteEventInfo(dhd, ACQUIRE_FOR_RENDERING,     qpc, { { L"thisPtr", TDH_INTYPE_POINTER, 8 } }, L"AcquireForRendering");
+    capture->WriteEventInfo(dhd, RELEASE_FROM_RENDERING,    qpc, { { L"thisPtr", TDH_INTYPE_POINTER, 8 } }, L"ReleaseFromRendering");
+    capture->WriteEventInfo(dhd, ACQUIRE_FOR_PRESENTATION,  qpc, { { L"thisPtr", TDH_INTYPE_POINTER, 8 } }, L"AcquireForPresentation");
+    capture->WriteEventInfo(dhd, RELEASE_FROM_PRESENTATION, qpc, { { L"thisPtr", TDH_INTYPE_POINTER, 8 } }, L"ReleaseFromPresentation");
+    capture->WriteEventInfo(dhd, BEGIN_LSR_PROCESSING, qpc, {
+        { L"SourcePtr",                              TDH_INTYPE_POINTER, 8 },
+        { L"NewSourceLatched",                       TDH_INTYPE_UINT8,   1 },
+        { L"TimeUntilVblankMs",                      TDH_INTYPE_FLOAT,   4 },
+        { L"TimeUntilPhotonsMiddleMs",               TDH_INTYPE_FLOAT,   4 },
+        { L"PredictionSampleTimeToPhotonsVisibleMs", TDH_INTYPE_FLOAT,   4 },
+        { L"MispredictionMs",                        TDH_INTYPE_FLOAT,   4 },
+    }, L"LsrThread_BeginLsrProcessing");
+    capture->WriteEventInfo(dhd, LATCHED_INPUT, qpc, {
+        { L"TimeUntilTopPhotonsMs",    TDH_INTYPE_FLOAT,  4 },
+        { L"TimeUntilBottomPhotonsMs", TDH_INTYPE_FLOAT,  4 },
+        { L"PresentId",                TDH_INTYPE_UINT32, 4 },
+    }, L"LsrThread_LatchedInput");
+    capture->WriteEventInfo(dhd, ON_TIME_PRESENTATION_TIMING, qpc, {
+        { L"cpuRenderFrameStartToHeadPoseCallbackStartInMs", TDH_INTYPE_FLOAT, 4 },
+        { L"headPoseCallbackDurationInMs",                   TDH_INTYPE_FLOAT, 4 },
+        { L"headPoseCallbackEndToInputLatchInMs",            TDH_INTYPE_FLOAT, 4 },
+        { L"inputLatchToGpuSubmissionInMs",                  TDH_INTYPE_FLOAT, 4 },
+        { L"gpuSubmissionToGpuStartInMs",                    TDH_INTYPE_FLOAT, 4 },
+        { L"gpuStartToGpuStopInMs",                          TDH_INTYPE_FLOAT, 4 },
+        { L"gpuStopToCopyStartInMs",                         TDH_INTYPE_FLOAT, 4 },
+        { L"copyStartToCopyStopInMs",                        TDH_INTYPE_FLOAT, 4 },
+        { L"copyStopToVsyncInMs",                            TDH_INTYPE_FLOAT, 4 },
+        { L"frameSubmittedOnSchedule",                       TDH_INTYPE_UINT8, 1 },
+        { L"threadWakeupToCpuRenderFrameStartInMs",          TDH_INTYPE_FLOAT, 4 },
+        { L"wakeupErrorInMs",                                TDH_INTYPE_FLOAT, 4 },
+    }, L"OnTimePresentationTiming");
+    capture->WriteEventInfo(dhd, UNHANDLED_DHD_EVENT, qpc, { { L"thisPtr", TDH_INTYPE_POINTER, 8 } }, L"CompositorFrame");
+    capture->WriteEventInfo(spectrum, HOLOGRAPHIC_FRAME_START, qpc, {
+        { L"isRehydration",      TDH_INTYPE_UINT8,  1 },
+        { L"holographicFrameID", TDH_INTYPE_UINT32, 4 },
+    }, L"HolographicFrame");
+    capture->WriteEventInfo(spectrum, HOLOGRAPHIC_FRAME_STOP, qpc, {
+        { L"isRehydration",      TDH_INTYPE_UINT8,  1 },
+        { L"holographicFrameID", TDH_INTYPE_UINT32, 4 },
+    }, L"HolographicFrame");
+    capture->WriteEventInfo(spectrum, GET_NEW_POSE_FOR_REPROJECTION, qpc, {
+        { L"holographicFrameId", TDH_INTYPE_UINT32, 4 },
+        { L"presentId",          TDH_INTYPE_UINT32, 4 },
+    }, L"HolographicFrameMetadata_GetNewPoseForReprojection");
+}
+
+bool WriteDHDCapture(SyntheticCapture* capture)
+{
+    if (!capture->Open()) {
+        return false;
+    }
+
+    auto const& dhd = DHD_PROVIDER_GUID;
+    auto const& spectrum = SPECTRUMCONTINUOUS_PROVIDER_GUID;
+
+    auto qpc = (uint64_t) QPC_FREQUENCY;
+    WriteEventInfos(capture, qpc);
+
+    BeginLsrProcessingData beginLsr = {};
+    beginLsr.NewSourceLatched = 1;
+    beginLsr.TimeUntilVblankMs = 5.f;
+    beginLsr.TimeUntilPhotonsMiddleMs = 12.f;
+    beginLsr.PredictionSampleTimeToPhotonsVisibleMs = 20.f;
+
+    LatchedInputData latchedInput = {};
+    latchedInput.TimeUntilTopPhotonsMs = 10.f;
+    latchedInput.TimeUntilBottomPhotonsMs = 14.f;
+
+    PresentationTimingData timing = {};
+    timing.gpuStartToGpuStopInMs = 1.f;
+    timing.copyStopToVsyncInMs = 2.f;
+    timing.frameSubmittedOnSchedule = 1;
+
+    HolographicFrameData holographicFrame = {};
+    GetNewPoseForReprojectionData newPose = {};
+
+    for (uint32_t frame = 1; frame <= FRAME_COUNT; ++frame, qpc += QPC_PER_FRAME) {
+        ThisPtrData source = { 0x1000 + (frame % 2) * 0x100 };
+
+        // App frame
+        holographicFrame.holographicFrameID = frame;
+        newPose.holographicFrameId = frame;
+        newPose.presentId = frame;
+        capture->WriteEvent(spectrum, HOLOGRAPHIC_FRAME_START,       PROCESS_ID, THREAD_ID, qpc,        &holographicFrame, sizeof(holographicFrame));
+        capture->WriteEvent(dhd,      ACQUIRE_FOR_RENDERING,         PROCESS_ID, THREAD_ID, qpc + 1000, &source, sizeof(source));
+        capture->WriteEvent(dhd,      RELEASE_FROM_RENDERING,        PROCESS_ID, THREAD_ID, qpc + 5000, &source, sizeof(source));
+        capture->WriteEvent(spectrum, GET_NEW_POSE_FOR_REPROJECTION, PROCESS_ID, THREAD_ID, qpc + 5100, &newPose, sizeof(newPose));
+        capture->WriteEvent(spectrum, HOLOGRAPHIC_FRAME_STOP,        PROCESS_ID, THREAD_ID, qpc + 5200, &holographicFrame, sizeof(holographicFrame));
+
+        // LSR pass
+        beginLsr.SourcePtr = source.thisPtr;
+        latchedInput.PresentId = frame;
+        capture->WriteEvent(dhd, BEGIN_LSR_PROCESSING,        LSR_PROCESS_ID, LSR_THREAD_ID, qpc + 6000, &beginLsr, sizeof(beginLsr));
+        capture->WriteEvent(dhd, ACQUIRE_FOR_PRESENTATION,    LSR_PROCESS_ID, LSR_THREAD_ID, qpc + 6100, &source, sizeof(source));
+        capture->WriteEvent(dhd, LATCHED_INPUT,               LSR_PROCESS_ID, LSR_THREAD_ID, qpc + 6200, &latchedInput, sizeof(latchedInput));
+        capture->WriteEvent(dhd, UNHANDLED_DHD_EVENT,         LSR_PROCESS_ID, LSR_THREAD_ID, qpc + 6300, &source, sizeof(source));
+        capture->WriteEvent(dhd, RELEASE_FROM_PRESENTATION,   LSR_PROCESS_ID, LSR_THREAD_ID, qpc + 7000, &source, sizeof(source));
+        capture->WriteEvent(dhd, ON_TIME_PRESENTATION_TIMING, LSR_PROCESS_ID, LSR_THREAD_ID, qpc + 9000, &timing, sizeof(timing));
+    }
+
+    capture->Close(QPC_FREQUENCY);
+    return true;
+}
+
+void RunDHDReplayBenchmark(bool simple)
+{
+    SyntheticCapture capture(simple ? "PresentDataBench_DHDReplaySimple" : "PresentDataBench_DHDReplay");
+    if (!WriteDHDCapture(&capture)) {
+        return;
+    }
+
+    PMTraceConsumer pmConsumer(false, simple);
+    MRTraceConsumer mrConsumer(simple);
+
+    uint64_t eventCount = 0;
+    double seconds = 0.0;
+    if (capture.Replay(&pmConsumer, &mrConsumer, &eventCount, &seconds)) {
+        ReportBenchmarkRate("events", eventCount, seconds);
+
+        std::vector<std::shared_ptr<LateStageReprojectionEvent>> lsrs;
+        mrConsumer.DequeueLSRs(lsrs);
+        printf("    %zu LSRs completed (the rest overflowed the queue)\n", lsrs.size());
+    }
+}
+
+}
+
+BENCHMARK(DHDReplay_Simple)
+{
+    RunDHDReplayBenchmark(true);
+}
+
+BENCHMARK(DHDReplay_Full)
+{
+    RunDHDReplayBenchmark(false);
+}
@@ -0,0 +1,395 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "PresentDataBench.hpp"
+#include "CaptureReplay.hpp"
+
+#include "../PresentDataTests/SyntheticEvent.hpp"
+#include "../../PresentData/D3d9EventStructs.hpp"
+#include "../../PresentData/DxgiEventStructs.hpp"
+#include "../../PresentData/DxgkrnlEventStructs.hpp"
+#include "../../PresentData/Win32kEventStructs.hpp"
+
+#include <limits.h>
+#include <vector>
+#include <windows.h>
+
+// Decodes each event type that the consumers read through a *_Struct
+// layout, reading the fields that the consumer reads three ways:
+//
+//   - EventStructReader, with the struct's offsets checked against the
+//     event's cached EventLayout (as the consumers do);
+//   - EventMetadata::GetEventData(), looking the fields up by name through
+//     the cached EventLayout;
+//   - TdhGetProperty(), looking the fields up by name in the provider's
+//     installed manifest.
+//
+// Each event is a SyntheticEvent, with the metadata of the struct's
+// properties up to the last field read.  TDH can only decode the event if the
+// provider's manifest is installed and describes the same layout; otherwise
+// the TDH lookup is skipped.
+
+namespace {
+
+enum {
+    DECODE_COUNT = 1000000,
+};
+
+#define DECODE_PROPERTY(StructT, field, inType) { EVENT_STRUCT_WIDEN(#field), inType, (USHORT) sizeof(StructT::field) }
+
+template<typename EventT, typename StructT>
+SyntheticEvent MakeDecodeEvent(GUID const& providerId, std::initializer_list<SyntheticEvent::Property> properties)
+{
+    SyntheticEvent event(providerId, GetEventDescriptor<EventT>(), properties);
+    for (size_t i = 0; i < sizeof(StructT); ++i) {
+        event.Append<uint8_t>((uint8_t) (i * 7 + 1));
+    }
+    return event;
+}
+
+void ReportDecodeTime(char const* method, double seconds)
+{
+    printf("    %-20s %6.1f ns/event\n", method, seconds * 1e9 / DECODE_COUNT);
+}
+
+// readStruct(reader) reads the fields with EventStructReader and returns
+// their sum, which the other lookups (of the same fields, by name) must
+// match.
+template<typename ReadStructFn>
+void RunDecodeBenchmark(SyntheticEvent event, std::initializer_list<wchar_t const*> fieldNames, ReadStructFn readStruct)
+{
+    EventMetadata metadata;
+    event.AddTo(&metadata);
+    auto eventRecord = event.GetRecord();
+
+    uint64_t structSum = 0;
+    auto start = GetBenchmarkSeconds();
+    for (uint32_t i = 0; i < DECODE_COUNT; ++i) {
+        EventStructReader reader(&metadata, eventRecord);
+        structSum += readStruct(reader);
+    }
+    auto structSeconds = GetBenchmarkSeconds() - start;
+
+    std::vector<EventDataDesc> desc(fieldNames.size());
+    uint64_t metadataSum = 0;
+    start = GetBenchmarkSeconds();
+    for (uint32_t i = 0; i < DECODE_COUNT; ++i) {
+        size_t j = 0;
+        for (auto name : fieldNames) {
+            desc[j] = {};
+            desc[j].name_ = name;
+            j += 1;
+        }
+        metadata.GetEventData(eventRecord, desc.data(), (uint32_t) desc.size());
+        for (auto const& d : desc) {
+            metadataSum += d.GetData<uint64_t>();
+        }
+    }
+    auto metadataSeconds = GetBenchmarkSeconds() - start;
+
+    ReportBenchmarkRate("events", DECODE_COUNT, structSeconds);
+    ReportDecodeTime("EventStructReader", structSeconds);
+    ReportDecodeTime("GetEventData", metadataSeconds);
+    if (metadataSum != structSum) {
+        printf("    error: GetEventData read different values than EventStructReader\n");
+    }
+
+    // TdhGetProperty() returns the property's bytes, so the value is read
+    // into a zeroed uint64_t as GetData<uint64_t>() does.
+    auto tdhGetProperty = [&](wchar_t const* name, uint64_t* value) {
+        PROPERTY_DATA_DESCRIPTOR pdd = {};
+        pdd.PropertyName = (ULONGLONG) (uintptr_t) name;
+        pdd.ArrayIndex = ULONG_MAX;
+        ULONG size = 0;
+        auto status = TdhGetPropertySize(eventRecord, 0, nullptr, 1, &pdd, &size);
+        if (status == ERROR_SUCCESS) {
+            *value = 0;
+            status = size <= sizeof(*value)
+                ? TdhGetProperty(eventRecord, 0, nullptr, 1, &pdd, size, (PBYTE) value)
+                : ERROR_INVALID_DATA;
+        }
+        return status;
+    };
+
+    uint64_t value = 0;
+    auto status = tdhGetProperty(*fieldNames.begin(), &value);
+    if (status != ERROR_SUCCESS) {
+        printf("    %-20s skipped, the event couldn't be decoded (error=%lu)\n", "TdhGetProperty", status);
+        return;
+    }
+
+    uint64_t tdhSum = 0;
+    start = GetBenchmarkSeconds();
+    for (uint32_t i = 0; i < DECODE_COUNT; ++i) {
+        for (auto name : fieldNames) {
+            tdhGetProperty(name, &value);
+            tdhSum += value;
+        }
+    }
+    ReportDecodeTime("TdhGetProperty", GetBenchmarkSeconds() - start);
+    if (tdhSum != structSum) {
+        printf("    warning: TDH read different values than EventStructReader (the installed manifest's layout may differ)\n");
+    }
+}
+
+}
+
+BENCHMARK(Decode_D3D9_Present_Start)
+{
+    typedef Microsoft_Windows_D3D9::Present_Start_Struct<uint64_t> S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_D3D9::Present_Start, S>(Microsoft_Windows_D3D9::GUID, {
+        DECODE_PROPERTY(S, pSwapchain, TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, Flags,      TDH_INTYPE_UINT32),
+    }), { L"pSwapchain", L"Flags" }, [](EventStructReader& reader) {
+        return EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_D3D9::Present_Start_Struct, pSwapchain) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_D3D9::Present_Start_Struct, Flags);
+    });
+}
+
+BENCHMARK(Decode_D3D9_Present_Stop)
+{
+    typedef Microsoft_Windows_D3D9::Present_Stop_Struct S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_D3D9::Present_Stop, S>(Microsoft_Windows_D3D9::GUID, {
+        DECODE_PROPERTY(S, Result, TDH_INTYPE_UINT32),
+    }), { L"Result" }, [](EventStructReader& reader) {
+        return (uint64_t) EVENT_STRUCT_FIELD(reader, Microsoft_Windows_D3D9::Present_Stop_Struct, Result);
+    });
+}
+
+BENCHMARK(Decode_DXGI_Present_Start)
+{
+    typedef Microsoft_Windows_DXGI::Present_Start_Struct<uint64_t> S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_DXGI::Present_Start, S>(Microsoft_Windows_DXGI::GUID, {
+        DECODE_PROPERTY(S, pIDXGISwapChain, TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, Flags,           TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, SyncInterval,    TDH_INTYPE_UINT32),
+    }), { L"pIDXGISwapChain", L"Flags", L"SyncInterval" }, [](EventStructReader& reader) {
+        return EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DXGI::Present_Start_Struct, pIDXGISwapChain) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DXGI::Present_Start_Struct, Flags) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DXGI::Present_Start_Struct, SyncInterval);
+    });
+}
+
+BENCHMARK(Decode_DXGI_Present_Stop)
+{
+    typedef Microsoft_Windows_DXGI::Present_Stop_Struct S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_DXGI::Present_Stop, S>(Microsoft_Windows_DXGI::GUID, {
+        DECODE_PROPERTY(S, Result, TDH_INTYPE_UINT32),
+    }), { L"Result" }, [](EventStructReader& reader) {
+        return (uint64_t) EVENT_STRUCT_FIELD(reader, Microsoft_Windows_DXGI::Present_Stop_Struct, Result);
+    });
+}
+
+BENCHMARK(Decode_DxgKrnl_Blit_Info)
+{
+    typedef Microsoft_Windows_DxgKrnl::Blit_Info_Struct<uint64_t> S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_DxgKrnl::Blit_Info, S>(Microsoft_Windows_DxgKrnl::GUID, {
+        DECODE_PROPERTY(S, hwnd,                TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, pDmaBuffer,          TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, PresentHistoryToken, TDH_INTYPE_UINT64),
+        DECODE_PROPERTY(S, hSourceAllocation,   TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, hDestAllocation,     TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, bSubmit,             TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, bRedirectedPresent,  TDH_INTYPE_UINT32),
+    }), { L"hwnd", L"bRedirectedPresent" }, [](EventStructReader& reader) {
+        return EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Blit_Info_Struct, hwnd) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Blit_Info_Struct, bRedirectedPresent);
+    });
+}
+
+BENCHMARK(Decode_DxgKrnl_Flip_Info)
+{
+    typedef Microsoft_Windows_DxgKrnl::Flip_Info_Struct<uint64_t> S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_DxgKrnl::Flip_Info, S>(Microsoft_Windows_DxgKrnl::GUID, {
+        DECODE_PROPERTY(S, pDmaBuffer,       TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, VidPnSourceId,    TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FlipToAllocation, TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, FlipInterval,     TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FlipWithNoWait,   TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, MMIOFlip,         TDH_INTYPE_UINT32),
+    }), { L"FlipInterval", L"MMIOFlip" }, [](EventStructReader& reader) {
+        return (uint64_t) EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Flip_Info_Struct, FlipInterval) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Flip_Info_Struct, MMIOFlip);
+    });
+}
+
+BENCHMARK(Decode_DxgKrnl_MMIOFlip_Info)
+{
+    typedef Microsoft_Windows_DxgKrnl::MMIOFlip_Info_Struct<uint64_t> S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_DxgKrnl::MMIOFlip_Info, S>(Microsoft_Windows_DxgKrnl::GUID, {
+        DECODE_PROPERTY(S, pDxgAdapter,             TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, VidPnSourceId,           TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FlipSubmitSequence,      TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FlipToDriverAllocation,  TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, FlipToPhysicalAddress,   TDH_INTYPE_UINT64),
+        DECODE_PROPERTY(S, FlipToSegmentId,         TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FlipPresentId,           TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FlipPhysicalAdapterMask, TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, Flags,                   TDH_INTYPE_UINT32),
+    }), { L"FlipSubmitSequence", L"Flags" }, [](EventStructReader& reader) {
+        return (uint64_t) EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::MMIOFlip_Info_Struct, FlipSubmitSequence) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::MMIOFlip_Info_Struct, Flags);
+    });
+}
+
+BENCHMARK(Decode_DxgKrnl_MMIOFlipMultiPlaneOverlay_Info)
+{
+    typedef Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info_Struct<uint64_t> S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info, S>(Microsoft_Windows_DxgKrnl::GUID, {
+        DECODE_PROPERTY(S, pDxgAdapter,              TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, VidPnSourceId,            TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, LayerIndex,               TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FlipSubmitSequence,       TDH_INTYPE_UINT64),
+        DECODE_PROPERTY(S, FlipToDriverAllocation,   TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, FlipToPhysicalAddress,    TDH_INTYPE_UINT64),
+        DECODE_PROPERTY(S, FlipToSegmentId,          TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FlipPresentId,            TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FlipPhysicalAdapterMask,  TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, SrcRect_left,             TDH_INTYPE_INT32),
+        DECODE_PROPERTY(S, SrcRect_right,            TDH_INTYPE_INT32),
+        DECODE_PROPERTY(S, SrcRect_top,              TDH_INTYPE_INT32),
+        DECODE_PROPERTY(S, SrcRect_bottom,           TDH_INTYPE_INT32),
+        DECODE_PROPERTY(S, DstRect_left,             TDH_INTYPE_INT32),
+        DECODE_PROPERTY(S, DstRect_right,            TDH_INTYPE_INT32),
+        DECODE_PROPERTY(S, DstRect_top,              TDH_INTYPE_INT32),
+        DECODE_PROPERTY(S, DstRect_bottom,           TDH_INTYPE_INT32),
+        DECODE_PROPERTY(S, ClipRect_left,            TDH_INTYPE_INT32),
+        DECODE_PROPERTY(S, ClipRect_right,           TDH_INTYPE_INT32),
+        DECODE_PROPERTY(S, ClipRect_top,             TDH_INTYPE_INT32),
+        DECODE_PROPERTY(S, ClipRect_bottom,          TDH_INTYPE_INT32),
+        DECODE_PROPERTY(S, ColorSpace,               TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FlipEntryStatusAfterFlip, TDH_INTYPE_UINT32),
+    }), { L"FlipSubmitSequence", L"FlipEntryStatusAfterFlip" }, [](EventStructReader& reader) {
+        return EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info_Struct, FlipSubmitSequence) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info_Struct, FlipEntryStatusAfterFlip);
+    });
+}
+
+BENCHMARK(Decode_DxgKrnl_Present_Info)
+{
+    typedef Microsoft_Windows_DxgKrnl::Present_Info_Struct<uint64_t> S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_DxgKrnl::Present_Info, S>(Microsoft_Windows_DxgKrnl::GUID, {
+        DECODE_PROPERTY(S, hContext, TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, hWindow,  TDH_INTYPE_POINTER),
+    }), { L"hWindow" }, [](EventStructReader& reader) {
+        return EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Present_Info_Struct, hWindow);
+    });
+}
+
+BENCHMARK(Decode_DxgKrnl_PresentHistory_Start)
+{
+    typedef Microsoft_Windows_DxgKrnl::PresentHistory_Start_Struct<uint64_t> S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_DxgKrnl::PresentHistory_Start, S>(Microsoft_Windows_DxgKrnl::GUID, {
+        DECODE_PROPERTY(S, hAdapter,  TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, Token,     TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, Model,     TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, TokenSize, TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, TokenData, TDH_INTYPE_UINT64),
+    }), { L"Token", L"TokenData", L"Model" }, [](EventStructReader& reader) {
+        return EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::PresentHistory_Start_Struct, Token) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::PresentHistory_Start_Struct, TokenData) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::PresentHistory_Start_Struct, Model);
+    });
+}
+
+BENCHMARK(Decode_DxgKrnl_PresentHistory_Info)
+{
+    typedef Microsoft_Windows_DxgKrnl::PresentHistory_Info_Struct<uint64_t> S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_DxgKrnl::PresentHistory_Info, S>(Microsoft_Windows_DxgKrnl::GUID, {
+        DECODE_PROPERTY(S, hAdapter, TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, Token,    TDH_INTYPE_POINTER),
+    }), { L"Token" }, [](EventStructReader& reader) {
+        return EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::PresentHistory_Info_Struct, Token);
+    });
+}
+
+BENCHMARK(Decode_DxgKrnl_QueuePacket_Start)
+{
+    typedef Microsoft_Windows_DxgKrnl::QueuePacket_Start_Struct<uint64_t> S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_DxgKrnl::QueuePacket_Start, S>(Microsoft_Windows_DxgKrnl::GUID, {
+        DECODE_PROPERTY(S, hContext,              TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, PacketType,            TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, SubmitSequence,        TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, DmaBufferSize,         TDH_INTYPE_UINT64),
+        DECODE_PROPERTY(S, AllocationListSize,    TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, PatchLocationListSize, TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, bPresent,              TDH_INTYPE_UINT32),
+    }), { L"PacketType", L"SubmitSequence", L"hContext", L"bPresent" }, [](EventStructReader& reader) {
+        return EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::QueuePacket_Start_Struct, PacketType) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::QueuePacket_Start_Struct, SubmitSequence) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::QueuePacket_Start_Struct, hContext) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::QueuePacket_Start_Struct, bPresent);
+    });
+}
+
+BENCHMARK(Decode_DxgKrnl_QueuePacket_Stop)
+{
+    typedef Microsoft_Windows_DxgKrnl::QueuePacket_Stop_Struct<uint64_t> S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_DxgKrnl::QueuePacket_Stop, S>(Microsoft_Windows_DxgKrnl::GUID, {
+        DECODE_PROPERTY(S, hContext,       TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, PacketType,     TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, SubmitSequence, TDH_INTYPE_UINT32),
+    }), { L"SubmitSequence" }, [](EventStructReader& reader) {
+        return (uint64_t) EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::QueuePacket_Stop_Struct, SubmitSequence);
+    });
+}
+
+BENCHMARK(Decode_DxgKrnl_VSyncDPC_Info)
+{
+    typedef Microsoft_Windows_DxgKrnl::VSyncDPC_Info_Struct<uint64_t> S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_DxgKrnl::VSyncDPC_Info, S>(Microsoft_Windows_DxgKrnl::GUID, {
+        DECODE_PROPERTY(S, pDxgAdapter,            TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, VidPnTargetId,          TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, ScannedPhysicalAddress, TDH_INTYPE_UINT64),
+        DECODE_PROPERTY(S, VidPnSourceId,          TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FrameNumber,            TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FrameQPCTime,           TDH_INTYPE_INT64),
+        DECODE_PROPERTY(S, hFlipDevice,            TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, FlipType,               TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FlipFenceId,            TDH_INTYPE_UINT64),
+    }), { L"FlipFenceId" }, [](EventStructReader& reader) {
+        return EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::VSyncDPC_Info_Struct, FlipFenceId);
+    });
+}
+
+BENCHMARK(Decode_Win32k_TokenStateChanged_Info)
+{
+    typedef Microsoft_Windows_Win32k::TokenStateChanged_Info_Struct<uint64_t> S;
+    RunDecodeBenchmark(MakeDecodeEvent<Microsoft_Windows_Win32k::TokenStateChanged_Info, S>(Microsoft_Windows_Win32k::GUID, {
+        DECODE_PROPERTY(S, pCompositionSurfaceObject, TDH_INTYPE_POINTER),
+        DECODE_PROPERTY(S, SwapChainIndex,            TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, PresentCount,              TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, FenceValue,                TDH_INTYPE_UINT64),
+        DECODE_PROPERTY(S, NewState,                  TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, IndependentFlip,           TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, SkipIndependentFlip,       TDH_INTYPE_UINT32),
+        DECODE_PROPERTY(S, CompositionSurfaceLuid,    TDH_INTYPE_UINT64),
+        DECODE_PROPERTY(S, BindId,                    TDH_INTYPE_UINT64),
+    }), { L"CompositionSurfaceLuid", L"PresentCount", L"BindId", L"NewState", L"IndependentFlip" }, [](EventStructReader& reader) {
+        return EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_Win32k::TokenStateChanged_Info_Struct, CompositionSurfaceLuid) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_Win32k::TokenStateChanged_Info_Struct, PresentCount) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_Win32k::TokenStateChanged_Info_Struct, BindId) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_Win32k::TokenStateChanged_Info_Struct, NewState) +
+               EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_Win32k::TokenStateChanged_Info_Struct, IndependentFlip);
+    });
+}
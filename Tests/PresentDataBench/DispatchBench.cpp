@@ -0,0 +1,333 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataBench.hpp"
+#include "CaptureReplay.hpp"
+
+#include "../../PresentData/DxgiEventStructs.hpp"
+#include "../../PresentData/DxgkrnlEventStructs.hpp"
+#include "../../PresentData/Win32kEventStructs.hpp"
+
+// Replays a synthetic capture through EventRecordCallback(), to measure the
+// provider/event id dispatch and the cost of dropping unhandled events.
+//
+// Each frame is a DXGI present plus the events around it that a capture of
+// every provider would have: DxgKrnl events that the consumer doesn't handle
+// (or, with -simple, whose provider isn't handled at all), other DXGI
+// events, and events from a provider that PresentMon doesn't enable.
+//
+// The DxgkHandlers_* benchmarks instead call the consumer's handlers
+// directly, with many presents in flight, to measure the lookups of presents
+// by thread, submit sequence and present history token.
+
+namespace {
+
+enum {
+    FRAME_COUNT = 200000,
+    PROCESS_ID = 1000,
+    THREAD_ID = 1001,
+    QPC_FREQUENCY = 10000000,
+    QPC_PER_FRAME = QPC_FREQUENCY / 60,
+    HANDLER_PRESENT_COUNT = 1000000,
+    HANDLER_IN_FLIGHT_COUNT = 1024,     // Presents in flight at once, one per thread
+    HANDLER_PROCESS_COUNT = 64,
+    HANDLER_OUTPUT_INTERVAL = 256,      // Presents between DequeuePresents() calls
+};
+
+// {6A399AE0-4BC6-4DE9-870B-3657F8947E7E}, e.g. a kernel rundown provider
+GUID const OTHER_PROVIDER_GUID = { 0x6a399ae0, 0x4bc6, 0x4de9, { 0x87, 0x0b, 0x36, 0x57, 0xf8, 0x94, 0x7e, 0x7e } };
+
+// DxgKrnl events that none of the handlers process (DMA packets, etc.)
+uint16_t const UNHANDLED_DXGKRNL_EVENT_IDS[] = { 0x00b1, 0x00b3, 0x00b5, 0x0010, 0x0012, 0x0013 };
+
+// The DXGI provider's Present_Start/Stop events are handled; its other events
+// (e.g., swapchain creation) aren't.
+uint16_t const UNHANDLED_DXGI_EVENT_ID = 0x0001;
+
+bool WriteDispatchCapture(SyntheticCapture* capture, uint64_t* handledEventCount)
+{
+    if (!capture->Open()) {
+        return false;
+    }
+
+    Microsoft_Windows_DXGI::Present_Start_Struct<uint64_t> presentStart = {};
+    presentStart.pIDXGISwapChain = 0x1000;
+    presentStart.SyncInterval = 1;
+
+    Microsoft_Windows_DXGI::Present_Stop_Struct presentStop = {};
+
+    uint64_t payload[4] = {};
+
+    auto qpc = (uint64_t) QPC_FREQUENCY;
+    capture->WriteEventInfo(Microsoft_Windows_DXGI::GUID, GetEventDescriptor<Microsoft_Windows_DXGI::Present_Start>(), qpc, {
+        { L"pIDXGISwapChain", TDH_INTYPE_POINTER, 8 },
+        { L"Flags",           TDH_INTYPE_UINT32,  4 },
+        { L"SyncInterval",    TDH_INTYPE_UINT32,  4 },
+        { L"DirtyRects",      TDH_INTYPE_UINT32,  4 },
+        { L"ScrollRects",     TDH_INTYPE_UINT32,  4 },
+    });
+    capture->WriteEventInfo(Microsoft_Windows_DXGI::GUID, GetEventDescriptor<Microsoft_Windows_DXGI::Present_Stop>(), qpc, {
+        { L"Result", TDH_INTYPE_UINT32, 4 },
+    });
+
+    *handledEventCount = 2;
+    for (uint32_t frame = 0; frame < FRAME_COUNT; ++frame, qpc += QPC_PER_FRAME) {
+        capture->WriteEvent<Microsoft_Windows_DXGI::Present_Start>(Microsoft_Windows_DXGI::GUID, PROCESS_ID, THREAD_ID, qpc, presentStart);
+        capture->WriteEvent(Microsoft_Windows_DXGI::GUID, GetEventDescriptor(UNHANDLED_DXGI_EVENT_ID), PROCESS_ID, THREAD_ID, qpc + 10, payload, sizeof(payload));
+        for (size_t i = 0; i < _countof(UNHANDLED_DXGKRNL_EVENT_IDS); ++i) {
+            capture->WriteEvent(Microsoft_Windows_DxgKrnl::GUID, GetEventDescriptor(UNHANDLED_DXGKRNL_EVENT_IDS[i]), PROCESS_ID, THREAD_ID,
+                                qpc + 20 + i, payload, sizeof(payload));
+        }
+        capture->WriteEvent<Microsoft_Windows_DXGI::Present_Stop>(Microsoft_Windows_DXGI::GUID, PROCESS_ID, THREAD_ID, qpc + 100, presentStop);
+        capture->WriteEvent(OTHER_PROVIDER_GUID, GetEventDescriptor(1), 4, 8, qpc + 200, payload, sizeof(payload));
+        capture->WriteEvent(OTHER_PROVIDER_GUID, GetEventDescriptor(2), 4, 8, qpc + 300, payload, sizeof(payload));
+        *handledEventCount += 2;
+    }
+
+    capture->Close(QPC_FREQUENCY);
+    return true;
+}
+
+EVENT_HEADER MakeHandlerEventHeader(uint32_t present, uint64_t qpcTime)
+{
+    auto threadId = present % HANDLER_IN_FLIGHT_COUNT;
+    EVENT_HEADER hdr = {};
+    hdr.Flags = EVENT_HEADER_FLAG_64_BIT_HEADER;
+    hdr.ProcessId = 1000 + threadId % HANDLER_PROCESS_COUNT;
+    hdr.ThreadId = 2000 + threadId;
+    hdr.TimeStamp.QuadPart = (LONGLONG) qpcTime;
+    return hdr;
+}
+
+void DequeueHandlerPresents(PMTraceConsumer* pmConsumer, uint64_t* completedCount)
+{
+    std::vector<PresentEventPtr> completed;
+    pmConsumer->DequeuePresents(completed);
+    *completedCount += completed.size();
+}
+
+void ReportHandlerBenchmark(uint64_t eventCount, uint64_t completedCount, double seconds)
+{
+    ReportBenchmarkRate("events", eventCount, seconds);
+    printf("    %.1f ns/present, %llu presents completed\n", seconds * 1e9 / HANDLER_PRESENT_COUNT, completedCount);
+}
+
+#pragma pack(push)
+#pragma pack(1)
+
+// TokenCompositionSurfaceObject_Info_Struct plus the DestWidth/DestHeight
+// properties that the consumer also reads.
+struct TokenCompositionSurfaceObjectData {
+    uint64_t pToken;
+    uint64_t pCompositionSurfaceObject;
+    uint32_t SwapChainIndex;
+    uint64_t PresentCount;
+    uint64_t CompositionSurfaceLuid;
+    uint64_t BindId;
+    uint32_t DestWidth;
+    uint32_t DestHeight;
+};
+
+#pragma pack(pop)
+
+void AddEventMetadata(PMTraceConsumer* pmConsumer, std::vector<uint8_t> teiData)
+{
+    EVENT_RECORD eventRecord = {};
+    eventRecord.EventHeader.ProviderId = Microsoft_Windows_EventMetadata::GUID;
+    eventRecord.EventHeader.EventDescriptor = GetEventDescriptor<Microsoft_Windows_EventMetadata::EventInfo>();
+    eventRecord.UserData = teiData.data();
+    eventRecord.UserDataLength = (USHORT) teiData.size();
+    pmConsumer->mMetadata.AddMetadata(&eventRecord);
+}
+
+// Registers the Win32k events' metadata, as a capture's EventInfo events
+// would.
+void AddWin32kMetadata(PMTraceConsumer* pmConsumer)
+{
+    AddEventMetadata(pmConsumer, MakeTraceEventInfo(Microsoft_Windows_Win32k::GUID, GetEventDescriptor<Microsoft_Windows_Win32k::TokenCompositionSurfaceObject_Info>(), {
+        { L"pToken",                    TDH_INTYPE_POINTER, 8 },
+        { L"pCompositionSurfaceObject", TDH_INTYPE_POINTER, 8 },
+        { L"SwapChainIndex",            TDH_INTYPE_UINT32,  4 },
+        { L"PresentCount",              TDH_INTYPE_UINT64,  8 },
+        { L"CompositionSurfaceLuid",    TDH_INTYPE_UINT64,  8 },
+        { L"BindId",                    TDH_INTYPE_UINT64,  8 },
+        { L"DestWidth",                 TDH_INTYPE_UINT32,  4 },
+        { L"DestHeight",                TDH_INTYPE_UINT32,  4 },
+    }));
+    AddEventMetadata(pmConsumer, MakeTraceEventInfo(Microsoft_Windows_Win32k::GUID, GetEventDescriptor<Microsoft_Windows_Win32k::TokenStateChanged_Info>(), {
+        { L"pCompositionSurfaceObject", TDH_INTYPE_POINTER, 8 },
+        { L"SwapChainIndex",            TDH_INTYPE_UINT32,  4 },
+        { L"PresentCount",              TDH_INTYPE_UINT32,  4 },
+        { L"FenceValue",                TDH_INTYPE_UINT64,  8 },
+        { L"NewState",                  TDH_INTYPE_UINT32,  4 },
+        { L"IndependentFlip",           TDH_INTYPE_UINT32,  4 },
+        { L"SkipIndependentFlip",       TDH_INTYPE_UINT32,  4 },
+        { L"CompositionSurfaceLuid",    TDH_INTYPE_UINT64,  8 },
+        { L"BindId",                    TDH_INTYPE_UINT64,  8 },
+    }));
+}
+
+template<typename EventT, typename StructT>
+void HandleWin32kEvent(PMTraceConsumer* pmConsumer, EVENT_HEADER const& hdr, StructT const& data)
+{
+    EVENT_RECORD eventRecord = {};
+    eventRecord.EventHeader = hdr;
+    eventRecord.EventHeader.ProviderId = Microsoft_Windows_Win32k::GUID;
+    eventRecord.EventHeader.EventDescriptor = GetEventDescriptor<EventT>();
+    eventRecord.UserData = (void*) &data;
+    eventRecord.UserDataLength = (USHORT) sizeof(data);
+    pmConsumer->HandleWin32kEvent(&eventRecord);
+}
+
+void RunDispatchBenchmark(bool simple)
+{
+    SyntheticCapture capture(simple ? "PresentDataBench_DispatchSimple" : "PresentDataBench_Dispatch");
+    uint64_t handledEventCount = 0;
+    if (!WriteDispatchCapture(&capture, &handledEventCount)) {
+        return;
+    }
+
+    // Without -simple the presents never complete (there are no DxgKrnl
+    // present events), so they are evicted as PresentMon would.
+    PMTraceConsumer pmConsumer(false, simple);
+    pmConsumer.SetPresentEvictionLimits(QPC_FREQUENCY, 4096);
+
+    uint64_t eventCount = 0;
+    double seconds = 0.0;
+    if (capture.Replay(&pmConsumer, nullptr, &eventCount, &seconds)) {
+        ReportBenchmarkRate("events", eventCount, seconds);
+        printf("    %llu of the events were handled\n", handledEventCount);
+    }
+}
+
+}
+
+BENCHMARK(Dispatch_Simple)
+{
+    RunDispatchBenchmark(true);
+}
+
+BENCHMARK(Dispatch_Full)
+{
+    RunDispatchBenchmark(false);
+}
+
+// Fullscreen (hardware legacy flip) presents: Flip and QueuePacket start
+// each present and add it to mPresentsBySubmitSequence, and the MMIOFlip and
+// VSyncDPC events look it up by submit sequence, the latter completing it
+// HANDLER_IN_FLIGHT_COUNT presents later.
+BENCHMARK(DxgkHandlers_HardwareFlip)
+{
+    PMTraceConsumer pmConsumer(false, false);
+    pmConsumer.mWaitForOutput = false;
+
+    uint64_t completedCount = 0;
+    uint64_t eventCount = 0;
+    auto qpc = (uint64_t) QPC_FREQUENCY;
+    auto start = GetBenchmarkSeconds();
+    for (uint32_t present = 0; present < HANDLER_PRESENT_COUNT + HANDLER_IN_FLIGHT_COUNT; ++present, qpc += 100) {
+        if (present >= HANDLER_IN_FLIGHT_COUNT) {
+            auto completing = present - HANDLER_IN_FLIGHT_COUNT;
+            pmConsumer.HandleDxgkSyncDPC(MakeHandlerEventHeader(completing, qpc), completing + 1);
+            eventCount += 1;
+        }
+        if (present >= HANDLER_IN_FLIGHT_COUNT / 2) {
+            auto ready = present - HANDLER_IN_FLIGHT_COUNT / 2;
+            pmConsumer.HandleDxgkMMIOFlip(MakeHandlerEventHeader(ready, qpc + 10), ready + 1, 0);
+            eventCount += 1;
+        }
+        if (present < HANDLER_PRESENT_COUNT) {
+            auto hdr = MakeHandlerEventHeader(present, qpc + 20);
+            pmConsumer.HandleDxgkFlip(hdr, 1, true);
+            pmConsumer.HandleDxgkQueueSubmit(hdr, DXGKETW_MMIOFLIP_COMMAND_BUFFER, present + 1, 0, false, true);
+            eventCount += 2;
+        }
+        if (present % HANDLER_OUTPUT_INTERVAL == 0) {
+            DequeueHandlerPresents(&pmConsumer, &completedCount);
+        }
+    }
+    DequeueHandlerPresents(&pmConsumer, &completedCount);
+    auto seconds = GetBenchmarkSeconds() - start;
+
+    ReportHandlerBenchmark(eventCount, completedCount, seconds);
+}
+
+// Windowed (composed flip) presents: the Win32k TokenCompositionSurfaceObject
+// event starts each present and adds it to mWin32KPresentHistoryTokens, the
+// DxgKrnl PresentHistory start and info events add and remove it from
+// mDxgKrnlPresentHistoryTokens, and HANDLER_IN_FLIGHT_COUNT presents later
+// the TokenStateChanged events look it up by token through InFrame,
+// Confirmed, Retired and Discarded, which completes it.
+BENCHMARK(DxgkHandlers_ComposedFlip)
+{
+    PMTraceConsumer pmConsumer(false, false);
+    pmConsumer.mWaitForOutput = false;
+    AddWin32kMetadata(&pmConsumer);
+
+    uint32_t const tokenStates[] = {
+        (uint32_t) Microsoft_Windows_Win32k::TokenState::InFrame,
+        (uint32_t) Microsoft_Windows_Win32k::TokenState::Confirmed,
+        (uint32_t) Microsoft_Windows_Win32k::TokenState::Retired,
+        (uint32_t) Microsoft_Windows_Win32k::TokenState::Discarded,
+    };
+
+    TokenCompositionSurfaceObjectData surface = {};
+    surface.DestWidth = 1920;
+    surface.DestHeight = 1080;
+
+    Microsoft_Windows_Win32k::TokenStateChanged_Info_Struct<uint64_t> tokenStateChanged = {};
+
+    uint64_t completedCount = 0;
+    uint64_t eventCount = 0;
+    auto qpc = (uint64_t) QPC_FREQUENCY;
+    auto start = GetBenchmarkSeconds();
+    for (uint32_t present = 0; present < HANDLER_PRESENT_COUNT + HANDLER_IN_FLIGHT_COUNT; ++present, qpc += 100) {
+        if (present >= HANDLER_IN_FLIGHT_COUNT) {
+            auto completing = present - HANDLER_IN_FLIGHT_COUNT;
+            auto hdr = MakeHandlerEventHeader(completing, qpc);
+            tokenStateChanged.PresentCount = completing + 1;
+            tokenStateChanged.CompositionSurfaceLuid = 0x1000 + completing % HANDLER_IN_FLIGHT_COUNT;
+            for (auto tokenState : tokenStates) {
+                tokenStateChanged.NewState = tokenState;
+                HandleWin32kEvent<Microsoft_Windows_Win32k::TokenStateChanged_Info>(&pmConsumer, hdr, tokenStateChanged);
+            }
+            eventCount += _countof(tokenStates);
+        }
+        if (present < HANDLER_PRESENT_COUNT) {
+            auto hdr = MakeHandlerEventHeader(present, qpc + 10);
+            auto token = 0x100000000ull + present;
+            surface.PresentCount = present + 1;
+            surface.CompositionSurfaceLuid = 0x1000 + present % HANDLER_IN_FLIGHT_COUNT;
+            HandleWin32kEvent<Microsoft_Windows_Win32k::TokenCompositionSurfaceObject_Info>(&pmConsumer, hdr, surface);
+            pmConsumer.HandleDxgkSubmitPresentHistoryEventArgs(hdr, token, 0, PresentMode::Composed_Flip);
+            pmConsumer.HandleDxgkPropagatePresentHistoryEventArgs(hdr, token);
+            eventCount += 3;
+        }
+        if (present % HANDLER_OUTPUT_INTERVAL == 0) {
+            DequeueHandlerPresents(&pmConsumer, &completedCount);
+        }
+    }
+    DequeueHandlerPresents(&pmConsumer, &completedCount);
+    auto seconds = GetBenchmarkSeconds() - start;
+
+    ReportHandlerBenchmark(eventCount, completedCount, seconds);
+}
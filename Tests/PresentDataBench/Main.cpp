@@ -0,0 +1,106 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataBench.hpp"
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <windows.h>
+
+namespace {
+
+Benchmark* gFirstBenchmark = nullptr;
+Benchmark** gLastBenchmark = &gFirstBenchmark;
+Benchmark const* gCurrentBenchmark = nullptr;
+std::atomic<uint64_t> gAllocationCount(0);
+
+}
+
+// Count allocations for GetBenchmarkAllocationCount().  The array and sized
+// forms call these.
+void* operator new(size_t size)
+{
+    gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (auto p = malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+Benchmark::Benchmark(char const* name, void (*function)())
+    : mName(name)
+    , mFunction(function)
+    , mNext(nullptr)
+{
+    *gLastBenchmark = this;
+    gLastBenchmark = &mNext;
+}
+
+double GetBenchmarkSeconds()
+{
+    LARGE_INTEGER qpc = {};
+    LARGE_INTEGER frequency = {};
+    QueryPerformanceCounter(&qpc);
+    QueryPerformanceFrequency(&frequency);
+    return (double) qpc.QuadPart / frequency.QuadPart;
+}
+
+uint64_t GetBenchmarkAllocationCount()
+{
+    return gAllocationCount.load(std::memory_order_relaxed);
+}
+
+void ReportBenchmarkRate(char const* unit, uint64_t count, double seconds)
+{
+    printf("%-40s %14.0f %s/s  (%llu %s in %.3f s)\n", gCurrentBenchmark->mName,
+        seconds > 0.0 ? count / seconds : 0.0, unit, count, unit, seconds);
+}
+
+int main(int argc, char** argv)
+{
+    for (auto benchmark = gFirstBenchmark; benchmark != nullptr; benchmark = benchmark->mNext) {
+        if (argc > 1) {
+            bool selected = false;
+            for (int i = 1; i < argc; ++i) {
+                if (strstr(benchmark->mName, argv[i]) != nullptr) {
+                    selected = true;
+                    break;
+                }
+            }
+            if (!selected) {
+                continue;
+            }
+        }
+
+        gCurrentBenchmark = benchmark;
+        benchmark->mFunction();
+    }
+
+    return 0;
+}
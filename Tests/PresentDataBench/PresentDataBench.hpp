@@ -0,0 +1,61 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// A minimal benchmark harness for the PresentData library, in the style of
+// PresentDataTests.  Each BENCHMARK() registers itself at static
+// initialization time, and PresentDataBench.exe runs every registered
+// benchmark (or only those whose names contain a command line argument).
+// A benchmark sets up its input, times the work with GetBenchmarkSeconds(),
+// and reports the rate with ReportBenchmarkRate().  GetBenchmarkAllocationCount()
+// returns how many times operator new has been called, for benchmarks that
+// report allocations.
+//
+// Benchmarks are only meaningful in Release builds.
+//
+//     BENCHMARK(Dispatch_Simple)
+//     {
+//         ...
+//         auto start = GetBenchmarkSeconds();
+//         ...
+//         ReportBenchmarkRate("events", eventCount, GetBenchmarkSeconds() - start);
+//     }
+
+struct Benchmark {
+    char const* mName;
+    void (*mFunction)();
+    Benchmark* mNext;
+
+    Benchmark(char const* name, void (*function)());
+};
+
+double GetBenchmarkSeconds();
+uint64_t GetBenchmarkAllocationCount();
+void ReportBenchmarkRate(char const* unit, uint64_t count, double seconds);
+
+#define BENCHMARK(name) \
+    static void name(); \
+    static Benchmark name##_Benchmark(#name, name); \
+    static void name()
@@ -0,0 +1,161 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "PresentDataBench.hpp"
+
+#include "../../PresentData/PresentMonTraceConsumer.hpp"
+#include "../PresentDataTests/ConsumerReplay.hpp"
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+// Measures the time and heap allocations per present of PresentEvent
+// allocation: first with the allocation lifecycle alone (create, keep in
+// flight, complete, hand to the output thread, release), with
+// PresentEventPool and with std::make_shared; then with presents replayed
+// through PMTraceConsumer (as with -simple).
+//
+// The pool's slabs are allocated with _aligned_malloc(), not operator new, so
+// they aren't counted; there is one per 256 presents, and only until released
+// presents are being reused.
+
+namespace {
+
+enum {
+    PRESENT_COUNT = 2000000,
+    IN_FLIGHT_COUNT = 8,                // Presents in flight at once
+    OUTPUT_BATCH_COUNT = 64,            // Completed presents per output thread dequeue
+    SWAPCHAIN_COUNT = 3,
+};
+
+void ReportPresentCost(uint64_t presentCount, double seconds, uint64_t allocationCount)
+{
+    ReportBenchmarkRate("presents", presentCount, seconds);
+    printf("    %.1f ns/present, %.3f allocations/present\n",
+        seconds * 1e9 / presentCount, (double) allocationCount / presentCount);
+}
+
+// Runs the present lifecycle with createPresent() and completePresent(), and
+// reports its cost.
+template<typename PresentPtr, typename CreateFn, typename CompleteFn>
+void RunPresentLifecycle(CreateFn createPresent, CompleteFn completePresent)
+{
+    std::deque<PresentPtr> inFlight;
+    std::vector<PresentPtr> completed;
+    completed.reserve(OUTPUT_BATCH_COUNT);
+
+    // Warm up, so both run from a steady state.
+    for (uint32_t i = 0; i < IN_FLIGHT_COUNT + OUTPUT_BATCH_COUNT; ++i) {
+        inFlight.emplace_back(createPresent(MakeEventHeader(10, 20, i)));
+    }
+    for (auto& present : inFlight) {
+        completePresent(present);
+    }
+    inFlight.clear();
+
+    auto allocationCount = GetBenchmarkAllocationCount();
+    auto start = GetBenchmarkSeconds();
+    for (uint32_t i = 0; i < PRESENT_COUNT; ++i) {
+        inFlight.emplace_back(createPresent(MakeEventHeader(10, 20, i)));
+        if (inFlight.size() > IN_FLIGHT_COUNT) {
+            completePresent(inFlight.front());
+            completed.emplace_back(std::move(inFlight.front()));
+            inFlight.pop_front();
+            if (completed.size() == OUTPUT_BATCH_COUNT) {
+                completed.clear();
+            }
+        }
+    }
+    for (auto& present : inFlight) {
+        completePresent(present);
+    }
+    inFlight.clear();
+    completed.clear();
+    auto seconds = GetBenchmarkSeconds() - start;
+
+    ReportPresentCost(PRESENT_COUNT, seconds, GetBenchmarkAllocationCount() - allocationCount);
+}
+
+}
+
+BENCHMARK(PresentAlloc_MakeShared)
+{
+    // As the consumer would without the pool: each present and its tracking
+    // state are allocated on the heap, and the tracking state is freed when
+    // the present completes.
+    RunPresentLifecycle<std::shared_ptr<PresentEvent>>(
+        [](EVENT_HEADER const& hdr) {
+            auto present = std::make_shared<PresentEvent>(hdr, Runtime::DXGI);
+            present->Tracking = new PresentTrackingState;
+            return present;
+        },
+        [](std::shared_ptr<PresentEvent> const& present) {
+            present->Completed = true;
+            delete present->Tracking;
+            present->Tracking = nullptr;
+        });
+}
+
+BENCHMARK(PresentAlloc_Pool)
+{
+    PresentEventPool pool;
+    RunPresentLifecycle<PresentEventPtr>(
+        [&pool](EVENT_HEADER const& hdr) {
+            return pool.Create(hdr, Runtime::DXGI);
+        },
+        [&pool](PresentEventPtr const& present) {
+            CompleteUntrackedPresent(&pool, present);
+        });
+}
+
+BENCHMARK(PresentAlloc_ConsumerReplay)
+{
+    PMTraceConsumer consumer(false, true);
+    std::vector<PresentEventPtr> completed;
+
+    auto presentCount = 0u;
+    auto allocationCount = GetBenchmarkAllocationCount();
+    auto start = GetBenchmarkSeconds();
+    uint64_t qpcTime = 1000;
+    for (uint32_t frame = 0; frame < PRESENT_COUNT / SWAPCHAIN_COUNT; ++frame) {
+        for (uint32_t chain = 0; chain < SWAPCHAIN_COUNT; ++chain) {
+            StartRuntimePresent(&consumer, 10 + chain, 20 + chain, qpcTime++, 0x1000 + chain);
+        }
+        for (uint32_t chain = 0; chain < SWAPCHAIN_COUNT; ++chain) {
+            StopRuntimePresent(&consumer, 10 + chain, 20 + chain, qpcTime++);
+        }
+
+        if (frame % (OUTPUT_BATCH_COUNT / SWAPCHAIN_COUNT) == 0) {
+            consumer.DequeuePresents(completed);
+            presentCount += (uint32_t) completed.size();
+            completed.clear();
+        }
+    }
+    consumer.DequeuePresents(completed);
+    presentCount += (uint32_t) completed.size();
+    completed.clear();
+    auto seconds = GetBenchmarkSeconds() - start;
+
+    ReportPresentCost(presentCount, seconds, GetBenchmarkAllocationCount() - allocationCount);
+}
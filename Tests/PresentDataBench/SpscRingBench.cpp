@@ -0,0 +1,143 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "PresentDataBench.hpp"
+
+#include "../../PresentData/SpscRing.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Pushes items from a producer thread to a consumer thread through a
+// SpscRing, as the consumer thread hands completed presents to the output
+// thread, to measure the items per second and the latency from TryPush() to
+// PopAll().  Each item is the QPC time it was pushed at.  Both threads spin
+// instead of sleeping (yielding the processor now and then, in case the other
+// thread is waiting to run on it), so the results are for the ring itself and
+// don't include the output thread's wait for a wakeup.
+//
+// SpscRing_Saturated pushes as fast as it can, so the ring is mostly full and
+// the latency is that of a full ring.  SpscRing_Paced pushes an item every
+// PACED_INTERVAL_NS.
+
+namespace {
+
+enum {
+    ITEM_COUNT = 4000000,
+    PACED_ITEM_COUNT = 1000000,
+    PACED_INTERVAL_NS = 2000,
+    RING_CAPACITY = 4096,
+    SPIN_COUNT_BEFORE_YIELD = 64,
+};
+
+uint64_t GetQpc()
+{
+    LARGE_INTEGER qpc = {};
+    QueryPerformanceCounter(&qpc);
+    return (uint64_t) qpc.QuadPart;
+}
+
+void Spin(uint32_t* spinCount)
+{
+    if (++*spinCount % SPIN_COUNT_BEFORE_YIELD == 0) {
+        SwitchToThread();
+    } else {
+        YieldProcessor();
+    }
+}
+
+void RunSpscRingBenchmark(uint32_t itemCount, uint32_t intervalNs)
+{
+    LARGE_INTEGER qpcFrequency = {};
+    QueryPerformanceFrequency(&qpcFrequency);
+    auto intervalQpc = (uint64_t) intervalNs * qpcFrequency.QuadPart / 1000000000;
+
+    SpscRing<uint64_t> ring(RING_CAPACITY);
+    std::vector<uint64_t> latencies;
+    latencies.reserve(itemCount);
+    std::atomic<bool> consumerReady(false);
+
+    std::thread consumerThread([&]() {
+        std::vector<uint64_t> items;
+        items.reserve(RING_CAPACITY);
+        uint32_t spinCount = 0;
+        consumerReady.store(true, std::memory_order_release);
+        while (latencies.size() < itemCount) {
+            if (!ring.PopAll(&items)) {
+                Spin(&spinCount);
+                continue;
+            }
+            auto now = GetQpc();
+            for (auto pushQpc : items) {
+                latencies.emplace_back(now - pushQpc);
+            }
+            items.clear();
+        }
+    });
+
+    while (!consumerReady.load(std::memory_order_acquire)) {
+        YieldProcessor();
+    }
+
+    auto start = GetBenchmarkSeconds();
+    auto nextQpc = GetQpc();
+    uint32_t spinCount = 0;
+    for (uint32_t i = 0; i < itemCount; ++i) {
+        auto qpc = GetQpc();
+        while (qpc < nextQpc) {
+            Spin(&spinCount);
+            qpc = GetQpc();
+        }
+        nextQpc = qpc + intervalQpc;
+        while (!ring.TryPush(qpc)) {
+            Spin(&spinCount);
+        }
+    }
+    consumerThread.join();
+    auto seconds = GetBenchmarkSeconds() - start;
+
+    ReportBenchmarkRate("items", itemCount, seconds);
+
+    auto toNs = [&](uint64_t qpcDelta) { return 1e9 * qpcDelta / qpcFrequency.QuadPart; };
+    std::sort(latencies.begin(), latencies.end());
+    printf("    push-to-pop latency: p50 %.0f ns, p90 %.0f ns, p99 %.0f ns, p99.9 %.0f ns, max %.0f ns\n",
+        toNs(latencies[latencies.size() / 2]),
+        toNs(latencies[latencies.size() * 9 / 10]),
+        toNs(latencies[latencies.size() * 99 / 100]),
+        toNs(latencies[latencies.size() * 999 / 1000]),
+        toNs(latencies.back()));
+}
+
+}
+
+BENCHMARK(SpscRing_Saturated)
+{
+    RunSpscRingBenchmark(ITEM_COUNT, 0);
+}
+
+BENCHMARK(SpscRing_Paced)
+{
+    RunSpscRingBenchmark(PACED_ITEM_COUNT, PACED_INTERVAL_NS);
+}
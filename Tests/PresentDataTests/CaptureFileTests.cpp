@@ -0,0 +1,239 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataTests.hpp"
+
+#include "../../PresentData/CaptureFile.hpp"
+
+#include <filesystem>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+enum {
+    CAPTURE_EVENT_COUNT = 50000,    // Enough for several blocks
+    RANDOM_EVENT_COUNT = 10,        // Enough for two blocks
+    RANDOM_USER_DATA_SIZE = 60000,
+};
+
+GUID const TEST_PROVIDER_GUID = { 0x5b1c1e0a, 0x3f2d, 0x4c6e, { 0x8a, 0x41, 0x0d, 0x77, 0x2e, 0x9c, 0x60, 0x13 } };
+
+std::string GetTempFilePath(char const* name)
+{
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+// Event i has i % 3 extended data items, the first holding i and the rest
+// holding (i % 5) + 1 bytes, and i % 40 bytes of UserData.
+struct TestEvent {
+    EVENT_RECORD mEventRecord;
+    EVENT_HEADER_EXTENDED_DATA_ITEM mExtendedData[2];
+    uint32_t mExtendedData0;
+    uint8_t mExtendedData1[8];
+    uint8_t mUserData[40];
+
+    explicit TestEvent(uint32_t i)
+    {
+        memset(this, 0, sizeof(*this));
+
+        auto hdr = &mEventRecord.EventHeader;
+        hdr->Flags = EVENT_HEADER_FLAG_64_BIT_HEADER;
+        hdr->ProcessId = 1000 + i % 7;
+        hdr->ThreadId = 2000 + i % 11;
+        hdr->TimeStamp.QuadPart = 100 + 10 * (int64_t) i;
+        hdr->ProviderId = TEST_PROVIDER_GUID;
+        hdr->EventDescriptor.Id = (uint16_t) (i % 100);
+        hdr->EventDescriptor.Opcode = (uint8_t) (i % 3);
+        mEventRecord.BufferContext.ProcessorIndex = (uint16_t) (i % 4);
+
+        mExtendedData0 = i;
+        for (uint8_t j = 0; j < sizeof(mExtendedData1); ++j) {
+            mExtendedData1[j] = (uint8_t) (i + j);
+        }
+        auto extendedDataCount = (uint16_t) (i % 3);
+        for (uint16_t j = 0; j < extendedDataCount; ++j) {
+            mExtendedData[j].ExtType = (uint16_t) (j + 1);
+            mExtendedData[j].Linkage = j + 1 < extendedDataCount ? 1 : 0;
+            mExtendedData[j].DataSize = j == 0 ? (uint16_t) sizeof(mExtendedData0) : (uint16_t) (i % 5 + 1);
+            mExtendedData[j].DataPtr = (uint64_t) (uintptr_t) (j == 0 ? (void*) &mExtendedData0 : (void*) mExtendedData1);
+        }
+        if (extendedDataCount > 0) {
+            hdr->Flags |= EVENT_HEADER_FLAG_EXTENDED_INFO;
+            mEventRecord.ExtendedDataCount = extendedDataCount;
+            mEventRecord.ExtendedData = mExtendedData;
+        }
+
+        for (uint8_t j = 0; j < sizeof(mUserData); ++j) {
+            mUserData[j] = (uint8_t) (i * 3 + j);
+        }
+        mEventRecord.UserDataLength = (uint16_t) (i % sizeof(mUserData));
+        mEventRecord.UserData = mUserData;
+    }
+};
+
+bool MatchesTestEvent(EVENT_RECORD const* actual, uint32_t i)
+{
+    TestEvent expected(i);
+    auto const& e = expected.mEventRecord;
+    auto const& a = *actual;
+    if (a.EventHeader.Flags != e.EventHeader.Flags ||
+        a.EventHeader.ProcessId != e.EventHeader.ProcessId ||
+        a.EventHeader.ThreadId != e.EventHeader.ThreadId ||
+        a.EventHeader.TimeStamp.QuadPart != e.EventHeader.TimeStamp.QuadPart ||
+        memcmp(&a.EventHeader.ProviderId, &e.EventHeader.ProviderId, sizeof(GUID)) != 0 ||
+        memcmp(&a.EventHeader.EventDescriptor, &e.EventHeader.EventDescriptor, sizeof(EVENT_DESCRIPTOR)) != 0 ||
+        a.BufferContext.ProcessorIndex != e.BufferContext.ProcessorIndex ||
+        a.ExtendedDataCount != e.ExtendedDataCount ||
+        a.UserDataLength != e.UserDataLength ||
+        memcmp(a.UserData, e.UserData, e.UserDataLength) != 0) {
+        return false;
+    }
+    for (uint16_t j = 0; j < e.ExtendedDataCount; ++j) {
+        auto const& ai = a.ExtendedData[j];
+        auto const& ei = e.ExtendedData[j];
+        if (ai.ExtType != ei.ExtType ||
+            ai.Linkage != ei.Linkage ||
+            ai.DataSize != ei.DataSize ||
+            memcmp((void const*) (uintptr_t) ai.DataPtr, (void const*) (uintptr_t) ei.DataPtr, ei.DataSize) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+TEST(CaptureFile_RoundTrip)
+{
+    auto path = GetTempFilePath("CaptureFile_RoundTrip.pmcapture");
+
+    CaptureFileWriter writer;
+    CHECK(writer.Open(path.c_str()));
+    auto written = true;
+    for (uint32_t i = 0; i < CAPTURE_EVENT_COUNT; ++i) {
+        TestEvent event(i);
+        written = writer.WriteEvent(&event.mEventRecord) && written;
+    }
+    CHECK(written);
+    CHECK(writer.Close(10000000, 100, 3, 4));
+
+    CaptureFileReader reader;
+    CHECK(reader.Open(path.c_str(), nullptr));
+    CHECK_EQUAL((uint64_t) 10000000, reader.mHeader.mQpcFrequency);
+    CHECK_EQUAL((uint64_t) 100, reader.mHeader.mStartQpc);
+    CHECK_EQUAL((uint64_t) CAPTURE_EVENT_COUNT, reader.mHeader.mEventCount);
+    CHECK_EQUAL((uint32_t) 3, reader.mHeader.mEventsLost);
+    CHECK_EQUAL((uint32_t) 4, reader.mHeader.mBuffersLost);
+
+    uint32_t count = 0;
+    auto matches = true;
+    while (auto eventRecord = reader.NextEvent()) {
+        matches = matches && MatchesTestEvent(eventRecord, count);
+        count += 1;
+    }
+    CHECK_EQUAL((uint32_t) CAPTURE_EVENT_COUNT, count);
+    CHECK(matches);
+
+    reader.Close();
+    std::remove(path.c_str());
+}
+
+TEST(CaptureFile_CompressBlock)
+{
+    // A mostly repetitive block compresses, and decompresses to the
+    // original.  Truncated data is rejected.
+    std::vector<uint8_t> src(100000);
+    for (size_t i = 0; i < src.size(); ++i) {
+        src[i] = (uint8_t) (i % 251 < 200 ? i % 13 : i * 2654435761u >> 24);
+    }
+
+    std::vector<uint8_t> compressed(GetMaxCompressedSize(src.size()));
+    auto compressedSize = CompressBlock(src.data(), src.size(), compressed.data());
+    CHECK(compressedSize < src.size() / 2);
+
+    std::vector<uint8_t> dst(src.size());
+    CHECK(DecompressBlock(compressed.data(), compressedSize, dst.data(), dst.size()));
+    CHECK(dst == src);
+    CHECK(!DecompressBlock(compressed.data(), compressedSize / 2, dst.data(), dst.size()));
+}
+
+TEST(CaptureFile_IncompressibleBlock)
+{
+    // Blocks of random UserData don't compress, so they are stored as is,
+    // and read back unchanged.
+    auto path = GetTempFilePath("CaptureFile_IncompressibleBlock.pmcapture");
+
+    std::mt19937 rng(1);
+    std::vector<std::vector<uint8_t>> userData(RANDOM_EVENT_COUNT, std::vector<uint8_t>(RANDOM_USER_DATA_SIZE));
+    for (auto& data : userData) {
+        for (auto& b : data) {
+            b = (uint8_t) rng();
+        }
+    }
+
+    CaptureFileWriter writer;
+    CHECK(writer.Open(path.c_str()));
+    auto written = true;
+    for (uint32_t i = 0; i < RANDOM_EVENT_COUNT; ++i) {
+        EVENT_RECORD eventRecord = {};
+        eventRecord.EventHeader.Flags = EVENT_HEADER_FLAG_64_BIT_HEADER;
+        eventRecord.EventHeader.TimeStamp.QuadPart = 100 + i;
+        eventRecord.EventHeader.ProviderId = TEST_PROVIDER_GUID;
+        eventRecord.UserDataLength = (uint16_t) RANDOM_USER_DATA_SIZE;
+        eventRecord.UserData = userData[i].data();
+        written = writer.WriteEvent(&eventRecord) && written;
+    }
+    CHECK(written);
+    CHECK(writer.Close(10000000, 100, 0, 0));
+
+    auto fp = fopen(path.c_str(), "rb");
+    CHECK(fp != nullptr);
+    if (fp != nullptr) {
+        CaptureFileHeader header = {};
+        CaptureBlockHeader block = {};
+        CHECK(fread(&header, sizeof(header), 1, fp) == 1);
+        CHECK(fread(&block, sizeof(block), 1, fp) == 1);
+        CHECK(block.mDataSize > 0);
+        CHECK_EQUAL(block.mDataSize, block.mStoredSize);
+        fclose(fp);
+    }
+
+    CaptureFileReader reader;
+    CHECK(reader.Open(path.c_str(), nullptr));
+    uint32_t count = 0;
+    auto matches = true;
+    while (auto eventRecord = reader.NextEvent()) {
+        matches = matches && count < RANDOM_EVENT_COUNT &&
+                  eventRecord->UserDataLength == RANDOM_USER_DATA_SIZE &&
+                  memcmp(eventRecord->UserData, userData[count].data(), RANDOM_USER_DATA_SIZE) == 0;
+        count += 1;
+    }
+    CHECK_EQUAL((uint32_t) RANDOM_EVENT_COUNT, count);
+    CHECK(matches);
+
+    reader.Close();
+    std::remove(path.c_str());
+}
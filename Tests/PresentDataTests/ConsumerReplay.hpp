@@ -0,0 +1,60 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "../../PresentData/PresentMonTraceConsumer.hpp"
+
+// Helpers to replay synthetic event streams through a PMTraceConsumer.
+
+inline EVENT_HEADER MakeEventHeader(uint32_t processId, uint32_t threadId, uint64_t qpcTime)
+{
+    EVENT_HEADER hdr = {};
+    hdr.ProcessId = processId;
+    hdr.ThreadId = threadId;
+    hdr.TimeStamp.QuadPart = (int64_t) qpcTime;
+    return hdr;
+}
+
+// Starts a runtime present on a thread, as DXGI's Present_Start does.
+inline PresentEventPtr StartRuntimePresent(PMTraceConsumer* consumer, uint32_t processId, uint32_t threadId, uint64_t qpcTime, uint64_t swapChainAddress)
+{
+    auto present = consumer->mPresentEventPool.Create(MakeEventHeader(processId, threadId, qpcTime), Runtime::DXGI);
+    present->SwapChainAddress = swapChainAddress;
+    consumer->CreatePresent(present);
+    return present;
+}
+
+// Ends the runtime present on a thread, as DXGI's Present_Stop does.  With
+// -simple, this completes the present.
+inline void StopRuntimePresent(PMTraceConsumer* consumer, uint32_t processId, uint32_t threadId, uint64_t qpcTime)
+{
+    consumer->RuntimePresentStop(MakeEventHeader(processId, threadId, qpcTime), true);
+}
+
+// Marks a present that was never handed to a consumer as completed, so it can
+// be released back to its pool.
+inline void CompleteUntrackedPresent(PresentEventPool* pool, PresentEventPtr const& present)
+{
+    present->Completed = true;
+    pool->ReleaseTracking(present.get());
+}
@@ -0,0 +1,101 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "PresentDataTests.hpp"
+
+#include "../../PresentMon/CsvFormat.hpp"
+
+namespace {
+
+// Checks that AppendQpcDelta() formats exactly like the printf() computation
+// it replaces.
+bool MatchesPrintf(uint64_t qpcDelta, uint64_t qpcFrequency)
+{
+    char expected[CSV_FLOAT_MAX_SIZE] = {};
+    char actual[CSV_FLOAT_MAX_SIZE] = {};
+
+    auto seconds = (double) qpcDelta / (double) qpcFrequency;
+    snprintf(expected, sizeof(expected), "%.6lf", seconds);
+    *AppendQpcDelta(actual, qpcDelta, qpcFrequency, 6) = '\0';
+    if (strcmp(expected, actual) != 0) {
+        return false;
+    }
+
+    snprintf(expected, sizeof(expected), "%.3lf", 1000.0 * seconds);
+    *AppendQpcDelta(actual, qpcDelta, qpcFrequency, 3) = '\0';
+    return strcmp(expected, actual) == 0;
+}
+
+}
+
+TEST(CsvFormat_Integers)
+{
+    char buffer[64] = {};
+
+    *AppendUnsigned(buffer, 0) = '\0';
+    CHECK(strcmp(buffer, "0") == 0);
+    *AppendUnsigned(buffer, UINT64_MAX) = '\0';
+    CHECK(strcmp(buffer, "18446744073709551615") == 0);
+
+    *AppendInt(buffer, 1234) = '\0';
+    CHECK(strcmp(buffer, "1234") == 0);
+    *AppendInt(buffer, INT32_MIN) = '\0';
+    CHECK(strcmp(buffer, "-2147483648") == 0);
+
+    *AppendHex(buffer, 0x1234ABCDull) = '\0';
+    CHECK(strcmp(buffer, "0x000000001234ABCD") == 0);
+
+    *AppendString(AppendString(buffer, "Composed: "), "Flip") = '\0';
+    CHECK(strcmp(buffer, "Composed: Flip") == 0);
+}
+
+TEST(CsvFormat_QpcDeltaMatchesPrintf)
+{
+    // Common QPC frequencies, plus tiny ones where every delta is close to a
+    // rounding boundary.
+    uint64_t const qpcFrequencies[] = { 10000000, 3579545, 2400000000, 1000000, 14318180, 1000, 3, 2, 7 };
+
+    auto matches = true;
+    for (auto qpcFrequency : qpcFrequencies) {
+        uint64_t noise = 1;
+        for (uint32_t i = 0; i < 100000; ++i) {
+            noise = noise * 6364136223846793005ull + 1442695040888963407ull;
+
+            // Mix small deltas (frame times), larger ones (times since the
+            // start of the capture), and ones past the integer arithmetic.
+            uint64_t qpcDelta = 0;
+            switch (i % 4) {
+            case 0: qpcDelta = i; break;
+            case 1: qpcDelta = (noise >> 40); break;
+            case 2: qpcDelta = (noise >> 20); break;
+            case 3: qpcDelta = noise >> (i % 64); break;
+            }
+            matches = matches && MatchesPrintf(qpcDelta, qpcFrequency);
+
+            // The frequency's half-microsecond boundaries.
+            auto boundary = (2 * (uint64_t) i + 1) * qpcFrequency / 2000000;
+            matches = matches && MatchesPrintf(boundary, qpcFrequency) && MatchesPrintf(boundary + 1, qpcFrequency);
+        }
+    }
+    CHECK(matches);
+}
@@ -0,0 +1,357 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataTests.hpp"
+
+#include "../../PresentData/EtlFileReader.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// These tests write a synthetic ETL file: small buffers from several
+// processors, each logging at a different rate, with the buffers stored
+// round-robin so that the file order doesn't match the timestamp order.
+// Some events are state events (kernel process events and event metadata),
+// which Seek() must still return from the buffers it skips.
+
+namespace {
+
+enum {
+    ETL_BUFFER_SIZE = 1024,
+    ETL_BUFFER_HEADER_SIZE = 72,
+    ETL_PROCESSOR_COUNT = 3,
+    ETL_EVENTS_PER_PROCESSOR = 600,
+};
+
+GUID const TEST_PROVIDER_GUID  = { 0x2a2a6b1f, 0x5d44, 0x4b0a, { 0x9d, 0x57, 0x2f, 0x1e, 0x7c, 0x3b, 0x11, 0x90 } };
+GUID const EVENT_METADATA_GUID = { 0xbbccf6c1, 0x6cd1, 0x48c4, { 0x80, 0xff, 0x83, 0x94, 0x82, 0xe3, 0x76, 0x71 } };
+
+enum class SyntheticEventType {
+    Header,         // The TRACE_LOGFILE_HEADER event
+    Provider,       // An EVENT_HEADER event
+    Metadata,       // An EVENT_HEADER event from Microsoft-Windows-EventMetadata
+    Process,        // A kernel process event with a SYSTEM_TRACE_HEADER
+};
+
+struct SyntheticEvent {
+    int64_t mTimeStamp;         // Unique across the file
+    uint16_t mProcessor;
+    SyntheticEventType mType;
+
+    bool IsStateEvent() const { return mType == SyntheticEventType::Metadata || mType == SyntheticEventType::Process; }
+};
+
+struct SyntheticBuffer {
+    std::vector<uint8_t> mData;
+    std::vector<SyntheticEvent> mEvents;
+};
+
+template<typename T>
+void Write(std::vector<uint8_t>* data, size_t offset, T value)
+{
+    memcpy(data->data() + offset, &value, sizeof(T));
+}
+
+// Returns the event's size in the buffer, before alignment.
+uint32_t GetSyntheticEventSize(SyntheticEvent const& e)
+{
+    switch (e.mType) {
+    case SyntheticEventType::Header:  return 32 + 280;
+    case SyntheticEventType::Process: return 32 + 8;
+    default:                          return (uint32_t) sizeof(EVENT_HEADER) + 16;
+    }
+}
+
+void WriteSyntheticEvent(std::vector<uint8_t>* data, size_t offset, SyntheticEvent const& e)
+{
+    auto size = GetSyntheticEventSize(e);
+    switch (e.mType) {
+    case SyntheticEventType::Header:
+    case SyntheticEventType::Process:
+        // SYSTEM_TRACE_HEADER: version, header type, flags, size, hook id,
+        // thread id, process id, timestamp, processor time.
+        Write<uint16_t>(data, offset + 0, 2);
+        (*data)[offset + 2] = 0x02;
+        (*data)[offset + 3] = 0xC0;
+        Write<uint16_t>(data, offset + 4, (uint16_t) size);
+        Write<uint16_t>(data, offset + 6, e.mType == SyntheticEventType::Header ? 0x0000 : 0x0301);
+        Write<int64_t>(data, offset + 16, e.mTimeStamp);
+        if (e.mType == SyntheticEventType::Header) {
+            // TRACE_LOGFILE_HEADER from a 64-bit system using QPC, with a 10
+            // MHz frequency.
+            Write<uint32_t>(data, offset + 32 + 44, 8);
+            Write<uint64_t>(data, offset + 32 + 256, 10000000);
+            Write<uint32_t>(data, offset + 32 + 272, 1);
+        }
+        break;
+
+    default: {
+        EVENT_HEADER hdr = {};
+        hdr.Size = (uint16_t) size;
+        hdr.HeaderType = 0xC013;
+        hdr.Flags = EVENT_HEADER_FLAG_64_BIT_HEADER;
+        hdr.TimeStamp.QuadPart = e.mTimeStamp;
+        hdr.ProviderId = e.mType == SyntheticEventType::Metadata ? EVENT_METADATA_GUID : TEST_PROVIDER_GUID;
+        hdr.EventDescriptor.Id = e.mProcessor;
+        memcpy(data->data() + offset, &hdr, sizeof(hdr));
+        break;
+    }
+    }
+}
+
+struct SyntheticEtl {
+    std::string mPath;
+    std::vector<std::vector<SyntheticBuffer>> mBuffersByProcessor;
+    std::vector<uint8_t> mFileData;
+
+    explicit SyntheticEtl(char const* name)
+    {
+        mPath = (std::filesystem::temp_directory_path() / name).string();
+        mPath += ".etl";
+        std::remove(GetIndexPath().c_str());
+
+        // Processor p logs an event every (p + 1) * ETL_PROCESSOR_COUNT ticks,
+        // offset by p so timestamps are unique.  Every 7th event is a state
+        // event.
+        mBuffersByProcessor.resize(ETL_PROCESSOR_COUNT);
+        for (uint16_t p = 0; p < ETL_PROCESSOR_COUNT; ++p) {
+            std::vector<SyntheticEvent> events;
+            if (p == 0) {
+                events.push_back({ 1, p, SyntheticEventType::Header });
+            }
+            for (int64_t i = 0; i < ETL_EVENTS_PER_PROCESSOR; ++i) {
+                auto type = i % 7 == 3 ? (p == 1 ? SyntheticEventType::Process : SyntheticEventType::Metadata)
+                                       : SyntheticEventType::Provider;
+                events.push_back({ 100 + (i * (p + 1) * ETL_PROCESSOR_COUNT) + p, p, type });
+            }
+            AddBuffers(p, events);
+        }
+
+        // An empty buffer part way through processor 2's buffers.
+        auto& buffers2 = mBuffersByProcessor[2];
+        buffers2.insert(buffers2.begin() + buffers2.size() / 2, MakeBuffer(2, {}));
+
+        // Store the buffers round-robin, last processor first, apart from
+        // the first buffer which must hold the header event.
+        AppendBuffer(mBuffersByProcessor[0][0]);
+        for (size_t i = 0; ; ++i) {
+            auto appended = false;
+            for (int p = ETL_PROCESSOR_COUNT - 1; p >= 0; --p) {
+                if ((p != 0 || i != 0) && i < mBuffersByProcessor[p].size()) {
+                    AppendBuffer(mBuffersByProcessor[p][i]);
+                    appended = true;
+                }
+            }
+            if (!appended) {
+                break;
+            }
+        }
+
+        WriteFile();
+    }
+
+    ~SyntheticEtl()
+    {
+        std::remove(mPath.c_str());
+        std::remove(GetIndexPath().c_str());
+    }
+
+    std::string GetIndexPath() const
+    {
+        return mPath + ".pmidx";
+    }
+
+    static SyntheticBuffer MakeBuffer(uint16_t processor, std::vector<SyntheticEvent> const& events)
+    {
+        SyntheticBuffer buffer;
+        buffer.mData.resize(ETL_BUFFER_SIZE, 0);
+        buffer.mEvents = events;
+
+        size_t offset = ETL_BUFFER_HEADER_SIZE;
+        for (auto const& e : events) {
+            WriteSyntheticEvent(&buffer.mData, offset, e);
+            offset = (offset + GetSyntheticEventSize(e) + 7) & ~(size_t) 7;
+        }
+
+        Write<uint32_t>(&buffer.mData, 0x00, ETL_BUFFER_SIZE);
+        Write<uint32_t>(&buffer.mData, 0x04, (uint32_t) offset);
+        Write<uint16_t>(&buffer.mData, 0x28, processor);
+        return buffer;
+    }
+
+    void AddBuffers(uint16_t processor, std::vector<SyntheticEvent> const& events)
+    {
+        std::vector<SyntheticEvent> bufferEvents;
+        size_t offset = ETL_BUFFER_HEADER_SIZE;
+        for (auto const& e : events) {
+            auto size = (GetSyntheticEventSize(e) + 7) & ~7u;
+            if (offset + size > ETL_BUFFER_SIZE) {
+                mBuffersByProcessor[processor].push_back(MakeBuffer(processor, bufferEvents));
+                bufferEvents.clear();
+                offset = ETL_BUFFER_HEADER_SIZE;
+            }
+            bufferEvents.push_back(e);
+            offset += size;
+        }
+        mBuffersByProcessor[processor].push_back(MakeBuffer(processor, bufferEvents));
+    }
+
+    void AppendBuffer(SyntheticBuffer const& buffer)
+    {
+        mFileData.insert(mFileData.end(), buffer.mData.begin(), buffer.mData.end());
+    }
+
+    void WriteFile() const
+    {
+        auto fp = fopen(mPath.c_str(), "wb");
+        CHECK(fp != nullptr);
+        if (fp != nullptr) {
+            CHECK(fwrite(mFileData.data(), 1, mFileData.size(), fp) == mFileData.size());
+            fclose(fp);
+        }
+    }
+
+    // The events that Seek(timestamp) should return, in timestamp order:
+    // every event from the last buffer of each processor that starts at or
+    // before timestamp onwards, and the state events from the buffers
+    // before it.
+    std::vector<SyntheticEvent> GetExpectedEvents(uint64_t timestamp) const
+    {
+        std::vector<SyntheticEvent> expected;
+        for (auto const& buffers : mBuffersByProcessor) {
+            size_t seekIndex = 0;
+            for (size_t i = 0; i < buffers.size(); ++i) {
+                if (!buffers[i].mEvents.empty() && (uint64_t) buffers[i].mEvents[0].mTimeStamp <= timestamp) {
+                    seekIndex = i;
+                }
+            }
+            for (size_t i = 0; i < buffers.size(); ++i) {
+                for (auto const& e : buffers[i].mEvents) {
+                    if (i >= seekIndex || e.IsStateEvent()) {
+                        expected.push_back(e);
+                    }
+                }
+            }
+        }
+        std::sort(expected.begin(), expected.end(), [](SyntheticEvent const& lhs, SyntheticEvent const& rhs) {
+            return lhs.mTimeStamp < rhs.mTimeStamp;
+        });
+        return expected;
+    }
+};
+
+// Reads the file with EtlFileReader, seeking first if timestamp isn't 0, and
+// checks the events against what the synthetic file should return.
+void CheckRead(SyntheticEtl const& etl, uint32_t decodeThreadCount, uint64_t timestamp, bool expectIndexed)
+{
+    EtlFileReader reader;
+    CHECK(reader.Open(etl.mPath.c_str(), nullptr, decodeThreadCount));
+    if (!reader.IsOpen()) {
+        return;
+    }
+    CHECK_EQUAL(expectIndexed, reader.mIndexed);
+    CHECK_EQUAL((uint64_t) 10000000, reader.mFrequency);
+    CHECK_EQUAL((uint32_t) 8, reader.mPointerSize);
+    CHECK_EQUAL((size_t) ETL_PROCESSOR_COUNT, reader.mStreams.size());
+
+    if (timestamp != 0) {
+        reader.Seek(timestamp);
+    }
+
+    auto expected = etl.GetExpectedEvents(timestamp);
+    size_t count = 0;
+    auto matches = true;
+    while (auto eventRecord = reader.NextEvent()) {
+        if (count < expected.size()) {
+            auto const& e = expected[count];
+            matches = matches &&
+                eventRecord->EventHeader.TimeStamp.QuadPart == e.mTimeStamp &&
+                eventRecord->BufferContext.ProcessorIndex == e.mProcessor;
+        }
+        count += 1;
+    }
+    CHECK_EQUAL(expected.size(), count);
+    CHECK(matches);
+}
+
+}
+
+TEST(EtlFileReader_MergesProcessorBuffers)
+{
+    SyntheticEtl etl("EtlFileReader_MergesProcessorBuffers");
+    CheckRead(etl, 0, 0, false);
+    CheckRead(etl, 2, 0, false);
+
+    // Reading from the start doesn't need the buffer timestamps, so it
+    // doesn't write an index file.
+    auto fp = fopen(etl.GetIndexPath().c_str(), "rb");
+    CHECK(fp == nullptr);
+    if (fp != nullptr) {
+        fclose(fp);
+    }
+}
+
+TEST(EtlFileReader_Seek)
+{
+    SyntheticEtl etl("EtlFileReader_Seek");
+    auto last = etl.GetExpectedEvents(0).back().mTimeStamp;
+
+    // The first seek indexes the file and saves the index; later opens use
+    // it.
+    CheckRead(etl, 0, 2000, false);
+    CheckRead(etl, 0, 2000, true);
+
+    for (uint32_t decodeThreadCount : { 0u, 2u }) {
+        for (uint64_t timestamp : { (uint64_t) 50, (uint64_t) 2000, (uint64_t) last / 2, (uint64_t) last, (uint64_t) last + 10 }) {
+            CheckRead(etl, decodeThreadCount, timestamp, true);
+        }
+    }
+}
+
+TEST(EtlFileReader_SeekIgnoresBadIndexFile)
+{
+    SyntheticEtl etl("EtlFileReader_SeekIgnoresBadIndexFile");
+    CheckRead(etl, 0, 2000, false);
+
+    // An index whose buffer offsets are out of order is ignored, and
+    // replaced by the next seek.
+    auto fp = fopen(etl.GetIndexPath().c_str(), "r+b");
+    CHECK(fp != nullptr);
+    if (fp != nullptr) {
+        uint64_t badOffset = UINT64_MAX;
+        fseek(fp, 40 + (long) sizeof(EtlFileReader::Buffer) * 2, SEEK_SET);
+        fwrite(&badOffset, sizeof(badOffset), 1, fp);
+        fclose(fp);
+    }
+    CheckRead(etl, 0, 2000, false);
+    CheckRead(etl, 0, 2000, true);
+
+    // So is the index of a different version of the ETL file.
+    SyntheticBuffer extra = SyntheticEtl::MakeBuffer(1, {});
+    etl.AppendBuffer(extra);
+    etl.WriteFile();
+    CheckRead(etl, 0, 2000, false);
+}
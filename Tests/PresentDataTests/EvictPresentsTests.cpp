@@ -0,0 +1,141 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataTests.hpp"
+#include "ConsumerReplay.hpp"
+
+#include "../../PresentData/DxgkrnlEventStructs.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// Presents past -max_in_flight are evicted oldest first, across swapchains,
+// and are removed from every container that refers to them.
+TEST(EvictPresents_OverLimit)
+{
+    PMTraceConsumer consumer(false, false);
+    consumer.SetPresentEvictionLimits(0, 8);
+
+    // None of these presents get any kernel events except a queue submit, so
+    // they never complete.
+    std::vector<PresentEventPtr> presents;
+    uint64_t qpcTime = 1000;
+    for (uint32_t i = 0; i < 100; ++i) {
+        auto threadId = 20 + i % 4;
+        presents.emplace_back(StartRuntimePresent(&consumer, 10, threadId, qpcTime++, 0x1000 + i % 3));
+        consumer.HandleDxgkQueueSubmit(MakeEventHeader(10, threadId, qpcTime++), DXGKETW_MMIOFLIP_COMMAND_BUFFER, i + 1, 0, false, true);
+        CHECK(consumer.mInFlightPresentCount <= 8);
+    }
+
+    std::vector<PresentEventPtr> completed;
+    consumer.DequeuePresents(completed);
+    CHECK_EQUAL(92u, (uint32_t) completed.size());
+    for (uint32_t i = 0; i < completed.size(); ++i) {
+        CHECK(completed[i] == presents[i]);
+        CHECK(completed[i]->FinalState == PresentResult::Unknown);
+    }
+
+    uint32_t timedOutCount = 0;
+    uint32_t overLimitCount = 0;
+    consumer.GetEvictedPresentCounts(&timedOutCount, &overLimitCount);
+    CHECK_EQUAL(0u, timedOutCount);
+    CHECK_EQUAL(92u, overLimitCount);
+
+    CHECK_EQUAL(8u, (uint32_t) consumer.mInFlightPresents.size());
+    CHECK_EQUAL(8u, (uint32_t) consumer.mPresentsBySubmitSequence.size());
+    for (auto const& pair : consumer.mPresentByThreadId) {
+        CHECK(!pair.second->Completed);
+    }
+
+    // A late event for an evicted present is ignored.
+    consumer.HandleDxgkSyncDPC(MakeEventHeader(4, 8, qpcTime++), 1);
+    CHECK(presents[0]->FinalState == PresentResult::Unknown);
+}
+
+// Presents are evicted by trace time even if their process stops presenting.
+TEST(EvictPresents_TimeoutWithoutNewPresents)
+{
+    PMTraceConsumer consumer(false, false);
+    consumer.SetPresentEvictionLimits(1000, 0);
+
+    auto a = StartRuntimePresent(&consumer, 10, 20, 100, 0x1000);
+    StopRuntimePresent(&consumer, 10, 20, 110);
+    auto b = StartRuntimePresent(&consumer, 11, 21, 500, 0x2000);
+    StopRuntimePresent(&consumer, 11, 21, 510);
+
+    std::vector<PresentEventPtr> completed;
+    for (uint64_t now = 600; now <= 1100; now += 100) {
+        consumer.EvictTimedOutPresents(now);
+    }
+    CHECK(!consumer.DequeuePresents(completed));
+
+    consumer.EvictTimedOutPresents(1101);
+    CHECK(consumer.DequeuePresents(completed));
+    CHECK_EQUAL(1u, (uint32_t) completed.size());
+    CHECK(completed[0] == a);
+    CHECK(consumer.HasInFlightPresentsBefore(501));
+    CHECK(!consumer.HasInFlightPresentsBefore(500));
+
+    completed.clear();
+    consumer.EvictTimedOutPresents(1501);
+    CHECK(consumer.DequeuePresents(completed));
+    CHECK_EQUAL(1u, (uint32_t) completed.size());
+    CHECK(completed[0] == b);
+    CHECK(consumer.mInFlightPresents.empty());
+    CHECK(consumer.mPresentsByProcessAndSwapChain.empty());
+    CHECK(!consumer.HasInFlightPresentsBefore(UINT64_MAX));
+
+    uint32_t timedOutCount = 0;
+    uint32_t overLimitCount = 0;
+    consumer.GetEvictedPresentCounts(&timedOutCount, &overLimitCount);
+    CHECK_EQUAL(2u, timedOutCount);
+    CHECK_EQUAL(0u, overLimitCount);
+}
+
+// Presents handed off to DWM are evicted if DWM never presents, and don't
+// build up in mPresentsWaitingForDWM.
+TEST(EvictPresents_WaitingForDWM)
+{
+    PMTraceConsumer consumer(false, false);
+    consumer.SetPresentEvictionLimits(0, 8);
+
+    uint64_t qpcTime = 1000;
+    size_t maxWaitingCount = 0;
+    uint32_t completedCount = 0;
+    std::vector<PresentEventPtr> completed;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        auto token = 0x10000ull + i;
+        StartRuntimePresent(&consumer, 10, 20, qpcTime++, 0x1000);
+        consumer.HandleDxgkSubmitPresentHistoryEventArgs(MakeEventHeader(10, 20, qpcTime++), token, 0, PresentMode::Composed_Composition_Atlas);
+        StopRuntimePresent(&consumer, 10, 20, qpcTime++);
+        consumer.HandleDxgkPropagatePresentHistoryEventArgs(MakeEventHeader(4, 8, qpcTime++), token);
+        maxWaitingCount = std::max(maxWaitingCount, consumer.mPresentsWaitingForDWM.size());
+
+        completed.clear();
+        consumer.DequeuePresents(completed);
+        completedCount += (uint32_t) completed.size();
+    }
+
+    CHECK_EQUAL(992u, completedCount);
+    CHECK(maxWaitingCount < 64);
+    CHECK(consumer.mDxgKrnlPresentHistoryTokens.empty());
+}
@@ -0,0 +1,233 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataTests.hpp"
+
+#include "../../PresentData/PresentMonTraceConsumer.hpp"
+
+#include <map>
+#include <memory>
+#include <random>
+#include <tuple>
+#include <vector>
+
+// Checks that map holds exactly the elements in expected.
+template<typename Key, typename Value, typename Hash>
+static void CheckContents(FlatHashMap<Key, Value, Hash>* map, std::map<Key, Value> const& expected)
+{
+    CHECK_EQUAL(expected.size(), map->size());
+    CHECK_EQUAL(expected.empty(), map->empty());
+
+    size_t iteratedCount = 0;
+    for (auto ii = map->begin(), ie = map->end(); ii != ie; ++ii) {
+        auto jj = expected.find(ii->first);
+        CHECK(jj != expected.end() && jj->second == ii->second);
+        iteratedCount += 1;
+    }
+    CHECK_EQUAL(expected.size(), iteratedCount);
+
+    for (auto const& pair : expected) {
+        auto ii = map->find(pair.first);
+        CHECK(ii != map->end() && ii->second == pair.second);
+    }
+}
+
+// Random inserts, lookups and erases, compared against std::map.  Keys are
+// drawn from a small range so the table fills with tombstones and keys are
+// frequently reinserted.
+TEST(FlatHashMap_MatchesStdMap)
+{
+    FlatHashMap<uint32_t, uint32_t> map;
+    std::map<uint32_t, uint32_t> expected;
+    std::mt19937 rng(1);
+
+    for (uint32_t i = 0; i < 200000; ++i) {
+        auto key = rng() % 512;
+        switch (rng() % 4) {
+        case 0:
+        case 1: {
+            auto result = map.emplace(key, i);
+            auto expectedResult = expected.emplace(key, i);
+            CHECK_EQUAL(expectedResult.second, result.second);
+            CHECK(result.first->first == key);
+            CHECK(result.first->second == expectedResult.first->second);
+            break;
+        }
+        case 2:
+            CHECK_EQUAL(expected.erase(key), map.erase(key));
+            break;
+        case 3: {
+            auto ii = map.find(key);
+            auto jj = expected.find(key);
+            CHECK_EQUAL(jj == expected.end(), ii == map.end());
+            if (ii != map.end() && jj != expected.end()) {
+                CHECK_EQUAL(jj->second, ii->second);
+                map.erase(ii);
+                expected.erase(jj);
+            }
+            break;
+        }
+        }
+
+        if ((i % 10000) == 0) {
+            CheckContents(&map, expected);
+        }
+    }
+    CheckContents(&map, expected);
+
+    map.clear();
+    expected.clear();
+    CheckContents(&map, expected);
+    CHECK(map.begin() == map.end());
+}
+
+// Keys that differ only in their high bits all hash to nearby slots with the
+// identity hash unless the map mixes them.
+TEST(FlatHashMap_CollidingKeys)
+{
+    FlatHashMap<uint64_t, uint64_t> map;
+    std::map<uint64_t, uint64_t> expected;
+    for (uint64_t i = 0; i < 4096; ++i) {
+        map[i << 40] = i;
+        expected[i << 40] = i;
+        map[i * 4096] = i + 1;
+        expected[i * 4096] = i + 1;
+    }
+    CheckContents(&map, expected);
+
+    for (uint64_t i = 0; i < 4096; i += 2) {
+        CHECK_EQUAL(1u, map.erase(i << 40));
+        expected.erase(i << 40);
+    }
+    CheckContents(&map, expected);
+}
+
+TEST(FlatHashMap_OperatorIndex)
+{
+    FlatHashMap<uint32_t, std::vector<uint32_t>> map;
+    map[5].emplace_back(1);
+    map[5].emplace_back(2);
+    map[7].emplace_back(3);
+    CHECK_EQUAL(2u, map.size());
+    CHECK_EQUAL(2u, map[5].size());
+    CHECK_EQUAL(1u, map[7].size());
+    CHECK(map[9].empty());
+    CHECK_EQUAL(3u, map.size());
+}
+
+// Erasing never moves other elements, so iterators (and references) to them
+// stay valid.  PMTraceConsumer relies on this to erase elements while
+// iterating.
+TEST(FlatHashMap_EraseKeepsIterators)
+{
+    FlatHashMap<uint32_t, uint32_t> map;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        map.emplace(i, i * 3);
+    }
+
+    auto kept = map.find(500);
+    auto keptValue = &kept->second;
+    for (uint32_t i = 0; i < 1000; ++i) {
+        if (i != 500 && (i % 3) != 0) {
+            map.erase(i);
+        }
+    }
+    CHECK(kept == map.find(500));
+    CHECK(keptValue == &kept->second);
+    CHECK_EQUAL(1500u, kept->second);
+
+    // Erase while iterating, visiting each element once.
+    uint32_t visitedCount = 0;
+    for (auto ii = map.begin(); ii != map.end(); ++ii) {
+        visitedCount += 1;
+        if ((ii->first % 2) == 0) {
+            map.erase(ii);
+        }
+    }
+    CHECK_EQUAL(335u, visitedCount);
+    for (auto ii = map.begin(); ii != map.end(); ++ii) {
+        CHECK((ii->first % 2) == 1);
+    }
+    CHECK_EQUAL(167u, map.size());
+}
+
+// Values are destroyed exactly once, whether they're erased, cleared, moved
+// by a rehash, or still in the map when it is destroyed.
+TEST(FlatHashMap_ValueLifetime)
+{
+    auto value = std::make_shared<int>(0);
+    {
+        FlatHashMap<uint32_t, std::shared_ptr<int>> map;
+        for (uint32_t i = 0; i < 100; ++i) {
+            map.emplace(i, value);
+        }
+        CHECK_EQUAL(101, value.use_count());
+
+        for (uint32_t i = 0; i < 50; ++i) {
+            map.erase(i);
+        }
+        CHECK_EQUAL(51, value.use_count());
+
+        for (uint32_t i = 100; i < 1000; ++i) {
+            map.emplace(i, value);
+        }
+        CHECK_EQUAL(951, value.use_count());
+
+        map.clear();
+        CHECK_EQUAL(1, value.use_count());
+
+        for (uint32_t i = 0; i < 10; ++i) {
+            map.emplace(i, value);
+        }
+        CHECK_EQUAL(11, value.use_count());
+    }
+    CHECK_EQUAL(1, value.use_count());
+}
+
+TEST(FlatHashMap_Win32KTokenKeys)
+{
+    typedef PMTraceConsumer::Win32KPresentHistoryTokenKey Key;
+    FlatHashMap<Key, uint32_t, PMTraceConsumer::Win32KPresentHistoryTokenHash> map;
+    std::map<Key, uint32_t> expected;
+
+    // Consecutive present counts on a few composition surfaces, as the
+    // consumer sees them.
+    uint32_t value = 0;
+    for (uint64_t surface = 1; surface <= 4; ++surface) {
+        for (uint64_t presentCount = 0; presentCount < 2000; ++presentCount) {
+            auto key = std::make_tuple(surface * 0x10000, presentCount, (uint64_t) 0);
+            map.emplace(key, value);
+            expected.emplace(key, value);
+            value += 1;
+        }
+    }
+    CheckContents(&map, expected);
+
+    for (uint64_t presentCount = 0; presentCount < 1990; ++presentCount) {
+        for (uint64_t surface = 1; surface <= 4; ++surface) {
+            auto key = std::make_tuple(surface * 0x10000, presentCount, (uint64_t) 0);
+            CHECK_EQUAL(1u, map.erase(key));
+            expected.erase(key);
+        }
+    }
+    CheckContents(&map, expected);
+}
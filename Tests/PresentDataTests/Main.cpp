@@ -0,0 +1,82 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataTests.hpp"
+
+#include <string.h>
+
+namespace {
+
+TestCase* gFirstTestCase = nullptr;
+TestCase** gLastTestCase = &gFirstTestCase;
+uint32_t gCheckFailureCount = 0;
+
+}
+
+TestCase::TestCase(char const* name, void (*function)())
+    : mName(name)
+    , mFunction(function)
+    , mNext(nullptr)
+{
+    *gLastTestCase = this;
+    gLastTestCase = &mNext;
+}
+
+void ReportCheckFailure(char const* file, int line, char const* expression)
+{
+    fprintf(stderr, "%s(%d): check failed: %s\n", file, line, expression);
+    gCheckFailureCount += 1;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t runCount = 0;
+    uint32_t failCount = 0;
+    for (auto test = gFirstTestCase; test != nullptr; test = test->mNext) {
+        if (argc > 1) {
+            bool selected = false;
+            for (int i = 1; i < argc; ++i) {
+                if (strstr(test->mName, argv[i]) != nullptr) {
+                    selected = true;
+                    break;
+                }
+            }
+            if (!selected) {
+                continue;
+            }
+        }
+
+        auto checkFailureCount = gCheckFailureCount;
+        test->mFunction();
+        runCount += 1;
+
+        if (gCheckFailureCount == checkFailureCount) {
+            printf("[  OK  ] %s\n", test->mName);
+        } else {
+            printf("[FAILED] %s\n", test->mName);
+            failCount += 1;
+        }
+    }
+
+    printf("%u/%u tests passed.\n", runCount - failCount, runCount);
+    return failCount == 0 ? 0 : 1;
+}
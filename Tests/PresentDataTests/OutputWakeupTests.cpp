@@ -0,0 +1,89 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataTests.hpp"
+#include "ConsumerReplay.hpp"
+
+// Completes one present on its own swapchain (with -simple, the runtime's
+// Present_Stop completes it).
+static void CompleteOnePresent(PMTraceConsumer* consumer, uint64_t* qpcTime)
+{
+    StartRuntimePresent(consumer, 10, 20, (*qpcTime)++, 0x1000);
+    StopRuntimePresent(consumer, 10, 20, (*qpcTime)++);
+}
+
+static bool IsSignalled(HANDLE handle, DWORD timeoutMilliseconds)
+{
+    return WaitForSingleObject(handle, timeoutMilliseconds) == WAIT_OBJECT_0;
+}
+
+TEST(OutputWakeup_PresentCount)
+{
+    PMTraceConsumer consumer(false, true);
+    consumer.SetOutputWakeup(4, 10000000);
+
+    // The first present is signalled, since there hasn't been a signal for
+    // longer than the interval.
+    uint64_t qpcTime = 1000;
+    CompleteOnePresent(&consumer, &qpcTime);
+    CHECK(IsSignalled(consumer.mCompletedPresentsEvent, 0));
+
+    for (uint32_t i = 0; i < 3; ++i) {
+        CompleteOnePresent(&consumer, &qpcTime);
+        CHECK(!IsSignalled(consumer.mCompletedPresentsEvent, 0));
+    }
+    CompleteOnePresent(&consumer, &qpcTime);
+    CHECK(IsSignalled(consumer.mCompletedPresentsEvent, 0));
+
+    std::vector<PresentEventPtr> completed;
+    consumer.DequeuePresents(completed);
+    CHECK_EQUAL(5u, (uint32_t) completed.size());
+}
+
+// A present that completes within the interval is still output by the end of
+// the interval, even if nothing else completes.
+TEST(OutputWakeup_IntervalWithoutMorePresents)
+{
+    PMTraceConsumer consumer(false, true);
+    consumer.SetOutputWakeup(1000, 20000);
+    CHECK(consumer.mWakeupTimer != NULL);
+
+    uint64_t qpcTime = 1000;
+    CompleteOnePresent(&consumer, &qpcTime);
+    CHECK(IsSignalled(consumer.mCompletedPresentsEvent, 0));
+
+    LARGE_INTEGER start = {};
+    QueryPerformanceCounter(&start);
+    CompleteOnePresent(&consumer, &qpcTime);
+    CHECK(!IsSignalled(consumer.mCompletedPresentsEvent, 0));
+    CHECK(IsSignalled(consumer.mWakeupTimer, 1000));
+
+    LARGE_INTEGER now = {};
+    LARGE_INTEGER qpcFrequency = {};
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&qpcFrequency);
+    CHECK((now.QuadPart - start.QuadPart) * 1000 / qpcFrequency.QuadPart >= 19);
+
+    std::vector<PresentEventPtr> completed;
+    consumer.DequeuePresents(completed);
+    CHECK_EQUAL(2u, (uint32_t) completed.size());
+}
@@ -0,0 +1,63 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// A minimal test harness for the PresentData library.  Each TEST() registers
+// itself at static initialization time, and PresentDataTests.exe runs every
+// registered test (or only those whose names contain a command line
+// argument).  A failed CHECK() is reported and the test continues, so one run
+// reports every failure.
+//
+//     TEST(FlatHashMap_Erase)
+//     {
+//         FlatHashMap<uint32_t, uint32_t> map;
+//         ...
+//         CHECK(map.find(1) == map.end());
+//     }
+
+struct TestCase {
+    char const* mName;
+    void (*mFunction)();
+    TestCase* mNext;
+
+    TestCase(char const* name, void (*function)());
+};
+
+void ReportCheckFailure(char const* file, int line, char const* expression);
+
+#define TEST(name) \
+    static void name(); \
+    static TestCase name##_TestCase(#name, name); \
+    static void name()
+
+#define CHECK(expression) \
+    do { \
+        if (!(expression)) { \
+            ReportCheckFailure(__FILE__, __LINE__, #expression); \
+        } \
+    } while (0)
+
+#define CHECK_EQUAL(expected, actual) CHECK((expected) == (actual))
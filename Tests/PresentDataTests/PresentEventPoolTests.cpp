@@ -0,0 +1,181 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataTests.hpp"
+#include "ConsumerReplay.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+TEST(PresentEventPool_RefCount)
+{
+    PresentEventPool pool;
+
+    auto a = pool.Create(MakeEventHeader(1, 2, 100), Runtime::DXGI);
+    CHECK(a);
+    CHECK(a->Tracking != nullptr);
+    CHECK_EQUAL(100u, a->QpcTime);
+    CHECK_EQUAL(1u, a->ProcessId);
+    CHECK_EQUAL(2u, a->ThreadId);
+
+    PresentEventPtr b(a);
+    CHECK(a == b);
+
+    PresentEventPtr c(std::move(b));
+    CHECK(!b);
+    CHECK(c == a);
+
+    b = c;
+    c = nullptr;
+    CHECK(b == a);
+    CHECK(!c);
+
+    // The present stays allocated until its last handle is released, so a
+    // new present can't reuse its slot.
+    CompleteUntrackedPresent(&pool, a);
+    CHECK(a->Tracking == nullptr);
+    auto raw = a.get();
+    a = nullptr;
+    auto d = pool.Create(MakeEventHeader(1, 2, 200), Runtime::DXGI);
+    CHECK(d.get() != raw);
+    CHECK_EQUAL(100u, b->QpcTime);
+
+    CompleteUntrackedPresent(&pool, d);
+}
+
+// Allocates count presents from pool, and adds their addresses to allocated
+// (sorted).  Returns how many of them were already in allocated.
+static uint32_t AllocatePresents(PresentEventPool* pool, uint32_t count, std::vector<PresentEventPtr>* presents, std::vector<PresentEvent*>* allocated)
+{
+    uint32_t reusedCount = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        auto present = pool->Create(MakeEventHeader(1, 2, i), Runtime::Other);
+        CHECK(present->Tracking != nullptr);
+        CHECK(present->Tracking->DependentPresents.empty());
+        CHECK(!present->Completed);
+        CHECK(present->Runtime == Runtime::Other);
+        CHECK_EQUAL(i, present->QpcTime);
+
+        auto ii = std::lower_bound(allocated->begin(), allocated->end(), present.get());
+        if (ii != allocated->end() && *ii == present.get()) {
+            reusedCount += 1;
+        } else {
+            allocated->insert(ii, present.get());
+        }
+
+        CompleteUntrackedPresent(pool, present);
+        presents->emplace_back(present);
+    }
+    return reusedCount;
+}
+
+TEST(PresentEventPool_ReusesReleasedPresents)
+{
+    PresentEventPool pool;
+    std::vector<PresentEventPtr> presents;
+    std::vector<PresentEvent*> allocated;
+
+    // The first two rounds may use slots left over from the last slab before
+    // reusing released ones.  After that, every slot has been handed out and
+    // released, so later rounds don't allocate any more.
+    AllocatePresents(&pool, 1000, &presents, &allocated);
+    CHECK_EQUAL(1000u, allocated.size());
+    presents.clear();
+    AllocatePresents(&pool, 1000, &presents, &allocated);
+    presents.clear();
+
+    for (uint32_t round = 0; round < 3; ++round) {
+        CHECK_EQUAL(1000u, AllocatePresents(&pool, 1000, &presents, &allocated));
+        presents.clear();
+    }
+}
+
+TEST(PresentEventPool_ReleaseOnOtherThread)
+{
+    PresentEventPool pool;
+    std::vector<PresentEventPtr> presents;
+    std::vector<PresentEvent*> allocated;
+
+    // Presents released by the output thread are reclaimed by the consumer
+    // thread once its private free list runs out.
+    for (uint32_t round = 0; round < 5; ++round) {
+        auto reusedCount = AllocatePresents(&pool, 300, &presents, &allocated);
+        if (round >= 2) {
+            CHECK_EQUAL(300u, reusedCount);
+        }
+
+        std::thread outputThread([&presents]() { presents.clear(); });
+        outputThread.join();
+    }
+}
+
+// Replays presents from several swapchains through the consumer (as with
+// -simple, where the runtime's Present_Stop completes each present), with the
+// output thread releasing completed presents as it goes.  Once the first
+// batch is released, later presents are all allocated from recycled slots.
+TEST(PresentEventPool_ConsumerReplay)
+{
+    PMTraceConsumer consumer(false, true);
+
+    std::vector<PresentEvent*> allocated;
+    std::vector<PresentEventPtr> completed;
+    uint64_t qpcTime = 1000;
+    uint32_t reusedCount = 0;
+    uint32_t completedCount[3] = {};
+    for (uint32_t frame = 0; frame < 2000; ++frame) {
+        for (uint32_t chain = 0; chain < 3; ++chain) {
+            auto present = StartRuntimePresent(&consumer, 10 + chain, 20 + chain, qpcTime++, 0x1000 + chain);
+            if (frame < 100) {
+                allocated.emplace_back(present.get());
+            } else if (std::binary_search(allocated.begin(), allocated.end(), present.get())) {
+                reusedCount += 1;
+            }
+        }
+        for (uint32_t chain = 0; chain < 3; ++chain) {
+            StopRuntimePresent(&consumer, 10 + chain, 20 + chain, qpcTime++);
+        }
+
+        if (frame == 99) {
+            std::sort(allocated.begin(), allocated.end());
+        }
+
+        completed.clear();
+        consumer.DequeuePresents(completed);
+        uint64_t lastQpcTime = 0;
+        for (auto const& present : completed) {
+            CHECK(present->Completed);
+            CHECK(present->Tracking == nullptr);
+            CHECK(present->FinalState == PresentResult::Presented);
+            CHECK(present->QpcTime > lastQpcTime);
+            lastQpcTime = present->QpcTime;
+            completedCount[present->ProcessId - 10] += 1;
+        }
+    }
+    completed.clear();
+
+    CHECK_EQUAL(2000u, completedCount[0]);
+    CHECK_EQUAL(2000u, completedCount[1]);
+    CHECK_EQUAL(2000u, completedCount[2]);
+    CHECK_EQUAL(1900u * 3, reusedCount);
+    CHECK_EQUAL(0u, consumer.mInFlightPresentCount);
+}
@@ -0,0 +1,79 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "PresentDataTests.hpp"
+
+#include "../../PresentData/SharedMetrics.hpp"
+
+#include <vector>
+
+namespace {
+
+// A mapping with two slots, each written the way PresentMon writes them.
+struct TestMapping {
+    std::vector<uint64_t> mView;
+    SharedMetricsHeader* mHeader;
+
+    TestMapping()
+        : mView((sizeof(SharedMetricsHeader) + 2 * sizeof(SharedSwapChainSlot)) / sizeof(uint64_t) + 1, 0)
+        , mHeader((SharedMetricsHeader*) mView.data())
+    {
+        memcpy(mHeader->mMagic, SHARED_METRICS_MAGIC, sizeof(mHeader->mMagic));
+        mHeader->mVersion = SHARED_METRICS_VERSION;
+        mHeader->mHeaderSize = sizeof(SharedMetricsHeader);
+        mHeader->mSlotSize = sizeof(SharedSwapChainSlot);
+        mHeader->mSwapChainCapacity = 2;
+        mHeader->mSwapChainCount = 2;
+    }
+
+    SharedSwapChainSlot* GetSlot(uint32_t index)
+    {
+        return (SharedSwapChainSlot*) GetSharedSwapChainSlot(mHeader, index);
+    }
+};
+
+}
+
+TEST(SharedMetrics_ReadResult)
+{
+    TestMapping mapping;
+    auto header = GetSharedMetricsHeader(mapping.mView.data());
+    CHECK(header == mapping.mHeader);
+
+    mapping.GetSlot(1)->mMetrics.mProcessId = 1234;
+    mapping.GetSlot(1)->mMetrics.mFps = 60.f;
+    mapping.GetSlot(1)->mSequence = 2;
+
+    SharedSwapChainMetrics metrics = {};
+    CHECK(ReadSharedSwapChainMetrics(header, 0, &metrics) == SharedMetricsReadResult::Unused);
+    CHECK(ReadSharedSwapChainMetrics(header, 1, &metrics) == SharedMetricsReadResult::Read);
+    CHECK_EQUAL(1234u, metrics.mProcessId);
+    CHECK_EQUAL(60.f, metrics.mFps);
+
+    // A slot that is left mid-update (as if PresentMon was killed while
+    // writing it) is reported as busy, not unused, whatever it holds.
+    mapping.GetSlot(0)->mSequence = 1;
+    mapping.GetSlot(1)->mSequence = 3;
+    CHECK(ReadSharedSwapChainMetrics(header, 0, &metrics) == SharedMetricsReadResult::Busy);
+    CHECK(ReadSharedSwapChainMetrics(header, 1, &metrics) == SharedMetricsReadResult::Busy);
+}
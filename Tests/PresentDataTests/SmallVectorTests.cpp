@@ -0,0 +1,147 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataTests.hpp"
+#include "ConsumerReplay.hpp"
+
+#include "../../PresentData/DxgkrnlEventStructs.hpp"
+#include "../../PresentData/SmallVector.hpp"
+
+#include <memory>
+
+typedef SmallVector<std::shared_ptr<int>, 4> TestVector;
+
+static void CheckContents(TestVector const& v, int first, size_t count)
+{
+    CHECK_EQUAL(count, v.size());
+    for (size_t i = 0; i < v.size(); ++i) {
+        CHECK_EQUAL(first + (int) i, *v[i]);
+    }
+}
+
+TEST(SmallVector_InlineThenHeap)
+{
+    auto value = std::make_shared<int>(0);
+    {
+        TestVector v;
+        CHECK(v.empty());
+        CHECK_EQUAL((size_t) 4, v.capacity());
+
+        v.emplace_back(value);
+        for (int i = 1; i < 4; ++i) {
+            v.emplace_back(std::make_shared<int>(i));
+        }
+        CHECK_EQUAL((size_t) 4, v.capacity());
+        CheckContents(v, 0, 4);
+
+        for (int i = 4; i < 20; ++i) {
+            v.emplace_back(std::make_shared<int>(i));
+        }
+        CHECK(v.capacity() >= 20);
+        CheckContents(v, 0, 20);
+        CHECK_EQUAL(2l, value.use_count());
+
+        // clear() keeps the heap storage.
+        auto capacity = v.capacity();
+        v.clear();
+        CHECK(v.empty());
+        CHECK_EQUAL(capacity, v.capacity());
+        CHECK_EQUAL(1l, value.use_count());
+
+        v.emplace_back(value);
+    }
+    CHECK_EQUAL(1l, value.use_count());
+}
+
+TEST(SmallVector_MoveAndSwap)
+{
+    TestVector a;
+    TestVector b;
+    for (int i = 0; i < 3; ++i) {
+        a.emplace_back(std::make_shared<int>(i));
+    }
+    for (int i = 10; i < 20; ++i) {
+        b.emplace_back(std::make_shared<int>(i));
+    }
+
+    // Inline and heap elements are swapped both ways.
+    a.swap(b);
+    CheckContents(a, 10, 10);
+    CheckContents(b, 0, 3);
+    CHECK_EQUAL((size_t) 4, b.capacity());
+
+    TestVector c(std::move(a));
+    CHECK(a.empty());
+    CHECK_EQUAL((size_t) 4, a.capacity());
+    CheckContents(c, 10, 10);
+
+    c = std::move(b);
+    CHECK(b.empty());
+    CheckContents(c, 0, 3);
+    CHECK_EQUAL((size_t) 4, c.capacity());
+
+    auto value = c[0];
+    c = TestVector();
+    CHECK(c.empty());
+    CHECK_EQUAL(1l, value.use_count());
+}
+
+// The presents composed by DWM ride along with its fullscreen present, and are
+// completed when it's displayed.  There are more than fit inline.
+TEST(SmallVector_DwmDependentPresents)
+{
+    PMTraceConsumer consumer(false, false);
+
+    uint64_t qpcTime = 1000;
+    std::vector<PresentEventPtr> windowed;
+    for (uint32_t i = 0; i < 6; ++i) {
+        auto token = 0x10000ull + i;
+        windowed.emplace_back(StartRuntimePresent(&consumer, 10 + i, 20 + i, qpcTime++, 0x1000));
+        consumer.HandleDxgkSubmitPresentHistoryEventArgs(MakeEventHeader(10 + i, 20 + i, qpcTime++), token, 0, PresentMode::Composed_Composition_Atlas);
+        StopRuntimePresent(&consumer, 10 + i, 20 + i, qpcTime++);
+        consumer.HandleDxgkPropagatePresentHistoryEventArgs(MakeEventHeader(4, 8, qpcTime++), token);
+    }
+    CHECK_EQUAL((size_t) 6, consumer.mPresentsWaitingForDWM.size());
+
+    consumer.DwmPresentThreadId = 50;
+    auto dwm = StartRuntimePresent(&consumer, 40, 50, qpcTime++, 0x2000);
+    auto hdr = MakeEventHeader(40, 50, qpcTime++);
+    consumer.HandleDxgkFlip(hdr, 1, true);
+    consumer.HandleDxgkQueueSubmit(hdr, DXGKETW_MMIOFLIP_COMMAND_BUFFER, 7, 0, false, true);
+    StopRuntimePresent(&consumer, 40, 50, qpcTime++);
+    CHECK(consumer.mPresentsWaitingForDWM.empty());
+    CHECK_EQUAL((size_t) 6, dwm->Tracking->DependentPresents.size());
+
+    auto screenTime = qpcTime++;
+    consumer.HandleDxgkMMIOFlip(MakeEventHeader(4, 8, screenTime), 7, 0);
+    consumer.HandleDxgkSyncDPC(MakeEventHeader(4, 8, screenTime), 7);
+
+    std::vector<PresentEventPtr> completed;
+    consumer.DequeuePresents(completed);
+    CHECK_EQUAL((size_t) 7, completed.size());
+    for (auto const& p : windowed) {
+        CHECK(p->Completed);
+        CHECK(p->FinalState == PresentResult::Presented);
+        CHECK_EQUAL(screenTime, p->ScreenTime);
+    }
+    CHECK(dwm->Completed);
+}
@@ -0,0 +1,115 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataTests.hpp"
+
+#include "../../PresentData/SpscRing.hpp"
+
+#include <memory>
+#include <thread>
+
+TEST(SpscRing_CapacityAndOverflow)
+{
+    // The capacity is rounded up to a power of two.
+    SpscRing<uint32_t> ring(5);
+    for (uint32_t i = 0; i < 8; ++i) {
+        CHECK(ring.TryPush(i));
+    }
+    CHECK(!ring.TryPush(8));
+    CHECK(!ring.Push(8, false));
+    CHECK(!ring.Push(9, false));
+    CHECK_EQUAL(2ull, ring.OverflowCount());
+
+    std::vector<uint32_t> out;
+    CHECK(ring.PopAll(&out));
+    CHECK_EQUAL(8u, (uint32_t) out.size());
+    for (uint32_t i = 0; i < 8; ++i) {
+        CHECK_EQUAL(i, out[i]);
+    }
+    CHECK(!ring.PopAll(&out));
+    CHECK_EQUAL(8u, (uint32_t) out.size());
+}
+
+// Values are appended to out in order, across the end of the slot array.
+TEST(SpscRing_WrapAround)
+{
+    SpscRing<uint32_t> ring(4);
+    std::vector<uint32_t> out;
+    uint32_t pushed = 0;
+    for (uint32_t round = 0; round < 100; ++round) {
+        auto count = 1 + round % 4;
+        for (uint32_t i = 0; i < count; ++i) {
+            CHECK(ring.Push(pushed++, false));
+        }
+        CHECK(ring.PopAll(&out));
+    }
+    CHECK_EQUAL(pushed, (uint32_t) out.size());
+    for (uint32_t i = 0; i < pushed; ++i) {
+        CHECK_EQUAL(i, out[i]);
+    }
+    CHECK_EQUAL(0ull, ring.OverflowCount());
+}
+
+// PopAll() doesn't leave a reference to popped values in the ring.
+TEST(SpscRing_ReleasesPoppedValues)
+{
+    SpscRing<std::shared_ptr<int>> ring(4);
+    auto value = std::make_shared<int>(1);
+    CHECK(ring.TryPush(value));
+    CHECK_EQUAL(2l, value.use_count());
+
+    std::vector<std::shared_ptr<int>> out;
+    CHECK(ring.PopAll(&out));
+    CHECK_EQUAL(2l, value.use_count());
+    out.clear();
+    CHECK_EQUAL(1l, value.use_count());
+}
+
+// With waitForSpace, a producer that outruns the consumer waits instead of
+// dropping anything.
+TEST(SpscRing_ProducerAndConsumerThreads)
+{
+    enum { VALUE_COUNT = 200000 };
+
+    SpscRing<uint32_t> ring(64);
+    std::thread producer([&ring]() {
+        for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+            ring.Push(i, true);
+        }
+    });
+
+    std::vector<uint32_t> out;
+    while (out.size() < VALUE_COUNT) {
+        if (!ring.PopAll(&out)) {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+
+    CHECK(!ring.PopAll(&out));
+    CHECK_EQUAL(0ull, ring.OverflowCount());
+    bool ordered = true;
+    for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+        ordered = ordered && out[i] == i;
+    }
+    CHECK(ordered);
+}
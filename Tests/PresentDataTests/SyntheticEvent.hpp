@@ -0,0 +1,122 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include "../../PresentData/TraceConsumer.hpp"
+
+#include <initializer_list>
+#include <vector>
+
+// Builds a TRACE_EVENT_INFO for an event with scalar and string properties,
+// and the matching event data, so EventMetadata can be tested without TDH.
+struct SyntheticEvent {
+    struct Property {
+        wchar_t const* mName;
+        USHORT mInType;
+        USHORT mLength;
+    };
+
+    GUID mProviderId;
+    EVENT_DESCRIPTOR mDescriptor;
+    std::vector<uint8_t> mTeiData;
+    std::vector<uint8_t> mUserData;
+    EVENT_RECORD mRecord;
+
+    SyntheticEvent(uint16_t id, std::initializer_list<Property> properties)
+    {
+        EVENT_DESCRIPTOR descriptor = {};
+        descriptor.Id = id;
+        Initialize(GUID(), descriptor, properties);
+    }
+
+    SyntheticEvent(GUID const& providerId, EVENT_DESCRIPTOR const& descriptor, std::initializer_list<Property> properties)
+    {
+        Initialize(providerId, descriptor, properties);
+    }
+
+    void Initialize(GUID const& providerId, EVENT_DESCRIPTOR const& descriptor, std::initializer_list<Property> properties)
+    {
+        mProviderId = providerId;
+        mDescriptor = descriptor;
+
+        auto propertyCount = (uint32_t) properties.size();
+        auto namesOffset = (uint32_t) (offsetof(TRACE_EVENT_INFO, EventPropertyInfoArray) + propertyCount * sizeof(EVENT_PROPERTY_INFO));
+        mTeiData.resize(namesOffset, 0);
+
+        uint32_t i = 0;
+        for (auto const& property : properties) {
+            auto nameOffset = (uint32_t) mTeiData.size();
+            auto name = (uint8_t const*) property.mName;
+            mTeiData.insert(mTeiData.end(), name, name + (wcslen(property.mName) + 1) * sizeof(wchar_t));
+
+            auto epi = &GetTei()->EventPropertyInfoArray[i++];
+            epi->NameOffset = nameOffset;
+            epi->nonStructType.InType = property.mInType;
+            epi->count = 1;
+            epi->length = property.mLength;
+        }
+
+        auto tei = GetTei();
+        tei->ProviderGuid = mProviderId;
+        tei->EventDescriptor = mDescriptor;
+        tei->PropertyCount = propertyCount;
+        tei->TopLevelPropertyCount = propertyCount;
+
+        mRecord = {};
+        mRecord.EventHeader.ProviderId = mProviderId;
+        mRecord.EventHeader.EventDescriptor = mDescriptor;
+        mRecord.EventHeader.Flags = EVENT_HEADER_FLAG_64_BIT_HEADER;
+    }
+
+    TRACE_EVENT_INFO* GetTei()
+    {
+        return (TRACE_EVENT_INFO*) mTeiData.data();
+    }
+
+    void AddTo(EventMetadata* metadata)
+    {
+        EventMetadataKey key = {};
+        key.guid_ = mProviderId;
+        key.desc_ = mDescriptor;
+        metadata->metadata_[key].teiData_ = mTeiData;
+    }
+
+    template<typename T> void Append(T value)
+    {
+        auto p = (uint8_t const*) &value;
+        mUserData.insert(mUserData.end(), p, p + sizeof(T));
+    }
+
+    void AppendString(wchar_t const* value)
+    {
+        auto p = (uint8_t const*) value;
+        mUserData.insert(mUserData.end(), p, p + (wcslen(value) + 1) * sizeof(wchar_t));
+    }
+
+    EVENT_RECORD* GetRecord()
+    {
+        mRecord.UserData = mUserData.data();
+        mRecord.UserDataLength = (uint16_t) mUserData.size();
+        return &mRecord;
+    }
+};
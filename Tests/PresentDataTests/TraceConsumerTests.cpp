@@ -0,0 +1,180 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataTests.hpp"
+
+#include "SyntheticEvent.hpp"
+
+#include "../../PresentData/DxgkrnlEventStructs.hpp"
+
+// A | B | Name | C, where Name is a null-terminated string so C is past the
+// fixed-offset properties.
+static SyntheticEvent MakeTestEvent(uint16_t id, wchar_t const* name)
+{
+    SyntheticEvent event(id, {
+        { L"A",    TDH_INTYPE_UINT32,        4 },
+        { L"B",    TDH_INTYPE_UINT64,        8 },
+        { L"Name", TDH_INTYPE_UNICODESTRING, 0 },
+        { L"C",    TDH_INTYPE_UINT32,        4 },
+    });
+    event.Append<uint32_t>(id * 10 + 1);
+    event.Append<uint64_t>(id * 10 + 2);
+    event.AppendString(name);
+    event.Append<uint32_t>(id * 10 + 3);
+    return event;
+}
+
+// Property names that aren't string literals, and different names passed
+// through the same buffer, are looked up by their contents.
+TEST(EventMetadata_LookupByNameContents)
+{
+    EventMetadata metadata;
+    auto event = MakeTestEvent(1, L"first");
+    event.AddTo(&metadata);
+
+    wchar_t name[16] = {};
+    wchar_t const* names[] = { L"A", L"B", L"C", L"A", L"Missing", L"C", L"B" };
+    for (auto n : names) {
+        wcscpy(name, n);
+
+        EventDataDesc desc = { name, };
+        metadata.GetEventData(event.GetRecord(), &desc, 1, 1);
+
+        if (wcscmp(n, L"Missing") == 0) {
+            CHECK_EQUAL((uint32_t) PROP_STATUS_NOT_FOUND, desc.status_);
+        } else {
+            CHECK(desc.status_ & PROP_STATUS_FOUND);
+            CHECK_EQUAL((uint64_t) (10 + (n[0] - L'A' + 1)), desc.GetData<uint64_t>());
+        }
+    }
+
+    // The same name at a different address
+    std::wstring copy(L"B");
+    CHECK_EQUAL((uint64_t) 12, metadata.GetEventData<uint64_t>(event.GetRecord(), copy.c_str()));
+    CHECK_EQUAL(L"first", metadata.GetEventData<std::wstring>(event.GetRecord(), L"Name"));
+}
+
+// Each event descriptor has its own cache, so the same name resolves to each
+// event's own property.
+TEST(EventMetadata_LookupPerDescriptor)
+{
+    EventMetadata metadata;
+    auto event1 = MakeTestEvent(1, L"one");
+    auto event2 = SyntheticEvent(2, {
+        { L"C", TDH_INTYPE_UINT32, 4 },
+        { L"A", TDH_INTYPE_UINT32, 4 },
+    });
+    event2.Append<uint32_t>(23);
+    event2.Append<uint32_t>(21);
+    event1.AddTo(&metadata);
+    event2.AddTo(&metadata);
+
+    for (int i = 0; i < 2; ++i) {
+        CHECK_EQUAL(11u, metadata.GetEventData<uint32_t>(event1.GetRecord(), L"A"));
+        CHECK_EQUAL(21u, metadata.GetEventData<uint32_t>(event2.GetRecord(), L"A"));
+        CHECK_EQUAL(13u, metadata.GetEventData<uint32_t>(event1.GetRecord(), L"C"));
+        CHECK_EQUAL(23u, metadata.GetEventData<uint32_t>(event2.GetRecord(), L"C"));
+    }
+}
+
+// Flip_Info as described by Flip_Info_Struct, optionally with an extra
+// property before FlipInterval (as a different version of the event might
+// have) so the struct's offsets no longer match.
+static SyntheticEvent MakeFlipEvent(bool is64Bit, USHORT extraInType)
+{
+    std::initializer_list<SyntheticEvent::Property> properties = {
+        { L"pDmaBuffer",       TDH_INTYPE_POINTER, 8 },
+        { L"VidPnSourceId",    TDH_INTYPE_UINT32,  4 },
+        { L"FlipToAllocation", TDH_INTYPE_POINTER, 8 },
+        { L"FlipInterval",     TDH_INTYPE_UINT32,  4 },
+        { L"FlipWithNoWait",   TDH_INTYPE_UINT32,  4 },
+        { L"MMIOFlip",         TDH_INTYPE_UINT32,  4 },
+    };
+    std::initializer_list<SyntheticEvent::Property> extendedProperties = {
+        { L"pDmaBuffer",       TDH_INTYPE_POINTER, 8 },
+        { L"VidPnSourceId",    TDH_INTYPE_UINT32,  4 },
+        { L"FlipToAllocation", TDH_INTYPE_POINTER, 8 },
+        { L"Extra",            extraInType,        extraInType == TDH_INTYPE_UNICODESTRING ? (USHORT) 0 : (USHORT) 4 },
+        { L"FlipInterval",     TDH_INTYPE_UINT32,  4 },
+        { L"FlipWithNoWait",   TDH_INTYPE_UINT32,  4 },
+        { L"MMIOFlip",         TDH_INTYPE_UINT32,  4 },
+    };
+
+    SyntheticEvent event(3, extraInType == TDH_INTYPE_NULL ? properties : extendedProperties);
+    if (!is64Bit) {
+        event.mRecord.EventHeader.Flags = 0;
+    }
+
+    auto appendPointer = [&](uint64_t value) {
+        if (is64Bit) {
+            event.Append<uint64_t>(value);
+        } else {
+            event.Append<uint32_t>((uint32_t) value);
+        }
+    };
+    appendPointer(0x11111111);
+    event.Append<uint32_t>(2);
+    appendPointer(0x33333333);
+    switch (extraInType) {
+    case TDH_INTYPE_NULL: break;
+    case TDH_INTYPE_UNICODESTRING: event.AppendString(L"extra"); break;
+    default: event.Append<uint32_t>(0xEEEEEEEE); break;
+    }
+    event.Append<uint32_t>(4);
+    event.Append<uint32_t>(5);
+    event.Append<uint32_t>(6);
+    return event;
+}
+
+static void CheckFlipFields(SyntheticEvent* event)
+{
+    EventMetadata metadata;
+    event->AddTo(&metadata);
+
+    // Read twice so the second read uses the cached layout and lookups.
+    for (int i = 0; i < 2; ++i) {
+        EventStructReader reader(&metadata, event->GetRecord());
+        CHECK_EQUAL((uint64_t) 0x33333333, EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Flip_Info_Struct, FlipToAllocation));
+        CHECK_EQUAL(4u, EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Flip_Info_Struct, FlipInterval));
+        CHECK_EQUAL(6u, EVENT_STRUCT_FIELD_PTR(reader, Microsoft_Windows_DxgKrnl::Flip_Info_Struct, MMIOFlip));
+    }
+}
+
+TEST(EventStructReader_MatchingLayout)
+{
+    auto event64 = MakeFlipEvent(true, TDH_INTYPE_NULL);
+    CheckFlipFields(&event64);
+
+    auto event32 = MakeFlipEvent(false, TDH_INTYPE_NULL);
+    CheckFlipFields(&event32);
+}
+
+// If the event's properties aren't where the struct says, the fields are
+// looked up by name.
+TEST(EventStructReader_MismatchedLayout)
+{
+    auto shifted = MakeFlipEvent(true, TDH_INTYPE_UINT32);
+    CheckFlipFields(&shifted);
+
+    auto variable = MakeFlipEvent(false, TDH_INTYPE_UNICODESTRING);
+    CheckFlipFields(&variable);
+}
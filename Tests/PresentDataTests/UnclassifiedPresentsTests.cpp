@@ -0,0 +1,95 @@
+/*
+Copyright 2020 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "PresentDataTests.hpp"
+#include "ConsumerReplay.hpp"
+
+#include "../../PresentData/DxgkrnlEventStructs.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// Replays a legacy fullscreen flip on the present's thread, up to its submission.
+static void SubmitLegacyFlip(PMTraceConsumer* consumer, uint32_t processId, uint32_t threadId, uint64_t qpcTime, uint32_t submitSequence)
+{
+    auto hdr = MakeEventHeader(processId, threadId, qpcTime);
+    consumer->HandleDxgkFlip(hdr, 1, true);
+    consumer->HandleDxgkQueueSubmit(hdr, DXGKETW_MMIOFLIP_COMMAND_BUFFER, submitSequence, 0, false, true);
+}
+
+static void DisplayLegacyFlip(PMTraceConsumer* consumer, uint64_t qpcTime, uint32_t submitSequence)
+{
+    auto hdr = MakeEventHeader(4, 8, qpcTime);
+    consumer->HandleDxgkMMIOFlip(hdr, submitSequence, 0);
+    consumer->HandleDxgkSyncDPC(hdr, submitSequence);
+}
+
+// A present that never gets any kernel events stays at the front of its
+// process's unclassified list, while the presents behind it are classified and
+// completed.  Those must not build up in the list, and the stuck present must
+// still be the next one handed to a batched kernel event.
+TEST(UnclassifiedPresents_StuckPresent)
+{
+    PMTraceConsumer consumer(false, false);
+
+    uint64_t qpcTime = 1000;
+    auto stuck = StartRuntimePresent(&consumer, 10, 30, qpcTime++, 0x2000);
+    StopRuntimePresent(&consumer, 10, 30, qpcTime++);
+
+    // Each frame's present is created before the previous one is displayed,
+    // so the previous one is in the middle of the list when it completes.
+    std::vector<PresentEventPtr> completed;
+    size_t maxUnclassifiedCount = 0;
+    uint32_t completedCount = 0;
+    PresentEventPtr previous;
+    for (uint32_t frame = 1; frame <= 2000; ++frame) {
+        auto present = StartRuntimePresent(&consumer, 10, 20, qpcTime++, 0x1000);
+        if (frame > 1) {
+            DisplayLegacyFlip(&consumer, qpcTime++, frame - 1);
+        }
+        SubmitLegacyFlip(&consumer, 10, 20, qpcTime++, frame);
+        StopRuntimePresent(&consumer, 10, 20, qpcTime++);
+        CHECK(present->PresentMode == PresentMode::Hardware_Legacy_Flip);
+
+        auto& unclassified = consumer.mUnclassifiedPresentsByProcess[10].mPresents;
+        CHECK(!unclassified.empty() && unclassified.front() == stuck);
+        maxUnclassifiedCount = std::max(maxUnclassifiedCount, unclassified.size());
+
+        completed.clear();
+        consumer.DequeuePresents(completed);
+        for (auto const& p : completed) {
+            CHECK(p == previous);
+            CHECK(p->FinalState == PresentResult::Presented);
+            completedCount += 1;
+        }
+        previous = present;
+    }
+
+    CHECK_EQUAL(1999u, completedCount);
+    CHECK(maxUnclassifiedCount < 64);
+
+    // A kernel event on a thread without a present of its own takes the
+    // stuck present.
+    SubmitLegacyFlip(&consumer, 10, 40, qpcTime++, 5000);
+    CHECK(stuck->PresentMode == PresentMode::Hardware_Legacy_Flip);
+    CHECK_EQUAL(5000u, stuck->Tracking->QueueSubmitSequence);
+}